@@ -0,0 +1,529 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/6502.h"
+
+
+
+/*
+	Benchmark suite.
+	Every workload runs on every engine (_6502_clock, _6502_run, block cache, JIT, cycle-exact) a few
+	times from the same initial state; the microbenchmarks are endless loops run for a fixed number of
+	instructions, Klaus2m5's functional test (-k, a binary assembled at $0000) runs until it traps.
+	The text table is for people, -f csv / -f json for tracking regressions.
+*/
+
+#define PRG_START					((uint16_t) (0x0400))
+
+#define DEF_BUDGET					10000000 //instructions per run
+#define DEF_RUNS					5
+#define KLAUS_MAX					200000000 //gives up on a functional test that never traps
+#define TRACE_RECORDS				(1 << 16) //ring of the trace -t writes
+
+#define ENGINE_CLOCK				0
+#define ENGINE_RUN					1
+#define ENGINE_CACHE				2
+#define ENGINE_JIT					3
+#define ENGINE_EXACT				4
+
+#define FMT_TEXT					0
+#define FMT_CSV						1
+#define FMT_JSON					2
+
+
+
+//all the programs are loaded at PRG_START. zero page $10-$7f and $3000-$33ff hold data, $20 and $22 point to $3000 and $3100
+static const uint8_t prg_imm[] = {
+	0xa9, 0x12,			//loop: lda #$12
+	0xa2, 0x34,			//ldx #$34
+	0xa0, 0x56,			//ldy #$56
+	0x29, 0xf0,			//and #$f0
+	0x09, 0x0f,			//ora #$0f
+	0x49, 0xff,			//eor #$ff
+	0xc9, 0x80,			//cmp #$80
+	0xe0, 0x34,			//cpx #$34
+	0xc0, 0x55,			//cpy #$55
+	0x69, 0x01,			//adc #$01
+	0xe9, 0x01,			//sbc #$01
+	0x4c, 0x00, 0x04,	//jmp loop
+};
+
+static const uint8_t prg_zp[] = {
+	0xa5, 0x10,			//loop: lda $10
+	0x85, 0x11,			//sta $11
+	0xa6, 0x12,			//ldx $12
+	0x86, 0x13,			//stx $13
+	0xa4, 0x14,			//ldy $14
+	0x84, 0x15,			//sty $15
+	0x65, 0x16,			//adc $16
+	0xc5, 0x17,			//cmp $17
+	0x24, 0x18,			//bit $18
+	0x45, 0x19,			//eor $19
+	0x4c, 0x00, 0x04,	//jmp loop
+};
+
+static const uint8_t prg_zpx[] = {
+	0xa2, 0x04,			//ldx #4
+	0xb5, 0x40,			//loop: lda $40,x
+	0x95, 0x50,			//sta $50,x
+	0xb4, 0x41,			//ldy $41,x
+	0x94, 0x51,			//sty $51,x
+	0x75, 0x42,			//adc $42,x
+	0xd5, 0x43,			//cmp $43,x
+	0x55, 0x44,			//eor $44,x
+	0x35, 0x45,			//and $45,x
+	0x15, 0x46,			//ora $46,x
+	0xf5, 0x47,			//sbc $47,x
+	0x4c, 0x02, 0x04,	//jmp loop
+};
+
+static const uint8_t prg_abs[] = {
+	0xad, 0x00, 0x30,	//loop: lda $3000
+	0x8d, 0x01, 0x30,	//sta $3001
+	0xae, 0x02, 0x30,	//ldx $3002
+	0x8e, 0x03, 0x30,	//stx $3003
+	0xac, 0x04, 0x30,	//ldy $3004
+	0x8c, 0x05, 0x30,	//sty $3005
+	0x6d, 0x06, 0x30,	//adc $3006
+	0xcd, 0x07, 0x30,	//cmp $3007
+	0x2c, 0x08, 0x30,	//bit $3008
+	0x4d, 0x09, 0x30,	//eor $3009
+	0x4c, 0x00, 0x04,	//jmp loop
+};
+
+static const uint8_t prg_absxy[] = {
+	0xbd, 0xf0, 0x30,	//loop: lda $30f0,x
+	0x9d, 0x00, 0x32,	//sta $3200,x
+	0x7d, 0x10, 0x30,	//adc $3010,x
+	0xdd, 0x20, 0x30,	//cmp $3020,x
+	0xb9, 0xf8, 0x30,	//lda $30f8,y
+	0x99, 0x00, 0x33,	//sta $3300,y
+	0x59, 0x30, 0x30,	//eor $3030,y
+	0x19, 0x40, 0x30,	//ora $3040,y
+	0xe8,				//inx
+	0xc8,				//iny
+	0x4c, 0x00, 0x04,	//jmp loop
+};
+
+static const uint8_t prg_ind[] = {
+	0xa2, 0x00,			//ldx #0
+	0xa1, 0x20,			//loop: lda ($20,x)
+	0x81, 0x22,			//sta ($22,x)
+	0x61, 0x20,			//adc ($20,x)
+	0xc1, 0x22,			//cmp ($22,x)
+	0xb1, 0x20,			//lda ($20),y
+	0x91, 0x22,			//sta ($22),y
+	0x51, 0x20,			//eor ($20),y
+	0x11, 0x22,			//ora ($22),y
+	0xc8,				//iny
+	0x4c, 0x02, 0x04,	//jmp loop
+};
+
+static const uint8_t prg_alu[] = {
+	0x18,				//loop: clc
+	0x69, 0x11,			//adc #$11
+	0xe5, 0x10,			//sbc $10
+	0x2d, 0x00, 0x30,	//and $3000
+	0x09, 0x21,			//ora #$21
+	0x45, 0x11,			//eor $11
+	0xcd, 0x01, 0x30,	//cmp $3001
+	0xaa,				//tax
+	0x8a,				//txa
+	0xa8,				//tay
+	0x98,				//tya
+	0xe8,				//inx
+	0x88,				//dey
+	0x4c, 0x00, 0x04,	//jmp loop
+};
+
+static const uint8_t prg_rmw[] = {
+	0xa2, 0x02,			//ldx #2
+	0x0a,				//loop: asl a
+	0x4a,				//lsr a
+	0x2a,				//rol a
+	0x6a,				//ror a
+	0x06, 0x10,			//asl $10
+	0x46, 0x11,			//lsr $11
+	0x2e, 0x00, 0x30,	//rol $3000
+	0x6e, 0x01, 0x30,	//ror $3001
+	0xe6, 0x12,			//inc $12
+	0xce, 0x02, 0x30,	//dec $3002
+	0xf6, 0x40,			//inc $40,x
+	0xde, 0x10, 0x30,	//dec $3010,x
+	0x4c, 0x02, 0x04,	//jmp loop
+};
+
+static const uint8_t prg_branch[] = {
+	0xa2, 0x10,			//loop: ldx #16
+	0xa5, 0x10,			//inner: lda $10
+	0xf0, 0x03,			//beq skip
+	0xd0, 0x01,			//bne skip
+	0xea,				//nop
+	0x30, 0x07,			//skip: bmi last
+	0x10, 0x00,			//bpl next
+	0x18,				//next: clc
+	0xb0, 0xfd,			//bcs next
+	0x90, 0x00,			//bcc last
+	0xca,				//last: dex
+	0xd0, 0xed,			//bne inner
+	0x4c, 0x00, 0x04,	//jmp loop
+};
+
+static const uint8_t prg_stack[] = {
+	0x48,				//loop: pha
+	0x68,				//pla
+	0x08,				//php
+	0x28,				//plp
+	0x48,				//pha
+	0x68,				//pla
+	0x20, 0x0e, 0x04,	//jsr sub
+	0xba,				//tsx
+	0x9a,				//txs
+	0x4c, 0x00, 0x04,	//jmp loop
+	0x48,				//sub: pha
+	0x68,				//pla
+	0x60,				//rts
+};
+
+static const uint8_t prg_mixed[] = {
+	0xa2, 0x3f,			//loop: ldx #63
+	0xbd, 0x00, 0x30,	//copy: lda $3000,x
+	0x45, 0x10,			//eor $10
+	0x9d, 0x00, 0x31,	//sta $3100,x
+	0xca,				//dex
+	0x10, 0xf5,			//bpl copy
+	0xe6, 0x10,			//inc $10
+	0xa0, 0x00,			//sort: ldy #0
+	0x84, 0x11,			//sty $11
+	0xa2, 0x00,			//ldx #0
+	0xbd, 0x00, 0x31,	//pass: lda $3100,x
+	0xdd, 0x01, 0x31,	//cmp $3101,x
+	0x90, 0x11,			//bcc noswap
+	0xf0, 0x0f,			//beq noswap
+	0xa8,				//tay
+	0xbd, 0x01, 0x31,	//lda $3101,x
+	0x9d, 0x00, 0x31,	//sta $3100,x
+	0x98,				//tya
+	0x9d, 0x01, 0x31,	//sta $3101,x
+	0xa9, 0x01,			//lda #1
+	0x85, 0x11,			//sta $11
+	0xe8,				//noswap: inx
+	0xe0, 0x3f,			//cpx #63
+	0xd0, 0xe2,			//bne pass
+	0xa5, 0x11,			//lda $11
+	0xd0, 0xd8,			//bne sort
+	0x20, 0x3d, 0x04,	//jsr sum
+	0x4c, 0x00, 0x04,	//jmp loop
+	0xa9, 0x00,			//sum: lda #0
+	0xa2, 0x3f,			//ldx #63
+	0x18,				//sloop: clc
+	0x7d, 0x00, 0x31,	//adc $3100,x
+	0xca,				//dex
+	0x10, 0xf9,			//bpl sloop
+	0x85, 0x12,			//sta $12
+	0x60,				//rts
+};
+
+
+
+struct workload {
+	const char *name;
+	const uint8_t *prg;
+	size_t len; //0 = the functional test image
+};
+
+#define W(n)						{#n, prg_##n, sizeof(prg_##n)}
+
+static const struct workload workloads[] = {
+	W(imm), W(zp), W(zpx), W(abs), W(absxy), W(ind),
+	W(alu), W(rmw), W(branch), W(stack),
+	W(mixed)
+};
+
+static const char *const engines[] = {"clock", "run", "cache", "jit", "exact"};
+
+static uint8_t ram[0x10000];
+static uint8_t *klaus;
+static size_t klaus_size;
+static const char *trace_path; //-t, every run traced to it (TRACE=1 builds)
+
+#ifdef _6502_BUS
+//the same, compiled into the core (bench/bus.h)
+#define ram_read					NULL
+#define ram_write					NULL
+#else
+static uint8_t ram_read(void *user, uint16_t a) {return ((uint8_t *) user)[a];}
+static void ram_write(void *user, uint16_t a, uint8_t x) {((uint8_t *) user)[a] = x;}
+#endif
+
+struct result {
+	uint64_t instr, cycles;
+	uint16_t pc; //where it ended (the trap, for the functional test)
+	double ips[3], ns[3], cps[3]; //min, median, max
+};
+
+
+
+static double now(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+//min, median, max
+static void stats(double *v, int n, double *out) {
+	qsort(v, n, sizeof(double), cmp_double);
+
+	out[0] = v[0];
+	out[1] = (n & 1) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+	out[2] = v[n - 1];
+}
+
+static void load(const struct workload *w) {
+	memset(ram, 0, sizeof(ram));
+
+	if (!w->len) {
+		memcpy(ram, klaus, klaus_size);
+		return;
+	}
+
+	for (int i = 0x10; i < 0x80; i++)
+		ram[i] = (i * 3) | 1;
+	for (int i = 0x3000; i < 0x3400; i++)
+		ram[i] = i * 7;
+
+	ram[0x20] = 0x00; ram[0x21] = 0x30;
+	ram[0x22] = 0x00; ram[0x23] = 0x31;
+
+	memcpy(ram + PRG_START, w->prg, w->len);
+}
+
+//0 on success, -1 if the engine isn't available
+static int setup(cpu6502_t *cpu, int engine, int mapped) {
+	_6502_init(cpu, ram_read, ram_write, ram);
+	if (mapped) _6502_map(cpu, 0, 256, ram, _6502_MAP_RAM);
+	_6502_reset(cpu);
+	cpu->PC = PRG_START;
+
+	if (engine == ENGINE_CACHE) return _6502_cache_enable(cpu);
+	if (engine == ENGINE_JIT) return _6502_jit_enable(cpu);
+	if (engine == ENGINE_EXACT) return _6502_exact(cpu, 1);
+
+	return 0;
+}
+
+//instructions executed: 'budget' of them, or up to the first trap when 'trap' is set
+static uint64_t execute(cpu6502_t *cpu, int engine, uint64_t budget, int trap) {
+	uint64_t n = 0;
+
+	if (engine == ENGINE_CLOCK) {
+		for (uint16_t pc = cpu->PC; n < budget; pc = cpu->PC) {
+			_6502_clock(cpu);
+			n++;
+			if (trap && cpu->PC == pc) break;
+		}
+
+		return n;
+	}
+
+	while (n < budget) {
+		n += _6502_run(cpu, budget - n);
+		if (cpu->stop == _6502_STOP_STUCK && trap) break;
+	}
+
+	return n;
+}
+
+//-1 if the engine isn't available
+static int bench(const struct workload *w, int engine, int runs, uint64_t budget, int mapped, struct result *r) {
+	double ips[runs], ns[runs], cps[runs];
+
+	for (int i = 0; i < runs; i++) {
+		cpu6502_t cpu;
+		uint64_t c0;
+		double t;
+
+		load(w);
+		if (setup(&cpu, engine, mapped)) {
+			_6502_cache_disable(&cpu);
+			return -1;
+		}
+
+		#if (_6502_TRACE)
+		if (trace_path && _6502_trace_enable(&cpu, trace_path, TRACE_RECORDS, _6502_TRACE_FILE)) {
+			_6502_cache_disable(&cpu);
+			return -1;
+		}
+		#endif
+
+		c0 = cpu.cycles;
+		t = now();
+		r->instr = execute(&cpu, engine, w->len ? budget : KLAUS_MAX, !w->len);
+		t = now() - t;
+		r->cycles = cpu.cycles - c0;
+		r->pc = cpu.PC;
+
+		ips[i] = r->instr / t;
+		ns[i] = t * 1e9 / r->instr;
+		cps[i] = r->cycles / t;
+
+		#if (_6502_TRACE)
+		_6502_trace_disable(&cpu);
+		#endif
+		_6502_cache_disable(&cpu);
+	}
+
+	stats(ips, runs, r->ips);
+	stats(ns, runs, r->ns);
+	stats(cps, runs, r->cps);
+
+	return 0;
+}
+
+
+
+static void header(int fmt) {
+	if (fmt == FMT_TEXT)
+		printf("%-8s %-6s %12s %12s %26s %10s %10s\n", "workload", "engine", "instr", "cycles", "MIPS min/median/max", "ns/instr", "Mcycles/s");
+	else if (fmt == FMT_CSV)
+		printf("workload,engine,instr,cycles,pc,ips_min,ips_median,ips_max,ns_min,ns_median,ns_max,cps_min,cps_median,cps_max\n");
+	else
+		printf("[\n");
+}
+
+static void row(int fmt, const char *name, int engine, const struct result *r, int first) {
+	if (fmt == FMT_TEXT) {
+		printf("%-8s %-6s %12" PRIu64 " %12" PRIu64 "   %7.1f / %7.1f / %7.1f %10.2f %10.1f", name, engines[engine], r->instr, r->cycles,
+			r->ips[0] / 1e6, r->ips[1] / 1e6, r->ips[2] / 1e6, r->ns[1], r->cps[1] / 1e6);
+		if (!strcmp(name, "klaus")) printf("   trapped at $%04x", r->pc);
+		printf("\n");
+	} else if (fmt == FMT_CSV) {
+		printf("%s,%s,%" PRIu64 ",%" PRIu64 ",%u,%.0f,%.0f,%.0f,%.3f,%.3f,%.3f,%.0f,%.0f,%.0f\n", name, engines[engine], r->instr, r->cycles, r->pc,
+			r->ips[0], r->ips[1], r->ips[2], r->ns[0], r->ns[1], r->ns[2], r->cps[0], r->cps[1], r->cps[2]);
+	} else {
+		printf("%s\t{\"workload\": \"%s\", \"engine\": \"%s\", \"instr\": %" PRIu64 ", \"cycles\": %" PRIu64 ", \"pc\": %u, "
+			"\"ips\": [%.0f, %.0f, %.0f], \"ns_per_instr\": [%.3f, %.3f, %.3f], \"cycles_per_s\": [%.0f, %.0f, %.0f]}",
+			first ? "" : ",\n", name, engines[engine], r->instr, r->cycles, r->pc,
+			r->ips[0], r->ips[1], r->ips[2], r->ns[0], r->ns[1], r->ns[2], r->cps[0], r->cps[1], r->cps[2]);
+	}
+}
+
+static int load_klaus(const char *name) {
+	FILE *fp = fopen(name, "rb");
+	if (fp == NULL)
+		return -1;
+
+	klaus = calloc(1, sizeof(ram));
+	klaus_size = fread(klaus, 1, sizeof(ram), fp);
+	fclose(fp);
+
+	return klaus_size ? 0 : -1;
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"usage: %s [-n instr] [-r runs] [-e engines] [-w workloads] [-k klaus.bin] [-f text|csv|json] [-i] [-t file]\n"
+		"\t-n\tinstructions per microbenchmark run (default %d)\n"
+		"\t-r\truns per workload and engine, reported as min/median/max (default %d)\n"
+		"\t-e\tcomma separated subset of clock,run,cache,jit,exact\n"
+		"\t-w\tcomma separated subset of the workloads (imm,zp,zpx,abs,absxy,ind,alu,rmw,branch,stack,mixed,klaus)\n"
+		"\t-k\tKlaus2m5's 6502_functional_test binary, loaded at $0000 and started at $0400\n"
+		"\t-i\tleave memory unmapped, so every access goes through the bus callbacks\n"
+		"\t-t\ttrace every run to a mapped file (make TRACE=1 builds only)\n",
+		argv0, DEF_BUDGET, DEF_RUNS);
+}
+
+//is 'name' in the comma separated 'list' (NULL = everything)
+static int listed(const char *list, const char *name) {
+	size_t len = strlen(name);
+
+	for (const char *p = list; p; p = strchr(p, ',')) {
+		if (*p == ',') p++;
+		if (!strncmp(p, name, len) && (p[len] == ',' || !p[len])) return 1;
+	}
+
+	return list == NULL;
+}
+
+int main(int argc, char **argv) {
+	uint64_t budget = DEF_BUDGET;
+	int runs = DEF_RUNS, fmt = FMT_TEXT, mapped = 1, first = 1, opt;
+	const char *only_e = NULL, *only_w = NULL;
+	const struct workload functional = {"klaus", NULL, 0};
+
+	while ((opt = getopt(argc, argv, "n:r:e:w:k:f:it:")) != -1) {
+		switch (opt) {
+			case 'n': budget = strtoull(optarg, NULL, 0); break;
+			case 'r': runs = atoi(optarg); break;
+			case 'e': only_e = optarg; break;
+			case 'w': only_w = optarg; break;
+			case 'i': mapped = 0; break;
+			case 't': trace_path = optarg; break;
+			case 'k':
+				if (load_klaus(optarg)) {
+					fprintf(stderr, "can't read %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'f':
+				fmt = !strcmp(optarg, "csv") ? FMT_CSV : !strcmp(optarg, "json") ? FMT_JSON : FMT_TEXT;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (!budget || runs < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	header(fmt);
+
+	for (size_t i = 0; i <= sizeof(workloads) / sizeof(workloads[0]); i++) {
+		const struct workload *w = (i < sizeof(workloads) / sizeof(workloads[0])) ? &workloads[i] : &functional;
+
+		if (!listed(only_w, w->name) || (!w->len && !klaus)) continue;
+
+		for (int e = ENGINE_CLOCK; e <= ENGINE_EXACT; e++) {
+			struct result r;
+
+			if (!listed(only_e, engines[e])) continue;
+			if (bench(w, e, runs, budget, mapped, &r)) {
+				fprintf(stderr, "%s: engine %s not available\n", w->name, engines[e]);
+				continue;
+			}
+
+			row(fmt, w->name, e, &r, first);
+			first = 0;
+			fflush(stdout);
+		}
+	}
+
+	if (fmt == FMT_JSON) printf("\n]\n");
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+/*
+	The benchmark's bus, for a build with it compiled in (make BUS=bench/bus.h, see 6502_ops.h):
+	64K of ram at 'user', what ram_read/ram_write in bench.c do through the callbacks.
+*/
+
+#pragma once
+
+
+
+#define _6502_BUS_READ(user, a)		(((uint8_t *) (user))[a])
+#define _6502_BUS_WRITE(user, a, x)	(((uint8_t *) (user))[a] = (x))
\ No newline at end of file
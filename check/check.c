@@ -0,0 +1,1198 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/6502.h"
+
+
+
+/*
+	Every engine against _6502_clock.
+
+		c6502-check [-p programs] [-n instructions] [-s seed] [-e engines] [-o image]
+
+	Programs are generated at random (see generate): opcodes of every kind, operands aimed at the zero
+	page, the stack, the program itself (so it modifies its own code), pages left to the bus callbacks
+	and rom, whose banks get switched from a callback (also by loops reading them around the switch);
+	jumps and calls into the program, brk through a handler returning with rti. Each engine runs
+	every program on a context of its own while another one is stepped through it with _6502_clock, in
+	lock step as in c6502-recomp-check: the engine runs 1 to 64 instructions (at random), the other
+	context is clocked as many times, and then everything must match: registers, cycle counts, stop
+	reasons and all 64K of memory. A program ends after its instructions, or when it gets stuck.
+	The batch engine runs _6502_BATCH_LANES contexts at once, on the same program over different data,
+	each one checked against its own clocked context.
+	Then the cases: fixed programs for what generated ones don't get to, each with the outcome it must have.
+	Ends at the first difference, telling the seed and program (or case) that reproduce it.
+	With -o, the first program of the seed is written out instead, as a raw 64K image starting at its
+	reset vector (for make recomp-check).
+*/
+
+#define DEF_PROGRAMS				100
+#define DEF_INSTRUCTIONS			100000
+#define STEP						64
+
+//memory layout of the programs
+#define CODE_START					((uint16_t) (0x0200))
+#define CODE_END					((uint16_t) (0x1000)) //(its last pages left to the callbacks)
+#define HANDLER						((uint16_t) (0x1000)) //brk/irq/nmi: inc $80, rti
+#define IO_PAGE						0x0e //0x0e00 - 0x0fff and 0x4000 - 0x43ff go through the bus callbacks
+#define IO_DATA						0x40
+#define ROM_PAGE					0x50 //0x5000 - 0x5fff mapped as rom
+#define BANK						0x43 //writing 0x4300 - 0x430f maps 0x5000 - 0x5fff to 0x5000 or 0x6000 (bit 0), from the bus callback
+#define SWITCH_AFTER				32
+#define IRQ_ACK						0x0e00 //writing it releases the timer's irq line, in the cases that ask for it
+
+#define LANES						_6502_BATCH_LANES
+
+enum {ENGINE_RUN, ENGINE_CACHE, ENGINE_JIT, ENGINE_EXACT, ENGINE_BATCH, ENGINES};
+
+static const char *const engines[] = {"run", "cache", "jit", "exact", "batch"};
+
+//the program as generated, then each context's own copy: [lane][0] runs the engine, [lane][1] is clocked
+static uint8_t prg[0x10000];
+static uint8_t ram[LANES][2][0x10000];
+static cpu6502_t cpu[LANES][2];
+static uint32_t writes[LANES][2]; //to the bank registers
+static uint64_t reads[LANES][2]; //through the bus callbacks
+static int acking; //IRQ_ACK does
+
+static uint64_t rng;
+
+static uint8_t ram_read(void *user, uint16_t a) {
+	uint8_t *m = user;
+	size_t k = (m - ram[0][0]) >> 16;
+
+	reads[k >> 1][k & 1]++;
+	return m[a];
+}
+
+/*
+	Bank switching, from the write callback: the page is picked by the value written, and every bank
+	register reads it back. Only writes changing the value count (the cycle-exact engine writes the old
+	value first on rmw), and the first SWITCH_AFTER of them don't switch: the code reading the rom gets
+	translated before the JIT sees it remapped.
+*/
+static void ram_write(void *user, uint16_t a, uint8_t x) {
+	uint8_t *m = user;
+	size_t k = (m - ram[0][0]) >> 16;
+
+	if (a == IRQ_ACK && acking) _6502_irq_clear(&cpu[k >> 1][k & 1], 1);
+
+	if ((a >> 8) == BANK && (a & 0xff) < 16 && x != m[a]) {
+		if (++writes[k >> 1][k & 1] > SWITCH_AFTER)
+			_6502_map(&cpu[k >> 1][k & 1], ROM_PAGE, 16, m + ((x & 1 ? 0x60 : ROM_PAGE) << 8), _6502_MAP_ROM);
+
+		memset(m + (BANK << 8), x, 16);
+	}
+
+	m[a] = x;
+}
+
+static uint32_t next(void) {
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	return rng >> 32;
+}
+
+//somewhere worth reading or writing: 'at' has the 'n' instructions generated so far, whose operands get rewritten
+static uint16_t target(const uint16_t *at, int n) {
+	switch (next() % 8) {
+		case 0: return next() & 0xff;
+		case 1: return 0x0100 | (next() & 0xff);
+		case 2: return (n && (next() & 1)) ? at[next() % n] + 1 : CODE_START + next() % (CODE_END - CODE_START);
+		case 3: return (IO_DATA << 8) + (next() & 0x3ff);
+		case 4: return (ROM_PAGE << 8) + (next() & 0xfff);
+		case 5: return (BANK << 8) + (next() & 0xf);
+	}
+
+	return 0x2000 + (next() & 0xfff);
+}
+
+//instruction length from the opcode's addressing mode bits, illegal opcodes included (jams as 1)
+static int length(uint8_t op) {
+	static const uint8_t len[8] = {2, 2, 2, 3, 2, 2, 3, 3}; //(zp,x) zp # abs (zp),y zp,x abs,y abs,x
+	int mode = (op >> 2) & 7, cc = op & 3;
+
+	if (cc == 1 || cc == 3) return len[mode];
+	if (mode == 2 || mode == 6) return 1; //implied, accumulator
+	if (mode == 4) return cc ? 1 : 2; //jam, branch
+	if (mode == 0) return op >= 0x80 ? 2 : op == 0x20 ? 3 : 1;
+
+	return len[mode];
+}
+
+//random data all over, then instructions from CODE_START on
+static void generate(void) {
+	uint16_t at[CODE_END - CODE_START], pc = CODE_START;
+	int n = 0;
+
+	for (int i = 0; i < 0x10000; i++)
+		prg[i] = next();
+
+	while (pc < CODE_END - 3) {
+		uint8_t op = next();
+		int len = length(op) + (op == 0x00); //(brk skips a byte)
+		uint16_t a = target(at, n);
+
+		at[n++] = pc;
+
+		//now and then (dec zp, bne +3, inc abs) an operand rewritten or the rom banks switched, seldom enough for the JIT to translate what's around
+		if (n > 1 && !(next() % 32) && pc < CODE_END - 10) {
+			a = (next() & 1) ? at[next() % n] + 1 : (BANK << 8) + (next() & 0xf);
+
+			prg[pc++] = 0xc6;
+			prg[pc++] = next() & 0x7f;
+			prg[pc++] = 0xd0;
+			prg[pc++] = 3;
+			prg[pc++] = 0xee;
+			prg[pc++] = a;
+			prg[pc++] = a >> 8;
+			continue;
+		}
+
+		//now and then a loop (ldy #n, lda rom, lda bank, eor #1, sta bank, lda rom, eor rom, dey, bne) flipping the rom banks in the middle of its block, between reads of them
+		if (!(next() % 64) && pc < CODE_END - 25) {
+			static const uint8_t op[6] = {0xad, 0xad, 0x49, 0x8d, 0xad, 0x4d};
+
+			prg[pc++] = 0xa0;
+			prg[pc++] = 16 + next() % 32;
+
+			for (int k = 0; k < 6; k++) {
+				a = k == 1 ? BANK << 8 : k == 2 ? 1 : k == 3 ? (BANK << 8) + (next() & 0xf) : (ROM_PAGE << 8) + (next() & 0xfff);
+
+				prg[pc++] = op[k];
+				prg[pc++] = a;
+				if (k != 2) prg[pc++] = a >> 8;
+			}
+
+			prg[pc++] = 0x88;
+			prg[pc++] = 0xd0;
+			prg[pc++] = -20;
+			continue;
+		}
+
+		if ((op & 0x1f) == 0x10) //branches mostly nearby
+			a = (uint8_t) (next() % 64 - 32);
+		else if (op == 0x4c || op == 0x20) //jmp, jsr: to an instruction, half the time
+			a = (next() & 1) ? at[next() % n] : CODE_START + next() % (CODE_END - CODE_START);
+
+		prg[pc] = op;
+		if (len > 1) prg[pc + 1] = a;
+		if (len > 2) prg[pc + 2] = a >> 8;
+		pc += len;
+	}
+
+	prg[pc] = 0x4c; //jmp CODE_START
+	prg[pc + 1] = CODE_START & 0xff;
+	prg[pc + 2] = CODE_START >> 8;
+
+	prg[HANDLER] = 0xe6; //inc $80
+	prg[HANDLER + 1] = 0x80;
+	prg[HANDLER + 2] = 0x40; //rti
+
+	for (int v = 0xfffa; v < 0x10000; v += 2) {
+		prg[v] = HANDLER & 0xff;
+		prg[v + 1] = HANDLER >> 8;
+	}
+
+	prg[0xfffc] = CODE_START & 0xff;
+	prg[0xfffd] = CODE_START >> 8;
+}
+
+static void setup(cpu6502_t *cpu, uint8_t *m) {
+	writes[(m - ram[0][0]) >> 17][((m - ram[0][0]) >> 16) & 1] = 0;
+	reads[(m - ram[0][0]) >> 17][((m - ram[0][0]) >> 16) & 1] = 0;
+	_6502_init(cpu, ram_read, ram_write, m);
+	_6502_map(cpu, 0, 256, m, _6502_MAP_RAM);
+	_6502_map(cpu, IO_PAGE, 2, NULL, _6502_MAP_IO);
+	_6502_map(cpu, IO_DATA, 4, NULL, _6502_MAP_IO);
+	_6502_map(cpu, ROM_PAGE, 16, m + (ROM_PAGE << 8), _6502_MAP_ROM);
+	_6502_reset(cpu);
+}
+
+//0 on success, -1 if the engine isn't available
+static int engine_on(cpu6502_t *cpu, int engine) {
+	if (engine == ENGINE_CACHE) return _6502_cache_enable(cpu);
+	if (engine == ENGINE_JIT) return _6502_jit_enable(cpu);
+	if (engine == ENGINE_EXACT) return _6502_exact(cpu, 1);
+
+	return 0;
+}
+
+static void engine_off(cpu6502_t *cpu, int engine) {
+	if (engine == ENGINE_CACHE) _6502_cache_disable(cpu);
+	if (engine == ENGINE_JIT) _6502_jit_disable(cpu);
+}
+
+static void state(const char *what, const cpu6502_t *cpu) {
+	fprintf(stderr, "%s\tpc %04x a %02x x %02x y %02x sp %02x p %02x ir %02x, %" PRIu64 " cycles, stop %d\n",
+		what, cpu->PC, cpu->A, cpu->X, cpu->Y, cpu->SP, _6502_get_p(cpu), cpu->IR, cpu->cycles, cpu->stop);
+}
+
+static int same(const cpu6502_t *r, const cpu6502_t *i) {
+	return r->PC == i->PC && r->A == i->A && r->X == i->X && r->Y == i->Y && r->SP == i->SP && _6502_get_p(r) == _6502_get_p(i) &&
+		r->IR == i->IR && r->cycles == i->cycles;
+}
+
+/*
+	One program on one engine. Returns the instructions compared, -1 on a difference.
+	Lanes past the first are only used by the batch engine.
+*/
+static int64_t check(int engine, uint64_t limit, const char *program) {
+	cpu6502_t *run[LANES];
+	uint64_t done[LANES] = {0}, total = 0;
+	int lanes = engine == ENGINE_BATCH ? LANES : 1, live = lanes;
+	uint8_t end[LANES] = {0};
+
+	for (int i = 0; i < lanes; i++) {
+		//lanes past the first get zero page data of their own, so that they take other paths
+		memcpy(ram[i][0], prg, 0x10000);
+		for (int a = 0x80; i && a < 0x100; a++)
+			ram[i][0][a] = next();
+
+		memcpy(ram[i][1], ram[i][0], 0x10000);
+		setup(&cpu[i][0], ram[i][0]);
+		setup(&cpu[i][1], ram[i][1]);
+
+		if (engine_on(&cpu[i][0], engine)) {
+			fprintf(stderr, "engine %s not available\n", engines[engine]);
+			exit(1);
+		}
+	}
+
+	while (live) {
+		uint64_t k = 1 + next() % STEP, n[LANES];
+		int m = 0;
+
+		for (int i = 0; i < lanes; i++)
+			if (!end[i]) run[m++] = &cpu[i][0];
+
+		if (engine == ENGINE_BATCH) {
+			uint64_t count[LANES];
+
+			_6502_batch_run(run, m, k, count);
+			for (int i = 0, j = 0; i < lanes; i++)
+				if (!end[i]) n[i] = count[j++];
+		} else {
+			n[0] = _6502_run(&cpu[0][0], k);
+		}
+
+		for (int i = 0; i < lanes; i++) {
+			int pg;
+
+			if (end[i]) continue;
+
+			for (uint64_t c = 0; c < n[i]; c++)
+				_6502_clock(&cpu[i][1]);
+
+			for (pg = 0; pg < 256 && !memcmp(ram[i][0] + (pg << 8), ram[i][1] + (pg << 8), 256); pg++);
+
+			if (!same(&cpu[i][0], &cpu[i][1]) || pg < 256 || (n[i] < k && cpu[i][0].stop != _6502_STOP_STUCK)) {
+				fprintf(stderr, "%s: %s, lane %d: difference after %" PRIu64 " instructions (%" PRIu64 " of %" PRIu64 " in the last step)",
+					program, engines[engine], i, done[i], n[i], k);
+				if (pg < 256) fprintf(stderr, ", memory in page %02x", pg);
+				fprintf(stderr, "\n");
+				state(engines[engine], &cpu[i][0]);
+				state("clock", &cpu[i][1]);
+				return -1;
+			}
+
+			done[i] += n[i];
+			if (cpu[i][0].stop == _6502_STOP_STUCK || done[i] >= limit) end[i] = 1, live--, total += done[i];
+		}
+	}
+
+	for (int i = 0; i < lanes; i++)
+		engine_off(&cpu[i][0], engine);
+
+	return total;
+}
+
+/*
+	Cases: fixed programs, for what generated ones don't get to. Each one runs on lane 0 (its first
+	context with the engine on) from _6502_START_ADDRESS, memory zeroed but for the program, on every
+	engine but the batch one, and returns 0 if it went as it should.
+*/
+
+#define ADD16						0x0600 //$14/$15 = $10/$11 + $12/$13
+#define ADD16_X						0x1234
+#define ADD16_Y						0x0ff0
+
+static const char *case_name;
+
+//memory all zeroes, vectors to HANDLER
+static void clear(void) {
+	memset(prg, 0, sizeof(prg));
+
+	for (int v = 0xfffa; v < 0x10000; v += 2) {
+		prg[v] = HANDLER & 0xff;
+		prg[v + 1] = HANDLER >> 8;
+	}
+}
+
+static void place(uint16_t at, const uint8_t *code, size_t len) {
+	memcpy(prg + at, code, len);
+}
+
+//what was placed, into both contexts of lane 0
+static void begin(int engine) {
+	memcpy(ram[0][0], prg, 0x10000);
+	memcpy(ram[0][1], prg, 0x10000);
+	setup(&cpu[0][0], ram[0][0]);
+	setup(&cpu[0][1], ram[0][1]);
+	engine_on(&cpu[0][0], engine);
+}
+
+static int failed(int engine, const char *what) {
+	fprintf(stderr, "case %s, %s: %s\n", case_name, engines[engine], what);
+	state(engines[engine], &cpu[0][0]);
+	engine_off(&cpu[0][0], engine);
+
+	return -1;
+}
+
+//runs until something else than the budget stops it
+static void finish(cpu6502_t *cpu) {
+	do _6502_run(cpu, 1 << 20);
+	while (cpu->stop == _6502_STOP_BUDGET);
+}
+
+//registers, cycle counts and memory of both contexts of lane 0, after 'done' instructions or cycles ('unit')
+static int matching(int engine, uint64_t done, const char *unit) {
+	int pg;
+
+	for (pg = 0; pg < 256 && !memcmp(ram[0][0] + (pg << 8), ram[0][1] + (pg << 8), 256); pg++);
+
+	if (!same(&cpu[0][0], &cpu[0][1]) || pg < 256) {
+		fprintf(stderr, "case %s, %s: difference after %" PRIu64 " %s", case_name, engines[engine], done, unit);
+		if (pg < 256) fprintf(stderr, ", memory in page %02x", pg);
+		fprintf(stderr, "\n");
+		state("clock", &cpu[0][1]);
+		return failed(engine, "not as clocked");
+	}
+
+	return 0;
+}
+
+/*
+	The engine's context run 1 to STEP instructions at a time and the other one clocked as many, for
+	'limit' instructions or until stuck: registers, cycle counts and memory must match after every
+	step. 'between' (if any) gets called after each with the instructions it ran, and fails the case
+	by returning -1.
+*/
+static int lockstep(int engine, uint64_t limit, int (*between)(int engine, uint64_t n)) {
+	for (uint64_t done = 0; done < limit;) {
+		uint64_t k = 1 + next() % STEP, n;
+
+		if (k > limit - done) k = limit - done;
+		n = _6502_run(&cpu[0][0], k);
+
+		for (uint64_t c = 0; c < n; c++)
+			_6502_clock(&cpu[0][1]);
+		done += n;
+
+		if (matching(engine, done, "instructions")) return -1;
+		if (between && between(engine, n)) return -1;
+		if (cpu[0][0].stop == _6502_STOP_STUCK) break;
+	}
+
+	return 0;
+}
+
+/*
+	Code on an io page: a loop there rewriting its own immediate, entered through a jump whose last
+	byte is the page's first. Every byte of it is read through the bus callbacks each time it runs,
+	as many times by every engine as by the plain loop, on a context of lane 1 (_6502_clock reads jmp's
+	target as data); by the cycle-exact one as by _6502_clock, dummy reads included.
+*/
+
+#define IO_CODE						((IO_PAGE << 8) + 0x100)
+#define IO_RUN						20000 //instructions
+
+static int io_code(int engine) {
+	static const uint8_t loop[] = {
+		0xa9, 0x00,				//lda #0
+		0x18,					//clc
+		0x69, 0x03,				//adc #3
+		0x8d, (IO_CODE + 1) & 0xff, (IO_CODE + 1) >> 8, //sta lda's immediate
+		0xe6, 0x80,				//inc $80
+		0xd0, 0xf4,				//bne lda
+		0x4c, ((IO_PAGE << 8) - 2) & 0xff, ((IO_PAGE << 8) - 2) >> 8
+	};
+	static const uint8_t into[] = {0x4c, IO_CODE & 0xff, IO_CODE >> 8};
+	static const uint8_t main[] = {0x4c, ((IO_PAGE << 8) - 2) & 0xff, ((IO_PAGE << 8) - 2) >> 8};
+	const uint64_t *want = (engine == ENGINE_EXACT) ? &reads[0][1] : &reads[1][0];
+	int err;
+
+	clear();
+	place(_6502_START_ADDRESS, main, sizeof(main));
+	place((IO_PAGE << 8) - 2, into, sizeof(into));
+	place(IO_CODE, loop, sizeof(loop));
+	begin(engine);
+	if (engine == ENGINE_EXACT) _6502_exact(&cpu[0][1], 1);
+
+	err = lockstep(engine, IO_RUN, NULL);
+
+	if (engine != ENGINE_EXACT) {
+		memcpy(ram[1][0], prg, 0x10000);
+		setup(&cpu[1][0], ram[1][0]);
+		_6502_run(&cpu[1][0], IO_RUN);
+	}
+
+	if (!err && reads[0][0] != *want) {
+		fprintf(stderr, "case %s, %s: %" PRIu64 " reads through the bus, %" PRIu64 " expected\n", case_name, engines[engine], reads[0][0], *want);
+		err = failed(engine, "not as many reads");
+	}
+
+	if (!err) engine_off(&cpu[0][0], engine);
+	return err;
+}
+
+/*
+	Decimal mode: adc and sbc for every a, operand, carry and d, on every variant compiled in (the
+	engine's context and the clocked one), against Bruce Clark's sequences ("Decimal Mode", 6502.org)
+	written out straight, not through tables as in the core.
+*/
+
+#define DECIMAL						0x10 //where the operand is
+
+//a, then n, v, z and c as in p, after adc or sbc with (a, b, c) on the variant
+static uint16_t decimal(int variant, int sbc, uint8_t a, uint8_t b, int c, int d) {
+	uint8_t m = sbc ? ~b : b;
+	int cmos = variant >= _6502_CPU_65C02, sum = a + m + c, r = sum & 0xff, al, s;
+	int n = sum & 0x80, v = (~(a ^ m) & (a ^ sum) & 0x80) != 0, z = !(sum & 0xff), carry = sum > 0xff;
+
+	if (d && !sbc) {
+		//sequence 1: the result and c
+		al = (a & 0x0f) + (b & 0x0f) + c;
+		if (al >= 0x0a) al = ((al + 0x06) & 0x0f) + 0x10;
+		r = (a & 0xf0) + (b & 0xf0) + al;
+		if (r >= 0xa0) r += 0x60;
+		carry = r >= 0x100;
+
+		//sequence 2: n and v, from the high digits signed (z stays the binary sum's on the NMOS)
+		s = (int8_t) (a & 0xf0) + (int8_t) (b & 0xf0) + al;
+		n = s & 0x80;
+		v = s < -128 || s > 127;
+		if (cmos) n = r & 0x80, z = !(r & 0xff);
+	} else if (d && !cmos) {
+		//sequence 3: the result, flags as in binary mode
+		al = (a & 0x0f) - (b & 0x0f) + c - 1;
+		if (al < 0) al = ((al - 0x06) & 0x0f) - 0x10;
+		r = (a & 0xf0) - (b & 0xf0) + al;
+		if (r < 0) r -= 0x60;
+	} else if (d) {
+		//sequence 4: the 65C02's result, n and z from it
+		al = (a & 0x0f) - (b & 0x0f) + c - 1;
+		r = a - b + c - 1;
+		if (r < 0) r -= 0x60;
+		if (al < 0) r -= 0x06;
+		n = r & 0x80;
+		z = !(r & 0xff);
+	}
+
+	return ((r & 0xff) << 8) | (n ? 0x80 : 0) | (v << 6) | (z << 1) | carry;
+}
+
+static int decimal_mode(int engine) {
+	static const uint8_t ops[] = {
+		0x65, DECIMAL,			//adc $10
+		0xe5, DECIMAL			//sbc $10
+	};
+	int variants = 0;
+
+	clear();
+	place(_6502_START_ADDRESS, ops, sizeof(ops));
+	begin(engine);
+
+	for (int variant = _6502_CPU_NMOS; variant <= _6502_CPU_R65C02; variant++) {
+		if (_6502_variant(&cpu[0][0], variant) || _6502_variant(&cpu[0][1], variant)) continue;
+		variants++;
+
+		for (uint32_t i = 0; i < 0x80000; i++) {
+			int sbc = i >> 18, d = (i >> 17) & 1, c = (i >> 16) & 1;
+			uint8_t a = i >> 8, b = i;
+			uint16_t want = decimal(variant, sbc, a, b, c, d);
+
+			for (int k = 0; k < 2; k++) {
+				cpu6502_t *x = &cpu[0][k];
+				uint16_t got;
+
+				ram[0][k][DECIMAL] = b;
+				x->PC = _6502_START_ADDRESS + (sbc ? 2 : 0);
+				x->A = a;
+				_6502_set_p(x, 0x20 | (d << 3) | c);
+
+				if (k) _6502_clock(x);
+				else _6502_run(x, 1);
+
+				if ((got = (x->A << 8) | (_6502_get_p(x) & 0xc3)) != want) {
+					fprintf(stderr, "case %s, %s%s: %s %02x with a %02x, c %d, d %d on %s gives a %02x, nvzc %x, not a %02x, nvzc %x\n", case_name, engines[engine],
+						k ? " (clocked)" : "", sbc ? "sbc" : "adc", b, a, c, d, ((const char *[]) _6502_CPU_NAMES)[variant],
+						got >> 8, ((got & 0xc0) >> 4) | (got & 3), want >> 8, ((want & 0xc0) >> 4) | (want & 3));
+					return failed(engine, "not as the sequences tell");
+				}
+			}
+		}
+	}
+
+	if (!variants) return failed(engine, "no variant to check");
+
+	engine_off(&cpu[0][0], engine);
+	return 0;
+}
+
+/*
+	Traps: jsr ADD16 then stuck, the routine stood in for by add16() natively or verified. The routine
+	with the stack pushes and calls, leaving bytes below sp the function never writes; the lost one
+	never returns. add16() gets a sum off by one into $15 or into a (the high byte, as the plain routine
+	leaves it) when told to, the routine's own results must then be what's left.
+*/
+
+#define ADD16_PLAIN					0
+#define ADD16_STACK					1
+#define ADD16_LOST					2
+
+#define WRONG_MEM					1
+#define WRONG_A						2
+
+static uint32_t add16(cpu6502_t *cpu, void *user) {
+	uint16_t sum = (_6502_peek(cpu, 0x10) | _6502_peek(cpu, 0x11) << 8) + (_6502_peek(cpu, 0x12) | _6502_peek(cpu, 0x13) << 8);
+	int wrong = *(const int *) user;
+
+	_6502_poke(cpu, 0x14, sum);
+	_6502_poke(cpu, 0x15, (sum >> 8) + (wrong == WRONG_MEM));
+	cpu->A = (sum >> 8) + (wrong == WRONG_A);
+
+	return 0;
+}
+
+//'kind' is what the verification must find, 0 if nothing
+static int trap(int engine, int routine, int flags, int wrong, uint8_t kind) {
+	static const uint8_t main[] = {0x20, ADD16 & 0xff, ADD16 >> 8, 0x4c, (_6502_START_ADDRESS + 3) & 0xff, (_6502_START_ADDRESS + 3) >> 8};
+	static const uint8_t plain[] = {0x18, 0xa5, 0x10, 0x65, 0x12, 0x85, 0x14, 0xa5, 0x11, 0x65, 0x13, 0x85, 0x15, 0x60};
+	static const uint8_t stack[] = {0x18, 0xa5, 0x10, 0x65, 0x12, 0x48, 0x20, (ADD16 + 13) & 0xff, (ADD16 + 13) >> 8, 0x68, 0x85, 0x14, 0x60,
+		0xa5, 0x11, 0x65, 0x13, 0x85, 0x15, 0x60};
+	static const uint8_t lost[] = {0xe6, 0x90, 0x4c, ADD16 & 0xff, ADD16 >> 8};
+	const uint8_t data[] = {ADD16_X & 0xff, ADD16_X >> 8, ADD16_Y & 0xff, ADD16_Y >> 8};
+	_6502_trap_stats_t st;
+
+	clear();
+	place(_6502_START_ADDRESS, main, sizeof(main));
+	if (routine == ADD16_PLAIN) place(ADD16, plain, sizeof(plain));
+	if (routine == ADD16_STACK) place(ADD16, stack, sizeof(stack));
+	if (routine == ADD16_LOST) place(ADD16, lost, sizeof(lost));
+	place(0x10, data, sizeof(data));
+
+	begin(engine);
+	if (_6502_trap(&cpu[0][0], ADD16, add16, &wrong, 20, flags)) return failed(engine, "can't trap");
+	finish(&cpu[0][0]);
+	st = _6502_trap_stats(&cpu[0][0], ADD16);
+	_6502_untrap_all(&cpu[0][0]);
+
+	if (kind) {
+		if (cpu[0][0].stop != _6502_STOP_TRAP || cpu[0][0].hit.addr != ADD16 || cpu[0][0].hit.kind != kind) return failed(engine, "verification missed it");
+		if (st.failed != 1 || st.verified) return failed(engine, "wrong trap stats");
+		if (routine == ADD16_LOST) {
+			engine_off(&cpu[0][0], engine);
+			return 0;
+		}
+	} else {
+		if (cpu[0][0].stop != _6502_STOP_STUCK) return failed(engine, "stopped at the trap");
+		if ((flags & _6502_TRAP_VERIFY) ? (st.verified != 1 || st.failed || st.calls) : (st.calls != 1 || st.verified)) return failed(engine, "wrong trap stats");
+	}
+
+	if ((ram[0][0][0x14] | ram[0][0][0x15] << 8) != (uint16_t) (ADD16_X + ADD16_Y)) return failed(engine, "wrong sum");
+
+	engine_off(&cpu[0][0], engine);
+	return 0;
+}
+
+static int trap_native(int engine) {return trap(engine, ADD16_PLAIN, 0, 0, 0);}
+static int trap_verify(int engine) {return trap(engine, ADD16_PLAIN, _6502_TRAP_VERIFY, 0, 0);}
+static int trap_verify_stack(int engine) {return trap(engine, ADD16_STACK, _6502_TRAP_VERIFY, 0, 0);}
+static int trap_wrong_mem(int engine) {return trap(engine, ADD16_PLAIN, _6502_TRAP_VERIFY, WRONG_MEM, _6502_TRAP_MEM);}
+static int trap_wrong_a(int engine) {return trap(engine, ADD16_PLAIN, _6502_TRAP_VERIFY | _6502_TRAP_A, WRONG_A, _6502_TRAP_A);}
+static int trap_lost(int engine) {return trap(engine, ADD16_LOST, _6502_TRAP_VERIFY, 0, _6502_TRAP_LOST);}
+
+/*
+	Idle loops and events: the program waits (in loops skipped as idle, but on the cycle-exact engine)
+	for a periodic event to set a flag, then for 40 irqs from a timer event pulling the irq line. The
+	handler releases it every other time, so the level triggered line takes it again right after rti.
+	Each go event cancels one it scheduled past the next, which must never fire. Both contexts get the
+	same events, in lock step by cycles: the engine's one runs to a target up to 8 * STEP cycles ahead
+	with _6502_run_until (interrupts aren't instructions), the other one is clocked up to it.
+*/
+
+#define TIMER						1000 //cycles between irqs
+#define GO							7000 //between go events
+#define TICKS						1000000 //cycles the case runs
+
+static struct device {
+	uint64_t timer, go; //when they're due next
+} dev[2];
+static int poisoned;
+
+static void timer(cpu6502_t *cpu, void *user) {
+	struct device *d = user;
+
+	_6502_irq_set(cpu, 1);
+	_6502_schedule(cpu, d->timer += TIMER, timer, d);
+}
+
+static void poison(cpu6502_t *cpu, void *user) {
+	(void) cpu; (void) user;
+	poisoned++;
+}
+
+static void go(cpu6502_t *cpu, void *user) {
+	struct device *d = user;
+
+	_6502_poke(cpu, 0x81, 1);
+	_6502_cancel(cpu, poison, d);
+	_6502_schedule(cpu, d->go + 2 * GO, poison, d);
+	_6502_schedule(cpu, d->go += GO, go, d);
+}
+
+static int events(int engine) {
+	static const uint8_t wait[] = {
+		0x58,					//cli
+		0xa5, 0x81,				//lda $81
+		0xf0, 0xfc,				//beq lda $81
+		0xa5, 0x80,				//lda $80
+		0xc9, 40,				//cmp #40
+		0x90, 0xfa,				//bcc lda $80
+		0xe6, 0x82,				//inc $82
+		0xa9, 0x00,				//lda #0
+		0x85, 0x80,				//sta $80
+		0x85, 0x81,				//sta $81
+		0x4c, (_6502_START_ADDRESS + 1) & 0xff, (_6502_START_ADDRESS + 1) >> 8
+	};
+	static const uint8_t isr[] = {
+		0xe6, 0x80,				//inc $80
+		0xa5, 0x80,				//lda $80
+		0x4a,					//lsr a
+		0x90, 0x03,				//bcc rti
+		0x8d, IRQ_ACK & 0xff, IRQ_ACK >> 8,
+		0x40					//rti
+	};
+	int err = 0;
+
+	clear();
+	place(_6502_START_ADDRESS, wait, sizeof(wait));
+	place(HANDLER, isr, sizeof(isr));
+	begin(engine);
+	if (engine == ENGINE_EXACT) _6502_exact(&cpu[0][1], 1);
+	_6502_idle(&cpu[0][0], _6502_IDLE_MEM);
+
+	for (int i = 0; i < 2; i++) {
+		dev[i].timer = TIMER;
+		dev[i].go = GO;
+		_6502_schedule(&cpu[0][i], dev[i].timer, timer, &dev[i]);
+		_6502_schedule(&cpu[0][i], dev[i].go, go, &dev[i]);
+	}
+
+	acking = 1;
+	poisoned = 0;
+
+	while (!err && cpu[0][0].cycles < TICKS) {
+		_6502_run_until(&cpu[0][0], cpu[0][0].cycles + 1 + next() % (8 * STEP));
+
+		while (cpu[0][1].cycles < cpu[0][0].cycles)
+			_6502_clock(&cpu[0][1]);
+
+		err = matching(engine, cpu[0][0].cycles, "cycles");
+	}
+
+	acking = 0;
+
+	if (!err && poisoned) err = failed(engine, "a cancelled event fired");
+	if (!err && ram[0][0][0x82] < TICKS / (40 * TIMER) / 2) err = failed(engine, "too few irqs");
+	if (!err && engine != ENGINE_EXACT && !cpu[0][0].idle_cycles) err = failed(engine, "no idle loop skipped");
+
+	if (!err) engine_off(&cpu[0][0], engine);
+	return err;
+}
+
+/*
+	Record and replay: a loop reading an io page and storing what it read plus an immediate it then
+	rewrites, so the cache and the JIT have stale code to run if they missed the stores made while
+	recording. The recording starts once it's hot and stops midway, nmis coming in between; the run
+	goes on in lock step all along. Then a context of lane 1 replays it, seeking to checkpoints taken
+	on the clocked context and stepping back from one to another.
+*/
+
+#define CHECKPOINTS					8
+#define SOURCE						0x0406 //the immediate rewritten
+
+static struct {
+	cpu6502_t regs;
+	uint64_t done; //instructions since the recording started
+	uint8_t mem[0x10000];
+} cp[CHECKPOINTS];
+static int ncp;
+static uint64_t recorded; //instructions so far
+
+//a checkpoint now and then, or nmis (never both at the same cycle count: replaying takes the nmi first)
+static int recording(int engine, uint64_t n) {
+	recorded += n;
+
+	if (ncp < CHECKPOINTS && !(next() % 16)) {
+		cp[ncp].regs = cpu[0][1];
+		cp[ncp].done = recorded;
+		memcpy(cp[ncp].mem, ram[0][1], 0x10000);
+		ncp++;
+	} else if (!(next() % 16)) {
+		_6502_nmi(&cpu[0][0]);
+		_6502_nmi(&cpu[0][1]);
+	}
+
+	return 0;
+}
+
+//the replaying context as at checkpoint i: registers, and the pages mapped (io ones read from the log)
+static int at_checkpoint(int i) {
+	const cpu6502_t *r = &cpu[1][0];
+
+	if (!same(r, &cp[i].regs)) return 0;
+
+	for (int pg = 0; pg < 256; pg++)
+		if (r->rpage[pg] && memcmp(r->rpage[pg], cp[i].mem + (pg << 8), 256)) return 0;
+
+	return 1;
+}
+
+static const uint8_t loop[] = {
+	0xa2, 0x00,				//ldx #0
+	0xbd, 0x00, IO_DATA,	//lda io,x
+	0x69, 0x01,				//adc #1 (SOURCE)
+	0x9d, 0x00, 0x03,		//sta $0300,x
+	0xe8,					//inx
+	0xd0, 0xf5,				//bne lda
+	0xee, SOURCE & 0xff, SOURCE >> 8,
+	0xee, 0x05, IO_DATA,	//inc io + 5
+	0x4c, _6502_START_ADDRESS & 0xff, _6502_START_ADDRESS >> 8
+};
+static const uint8_t handler[] = {0xe6, 0x80, 0x40}; //inc $80, rti
+
+static int replay(int engine) {
+	char path[] = "/tmp/c6502-check-XXXXXX";
+	_6502_replay_t *r;
+	int fd, err;
+
+	clear();
+	place(_6502_START_ADDRESS, loop, sizeof(loop));
+	place(HANDLER, handler, sizeof(handler));
+	begin(engine);
+
+	if ((fd = mkstemp(path)) < 0) return failed(engine, "no temporary file");
+	close(fd);
+
+	ncp = 0;
+	recorded = 0;
+	err = lockstep(engine, 20000, NULL);
+	if (!err && _6502_record(&cpu[0][0], path, 5000)) err = failed(engine, "can't record");
+	if (!err) err = lockstep(engine, 100000, recording);
+	if (!err && _6502_record_stop(&cpu[0][0])) err = failed(engine, "recording failed");
+	if (!err) err = lockstep(engine, 20000, NULL);
+
+	if (!err) {
+		memcpy(ram[1][0], prg, 0x10000);
+		setup(&cpu[1][0], ram[1][0]);
+		engine_on(&cpu[1][0], engine);
+
+		if (!(r = _6502_replay_open(&cpu[1][0], path))) {
+			err = failed(engine, "can't replay");
+		} else {
+			for (int i = 0; i < ncp && !err; i++) {
+				int j = next() % (i + 1);
+
+				if (_6502_replay_seek(r, cp[i].regs.cycles) || !at_checkpoint(i)) err = -1;
+				else if (_6502_replay_back(r, cp[i].done - cp[j].done) || !at_checkpoint(j)) err = -1;
+
+				if (err) {
+					fprintf(stderr, "case %s, %s: replay not at checkpoint %d, %" PRIu64 " cycles\n", case_name, engines[engine], i, cp[i].regs.cycles);
+					state("replay", &cpu[1][0]);
+					state("clock", &cp[i].regs);
+				}
+			}
+
+			_6502_replay_close(r);
+		}
+
+		engine_off(&cpu[1][0], engine);
+	}
+
+	if (!err) engine_off(&cpu[0][0], engine);
+	remove(path);
+
+	return err;
+}
+
+/*
+	Breakpoints and watches, on the same loop once it's hot: a breakpoint on the store patching it, an
+	opcode breakpoint on jmp, a write watch, a write watch matching a value and a read watch on the io
+	page. The engine's context goes on in lock step with the clocked one (a breakpoint stops before the
+	instruction, which then runs first thing next time), and the stops must be the same on every engine:
+	reason, pc, cycle count and hit. Then everything is unwatched, and what the plain loop patched must
+	not be left behind in the cache or the JIT.
+*/
+
+#define STOPS						64
+
+static struct stop {
+	uint8_t stop, kind, value;
+	uint16_t pc, addr;
+	uint64_t cycles;
+} stops[STOPS];
+static int nstops, stopped, stops_by = -1; //recorded, seen this time, and the engine that recorded them
+
+static int same_stop(const struct stop *a, const struct stop *b) {
+	return a->stop == b->stop && a->kind == b->kind && a->value == b->value && a->pc == b->pc && a->addr == b->addr && a->cycles == b->cycles;
+}
+
+static int watched(int engine, uint64_t n) {
+	const cpu6502_t *c = &cpu[0][0];
+	struct stop s = {c->stop, c->hit.kind, c->hit.value, c->PC, c->hit.addr, c->cycles};
+
+	(void) n;
+	if (c->stop != _6502_STOP_BREAK && c->stop != _6502_STOP_WATCH) return 0;
+	if (stopped == STOPS) return 0;
+
+	if (stops_by == engine) {
+		stops[nstops++] = s;
+	} else if (stopped >= nstops || !same_stop(&stops[stopped], &s)) {
+		fprintf(stderr, "case %s, %s: stop %d not as on %s", case_name, engines[engine], stopped, engines[stops_by]);
+		if (stopped < nstops) fprintf(stderr, " (stop %d at %04x, %" PRIu64 " cycles, hit %x %04x %02x)", stops[stopped].stop, stops[stopped].pc,
+			stops[stopped].cycles, stops[stopped].kind, stops[stopped].addr, stops[stopped].value);
+		fprintf(stderr, ": stop %d at %04x, %" PRIu64 " cycles, hit %x %04x %02x\n", s.stop, s.pc, s.cycles, s.kind, s.addr, s.value);
+		return failed(engine, "stopped elsewhere");
+	}
+
+	stopped++;
+	return 0;
+}
+
+static int watch(int engine) {
+	cpu6502_t *c = &cpu[0][0];
+	int err;
+
+	clear();
+	place(_6502_START_ADDRESS, loop, sizeof(loop));
+	begin(engine);
+
+	if (stops_by < 0) stops_by = engine;
+	if (stops_by == engine) nstops = 0;
+	stopped = 0;
+
+	err = lockstep(engine, 20000, NULL);
+	if (!err && (_6502_watch(c, _6502_START_ADDRESS + 13, 1, _6502_WATCH_EXEC, 0) || _6502_break_op(c, 0x4c, 1) ||
+		_6502_watch(c, 0x0380, 1, _6502_WATCH_WRITE, 0) || _6502_watch(c, 0x0300, 0x100, _6502_WATCH_WRITE | _6502_WATCH_VALUE, 0x42) ||
+		_6502_watch(c, (IO_DATA << 8) + 5, 1, _6502_WATCH_READ, 0)))
+		err = failed(engine, "can't watch");
+	if (!err) err = lockstep(engine, 20000, watched);
+	if (!err && stopped < 16) err = failed(engine, "too few stops");
+	if (!err && stops_by != engine && stopped != nstops) err = failed(engine, "not as many stops as on the first engine");
+
+	if (!err) {
+		_6502_unwatch(c, _6502_START_ADDRESS + 13, 1, _6502_WATCH_EXEC);
+		_6502_break_op(c, 0x4c, 0);
+		_6502_unwatch(c, 0x0300, 0x100, _6502_WATCH_WRITE | _6502_WATCH_VALUE);
+		_6502_unwatch(c, 0x0380, 1, _6502_WATCH_WRITE);
+		_6502_unwatch(c, (IO_DATA << 8) + 5, 1, _6502_WATCH_READ);
+		err = lockstep(engine, 20000, NULL);
+	}
+
+	_6502_unwatch_all(c);
+	if (!err) engine_off(c, engine);
+
+	return err;
+}
+
+/*
+	Coverage: a loop calling a subroutine whose branches go one way or the other by what the loop
+	patched into it last time, brk in between. Once it's hot, edges are counted for a while into a
+	map, in lock step, then no more and on in lock step (the cache and the JIT must not be left with
+	what was patched meanwhile). The map must be the same on every engine but the cycle-exact one, which
+	counts nothing, and the list of counters touched must be those that aren't 0, once each.
+*/
+
+#define MAP							0x10000
+
+static uint8_t map[MAP], first_map[MAP], once[MAP];
+static uint32_t touched[MAP];
+static int map_by = -1; //the engine that made first_map
+
+static int cover(int engine) {
+	static const uint8_t calls[] = {
+		0xa2, 0x00,				//ldx #0
+		0x20, 0x20, 0x04,		//jsr $0420
+		0xe8,					//inx
+		0xd0, 0xfa,				//bne jsr
+		0x00, 0xea,				//brk
+		0xee, 0x22, 0x04,		//inc $0422 (the and's operand)
+		0x4c, _6502_START_ADDRESS & 0xff, _6502_START_ADDRESS >> 8
+	};
+	static const uint8_t sub[] = {
+		0x8a,					//txa
+		0x29, 0x03,				//and #3
+		0xf0, 0x04,				//beq rts
+		0x4a,					//lsr a
+		0xb0, 0x01,				//bcs rts
+		0x60,					//rts
+		0x60					//rts
+	};
+	cpu6502_t *c = &cpu[0][0];
+	uint32_t nonzero = 0;
+	int err;
+
+	clear();
+	place(_6502_START_ADDRESS, calls, sizeof(calls));
+	place(0x0420, sub, sizeof(sub));
+	place(HANDLER, handler, sizeof(handler));
+	begin(engine);
+
+	memset(map, 0, sizeof(map));
+	err = lockstep(engine, 20000, NULL);
+	if (!err && (_6502_cover(c, map, MAP) || (_6502_cover_touched(c, touched), 0))) err = failed(engine, "can't cover");
+	if (!err) err = lockstep(engine, 20000, NULL);
+	if (!err) {
+		_6502_cover(c, NULL, 0);
+		err = lockstep(engine, 20000, NULL);
+	}
+
+	for (uint32_t i = 0; i < MAP; i++)
+		nonzero += map[i] != 0;
+	memset(once, 0, sizeof(once));
+	for (uint32_t i = 0; i < c->cover.ntouched && !err; i++)
+		if (!map[touched[i]] || once[touched[i]]++) err = failed(engine, "counters listed twice, or 0");
+	if (!err && c->cover.ntouched != nonzero) err = failed(engine, "counters touched not listed");
+
+	if (!err && engine == ENGINE_EXACT) {
+		if (nonzero) err = failed(engine, "edges counted");
+	} else if (!err) {
+		if (nonzero < 8) err = failed(engine, "too few edges");
+		if (map_by < 0) {
+			map_by = engine;
+			memcpy(first_map, map, MAP);
+		} else if (!err && memcmp(first_map, map, MAP)) {
+			fprintf(stderr, "case %s, %s: edges not as counted on %s\n", case_name, engines[engine], engines[map_by]);
+			err = failed(engine, "other edges");
+		}
+	}
+
+	_6502_cover_touched(c, NULL);
+	if (!err) engine_off(c, engine);
+
+	return err;
+}
+
+#if (_6502_TRACE)
+/*
+	Trace: the same loop, hot before tracing starts to a ring smaller than a pass around it, then on
+	with the trace off. What the plain loop stored while tracing must not be left behind in the cache
+	or the JIT. The file must hold the last records written, one instruction after the other, with
+	the addresses the stores went to (the cycle-exact engine leaves none).
+*/
+
+#define TRACE_RING					100 //records asked for
+#define TRACE_CAP					128 //what the ring holds
+
+static uint64_t traced;
+
+static int tracing(int engine, uint64_t n) {
+	(void) engine;
+	traced += n;
+
+	return 0;
+}
+
+static int trace(int engine) {
+	char path[] = "/tmp/c6502-check-XXXXXX";
+	_6502_trace_hdr_t h;
+	_6502_trace_rec_t rec[TRACE_CAP];
+	FILE *fp;
+	int fd, err;
+
+	clear();
+	place(_6502_START_ADDRESS, loop, sizeof(loop));
+	place(HANDLER, handler, sizeof(handler));
+	begin(engine);
+
+	if ((fd = mkstemp(path)) < 0) return failed(engine, "no temporary file");
+	close(fd);
+
+	traced = 0;
+	err = lockstep(engine, 20000, NULL);
+	if (!err && _6502_trace_enable(&cpu[0][0], path, TRACE_RING, _6502_TRACE_FILE)) err = failed(engine, "can't trace");
+	if (!err) err = lockstep(engine, 20000, tracing);
+	if (!err) {
+		_6502_trace_disable(&cpu[0][0]);
+		err = lockstep(engine, 20000, NULL);
+	}
+
+	if (!err) {
+		uint64_t want = (engine == ENGINE_EXACT) ? 0 : traced, k;
+
+		if (!(fp = fopen(path, "rb")) || fread(&h, sizeof(h), 1, fp) != 1 || h.n != want || h.cap != TRACE_CAP) {
+			err = failed(engine, "wrong trace header");
+		} else {
+			k = fread(rec, sizeof(rec[0]), TRACE_CAP, fp);
+
+			//(oldest at n % cap)
+			for (uint64_t i = 1; i < TRACE_CAP && i < want && !err; i++) {
+				const _6502_trace_rec_t *r0 = &rec[(want - i - 1) % TRACE_CAP], *r1 = &rec[(want - i) % TRACE_CAP];
+
+				if (k != TRACE_CAP || r0->cycles >= r1->cycles || r1->pc < _6502_START_ADDRESS || r1->pc >= _6502_START_ADDRESS + sizeof(loop) || r1->op != prg[r1->pc] ||
+					(r1->op == 0x9d && _6502_trace_ea(&h, rec, want - i) != 0x0300 + r1->x))
+					err = failed(engine, "wrong trace records");
+			}
+		}
+
+		if (fp) fclose(fp);
+	}
+
+	if (!err) engine_off(&cpu[0][0], engine);
+	remove(path);
+
+	return err;
+}
+#endif
+
+static const struct {
+	const char *name;
+	int (*f)(int engine);
+} cases[] = {
+	{"code on an io page", io_code},
+	{"decimal mode, every input", decimal_mode},
+	{"trap", trap_native},
+	{"trap verify", trap_verify},
+	{"trap verify, routine using the stack", trap_verify_stack},
+	{"trap verify, memory differing", trap_wrong_mem},
+	{"trap verify, register differing", trap_wrong_a},
+	{"trap verify, routine not returning", trap_lost},
+	{"idle loops, events and the irq line", events},
+	{"record, replay, seek and step back", replay},
+	{"breakpoints and watches", watch},
+	{"edge coverage", cover},
+	#if (_6502_TRACE)
+	{"trace, code patched while tracing", trace},
+	#endif
+};
+
+#define CASES						((int) (sizeof(cases) / sizeof(cases[0])))
+
+static int listed(const char *list, const char *name) {
+	size_t len = strlen(name);
+
+	for (const char *s = list; s && *s; s += strcspn(s, ",") + (s[strcspn(s, ",")] == ',')) {
+		if (strcspn(s, ",") == len && !strncmp(s, name, len)) return 1;
+	}
+
+	return !list;
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"usage: %s [-p programs] [-n instructions] [-s seed] [-e engines] [-o image]\n"
+		"\t-p\tprograms generated (default %d)\n"
+		"\t-n\tinstructions each program runs at most (default %d)\n"
+		"\t-s\trandom seed (default: the time)\n"
+		"\t-e\tcomma separated subset of run,cache,jit,exact,batch (default: all those compiled in)\n"
+		"\t-o\twrite the seed's first program to a raw image (-f raw -l 0 -e reset), and check nothing\n",
+		argv0, DEF_PROGRAMS, DEF_INSTRUCTIONS);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	uint64_t programs = DEF_PROGRAMS, limit = DEF_INSTRUCTIONS, seed = 0, total[ENGINES] = {0};
+	const char *only = NULL, *out = NULL;
+	int c, avail[ENGINES];
+
+	while ((c = getopt(argc, argv, "p:n:s:e:o:")) != -1) {
+		switch (c) {
+			case 'p': programs = strtoull(optarg, NULL, 0); break;
+			case 'n': limit = strtoull(optarg, NULL, 0); break;
+			case 's': seed = strtoull(optarg, NULL, 0); break;
+			case 'e': only = optarg; break;
+			case 'o': out = optarg; break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if (optind != argc) usage(argv[0]);
+	if (!seed) seed = (uint64_t) time(NULL);
+
+	if (out) {
+		FILE *fp = fopen(out, "wb");
+
+		rng = seed | 1;
+		generate();
+
+		if (!fp || fwrite(prg, sizeof(prg), 1, fp) != 1 || fclose(fp)) {
+			perror(out);
+			return 1;
+		}
+
+		return 0;
+	}
+
+	//engines not compiled in (or for another variant) are skipped, unless asked for
+	for (int e = 0; e < ENGINES; e++) {
+		setup(&cpu[0][0], ram[0][0]);
+		avail[e] = listed(only, engines[e]) && !engine_on(&cpu[0][0], e);
+		engine_off(&cpu[0][0], e);
+
+		if (only && listed(only, engines[e]) && !avail[e]) {
+			fprintf(stderr, "engine %s not available\n", engines[e]);
+			return 1;
+		}
+	}
+
+	for (uint64_t p = 0; p < programs; p++) {
+		char program[64];
+
+		//(every program from a seed of its own, so that one can be checked again alone)
+		rng = (seed + p * 0x9e3779b97f4a7c15ULL) | 1;
+		generate();
+		snprintf(program, sizeof(program), "seed %" PRIu64 ", program %" PRIu64, seed, p);
+
+		for (int e = 0; e < ENGINES; e++) {
+			int64_t n;
+
+			if (!avail[e]) continue;
+			if ((n = check(e, limit, program)) < 0) return 1;
+			total[e] += n;
+		}
+	}
+
+	for (int i = 0; i < CASES; i++) {
+		case_name = cases[i].name;
+		rng = seed | 1;
+
+		for (int e = 0; e < ENGINES; e++)
+			if (avail[e] && e != ENGINE_BATCH && cases[i].f(e)) return 1;
+	}
+
+	for (int e = 0; e < ENGINES; e++)
+		if (avail[e]) printf("%-6s %" PRIu64 " instructions, no difference\n", engines[e], total[e]);
+	printf("cases  %d, as expected on every engine but batch\n", CASES);
+
+	return 0;
+}
\ No newline at end of file
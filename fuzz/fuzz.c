@@ -0,0 +1,534 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/6502.h"
+
+
+
+/*
+	Fuzzer.
+	Runs guest code over and over in the same process, one input after the other:
+
+		c6502-fuzz -i addr:size [-d done] [...] image [seed file or directory]...
+
+	The image is loaded and reset once, then snapshotted. Every execution restores the snapshot (only
+	the pages the last one wrote), writes the input at the region given (zero filled up to its size, its
+	length as a little endian word at -L if given) and runs until the done address, or one of the
+	conditions picked with -k: an opcode the NMOS doesn't document or a brk (crashes), a jump or branch
+	onto itself anywhere else or the instruction budget running out (hangs).
+	Edges are counted into a 64K map laid out as AFL's (see _6502_cover), in the shared memory segment
+	named by __AFL_SHM_ID when set; the core lists the counters an execution touches, and only those
+	are scanned and cleared. This is a stand-in for AFL's driver: inputs are mutated locally,
+	havoc style, and kept when their edges (with AFL's hit count buckets) are new; crashes and hangs
+	are kept when new for their own kind. They all end up in the output directory, under queue/,
+	crashes/ and hangs/.
+*/
+
+#define PRG_START					((uint16_t) (0x000a)) //where raw images go unless --load says otherwise
+
+#define MAP_SIZE					(1 << 16)
+#define DEF_BUDGET					100000 //instructions before an execution hangs
+#define MAX_QUEUE					65536
+#define HAVOC						16 //mutations stacked on an input, at most
+
+//conditions (-k)
+#define K_ILLEGAL					1
+#define K_BRK						2
+#define K_STUCK						4
+#define K_BUDGET					8
+
+//what an execution came to
+#define END_OK						0
+#define END_CRASH					1
+#define END_HANG					2
+
+
+
+struct entry {
+	uint8_t *data;
+	uint32_t len;
+};
+
+static uint8_t ram[0x10000];
+static uint8_t *map, virgin[MAP_SIZE], virgin_crash[MAP_SIZE], virgin_hang[MAP_SIZE];
+static uint32_t touched[MAP_SIZE]; //the counters the last execution bumped (see _6502_cover_touched)
+
+static struct entry queue[MAX_QUEUE];
+static int nqueue;
+
+static uint64_t rng = 0x2545f4914f6cdd1dULL;
+static volatile sig_atomic_t quit;
+
+static const char *const cpu_names[] = _6502_CPU_NAMES;
+
+static uint8_t ram_read(void *user, uint16_t a) {return ((uint8_t *) user)[a];}
+static void ram_write(void *user, uint16_t a, uint8_t x) {((uint8_t *) user)[a] = x;}
+
+static void interrupted(int sig) {
+	(void) sig;
+	quit = 1;
+}
+
+static double now(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint32_t next(void) {
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	return rng >> 32;
+}
+
+
+
+//the guest, set up once and rolled back to before every execution
+static struct {
+	cpu6502_t cpu;
+	_6502_snapshot_t *base;
+	uint16_t in;
+	uint32_t size;
+	int32_t len_at, done; //-1 = none
+	int kinds;
+	uint64_t budget;
+} g;
+
+static int run(const uint8_t *data, uint32_t len, const char **why) {
+	cpu6502_t *cpu = &g.cpu;
+	uint64_t n = 0;
+
+	_6502_restore(cpu, g.base);
+	memcpy(ram + g.in, data, len);
+	memset(ram + g.in + len, 0, g.size - len);
+	if (g.len_at >= 0) ram[g.len_at] = len, ram[(uint16_t) (g.len_at + 1)] = len >> 8;
+
+	//only the counters the last execution touched, not the whole map
+	for (uint32_t i = 0; i < cpu->cover.ntouched; i++)
+		map[touched[i]] = 0;
+	cpu->cover.ntouched = 0;
+	cpu->cover.prev = 0;
+
+	while (n < g.budget) {
+		n += _6502_run(cpu, g.budget - n);
+
+		switch (cpu->stop) {
+			case _6502_STOP_BREAK:
+				if (cpu->hit.kind == _6502_WATCH_EXEC) return END_OK;
+				*why = (cpu->hit.value == 0x00) ? "brk" : "illegal";
+				return END_CRASH;
+
+			case _6502_STOP_STUCK:
+				if (!(g.kinds & K_STUCK) || g.done < 0 || cpu->PC == g.done) return END_OK;
+				*why = "stuck";
+				return END_HANG;
+		}
+	}
+
+	*why = "budget";
+	return (g.kinds & K_BUDGET) ? END_HANG : END_OK;
+}
+
+//AFL's hit count buckets: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+
+static uint8_t bucket[256];
+
+static void buckets(void) {
+	static const int lo[] = {1, 2, 3, 4, 8, 16, 32, 128, 256};
+
+	for (int b = 0; b < 8; b++)
+		for (int c = lo[b]; c < lo[b + 1]; c++)
+			bucket[c] = 1 << b;
+}
+
+//folds the counters the execution touched into buckets and takes what's new out of 'v': 1 if anything was
+static int new_bits(uint8_t *v) {
+	int found = 0;
+
+	for (uint32_t i = 0; i < g.cpu.cover.ntouched; i++) {
+		uint32_t k = touched[i];
+		uint8_t b = bucket[map[k]];
+
+		if (b & v[k]) {
+			v[k] &= ~b;
+			found = 1;
+		}
+	}
+
+	return found;
+}
+
+static int edges(void) {
+	int n = 0;
+
+	for (int i = 0; i < MAP_SIZE; i++)
+		n += virgin[i] != 0xff;
+
+	return n;
+}
+
+
+
+static void save(const char *dir, const char *kind, uint64_t id, const uint8_t *data, uint32_t len) {
+	char path[4096];
+	FILE *fp;
+
+	if (kind) snprintf(path, sizeof(path), "%s/id:%06" PRIu64 ",%s,pc:%04x", dir, id, kind, g.cpu.PC);
+	else snprintf(path, sizeof(path), "%s/id:%06" PRIu64, dir, id);
+
+	if (!(fp = fopen(path, "wb"))) return;
+	fwrite(data, 1, len, fp);
+	fclose(fp);
+}
+
+static int add(const uint8_t *data, uint32_t len) {
+	uint8_t *d;
+
+	if (nqueue == MAX_QUEUE || !(d = malloc(len ? len : 1))) return -1;
+
+	memcpy(d, data, len);
+	queue[nqueue].data = d;
+	queue[nqueue].len = len;
+	nqueue++;
+
+	return 0;
+}
+
+static void seed_file(const char *path) {
+	static uint8_t buf[0x10000];
+	FILE *fp = fopen(path, "rb");
+	size_t len;
+
+	if (!fp) return;
+	len = fread(buf, 1, g.size, fp);
+	fclose(fp);
+
+	add(buf, len);
+}
+
+static void seed(const char *path) {
+	struct stat st;
+	struct dirent *e;
+	DIR *dir;
+
+	if (stat(path, &st)) return;
+	if (!S_ISDIR(st.st_mode)) {
+		seed_file(path);
+		return;
+	}
+
+	if (!(dir = opendir(path))) return;
+	while ((e = readdir(dir))) {
+		char p[4096];
+
+		if (e->d_name[0] == '.') continue;
+		snprintf(p, sizeof(p), "%s/%s", path, e->d_name);
+		if (!stat(p, &st) && S_ISREG(st.st_mode)) seed_file(p);
+	}
+	closedir(dir);
+}
+
+static const uint8_t interesting[] = {0x00, 0x01, 0x7f, 0x80, 0xff, 0x10, 0x20, 0x40, 0x64, 0x0a, 0x0d, 0x30, 0x39, 0x41, 0x5a, 0x61, 0x7a};
+
+//a few of: bit flips, random and interesting bytes, small additions, deleting, inserting and copying blocks, splicing another input in
+static uint32_t havoc(uint8_t *d, uint32_t len) {
+	int k = 1 + next() % HAVOC;
+
+	while (k--) {
+		uint32_t at = len ? next() % len : 0, span = 1 + next() % 8;
+
+		switch (next() % 9) {
+			case 0: if (len) d[at] ^= 1 << (next() & 7); break;
+			case 1: if (len) d[at] = next(); break;
+			case 2: if (len) d[at] = interesting[next() % sizeof(interesting)]; break;
+			case 3: if (len) d[at] += 1 + next() % 16; break;
+			case 4: if (len) d[at] -= 1 + next() % 16; break;
+			case 5:
+				if (len > span && at + span <= len) {
+					memmove(d + at, d + at + span, len - at - span);
+					len -= span;
+				}
+				break;
+			case 6:
+				if (len + span <= g.size) {
+					memmove(d + at + span, d + at, len - at);
+					for (uint32_t i = 0; i < span; i++) d[at + i] = next();
+					len += span;
+				}
+				break;
+			case 7:
+				if (len >= 2) {
+					uint32_t from = next() % len, to = next() % len;
+
+					span = 1 + next() % (len - (from > to ? from : to));
+					memmove(d + to, d + from, span);
+				}
+				break;
+			case 8: {
+				const struct entry *o = &queue[next() % nqueue];
+
+				if (o->len && len) {
+					uint32_t from = next() % o->len;
+
+					span = o->len - from;
+					if (span > len - at) span = len - at;
+					memcpy(d + at, o->data + from, span);
+				}
+				break;
+			}
+		}
+	}
+
+	return len;
+}
+
+
+
+//AFL's driver hands out its bitmap through a shared memory id
+static uint8_t *bitmap(void) {
+	const char *id = getenv("__AFL_SHM_ID");
+
+	if (id) {
+		void *m = shmat(atoi(id), NULL, 0);
+
+		return (m == (void *) -1) ? NULL : m;
+	}
+
+	return calloc(1, MAP_SIZE);
+}
+
+static int32_t address(const char *s) {
+	char *end;
+	long a = strtol(s, &end, 0);
+
+	return (*s && !*end && a >= 0 && a <= 0xffff) ? a : -1;
+}
+
+static int conditions(const char *s) {
+	static const char *const names[] = {"illegal", "brk", "stuck", "budget"};
+	char buf[256], *tok, *save;
+	int k = 0;
+
+	snprintf(buf, sizeof(buf), "%s", s);
+	for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		int i;
+
+		for (i = 0; i < 4 && strcmp(tok, names[i]); i++);
+		if (i == 4) return -1;
+		k |= 1 << i;
+	}
+
+	return k;
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"usage: %s -i addr:size [-L addr] [-d done] [-k conditions] [-b budget] [-n execs] [-s seed] [-o dir]\n"
+		"\t[-r input] [-f raw|prg|hex] [-l load] [-e entry|reset] [-c cpu] image [seed]...\n"
+		"\t-i\twhere inputs are written, and their size at most\n"
+		"\t-L\twhere their length goes (16 bit little endian)\n"
+		"\t-d\taddress an execution ends at normally (default: getting stuck anywhere)\n"
+		"\t-k\twhat counts as a crash or hang: illegal,brk,stuck,budget (default all)\n"
+		"\t-b\tinstructions per execution (default %d)\n"
+		"\t-n\texecutions before stopping (default: until interrupted)\n"
+		"\t-s\trandom seed\n"
+		"\t-o\toutput directory (default fuzz-out)\n"
+		"\t-r\trun this one input and tell what it came to\n"
+		"\t-f -l -e -c\tas for c6502 (image format, load and entry address, cpu variant)\n",
+		argv0, DEF_BUDGET);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	const char *out = "fuzz-out", *replay = NULL;
+	int format = -1, has_entry = 0, variant = _6502_CPU, has_in = 0, c;
+	int32_t load = PRG_START, entry = 0;
+	uint64_t execs = 0, limit = 0, crashes = 0, hangs = 0;
+	static uint8_t buf[0x10000];
+	char *colon;
+	double t0, shown;
+
+	g.len_at = g.done = -1;
+	g.kinds = K_ILLEGAL | K_BRK | K_STUCK | K_BUDGET;
+	g.budget = DEF_BUDGET;
+
+	while ((c = getopt(argc, argv, "i:L:d:k:b:n:s:o:r:f:l:e:c:")) != -1) {
+		switch (c) {
+			case 'i':
+				if (!(colon = strchr(optarg, ':'))) usage(argv[0]);
+				*colon = 0;
+				if (address(optarg) < 0 || (g.size = strtoul(colon + 1, NULL, 0)) < 1 || address(optarg) + g.size > 0x10000) usage(argv[0]);
+				g.in = address(optarg);
+				has_in = 1;
+				break;
+			case 'L': if ((g.len_at = address(optarg)) < 0) usage(argv[0]); break;
+			case 'd': if ((g.done = address(optarg)) < 0) usage(argv[0]); break;
+			case 'k': if ((g.kinds = conditions(optarg)) < 0) usage(argv[0]); break;
+			case 'b': if (!(g.budget = strtoull(optarg, NULL, 0))) usage(argv[0]); break;
+			case 'n': limit = strtoull(optarg, NULL, 0); break;
+			case 's': rng = strtoull(optarg, NULL, 0) | 1; break;
+			case 'o': out = optarg; break;
+			case 'r': replay = optarg; break;
+			case 'f':
+				if (!strcmp(optarg, "raw")) format = _6502_IMAGE_RAW;
+				else if (!strcmp(optarg, "prg")) format = _6502_IMAGE_PRG;
+				else if (!strcmp(optarg, "hex")) format = _6502_IMAGE_HEX;
+				else usage(argv[0]);
+				break;
+			case 'l': if ((load = address(optarg)) < 0) usage(argv[0]); break;
+			case 'e':
+				if (!strcmp(optarg, "reset")) entry = _6502_START_VECTOR;
+				else if ((entry = address(optarg)) < 0) usage(argv[0]);
+				has_entry = 1;
+				break;
+			case 'c':
+				for (variant = 0; variant < (int) (sizeof(cpu_names) / sizeof(cpu_names[0])) && strcmp(optarg, cpu_names[variant]); variant++);
+				if (variant == sizeof(cpu_names) / sizeof(cpu_names[0])) usage(argv[0]);
+				break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if (optind >= argc || !has_in) usage(argv[0]);
+
+	//the guest, up to where every execution starts
+	cpu6502_t *cpu = &g.cpu;
+	_6502_image_t img;
+
+	if (format < 0) format = _6502_image_format(argv[optind]);
+	if (_6502_image_open(&img, argv[optind], format, load)) {
+		fprintf(stderr, "%s: unreadable, malformed or not fitting in 64K\n", argv[optind]);
+		return 1;
+	}
+
+	_6502_init(cpu, ram_read, ram_write, ram);
+	if (_6502_variant(cpu, variant)) {
+		fprintf(stderr, "%s: not compiled in (make CPUS=all)\n", cpu_names[variant]);
+		return 1;
+	}
+	_6502_map(cpu, 0, 256, ram, _6502_MAP_RAM);
+	_6502_image_load(cpu, &img, ram, _6502_MAP_RAM);
+
+	if (has_entry) cpu->start = entry;
+	else if (img.entry >= 0) cpu->start = img.entry;
+	_6502_reset(cpu);
+
+	_6502_cover_touched(cpu, touched);
+	if (!(map = bitmap()) || _6502_cover(cpu, map, MAP_SIZE) ||
+		(g.done >= 0 && _6502_watch(cpu, g.done, 1, _6502_WATCH_EXEC, 0)) ||
+		((g.kinds & K_ILLEGAL) && _6502_break_op(cpu, _6502_BREAK_ILLEGAL, 1)) ||
+		((g.kinds & K_BRK) && _6502_break_op(cpu, 0x00, 1)) ||
+		!(g.base = _6502_snapshot(cpu))) {
+		fprintf(stderr, "out of memory, or no shared memory %s\n", getenv("__AFL_SHM_ID") ? getenv("__AFL_SHM_ID") : "");
+		return 1;
+	}
+
+	if (replay) {
+		const char *why = "done";
+		FILE *fp = fopen(replay, "rb");
+		uint32_t len;
+		int r;
+
+		if (!fp) {
+			perror(replay);
+			return 1;
+		}
+		len = fread(buf, 1, g.size, fp);
+		fclose(fp);
+
+		r = run(buf, len, &why);
+		printf("%s: %s at 0x%04x, %" PRIu64 " cycles\n", (r == END_OK) ? "ok" : (r == END_CRASH) ? "crash" : "hang", why, cpu->PC, cpu->cycles);
+		return r;
+	}
+
+	//the output directory, and queue/, crashes/ and hangs/ in it
+	static const char *const sub[] = {"", "/queue", "/crashes", "/hangs"};
+	char dir[4][4096];
+
+	for (int i = 0; i < 4; i++) {
+		snprintf(dir[i], sizeof(dir[i]), "%s%s", out, sub[i]);
+		if (mkdir(dir[i], 0755) && errno != EEXIST) {
+			perror(dir[i]);
+			return 1;
+		}
+	}
+
+	for (int i = optind + 1; i < argc; i++)
+		seed(argv[i]);
+	if (!nqueue) add((const uint8_t *) "", 0);
+
+	buckets();
+	memset(virgin, 0xff, sizeof(virgin));
+	memset(virgin_crash, 0xff, sizeof(virgin_crash));
+	memset(virgin_hang, 0xff, sizeof(virgin_hang));
+
+	//the seeds' own edges first
+	for (int i = 0; i < nqueue; i++) {
+		const char *why;
+
+		run(queue[i].data, queue[i].len, &why);
+		new_bits(virgin);
+		execs++;
+	}
+
+	signal(SIGINT, interrupted);
+	t0 = shown = now();
+
+	for (uint64_t k = 0; !quit && (!limit || execs < limit); k++) {
+		const struct entry *e = &queue[k % nqueue];
+		const char *why = "";
+		uint32_t len;
+		int r;
+
+		memcpy(buf, e->data, e->len);
+		len = havoc(buf, e->len);
+		r = run(buf, len, &why);
+		execs++;
+
+		if (r == END_CRASH && new_bits(virgin_crash)) {
+			save(dir[2], why, crashes++, buf, len);
+		} else if (r == END_HANG && new_bits(virgin_hang)) {
+			save(dir[3], why, hangs++, buf, len);
+		} else if (r == END_OK && new_bits(virgin) && !add(buf, len)) {
+			save(dir[1], NULL, nqueue - 1, buf, len);
+		}
+
+		if (!(execs & 0xfff) && now() - shown >= 1) {
+			shown = now();
+			fprintf(stderr, "\rexecs %" PRIu64 " (%.0f/s), queue %d, edges %d, crashes %" PRIu64 ", hangs %" PRIu64 "   ",
+				execs, execs / (shown - t0), nqueue, edges(), crashes, hangs);
+		}
+	}
+
+	t0 = now() - t0;
+	fprintf(stderr, "\rexecs %" PRIu64 " (%.0f/s), queue %d, edges %d, crashes %" PRIu64 ", hangs %" PRIu64 "   \n",
+		execs, execs / (t0 > 0 ? t0 : 1), nqueue, edges(), crashes, hangs);
+
+	_6502_snapshot_free(g.base);
+	_6502_unwatch_all(cpu);
+	_6502_image_close(&img);
+
+	return 0;
+}
\ No newline at end of file
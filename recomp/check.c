@@ -0,0 +1,163 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/6502.h"
+
+
+
+/*
+	Recompiled code against the interpreter.
+	Linked with the C c6502-recomp wrote for an image (its table named 'recompiled'):
+
+		c6502-recomp-check [-n instructions] [-s seed] [-f raw|prg|hex] [-l load] [-e entry|reset] image
+
+	Two contexts load the image and reset, one with the table attached, the other running the plain
+	interpreter. They then go in lock step, the same number of instructions at a time (1 to 64, at
+	random, so both whole recompiled blocks and every instruction boundary get to be compared), and
+	after each step everything must match: what the runs returned, stop reasons, registers, cycle
+	counts and all 64K of memory. Ends at the first difference, or when both get stuck.
+*/
+
+#define PRG_START					((uint16_t) (0x000a))
+#define DEF_INSTRUCTIONS			10000000
+#define STEP						64
+
+extern const _6502_recomp_t recompiled;
+
+static uint8_t ram[2][0x10000];
+
+static uint64_t rng = 0x2545f4914f6cdd1dULL;
+
+static uint8_t ram_read(void *user, uint16_t a) {return ((uint8_t *) user)[a];}
+static void ram_write(void *user, uint16_t a, uint8_t x) {((uint8_t *) user)[a] = x;}
+
+static uint32_t next(void) {
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	return rng >> 32;
+}
+
+static int32_t address(const char *s) {
+	char *end;
+	long a = strtol(s, &end, 0);
+
+	return (*s && !*end && a >= 0 && a <= 0xffff) ? a : -1;
+}
+
+static void state(const char *what, const cpu6502_t *cpu) {
+	fprintf(stderr, "%s\tpc %04x a %02x x %02x y %02x sp %02x p %02x ir %02x, %" PRIu64 " cycles, stop %d\n",
+		what, cpu->PC, cpu->A, cpu->X, cpu->Y, cpu->SP, _6502_get_p(cpu), cpu->IR, cpu->cycles, cpu->stop);
+}
+
+static int same(const cpu6502_t *r, const cpu6502_t *i) {
+	return r->PC == i->PC && r->A == i->A && r->X == i->X && r->Y == i->Y && r->SP == i->SP && r->P._raw == i->P._raw &&
+		r->nz == i->nz && r->IR == i->IR && r->cycles == i->cycles && r->stop == i->stop;
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"usage: %s [-n instructions] [-s seed] [-f raw|prg|hex] [-l load] [-e entry|reset] image\n"
+		"\t-n\tinstructions to compare (default %d)\n"
+		"\t-s\trandom seed, for the step lengths\n"
+		"\t-f -l -e\tas for c6502 (image format, load and entry address)\n",
+		argv0, DEF_INSTRUCTIONS);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	int format = -1, has_entry = 0, c;
+	int32_t load = PRG_START, entry = 0;
+	uint64_t limit = DEF_INSTRUCTIONS, done = 0;
+	cpu6502_t cpu[2];
+	_6502_image_t img[2];
+
+	while ((c = getopt(argc, argv, "n:s:f:l:e:")) != -1) {
+		switch (c) {
+			case 'n': limit = strtoull(optarg, NULL, 0); break;
+			case 's': rng = strtoull(optarg, NULL, 0) | 1; break;
+			case 'f':
+				if (!strcmp(optarg, "raw")) format = _6502_IMAGE_RAW;
+				else if (!strcmp(optarg, "prg")) format = _6502_IMAGE_PRG;
+				else if (!strcmp(optarg, "hex")) format = _6502_IMAGE_HEX;
+				else usage(argv[0]);
+				break;
+			case 'l': if ((load = address(optarg)) < 0) usage(argv[0]); break;
+			case 'e':
+				if (!strcmp(optarg, "reset")) entry = _6502_START_VECTOR;
+				else if ((entry = address(optarg)) < 0) usage(argv[0]);
+				has_entry = 1;
+				break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1) usage(argv[0]);
+	if (format < 0) format = _6502_image_format(argv[optind]);
+
+	//(opened once per context: loaded as ram, they would share its pages)
+	for (int i = 0; i < 2; i++) {
+		if (_6502_image_open(&img[i], argv[optind], format, load)) {
+			fprintf(stderr, "%s: unreadable, malformed or not fitting in 64K\n", argv[optind]);
+			return 1;
+		}
+
+		_6502_init(&cpu[i], ram_read, ram_write, ram[i]);
+		_6502_map(&cpu[i], 0, 256, ram[i], _6502_MAP_RAM);
+		_6502_image_load(&cpu[i], &img[i], ram[i], _6502_MAP_RAM);
+
+		if (has_entry) cpu[i].start = entry;
+		else if (img[i].entry >= 0) cpu[i].start = img[i].entry;
+		_6502_reset(&cpu[i]);
+	}
+
+	if (_6502_recomp_attach(&cpu[0], &recompiled)) {
+		fprintf(stderr, "recompiled code needs an NMOS build\n");
+		return 1;
+	}
+
+	while (done < limit) {
+		uint64_t k = 1 + next() % STEP, n[2];
+		int pg;
+
+		for (int i = 0; i < 2; i++)
+			n[i] = _6502_run(&cpu[i], k);
+
+		for (pg = 0; pg < 256 && !memcmp(cpu[0].rpage[pg], cpu[1].rpage[pg], 256); pg++);
+
+		if (n[0] != n[1] || !same(&cpu[0], &cpu[1]) || pg < 256) {
+			fprintf(stderr, "difference after %" PRIu64 " instructions (%" PRIu64 " and %" PRIu64 " in the last step)", done, n[0], n[1]);
+			if (pg < 256) fprintf(stderr, ", memory in page %02x", pg);
+			fprintf(stderr, "\n");
+			state("recompiled", &cpu[0]);
+			state("interpreter", &cpu[1]);
+			return 1;
+		}
+
+		done += n[0];
+		if (cpu[0].stop == _6502_STOP_STUCK) break;
+	}
+
+	printf("%" PRIu64 " instructions, %" PRIu64 " blocks run recompiled (of %u), no difference\n",
+		done, _6502_cache_stats(&cpu[0]).recompiled, recompiled.n);
+
+	for (int i = 0; i < 2; i++)
+		_6502_image_close(&img[i]);
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,303 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/6502.h"
+#include "../src/6502_ops.h"
+
+
+
+/*
+	Static recompiler.
+	Turns the code of an image into C, for _6502_recomp_attach:
+
+		c6502-recomp [-n name] [-o out.c] [-f raw|prg|hex] [-l load] [-e entry|reset]... image
+
+	The walk starts from the image's entry point (or the ones given with -e) and the nmi, reset and
+	irq/brk vectors, when the image holds them. Blocks are cut the way the cache decodes them (see
+	6502_cache.c): up to a branch, jump, call, return or brk, the first instruction starting in the next
+	page or __6502_CACHE_OPS instructions. Then the walk goes on from where a block can lead: branch
+	targets and the instruction after them, jump and call targets and the instruction after the call,
+	the next instruction when the block was cut short. Computed jumps (jmp (abs), rts/rti to an address
+	pushed by hand) are left to the cache at run time, as is any block with a byte outside the image.
+	Each block becomes a function running the NMOS handlers of 6502_ops.h, taken as text from the same
+	opcode list the interpreters are built from, so the code is the interpreter's with the decoding
+	done. The table it defines is sorted by address, and keeps the bytes of every block so the cache
+	can tell they are still there.
+	recomp/check.c runs the result in lock step with the interpreter (make recomp-check).
+*/
+
+#define PRG_START					((uint16_t) (0x000a)) //where raw images go unless -l says otherwise
+#define MAX_ENTRIES					16
+
+//the handlers, as text
+#define BODY(h, body)				[0x##h] = #body,
+
+static const char *const bodies[256] = {_6502_OPCODES(BODY)};
+
+static uint8_t mem[0x10000], have[0x10000]; //the image's bytes, and which ones it has
+static uint8_t queued[0x10000], start[0x10000]; //addresses the walk got to, and the ones a block was decoded at
+
+static uint16_t todo[0x10000];
+static uint32_t ntodo;
+
+struct blk {
+	uint16_t pc, len;
+	uint8_t n, cyc;
+	uint16_t at[__6502_CACHE_OPS];
+};
+
+
+
+//as the cache has it
+static int ends_block(uint8_t op) {
+	switch (op) {
+		case 0x00: case 0x20: case 0x40: case 0x4c: case 0x60: case 0x6c:
+		case 0x10: case 0x30: case 0x50: case 0x70: case 0x90: case 0xb0: case 0xd0: case 0xf0:
+			return 1;
+	}
+
+	return 0;
+}
+
+static int branch(uint8_t op) {
+	return (op & 0x1f) == 0x10;
+}
+
+//-1 if a byte of the block isn't in the image
+static int decode(struct blk *b, uint16_t pc) {
+	uint16_t at = pc;
+	uint8_t op, len;
+
+	b->pc = pc;
+	b->n = b->cyc = 0;
+
+	do {
+		op = mem[at];
+		len = AM_LEN(i_jtable[op].A_func_i);
+
+		for (uint8_t k = 0; k < len; k++)
+			if (!have[(uint16_t) (at + k)]) return -1;
+
+		b->at[b->n++] = at;
+		b->cyc += i_jtable[op].cycles + i_jtable[op].page + (branch(op) ? 2 : 0);
+		at += len;
+	} while (b->n < __6502_CACHE_OPS && !ends_block(op) && (at >> 8) == (pc >> 8));
+
+	b->len = (uint16_t) (at - pc);
+
+	return 0;
+}
+
+static void visit(uint16_t pc) {
+	if (have[pc] && !queued[pc]) {
+		queued[pc] = 1;
+		todo[ntodo++] = pc;
+	}
+}
+
+static uint16_t word(uint16_t a) {
+	return mem[a] | (mem[(uint16_t) (a + 1)] << 8);
+}
+
+static void walk(void) {
+	struct blk b;
+
+	while (ntodo) {
+		uint16_t pc = todo[--ntodo], at, next;
+		uint8_t op;
+
+		if (decode(&b, pc)) continue;
+		start[pc] = 1;
+
+		at = b.at[b.n - 1];
+		op = mem[at];
+		next = at + AM_LEN(i_jtable[op].A_func_i);
+
+		if (branch(op)) {
+			visit(next + (int8_t) mem[(uint16_t) (at + 1)]);
+			visit(next);
+		} else if (op == 0x4c) {
+			visit(word(at + 1));
+		} else if (op == 0x20) {
+			visit(word(at + 1));
+			visit(next);
+		} else if (!ends_block(op)) {
+			visit(next);
+		}
+	}
+}
+
+
+
+//what the handler needs to leave through 'out'
+static int may_stick(const char *body) {
+	return strstr(body, "BRANCH") || strstr(body, "JMP_ABS") || strstr(body, "JAM") || strstr(body, "STUCK");
+}
+
+//only instructions touching memory (io callbacks, stores onto code) or polling the irq line can end a block early
+static int may_end(uint8_t op) {
+	uint8_t m = i_jtable[op].A_func_i;
+
+	return (m != AM_IMP && m != AM_IMM) || strstr(bodies[op], "PH") || strstr(bodies[op], "PL") || strstr(bodies[op], "IRQ_POLL");
+}
+
+static void emit(FILE *fp, const char *image, const char *name) {
+	struct blk b;
+	uint32_t nblk = 0, nins = 0, off = 0;
+
+	for (uint32_t pc = 0; pc < 0x10000; pc++)
+		if (start[pc]) decode(&b, pc), nblk++, nins += b.n;
+
+	fprintf(fp,
+		"/*\n"
+		"\tRecompiled by c6502-recomp from %s: %u blocks, %u instructions.\n"
+		"*/\n\n\n\n"
+		"#include \"6502_recomp.h\"\n\n\n\n",
+		image, nblk, nins);
+
+	fprintf(fp, "static const uint8_t code[] = {\n");
+	for (uint32_t pc = 0; pc < 0x10000; pc++) {
+		if (!start[pc]) continue;
+
+		decode(&b, pc);
+		fprintf(fp, "\t");
+		for (uint16_t k = 0; k < b.len; k++)
+			fprintf(fp, "0x%02x,%s", mem[(uint16_t) (pc + k)], (k + 1 < b.len) ? " " : "");
+		fprintf(fp, " /* %04x */\n", pc);
+	}
+	fprintf(fp, "};\n\n\n\n");
+
+	for (uint32_t pc = 0; pc < 0x10000; pc++) {
+		int out = 0, again;
+		uint8_t last;
+
+		if (!start[pc]) continue;
+
+		decode(&b, pc);
+		fprintf(fp, "static void b_%04x(cpu6502_t *cpu, struct _6502_recomp_run *r) {\n\tENTER;\n", pc);
+
+		//(a block ending in a branch or jump back to itself goes round without leaving)
+		last = mem[b.at[b.n - 1]];
+		again = (branch(last) && (uint16_t) (b.at[b.n - 1] + 2 + (int8_t) mem[(uint16_t) (b.at[b.n - 1] + 1)]) == pc) || (last == 0x4c && word(b.at[b.n - 1] + 1) == pc);
+		if (again) fprintf(fp, "top:\n");
+
+		for (uint8_t i = 0; i < b.n; i++) {
+			uint16_t at = b.at[i];
+			uint8_t op = mem[at], len = AM_LEN(i_jtable[op].A_func_i);
+			uint16_t arg = (len > 1) ? mem[(uint16_t) (at + 1)] : 0;
+			int next = (i + 1 < b.n) && may_end(op);
+
+			if (len > 2) arg |= mem[(uint16_t) (at + 2)] << 8;
+
+			fprintf(fp, "\tI(0x%04x, 0x%02x, %d, 0x%04x) %s;%s\n", at, op, i_jtable[op].cycles, arg, bodies[op], next ? " NEXT;" : "");
+			out |= next || may_stick(bodies[op]);
+		}
+
+		if (again) fprintf(fp, "\tAGAIN(0x%04x, %u, %u);\n", pc, b.n, b.cyc), out = 1;
+		fprintf(fp, "%s\tLEAVE;\n}\n\n", out ? "out:\n" : "");
+	}
+
+	fprintf(fp, "\n\nstatic const _6502_recomp_block_t blocks[] = {\n");
+	for (uint32_t pc = 0; pc < 0x10000; pc++) {
+		if (!start[pc]) continue;
+
+		decode(&b, pc);
+		fprintf(fp, "\t{0x%04x, %u, %u, %u, code + %u, b_%04x},\n", pc, b.len, b.n, b.cyc, off, pc);
+		off += b.len;
+	}
+	fprintf(fp, "};\n\nconst _6502_recomp_t %s = {%u, blocks};\n", name, nblk);
+}
+
+
+
+static int32_t address(const char *s) {
+	char *end;
+	long a = strtol(s, &end, 0);
+
+	return (*s && !*end && a >= 0 && a <= 0xffff) ? a : -1;
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"usage: %s [-n name] [-o out.c] [-f raw|prg|hex] [-l load] [-e entry|reset]... image\n"
+		"\t-n\tname of the table defined (default recompiled)\n"
+		"\t-o\toutput file (default stdout)\n"
+		"\t-e\twhere the walk starts, besides the vectors (default the image's entry point), repeatable\n"
+		"\t-f -l\tas for c6502 (image format and load address)\n",
+		argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	const char *name = "recompiled", *out = NULL;
+	int format = -1, nentry = 0, reset = 0, c;
+	int32_t load = PRG_START, entry[MAX_ENTRIES];
+	_6502_image_t img;
+	FILE *fp = stdout;
+
+	while ((c = getopt(argc, argv, "n:o:f:l:e:")) != -1) {
+		switch (c) {
+			case 'n': name = optarg; break;
+			case 'o': out = optarg; break;
+			case 'f':
+				if (!strcmp(optarg, "raw")) format = _6502_IMAGE_RAW;
+				else if (!strcmp(optarg, "prg")) format = _6502_IMAGE_PRG;
+				else if (!strcmp(optarg, "hex")) format = _6502_IMAGE_HEX;
+				else usage(argv[0]);
+				break;
+			case 'l': if ((load = address(optarg)) < 0) usage(argv[0]); break;
+			case 'e':
+				if (!strcmp(optarg, "reset")) reset = 1;
+				else if (nentry == MAX_ENTRIES || (entry[nentry++] = address(optarg)) < 0) usage(argv[0]);
+				break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1) usage(argv[0]);
+
+	if (format < 0) format = _6502_image_format(argv[optind]);
+	if (_6502_image_open(&img, argv[optind], format, load)) {
+		fprintf(stderr, "%s: unreadable, malformed or not fitting in 64K\n", argv[optind]);
+		return 1;
+	}
+
+	for (int i = 0; i < img.nseg; i++) {
+		memcpy(mem + img.seg[i].addr, img.seg[i].data, img.seg[i].len);
+		memset(have + img.seg[i].addr, 1, img.seg[i].len);
+	}
+
+	for (int i = 0; i < nentry; i++)
+		visit(entry[i]);
+	if (!nentry && !reset && img.entry >= 0) visit(img.entry);
+
+	for (uint32_t v = __6502_NMI_V; v <= __6502_IRQ_V; v += 2)
+		if (have[v] && have[v + 1]) visit(word(v));
+
+	walk();
+
+	if (out && !(fp = fopen(out, "w"))) {
+		perror(out);
+		return 1;
+	}
+
+	emit(fp, argv[optind], name);
+
+	if (fp != stdout) fclose(fp);
+	_6502_image_close(&img);
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,598 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/6502.h"
+
+
+
+/*
+	Batch runner.
+	Runs every job of a manifest, one line each:
+
+		image [format=raw|prg|hex] [load=addr] [entry=addr|reset] [rom] [name=text] [cpu=variant]
+			[stop=stuck|instr:n|cycles:n|pc:addr] [limit=instr] [a=v] [x=v] [y=v] [sp=v] [p=v] [pc=v] [m:addr=hexbytes]...
+
+	Blank lines and lines starting with # are skipped, relative image paths are taken from the manifest's
+	directory. A job runs until it gets stuck (a jump or branch onto itself, the usual way test programs
+	end), has executed n instructions, has reached n cycles or is about to execute the instruction at a
+	breakpoint address (see _6502_watch), then its registers and memory are checked
+	against the expected values given; 'limit' instructions without getting there is a timeout.
+	Every worker thread owns one context and 64K of ram, reused job after job. Jobs are dealt out to the
+	workers in contiguous ranges, and a worker that runs out steals half of what's left of someone else's,
+	so uneven jobs don't leave cores idle. Results are written in manifest order once all are done.
+*/
+
+#define PRG_START					((uint16_t) (0x000a)) //where raw images go unless load= says otherwise
+
+#define DEF_LIMIT					1000000000ULL //instructions before a job times out
+#define MAX_WORKERS					256
+
+#define STOP_STUCK					0
+#define STOP_INSTR					1
+#define STOP_CYCLES					2
+#define STOP_PC						3
+
+#define ENGINE_RUN					0
+#define ENGINE_CACHE				1
+#define ENGINE_JIT					2
+#define ENGINE_EXACT				3
+
+#define FMT_JSON					0
+#define FMT_CSV						1
+
+//expected registers (has), in this order
+#define R_A							0
+#define R_X							1
+#define R_Y							2
+#define R_SP						3
+#define R_P							4
+#define R_PC						5
+
+#define ST_PASS						0
+#define ST_FAIL						1
+#define ST_TIMEOUT					2
+#define ST_ERROR					3
+
+
+
+struct expect_mem {
+	uint16_t addr, len;
+	uint8_t *data;
+};
+
+struct job {
+	char *name, *path;
+	int format, rom, has_entry, stop;
+	int cpu; //variant, -1 = the build's own
+	int32_t load, entry;
+	uint64_t until, limit;
+
+	uint8_t has; //registers to check, 1 << R_*
+	uint16_t reg[6];
+	struct expect_mem *mem;
+	int nmem;
+};
+
+struct result {
+	int status;
+	uint64_t instr, cycles;
+	double wall;
+	uint16_t reg[6];
+	char detail[96]; //the first mismatch, or what went wrong
+} __attribute__((aligned(64))); //written by different workers
+
+struct worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int lo, hi; //jobs not taken yet
+	cpu6502_t cpu;
+	uint8_t ram[0x10000];
+};
+
+static const char *const status_names[] = {"pass", "fail", "timeout", "error"};
+static const char *const reg_names[] = {"a", "x", "y", "sp", "p", "pc"};
+static const char *const cpu_names[] = _6502_CPU_NAMES;
+
+static struct job *jobs;
+static struct result *results;
+static int njobs;
+
+static struct worker *workers;
+static int nworkers, engine = ENGINE_RUN;
+
+static uint8_t ram_read(void *user, uint16_t a) {return ((uint8_t *) user)[a];}
+static void ram_write(void *user, uint16_t a, uint8_t x) {((uint8_t *) user)[a] = x;}
+
+
+
+static double now(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+//a number, in any base strtoull understands. -1 if it isn't one or is above max
+static int64_t number(const char *s, uint64_t max) {
+	char *end;
+	unsigned long long v = strtoull(s, &end, 0);
+
+	return (*s && *s != '-' && !*end && v <= max) ? (int64_t) v : -1;
+}
+
+static int hex_digit(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+//m:addr=hexbytes
+static int expect_mem(struct job *j, char *key, const char *val) {
+	char *eq = strchr(key, '=');
+	size_t len = strlen(val);
+	int64_t addr;
+	struct expect_mem *m;
+
+	*eq = 0;
+	if ((addr = number(key + 2, 0xffff)) < 0 || !len || (len & 1) || addr + len / 2 > 0x10000) return -1;
+
+	if (!(m = realloc(j->mem, (j->nmem + 1) * sizeof(*m)))) return -1;
+	j->mem = m;
+	m = &j->mem[j->nmem];
+	m->addr = addr;
+	m->len = len / 2;
+	if (!(m->data = malloc(m->len))) return -1;
+	j->nmem++;
+
+	for (size_t i = 0; i < len; i += 2) {
+		int h = hex_digit(val[i]), l = hex_digit(val[i + 1]);
+		if (h < 0 || l < 0) return -1;
+		m->data[i / 2] = (h << 4) | l;
+	}
+
+	return 0;
+}
+
+static int option(struct job *j, char *tok) {
+	char *val = strchr(tok, '=');
+	int64_t v;
+
+	if (!strcmp(tok, "rom")) {
+		j->rom = 1;
+		return 0;
+	}
+	if (!val) return -1;
+	val++;
+
+	if (!strncmp(tok, "m:", 2)) return expect_mem(j, tok, val);
+
+	for (int r = R_A; r <= R_PC; r++) {
+		size_t len = strlen(reg_names[r]);
+
+		if (strncmp(tok, reg_names[r], len) || tok[len] != '=') continue;
+		if ((v = number(val, (r == R_PC) ? 0xffff : 0xff)) < 0) return -1;
+		j->has |= 1 << r;
+		j->reg[r] = v;
+		return 0;
+	}
+
+	if (!strncmp(tok, "format=", 7)) {
+		if (!strcmp(val, "raw")) j->format = _6502_IMAGE_RAW;
+		else if (!strcmp(val, "prg")) j->format = _6502_IMAGE_PRG;
+		else if (!strcmp(val, "hex")) j->format = _6502_IMAGE_HEX;
+		else return -1;
+	} else if (!strncmp(tok, "load=", 5)) {
+		if ((j->load = number(val, 0xffff)) < 0) return -1;
+	} else if (!strncmp(tok, "entry=", 6)) {
+		if (!strcmp(val, "reset")) j->entry = _6502_START_VECTOR;
+		else if ((j->entry = number(val, 0xffff)) < 0) return -1;
+		j->has_entry = 1;
+	} else if (!strncmp(tok, "cpu=", 4)) {
+		for (j->cpu = 0; j->cpu < (int) (sizeof(cpu_names) / sizeof(cpu_names[0])) && strcmp(val, cpu_names[j->cpu]); j->cpu++);
+		if (j->cpu == sizeof(cpu_names) / sizeof(cpu_names[0])) return -1;
+	} else if (!strncmp(tok, "name=", 5)) {
+		if (!*val || !(j->name = strdup(val))) return -1;
+	} else if (!strncmp(tok, "limit=", 6)) {
+		if ((v = number(val, INT64_MAX)) <= 0) return -1;
+		j->limit = v;
+	} else if (!strncmp(tok, "stop=", 5)) {
+		if (!strcmp(val, "stuck")) j->stop = STOP_STUCK;
+		else if (!strncmp(val, "instr:", 6) && (v = number(val + 6, INT64_MAX)) >= 0) j->stop = STOP_INSTR, j->until = v;
+		else if (!strncmp(val, "cycles:", 7) && (v = number(val + 7, INT64_MAX)) >= 0) j->stop = STOP_CYCLES, j->until = v;
+		else if (!strncmp(val, "pc:", 3) && (v = number(val + 3, 0xffff)) >= 0) j->stop = STOP_PC, j->until = v;
+		else return -1;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+//image paths are relative to the manifest
+static char *image_path(const char *manifest, const char *image) {
+	const char *slash = strrchr(manifest, '/');
+	size_t dir = (slash && image[0] != '/') ? (size_t) (slash - manifest + 1) : 0;
+	char *path = malloc(dir + strlen(image) + 1);
+
+	if (path) {
+		memcpy(path, manifest, dir);
+		strcpy(path + dir, image);
+	}
+
+	return path;
+}
+
+static int manifest(const char *path, uint64_t limit) {
+	FILE *fp = fopen(path, "r");
+	char *line = NULL, *image = NULL, *save;
+	size_t cap = 0, size = 0;
+	int lineno = 0;
+
+	if (fp == NULL) {
+		fprintf(stderr, "can't read %s\n", path);
+		return -1;
+	}
+
+	while (getline(&line, &cap, fp) != -1) {
+		char *tok = strtok_r(line, " \t\r\n", &save);
+		struct job *j;
+
+		lineno++;
+		if (!tok || *tok == '#') continue;
+
+		if ((size_t) njobs == size) {
+			size = size ? size * 2 : 256;
+			if (!(j = realloc(jobs, size * sizeof(*j)))) goto bad;
+			jobs = j;
+		}
+
+		j = &jobs[njobs++];
+		*j = (struct job) {.format = -1, .cpu = -1, .load = PRG_START, .limit = limit};
+		if (!(j->path = image_path(path, tok)) || !(image = strdup(tok))) goto bad;
+
+		while ((tok = strtok_r(NULL, " \t\r\n", &save)))
+			if (option(j, tok)) goto bad;
+
+		//named after the image unless name= says otherwise
+		if (j->name) free(image);
+		else j->name = image;
+		image = NULL;
+	}
+
+	free(line);
+	fclose(fp);
+	return 0;
+
+	bad:
+	fprintf(stderr, "%s:%d: malformed job\n", path, lineno);
+	free(image);
+	free(line);
+	fclose(fp);
+	return -1;
+}
+
+
+
+//until the job's stop condition, or the limit: 0 if it got there
+static int execute(cpu6502_t *cpu, const struct job *j, uint64_t *n) {
+	uint64_t limit = (j->stop == STOP_INSTR && j->until < j->limit) ? j->until : j->limit;
+
+	*n = 0;
+
+	switch (j->stop) {
+		case STOP_STUCK:
+			while (*n < limit) {
+				*n += _6502_run(cpu, limit - *n);
+				if (cpu->stop == _6502_STOP_STUCK) return 0;
+			}
+			return -1;
+
+		case STOP_INSTR:
+			while (*n < limit) {
+				*n += _6502_run(cpu, limit - *n);
+				if (cpu->stop == _6502_STOP_STUCK && *n < limit) {
+					//nothing changes there but the cycles: one more pass to count them, then the rest at once
+					uint64_t c = cpu->cycles;
+
+					*n += _6502_run(cpu, 1);
+					if (cpu->stop != _6502_STOP_STUCK) continue;
+					cpu->cycles += (limit - *n) * (cpu->cycles - c);
+					*n = limit;
+				}
+			}
+			return (*n == j->until) ? 0 : -1;
+
+		case STOP_CYCLES:
+			//a program parked in a loop skips straight to the target
+			_6502_idle(cpu, _6502_IDLE_MEM);
+			while (cpu->cycles < j->until && *n < limit)
+				*n += _6502_run_until(cpu, j->until);
+			return (cpu->cycles >= j->until) ? 0 : -1;
+
+		case STOP_PC:
+			if (_6502_watch(cpu, j->until, 1, _6502_WATCH_EXEC, 0)) return -1;
+			while (*n < limit) {
+				*n += _6502_run(cpu, limit - *n);
+				if (cpu->stop == _6502_STOP_BREAK) break;
+			}
+			_6502_unwatch_all(cpu);
+			return (cpu->stop == _6502_STOP_BREAK) ? 0 : -1;
+	}
+
+	return -1;
+}
+
+static void check(cpu6502_t *cpu, const struct job *j, struct result *r) {
+	for (int i = R_A; i <= R_PC; i++) {
+		if (!(j->has & (1 << i)) || r->reg[i] == j->reg[i]) continue;
+		snprintf(r->detail, sizeof(r->detail), "%s=0x%02x, expected 0x%02x", reg_names[i], r->reg[i], j->reg[i]);
+		r->status = ST_FAIL;
+		return;
+	}
+
+	for (int i = 0; i < j->nmem; i++) {
+		for (int k = 0; k < j->mem[i].len; k++) {
+			uint16_t a = j->mem[i].addr + k;
+			uint8_t x = cpu->rpage[a >> 8] ? cpu->rpage[a >> 8][a & 0xff] : 0;
+
+			if (x == j->mem[i].data[k]) continue;
+			snprintf(r->detail, sizeof(r->detail), "$%04x=0x%02x, expected 0x%02x", a, x, j->mem[i].data[k]);
+			r->status = ST_FAIL;
+			return;
+		}
+	}
+}
+
+static void job(struct worker *w, const struct job *j, struct result *r) {
+	cpu6502_t *cpu = &w->cpu;
+	_6502_image_t img;
+	int format = (j->format < 0) ? _6502_image_format(j->path) : j->format;
+	double t;
+
+	if (_6502_image_open(&img, j->path, format, j->load)) {
+		r->status = ST_ERROR;
+		snprintf(r->detail, sizeof(r->detail), "unreadable, malformed or not fitting in 64K");
+		return;
+	}
+
+	memset(w->ram, 0, sizeof(w->ram));
+	_6502_init(cpu, ram_read, ram_write, w->ram);
+	if (j->cpu >= 0 && _6502_variant(cpu, j->cpu)) {
+		r->status = ST_ERROR;
+		snprintf(r->detail, sizeof(r->detail), "cpu %s not compiled in", cpu_names[j->cpu]);
+		_6502_image_close(&img);
+		return;
+	}
+	_6502_map(cpu, 0, 256, w->ram, _6502_MAP_RAM);
+	_6502_image_load(cpu, &img, w->ram, j->rom ? _6502_MAP_ROM : _6502_MAP_RAM);
+
+	if (j->has_entry) cpu->start = j->entry;
+	else if (img.entry >= 0) cpu->start = img.entry;
+	_6502_reset(cpu);
+
+	if ((engine == ENGINE_CACHE && _6502_cache_enable(cpu)) || (engine == ENGINE_JIT && _6502_jit_enable(cpu)) || (engine == ENGINE_EXACT && _6502_exact(cpu, 1))) {
+		r->status = ST_ERROR;
+		snprintf(r->detail, sizeof(r->detail), "engine not available");
+		_6502_image_close(&img);
+		return;
+	}
+
+	uint64_t c0 = cpu->cycles;
+	t = now();
+	r->status = execute(cpu, j, &r->instr) ? ST_TIMEOUT : ST_PASS;
+	r->wall = now() - t;
+	r->cycles = cpu->cycles - c0;
+
+	r->reg[R_A] = cpu->A; r->reg[R_X] = cpu->X; r->reg[R_Y] = cpu->Y;
+	r->reg[R_SP] = cpu->SP; r->reg[R_P] = _6502_get_p(cpu); r->reg[R_PC] = cpu->PC;
+
+	if (r->status == ST_PASS) check(cpu, j, r);
+	else snprintf(r->detail, sizeof(r->detail), "no stop after %" PRIu64 " instructions", r->instr);
+
+	_6502_cache_disable(cpu);
+	_6502_image_close(&img);
+}
+
+
+
+//the next job of the worker's own range, else half of the biggest range left to steal (-1 = all done)
+static int take(struct worker *w) {
+	int k = -1, most = 0, lo = 0, hi = 0;
+	struct worker *v = NULL;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->lo < w->hi) k = w->lo++;
+	pthread_mutex_unlock(&w->lock);
+	if (k >= 0) return k;
+
+	//stealing is rare enough to look at every range under its lock, it may still be gone by the time it's taken
+	for (int i = 0; i < nworkers; i++) {
+		pthread_mutex_lock(&workers[i].lock);
+		if (workers[i].hi - workers[i].lo > most) most = workers[i].hi - workers[i].lo, v = &workers[i];
+		pthread_mutex_unlock(&workers[i].lock);
+	}
+
+	if (!v) return -1;
+
+	pthread_mutex_lock(&v->lock);
+	if (v->lo < v->hi) {
+		hi = v->hi;
+		k = v->hi - (v->hi - v->lo + 1) / 2;
+		lo = k + 1;
+		v->hi = k;
+	}
+	pthread_mutex_unlock(&v->lock);
+
+	//never both locks at once: two workers may be stealing from each other
+	pthread_mutex_lock(&w->lock);
+	w->lo = lo;
+	w->hi = hi;
+	pthread_mutex_unlock(&w->lock);
+
+	//someone else got there first: look again
+	return (k >= 0) ? k : take(w);
+}
+
+static void *work(void *arg) {
+	struct worker *w = arg;
+	int k;
+
+	while ((k = take(w)) >= 0)
+		job(w, &jobs[k], &results[k]);
+
+	return NULL;
+}
+
+
+
+//names and details as CSV fields
+static void csv_string(FILE *fp, const char *s) {
+	fputc('"', fp);
+	for (; *s; s++) {
+		if (*s == '"') fputc('"', fp);
+		fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+//and as JSON strings
+static void json_string(FILE *fp, const char *s) {
+	fputc('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') fprintf(fp, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20) fprintf(fp, "\\u%04x", *s);
+		else fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+static void report(FILE *fp, int fmt) {
+	if (fmt == FMT_CSV)
+		fprintf(fp, "job,status,instr,cycles,wall_s,pc,a,x,y,sp,p,detail\n");
+	else
+		fprintf(fp, "[\n");
+
+	for (int i = 0; i < njobs; i++) {
+		const struct result *r = &results[i];
+
+		if (fmt == FMT_CSV) {
+			csv_string(fp, jobs[i].name);
+			fprintf(fp, ",%s,%" PRIu64 ",%" PRIu64 ",%.6f,%u,%u,%u,%u,%u,%u,", status_names[r->status], r->instr, r->cycles,
+				r->wall, r->reg[R_PC], r->reg[R_A], r->reg[R_X], r->reg[R_Y], r->reg[R_SP], r->reg[R_P]);
+			csv_string(fp, r->detail);
+			fputc('\n', fp);
+			continue;
+		}
+
+		fprintf(fp, "%s\t{\"job\": ", i ? ",\n" : "");
+		json_string(fp, jobs[i].name);
+		fprintf(fp, ", \"status\": \"%s\", \"instr\": %" PRIu64 ", \"cycles\": %" PRIu64 ", \"wall_s\": %.6f, "
+			"\"pc\": %u, \"a\": %u, \"x\": %u, \"y\": %u, \"sp\": %u, \"p\": %u, \"detail\": ", status_names[r->status], r->instr, r->cycles,
+			r->wall, r->reg[R_PC], r->reg[R_A], r->reg[R_X], r->reg[R_Y], r->reg[R_SP], r->reg[R_P]);
+		json_string(fp, r->detail);
+		fprintf(fp, "}");
+	}
+
+	if (fmt == FMT_JSON) fprintf(fp, "\n]\n");
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"usage: %s [-j workers] [-n limit] [-e run|cache|jit|exact] [-f json|csv] [-o results] manifest\n"
+		"\t-j\tworker threads, one context each (default: one per online cpu)\n"
+		"\t-n\tinstructions before a job without its own limit= times out (default %llu)\n"
+		"\t-e\tengine: _6502_run, the block cache or JIT on top of it, or the cycle-exact engine\n"
+		"\t-f\tresults format (default json)\n"
+		"\t-o\tresults file (default stdout)\n",
+		argv0, DEF_LIMIT);
+}
+
+int main(int argc, char **argv) {
+	uint64_t limit = DEF_LIMIT;
+	int fmt = FMT_JSON, opt, count[4] = {0};
+	const char *out = NULL;
+	FILE *fp = stdout;
+	double t;
+
+	nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "j:n:e:f:o:")) != -1) {
+		switch (opt) {
+			case 'j': nworkers = atoi(optarg); break;
+			case 'n': limit = strtoull(optarg, NULL, 0); break;
+			case 'e':
+				engine = !strcmp(optarg, "cache") ? ENGINE_CACHE : !strcmp(optarg, "jit") ? ENGINE_JIT : !strcmp(optarg, "exact") ? ENGINE_EXACT : ENGINE_RUN;
+				break;
+			case 'f': fmt = !strcmp(optarg, "csv") ? FMT_CSV : FMT_JSON; break;
+			case 'o': out = optarg; break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind + 1 != argc || nworkers < 1 || !limit) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (nworkers > MAX_WORKERS) nworkers = MAX_WORKERS;
+
+	if (manifest(argv[optind], limit)) return 1;
+	if (nworkers > njobs) nworkers = njobs ? njobs : 1;
+
+	results = aligned_alloc(64, (njobs ? njobs : 1) * sizeof(*results));
+	workers = calloc(nworkers, sizeof(*workers));
+	if (!results || !workers) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	memset(results, 0, njobs * sizeof(*results));
+
+	//contiguous ranges to start with, stolen from each other from then on
+	t = now();
+	for (int i = 0; i < nworkers; i++) {
+		workers[i].lo = (int) ((int64_t) njobs * i / nworkers);
+		workers[i].hi = (int) ((int64_t) njobs * (i + 1) / nworkers);
+		pthread_mutex_init(&workers[i].lock, NULL);
+	}
+	for (int i = 0; i < nworkers; i++) {
+		if (pthread_create(&workers[i].thread, NULL, work, &workers[i])) {
+			fprintf(stderr, "can't start worker %d\n", i);
+			return 1;
+		}
+	}
+	for (int i = 0; i < nworkers; i++)
+		pthread_join(workers[i].thread, NULL);
+	t = now() - t;
+
+	if (out && !(fp = fopen(out, "w"))) {
+		fprintf(stderr, "can't write %s\n", out);
+		return 1;
+	}
+	report(fp, fmt);
+	if (fp != stdout) fclose(fp);
+
+	for (int i = 0; i < njobs; i++)
+		count[results[i].status]++;
+	fprintf(stderr, "%d jobs: %d passed, %d failed, %d timed out, %d errors, %.3f s on %d workers\n",
+		njobs, count[ST_PASS], count[ST_FAIL], count[ST_TIMEOUT], count[ST_ERROR], t, nworkers);
+
+	return (count[ST_PASS] == njobs) ? 0 : 1;
+}
\ No newline at end of file
@@ -9,155 +9,170 @@
 
 
 
+#include <stdatomic.h>
+#include <stddef.h>
+
 #include "6502.h"
+#include "6502_ops.h"
+
 
 
+//#define FETCH					data = _6502_read(addr)
 
-#define BIT_O(bit)				(1 << (bit))
+//every function below receives the context as 'cpu', these keep the code readable
+#define _PC						(cpu->PC)
+#define _A						(cpu->A)
+#define _X						(cpu->X)
+#define _Y						(cpu->Y)
+#define _SP						(cpu->SP)
+#define _IR						(cpu->IR)
+#define _P						(cpu->P)
+#define _NZ						(cpu->nz) //N and Z, lazily (see cpu6502_t)
 
-#define AM_IMP					0
-#define AM_IMM					1
-#define AM_ZP0					2
-#define AM_ZPX					3
-#define AM_ZPY					4
-#define AM_ABS					5
-#define AM_ABX					6
-#define AM_ABY					7
-#define AM_IND					8
-#define AM_INX					9
-#define AM_INY					10
+#define _6502_read(a)			bus_rd(cpu, (a))
+#define _6502_write(a, x)		bus_write(cpu, (a), (x))
 
-//#define FETCH					data = _6502_read(addr)
+//default context for the legacy api (see 6502.h)
+cpu6502_t _6502_cpu = {.start = (_6502_RESET_ON_START) ? _6502_START_VECTOR : _6502_START_ADDRESS, .variant = _6502_CPU};
 
-//registers (extern)
-uint16_t _PC;
-uint8_t _A, _X, _Y, _SP, _IR; //'ir' could actually be local
-cpu_s_t _P;
 
-//local variables
-uint16_t addr;
-uint8_t data, fetch;
 
+#ifdef _6502_BUS
+uint8_t __6502_bus_read(void *user, uint16_t a) {return _6502_BUS_READ(user, a);}
+void __6502_bus_write(void *user, uint16_t a, uint8_t x) {_6502_BUS_WRITE(user, a, x);}
+#endif
 
+static void bus_write(cpu6502_t *cpu, uint16_t a, uint8_t x) {
+	bus_wr(cpu, a, x);
+	if (cpu->cache) _6502_cache_written(cpu->cache, a);
+}
 
-static uint16_t get_w(uint16_t a) {
+static uint16_t get_w(cpu6502_t *cpu, uint16_t a) {
 	return _6502_read(a) | (_6502_read(a+1) << 8);
 }
 
-static void pushc(uint8_t x) {
+static uint16_t get_zw(cpu6502_t *cpu, uint8_t a) { //a zero page pointer, whose high byte wraps to $00
+	return _6502_read(a) | (_6502_read((uint8_t) (a+1)) << 8);
+}
+
+static void pushc(cpu6502_t *cpu, uint8_t x) {
 	_6502_write(__6502_STACK_BOTTOM + (_SP--), x);
 }
 
-static uint8_t pullc() {
+static uint8_t pullc(cpu6502_t *cpu) {
 	return _6502_read(__6502_STACK_BOTTOM + (++_SP));
 }
 
-static void pushpc() {
-	pushc(_PC >> 8);
-	pushc(_PC);
+static void pushpc(cpu6502_t *cpu) {
+	pushc(cpu, _PC >> 8);
+	pushc(cpu, _PC);
 }
 
-static uint16_t pullpc() {
-	return pullc() | (pullc() << 8);
+static uint16_t pullpc(cpu6502_t *cpu) {
+	return pullc(cpu) | (pullc(cpu) << 8);
 }
 
-static void interr(uint16_t vct, uint8_t st) {
-	pushpc();
-	pushc(st);
+static void interr(cpu6502_t *cpu, uint16_t vct, uint8_t st) {
+	pushpc(cpu);
+	pushc(cpu, st);
 
 	_P.flags.i = 1;
-	_PC = get_w(vct);
+	if (cpu->variant >= _6502_CPU_65C02) _P.flags.d = 0;
+	_PC = get_w(cpu, vct);
 }
 
 
 
-static void w2a(uint8_t x) {_A = x;}
-static void w2b(uint8_t x) {_6502_write(addr, x);}
-void (*busora[2])(uint8_t x) = {w2a, w2b}; //bypassing some branches by using this evil jump table
+static void w2a(cpu6502_t *cpu, uint8_t x) {_A = x;}
+static void w2b(cpu6502_t *cpu, uint8_t x) {_6502_write(cpu->addr, x);}
+static void (*const busora[2])(cpu6502_t *cpu, uint8_t x) = {w2a, w2b}; //bypassing some branches by using this evil jump table
 
 
 
 //addressing mode functions (relative is equal to immediate (we differentiate in the operative functions))
-static void A_imp() {
-	data = _A;
+static void A_imp(cpu6502_t *cpu) {
+	cpu->data = _A;
 }
 
-static void A_imm() {
-	addr = _PC++;
-	//data = _6502_read((addr = _PC++));
-	//addr = _PC++;
+static void A_imm(cpu6502_t *cpu) {
+	cpu->addr = _PC++;
+	//cpu->data = _6502_read((cpu->addr = _PC++));
+	//cpu->addr = _PC++;
 	//FETCH;
 }
 
-static void A_zp0() {
-	addr = _6502_read(_PC++);
-	//data = _6502_read((addr = _6502_read(_PC++)));
-	//addr = _6502_read(_PC++);
+static void A_zp0(cpu6502_t *cpu) {
+	cpu->addr = _6502_read(_PC++);
+	//cpu->data = _6502_read((cpu->addr = _6502_read(_PC++)));
+	//cpu->addr = _6502_read(_PC++);
 	//FETCH;
 }
 
-static void A_zpx() {
-	addr = (_6502_read(_PC++) + _X) & 0xff;
-	//data = _6502_read((addr = (_6502_read(_PC++) + _X) & 0xff));
-	//addr = (_6502_read(_PC++) + _X) & 0xff;
+static void A_zpx(cpu6502_t *cpu) {
+	cpu->addr = (_6502_read(_PC++) + _X) & 0xff;
+	//cpu->data = _6502_read((cpu->addr = (_6502_read(_PC++) + _X) & 0xff));
+	//cpu->addr = (_6502_read(_PC++) + _X) & 0xff;
 	//FETCH;
 }
 
-static void A_zpy() {
-	addr = (_6502_read(_PC++) + _Y) & 0xff;
-	//data = _6502_read((addr = (_6502_read(_PC++) + _Y) & 0xff));
-	//addr = (_6502_read(_PC++) + _Y) & 0xff;
+static void A_zpy(cpu6502_t *cpu) {
+	cpu->addr = (_6502_read(_PC++) + _Y) & 0xff;
+	//cpu->data = _6502_read((cpu->addr = (_6502_read(_PC++) + _Y) & 0xff));
+	//cpu->addr = (_6502_read(_PC++) + _Y) & 0xff;
 	//FETCH;
 }
 
-static void A_abs() {
-	addr = get_w(_PC++);
-	//data = _6502_read((addr = get_w(_PC++))); //basically we read from the ppu even if we don't, because this function will serve the store istrunctions, and it doesn't want it. You could add a flag in the instruction struct, which determines where to fetch from address or from instruction.
-	//addr = get_w(_PC++);
+static void A_abs(cpu6502_t *cpu) {
+	cpu->addr = get_w(cpu, _PC++);
+	//cpu->data = _6502_read((cpu->addr = get_w(cpu, _PC++))); //basically we read from the ppu even if we don't, because this function will serve the store istrunctions, and it doesn't want it. You could add a flag in the instruction struct, which determines where to fetch from address or from instruction.
+	//cpu->addr = get_w(cpu, _PC++);
 	_PC++;
 	//FETCH;
 }
 
-static void A_abx() {
-	addr = get_w(_PC++) + _X;
-	//data = _6502_read((addr = get_w(_PC++) + _X));
-	//addr = get_w(_PC++) + _X;
+static void A_abx(cpu6502_t *cpu) {
+	cpu->addr = get_w(cpu, _PC++) + _X;
+	cpu->cycles += i_jtable[_IR].page & ((cpu->addr & 0xff) < _X);
+	//cpu->data = _6502_read((cpu->addr = get_w(cpu, _PC++) + _X));
+	//cpu->addr = get_w(cpu, _PC++) + _X;
 	_PC++;
 	//FETCH;
 }
 
-static void A_aby() {
-	addr = get_w(_PC++) + _Y;
-	//data = _6502_read((addr = get_w(_PC++) + _Y));
-	//addr = get_w(_PC++) + _Y;
+static void A_aby(cpu6502_t *cpu) {
+	cpu->addr = get_w(cpu, _PC++) + _Y;
+	cpu->cycles += i_jtable[_IR].page & ((cpu->addr & 0xff) < _Y);
+	//cpu->data = _6502_read((cpu->addr = get_w(cpu, _PC++) + _Y));
+	//cpu->addr = get_w(cpu, _PC++) + _Y;
 	_PC++;
 	//FETCH;
 }
 
-static void A_ind() {
-	addr = get_w(_PC++); //reusing
-	uint8_t x = ((addr & 0xff) == 0xff) - 1;
+static void A_ind(cpu6502_t *cpu) {
+	cpu->addr = get_w(cpu, _PC++); //reusing
+	uint8_t x = ((cpu->addr & 0xff) == 0xff) - 1;
 	_PC++;
 
-	addr = _6502_read(addr) | (_6502_read((addr & 0xff00 & ~x) | ((addr+1) & x)) << 8);
-	//data = _6502_read((addr = _6502_read(addr) | (_6502_read((addr & 0xff00 & ~data) | ((addr+1) & data)) << 8)));
+	cpu->addr = _6502_read(cpu->addr) | (_6502_read((cpu->addr & 0xff00 & ~x) | ((cpu->addr+1) & x)) << 8);
+	//cpu->data = _6502_read((cpu->addr = _6502_read(cpu->addr) | (_6502_read((cpu->addr & 0xff00 & ~cpu->data) | ((cpu->addr+1) & cpu->data)) << 8)));
 }
 
-static void A_inx() {
-	addr = get_w((_6502_read(_PC++) + _X) & 0xff);
-	//data = _6502_read((addr = get_w((_6502_read(_PC++) + _X) & 0xff)));
-	//addr = get_w((_6502_read(_PC++) + _X) & 0xff);
+static void A_inx(cpu6502_t *cpu) {
+	cpu->addr = get_zw(cpu, _6502_read(_PC++) + _X);
+	//cpu->data = _6502_read((cpu->addr = get_w(cpu, (_6502_read(_PC++) + _X) & 0xff)));
+	//cpu->addr = get_w(cpu, (_6502_read(_PC++) + _X) & 0xff);
 	//FETCH;
 }
 
-static void A_iny() {
-	addr = get_w(_6502_read(_PC++)) + _Y;
-	//data = _6502_read((addr = get_w(_6502_read(_PC++)) + _Y));
-	//addr = get_w(_6502_read(_PC++)) + _Y;
+static void A_iny(cpu6502_t *cpu) {
+	cpu->addr = get_zw(cpu, _6502_read(_PC++)) + _Y;
+	cpu->cycles += i_jtable[_IR].page & ((cpu->addr & 0xff) < _Y);
+	//cpu->data = _6502_read((cpu->addr = get_w(cpu, _6502_read(_PC++)) + _Y));
+	//cpu->addr = get_w(cpu, _6502_read(_PC++)) + _Y;
 	//FETCH;
 }
 
-void (*A_funcs[])() = { //addressing modes jump-table
+static void (*const A_funcs[])(cpu6502_t *cpu) = { //addressing modes jump-table
 	A_imp,
 	A_imm,
 	A_zp0,
@@ -175,440 +190,434 @@ void (*A_funcs[])() = { //addressing modes jump-table
 
 //operative functions
 //load/store operations
-static void I_lda() {
+static void I_lda(cpu6502_t *cpu) {
 	//FETCH;
-	_A = data;
+	_A = cpu->data;
 
-	_P.flags.z = !_A;
-	_P.flags.n = (_A & BIT_O(7)) > 0;
+	_NZ = _A;
 }
 
-static void I_ldx() {
+static void I_ldx(cpu6502_t *cpu) {
 	//FETCH;
-	_X = data;
+	_X = cpu->data;
 
-	_P.flags.z = !_X;
-	_P.flags.n = (_X & BIT_O(7)) > 0;
+	_NZ = _X;
 }
 
-static void I_ldy() {
+static void I_ldy(cpu6502_t *cpu) {
 	//FETCH;
-	_Y = data;
+	_Y = cpu->data;
 
-	_P.flags.z = !_Y;
-	_P.flags.n = (_Y & BIT_O(7)) > 0;
+	_NZ = _Y;
 }
 
-static void I_sta() {
-	_6502_write(addr, _A);
+static void I_sta(cpu6502_t *cpu) {
+	_6502_write(cpu->addr, _A);
 }
 
-static void I_stx() {
-	_6502_write(addr, _X);
+static void I_stx(cpu6502_t *cpu) {
+	_6502_write(cpu->addr, _X);
 }
 
-static void I_sty() {
-	_6502_write(addr, _Y);
+static void I_sty(cpu6502_t *cpu) {
+	_6502_write(cpu->addr, _Y);
 }
 
 
 
 //register transfers operations
-static void I_tax() {
+static void I_tax(cpu6502_t *cpu) {
 	_X = _A;
 
-	_P.flags.z = !_X;
-	_P.flags.n = (_X & BIT_O(7)) > 0;
+	_NZ = _X;
 }
 
-static void I_tay() {
+static void I_tay(cpu6502_t *cpu) {
 	_Y = _A;
 
-	_P.flags.z = !_Y;
-	_P.flags.n = (_Y & BIT_O(7)) > 0;
+	_NZ = _Y;
 }
 
-static void I_txa() {
+static void I_txa(cpu6502_t *cpu) {
 	_A = _X;
 
-	_P.flags.z = !_A;
-	_P.flags.n = (_A & BIT_O(7)) > 0;
+	_NZ = _A;
 }
 
-static void I_tya() {
+static void I_tya(cpu6502_t *cpu) {
 	_A = _Y;
 
-	_P.flags.z = !_A;
-	_P.flags.n = (_A & BIT_O(7)) > 0;
+	_NZ = _A;
 }
 
-static void I_tsx() {
+static void I_tsx(cpu6502_t *cpu) {
 	_X = _SP;
 
-	_P.flags.z = !_X;
-	_P.flags.n = (_X & BIT_O(7)) > 0;
+	_NZ = _X;
 }
 
-static void I_txs() {
+static void I_txs(cpu6502_t *cpu) {
 	_SP = _X;
 }
 
 
 
 //stack pushing/pulling operations
-static void I_pha() {
-	pushc(_A);
+static void I_pha(cpu6502_t *cpu) {
+	pushc(cpu, _A);
 }
 
-static void I_php() {
-	pushc(_P._raw);
+static void I_php(cpu6502_t *cpu) {
+	pushc(cpu, _6502_get_p(cpu));
 }
 
-static void I_pla() {
-	_A = pullc();
+static void I_pla(cpu6502_t *cpu) {
+	_A = pullc(cpu);
 
-	_P.flags.z = !_A;
-	_P.flags.n = (_A & BIT_O(7)) > 0;
+	_NZ = _A;
 }
 
-static void I_plp() {
-	_P._raw = pullc() | 0x30;
+static void I_plp(cpu6502_t *cpu) {
+	_6502_set_p(cpu, pullc(cpu));
 }
 
 
 
 //logical operations
-static void I_and() {
+static void I_and(cpu6502_t *cpu) {
 	//FETCH;
-	_A &= data;
+	_A &= cpu->data;
 
-	_P.flags.z = !_A;
-	_P.flags.n = (_A & BIT_O(7)) > 0;
+	_NZ = _A;
 }
 
-static void I_ora() {
+static void I_ora(cpu6502_t *cpu) {
 	//FETCH;
-	_A |= data;
+	_A |= cpu->data;
 
-	_P.flags.z = !_A;
-	_P.flags.n = (_A & BIT_O(7)) > 0;
+	_NZ = _A;
 }
 
-static void I_eor() {
+static void I_eor(cpu6502_t *cpu) {
 	//FETCH;
-	_A ^= data;
+	_A ^= cpu->data;
 
-	_P.flags.z = !_A;
-	_P.flags.n = (_A & BIT_O(7)) > 0;
+	_NZ = _A;
 }
 
-static void I_bit() {
+static void I_bit(cpu6502_t *cpu) {
 	//FETCH;
 
-	_P.flags.z = !(_A & data & 0xff);
-	_P.flags.v = (data & BIT_O(6)) > 0;
-	_P.flags.n = (data & BIT_O(7)) > 0;
+	_NZ = (_A & cpu->data) | ((cpu->data & BIT_O(7)) << 8); //z from the and, n from memory
+	_P.flags.v = (cpu->data & BIT_O(6)) > 0;
 }
 
 
 
 //arithmetic operations
-static void I_adc() {
+//decimal mode, through the tables (see _6502_bcd_init)
+static void bcd(cpu6502_t *cpu, const uint16_t *tab) {
+	uint16_t r = tab[(_P.flags.c << 16) | (_A << 8) | cpu->data];
+
+	_A = r;
+	_P.flags.c = (r >> 8) & 1;
+	_P.flags.v = (r >> 14) & 1;
+	_NZ = (((r >> 8) & 0x80) << 8) | !(r & 0x200);
+}
+
+static void I_adc(cpu6502_t *cpu) {
 	//FETCH;
+	if (_P.flags.d) {
+		bcd(cpu, _6502_bcd_adc);
+		return;
+	}
 
-	addr = _A + data + _P.flags.c;
+	cpu->addr = _A + cpu->data + _P.flags.c;
 
-	_P.flags.c = addr > 0xff;
-	addr &= 0xff;
+	_P.flags.c = cpu->addr > 0xff;
+	cpu->addr &= 0xff;
 
-	_P.flags.z = !addr;
-	_P.flags.v = ((_A ^ addr) & (data ^ addr) & BIT_O(7)) > 0;
-	_P.flags.n = (addr & BIT_O(7)) > 0;
+	_NZ = cpu->addr;
+	_P.flags.v = ((_A ^ cpu->addr) & (cpu->data ^ cpu->addr) & BIT_O(7)) > 0;
 
-	_A = addr;
+	_A = cpu->addr;
 }
 
-static void I_sbc() {
+static void I_sbc(cpu6502_t *cpu) {
 	//FETCH;
-	data = ~data;
-	addr = _A + data + _P.flags.c;
+	if (_P.flags.d) {
+		bcd(cpu, _6502_bcd_sbc);
+		return;
+	}
 
-	_P.flags.c = addr > 0xff;
-	addr &= 0xff;
+	cpu->data = ~cpu->data;
+	cpu->addr = _A + cpu->data + _P.flags.c;
 
-	_P.flags.z = !addr;
-	_P.flags.v = ((_A ^ addr) & (data ^ addr) & BIT_O(7)) > 0;
-	_P.flags.n = (addr & BIT_O(7)) > 0;
+	_P.flags.c = cpu->addr > 0xff;
+	cpu->addr &= 0xff;
 
-	_A = addr;
+	_NZ = cpu->addr;
+	_P.flags.v = ((_A ^ cpu->addr) & (cpu->data ^ cpu->addr) & BIT_O(7)) > 0;
+
+	_A = cpu->addr;
 }
 
-static void I_cmp() {
+static void I_cmp(cpu6502_t *cpu) {
 	//FETCH;
-	_P.flags.c = _A >= data;
+	_P.flags.c = _A >= cpu->data;
 
-	data = _A - data;
+	cpu->data = _A - cpu->data;
 
-	_P.flags.z = !data;
-	_P.flags.n = (data & BIT_O(7)) > 0;
+	_NZ = cpu->data;
 }
 
-static void I_cpx() {
+static void I_cpx(cpu6502_t *cpu) {
 	//FETCH;
-	_P.flags.c = _X >= data;
+	_P.flags.c = _X >= cpu->data;
 
-	data = _X - data;
+	cpu->data = _X - cpu->data;
 
-	_P.flags.z = !data;
-	_P.flags.n = (data & BIT_O(7)) > 0;
+	_NZ = cpu->data;
 }
 
-static void I_cpy() {
+static void I_cpy(cpu6502_t *cpu) {
 	//FETCH;
-	_P.flags.c = _Y >= data;
+	_P.flags.c = _Y >= cpu->data;
 
-	data = _Y - data;
+	cpu->data = _Y - cpu->data;
 
-	_P.flags.z = !data;
-	_P.flags.n = (data & BIT_O(7)) > 0;
+	_NZ = cpu->data;
 }
 
 
 
 //increment/decrement
-static void I_inc() {
+static void I_inc(cpu6502_t *cpu) {
 	//FETCH;
-	_6502_write(addr, ++data);
+	_6502_write(cpu->addr, ++cpu->data);
 
-	_P.flags.z = !data;
-	_P.flags.n = (data & BIT_O(7)) > 0;
+	_NZ = cpu->data;
 }
 
-static void I_inx() {
-	_P.flags.z = !(++_X);
-	_P.flags.n = (_X & BIT_O(7)) > 0;
+static void I_inx(cpu6502_t *cpu) {
+	_NZ = ++_X;
 }
 
-static void I_iny() {
-	_P.flags.z = !(++_Y);
-	_P.flags.n = (_Y & BIT_O(7)) > 0;
+static void I_iny(cpu6502_t *cpu) {
+	_NZ = ++_Y;
 }
 
-static void I_dec() {
+static void I_dec(cpu6502_t *cpu) {
 	//FETCH;
-	_6502_write(addr, --data);
+	_6502_write(cpu->addr, --cpu->data);
 
-	_P.flags.z = !data;
-	_P.flags.n = (data & BIT_O(7)) > 0;
+	_NZ = cpu->data;
 }
 
-static void I_dex() {
-	_P.flags.z = !(--_X);
-	_P.flags.n = (_X & BIT_O(7)) > 0;
+static void I_dex(cpu6502_t *cpu) {
+	_NZ = --_X;
 }
 
-static void I_dey() {
-	_P.flags.z = !(--_Y);
-	_P.flags.n = (_Y & BIT_O(7)) > 0;
+static void I_dey(cpu6502_t *cpu) {
+	_NZ = --_Y;
 }
 
 
 
 //shift operations
-static void I_asl() {
+static void I_asl(cpu6502_t *cpu) {
 	////FETCH;
-	_P.flags.c = (data & BIT_O(7)) > 0;
-	_P.flags.n = (data & BIT_O(6)) > 0;
+	_P.flags.c = (cpu->data & BIT_O(7)) > 0;
 
 	//SDL_Log("%d\n", amode);
-	data <<= 1;
-	_P.flags.z = !data;
+	cpu->data <<= 1;
+	_NZ = cpu->data;
 
-	busora[fetch](data);
+	busora[cpu->fetch](cpu, cpu->data);
 }
 
-static void I_lsr() {
+static void I_lsr(cpu6502_t *cpu) {
 	//FETCH;
-	_P.flags.c = data & 0x1;
+	_P.flags.c = cpu->data & 0x1;
 
-	data >>= 1;
+	cpu->data >>= 1;
 
-	_P.flags.z = !data;
-	_P.flags.n = 0;//(data & BIT_O(7)) > 0; always equal to 0
+	_NZ = cpu->data; //n always ends up 0
 
-	busora[fetch](data);
+	busora[cpu->fetch](cpu, cpu->data);
 }
 
-static void I_rol() {
+static void I_rol(cpu6502_t *cpu) {
 	//FETCH;
 
 	_P.flags.u = _P.flags.c; //using unused flag only for internal scopes. Gets resetted back once finished
-	_P.flags.c = (data & BIT_O(7)) > 0;
+	_P.flags.c = (cpu->data & BIT_O(7)) > 0;
 
-	data = (data << 1) | _P.flags.u;
+	cpu->data = (cpu->data << 1) | _P.flags.u;
 	_P.flags.u = 1;
 
-	_P.flags.z = !data;
-	_P.flags.n = (data & BIT_O(7)) > 0;
+	_NZ = cpu->data;
 
-	busora[fetch](data);
+	busora[cpu->fetch](cpu, cpu->data);
 }
 
-static void I_ror() {
+static void I_ror(cpu6502_t *cpu) {
 	//FETCH;
 
 	_P.flags.u = _P.flags.c; //using unused flag only for internal scopes. Gets resetted back once finished
-	_P.flags.c = data & 0x1;
+	_P.flags.c = cpu->data & 0x1;
 
-	data = (data >> 1) | (_P.flags.u << 7);
+	cpu->data = (cpu->data >> 1) | (_P.flags.u << 7);
 	_P.flags.u = 1;
 
-	_P.flags.z = !data;
-	_P.flags.n = (data & BIT_O(7)) > 0;
+	_NZ = cpu->data;
 
-	busora[fetch](data);
+	busora[cpu->fetch](cpu, cpu->data);
 }
 
 
 
 //jumps & calls
-static void I_jmp() {
-	_PC = addr;
+static void I_jmp(cpu6502_t *cpu) {
+	_PC = cpu->addr;
 }
 
-static void I_jsr() {
+static void I_jsr(cpu6502_t *cpu) {
 	_PC--;
-	pushpc();
-	_PC = addr;
+	pushpc(cpu);
+	_PC = cpu->addr;
 }
 
-static void I_rts() {
-	_PC = pullpc() + 1;
+static void I_rts(cpu6502_t *cpu) {
+	_PC = pullpc(cpu) + 1;
 }
 
 
 
 //branch operations
-#define BR(C)				addr + 1 + ((char) data & (C-1))
+//taken branches cost one more cycle, and another one if they land on a different page
+static uint16_t br(cpu6502_t *cpu, uint8_t c) {
+	uint16_t pc = cpu->addr + 1, to = pc + ((char) cpu->data & (c-1));
 
-//note that the condition given to the macro must be the condition for the negative case.
-static void I_bcc() {
+	cpu->cycles += !c + ((pc ^ to) > 0xff);
+	return to;
+}
+
+//note that the condition given to br() must be the condition for the negative case.
+static void I_bcc(cpu6502_t *cpu) {
 	//FETCH;
-	_PC = BR(_P.flags.c); //for example, here we won't branch only if carry is set.
+	_PC = br(cpu, _P.flags.c); //for example, here we won't branch only if carry is set.
 }
 
-static void I_bcs() {
+static void I_bcs(cpu6502_t *cpu) {
 	//FETCH;
-	_PC = BR(!_P.flags.c);
+	_PC = br(cpu, !_P.flags.c);
 }
 
-static void I_bne() {
+static void I_bne(cpu6502_t *cpu) {
 	//FETCH;
-	_PC = BR(_P.flags.z);
+	_PC = br(cpu, LZ(_NZ));
 }
 
-static void I_beq() {
+static void I_beq(cpu6502_t *cpu) {
 	//FETCH;
 	//SDL_Log("%04x\n", _PC);
-	_PC = BR(!_P.flags.z);
+	_PC = br(cpu, !LZ(_NZ));
 	//SDL_Log("%04x\n", _PC);
 }
 
-static void I_bpl() {
+static void I_bpl(cpu6502_t *cpu) {
 	//FETCH;
-	_PC = BR(_P.flags.n);
+	_PC = br(cpu, LN(_NZ));
 }
 
-static void I_bmi() {
+static void I_bmi(cpu6502_t *cpu) {
 	//FETCH;
-	_PC = BR(!_P.flags.n);
+	_PC = br(cpu, !LN(_NZ));
 }
 
-static void I_bvc() {
+static void I_bvc(cpu6502_t *cpu) {
 	//FETCH;
-	_PC = BR(_P.flags.v);
+	_PC = br(cpu, _P.flags.v);
 }
 
-static void I_bvs() {
+static void I_bvs(cpu6502_t *cpu) {
 	//FETCH;
-	_PC = BR(!_P.flags.v);
+	_PC = br(cpu, !_P.flags.v);
 }
 
-#undef BR
-
 
 
 //status clear/set operations
-static void I_clc() {
+static void I_clc(cpu6502_t *cpu) {
 	_P.flags.c = 0;
 }
 
-static void I_cld() {
+static void I_cld(cpu6502_t *cpu) {
 	_P.flags.d = 0;
 }
 
-static void I_cli() {
+static void I_cli(cpu6502_t *cpu) {
 	_P.flags.i = 0;
 }
 
-static void I_clv() {
+static void I_clv(cpu6502_t *cpu) {
 	_P.flags.v = 0;
 }
 
-static void I_sec() {
+static void I_sec(cpu6502_t *cpu) {
 	_P.flags.c = 1;
 }
 
-static void I_sed() {
+static void I_sed(cpu6502_t *cpu) {
 	_P.flags.d = 1;
 }
 
-static void I_sei() {
+static void I_sei(cpu6502_t *cpu) {
 	_P.flags.i = 1;
 }
 
 
 
 //system operations
-static void I_brk() {
-	interr(__6502_BRK_V, _P._raw | 0x30);
+static void I_brk(cpu6502_t *cpu) {
+	interr(cpu, __6502_BRK_V, _6502_get_p(cpu));
 }
 
-static void I_nop() {}
+static void I_nop(cpu6502_t *cpu) {}
 
-static void I_rti() {
-	_P._raw = pullc() | 0x30;
-	_PC = pullpc();
+static void I_rti(cpu6502_t *cpu) {
+	_6502_set_p(cpu, pullc(cpu));
+	_PC = pullpc(cpu);
 }
 
-static void I_xxx() {} //illegal opcodes end up here
+static void I_xxx(cpu6502_t *cpu) {} //illegal opcodes end up here
 
 
 
-struct instr {
-	void (*I_func)();
-	uint8_t A_func_i : 4;
-	uint8_t fetch : 1; //1 = we want to fetch the data from the prepared address, after the addressing-mode function, 0 = we don't
+const struct instr i_jtable[256] = {
+	{I_brk, AM_IMM, 1, 7, 0}, {I_ora, AM_INX, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_ora, AM_ZP0, 1, 3, 0}, {I_asl, AM_ZP0, 1, 5, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_php, AM_IMP, 0, 3, 0}, {I_ora, AM_IMM, 1, 2, 0}, {I_asl, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_ora, AM_ABS, 1, 4, 0}, {I_asl, AM_ABS, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_bpl, AM_IMM, 1, 2, 0}, {I_ora, AM_INY, 1, 5, 1}, {I_xxx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_ora, AM_ZPX, 1, 4, 0}, {I_asl, AM_ZPX, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_clc, AM_IMP, 0, 2, 0}, {I_ora, AM_ABY, 1, 4, 1}, {I_nop, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_ora, AM_ABX, 1, 4, 1}, {I_asl, AM_ABX, 1, 7, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_jsr, AM_ABS, 1, 6, 0}, {I_and, AM_INX, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_bit, AM_ZP0, 1, 3, 0}, {I_and, AM_ZP0, 1, 3, 0}, {I_rol, AM_ZP0, 1, 5, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_plp, AM_IMP, 0, 4, 0}, {I_and, AM_IMM, 1, 2, 0}, {I_rol, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_bit, AM_ABS, 1, 4, 0}, {I_and, AM_ABS, 1, 4, 0}, {I_rol, AM_ABS, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_bmi, AM_IMM, 1, 2, 0}, {I_and, AM_INY, 1, 5, 1}, {I_xxx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_and, AM_ZPX, 1, 4, 0}, {I_rol, AM_ZPX, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_sec, AM_IMP, 0, 2, 0}, {I_and, AM_ABY, 1, 4, 1}, {I_nop, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_and, AM_ABX, 1, 4, 1}, {I_rol, AM_ABX, 1, 7, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_rti, AM_IMP, 0, 6, 0}, {I_eor, AM_INX, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_eor, AM_ZP0, 1, 3, 0}, {I_lsr, AM_ZP0, 1, 5, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_pha, AM_IMP, 0, 3, 0}, {I_eor, AM_IMM, 1, 2, 0}, {I_lsr, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_jmp, AM_ABS, 1, 3, 0}, {I_eor, AM_ABS, 1, 4, 0}, {I_lsr, AM_ABS, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_bvc, AM_IMM, 1, 2, 0}, {I_eor, AM_INY, 1, 5, 1}, {I_xxx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_eor, AM_ZPX, 1, 4, 0}, {I_lsr, AM_ZPX, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_cli, AM_IMP, 0, 2, 0}, {I_eor, AM_ABY, 1, 4, 1}, {I_nop, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_eor, AM_ABX, 1, 4, 1}, {I_lsr, AM_ABX, 1, 7, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_rts, AM_IMP, 0, 6, 0}, {I_adc, AM_INX, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_adc, AM_ZP0, 1, 3, 0}, {I_ror, AM_ZP0, 1, 5, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_pla, AM_IMP, 0, 4, 0}, {I_adc, AM_IMM, 1, 2, 0}, {I_ror, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_jmp, AM_IND, 1, 5, 0}, {I_adc, AM_ABS, 1, 4, 0}, {I_ror, AM_ABS, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_bvs, AM_IMM, 1, 2, 0}, {I_adc, AM_INY, 1, 5, 1}, {I_xxx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_adc, AM_ZPX, 1, 4, 0}, {I_ror, AM_ZPX, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_sei, AM_IMP, 0, 2, 0}, {I_adc, AM_ABY, 1, 4, 1}, {I_nop, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_adc, AM_ABX, 1, 4, 1}, {I_ror, AM_ABX, 1, 7, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_nop, AM_IMP, 0, 2, 0}, {I_sta, AM_INX, 0, 6, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_sty, AM_ZP0, 1, 3, 0}, {I_sta, AM_ZP0, 0, 3, 0}, {I_stx, AM_ZP0, 1, 3, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_dey, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_txa, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_sty, AM_ABS, 1, 4, 0}, {I_sta, AM_ABS, 0, 4, 0}, {I_stx, AM_ABS, 1, 4, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_bcc, AM_IMM, 1, 2, 0}, {I_sta, AM_INY, 0, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_sty, AM_ZPX, 1, 4, 0}, {I_sta, AM_ZPX, 0, 4, 0}, {I_stx, AM_ZPY, 1, 4, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_tya, AM_IMP, 0, 2, 0}, {I_sta, AM_ABY, 0, 5, 0}, {I_txs, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_sta, AM_ABX, 0, 5, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_ldy, AM_IMM, 1, 2, 0}, {I_lda, AM_INX, 1, 6, 0}, {I_ldx, AM_IMM, 1, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_ldy, AM_ZP0, 1, 3, 0}, {I_lda, AM_ZP0, 1, 3, 0}, {I_ldx, AM_ZP0, 1, 3, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_tay, AM_IMP, 0, 2, 0}, {I_lda, AM_IMM, 1, 2, 0}, {I_tax, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_ldy, AM_ABS, 1, 4, 0}, {I_lda, AM_ABS, 1, 4, 0}, {I_ldx, AM_ABS, 1, 4, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_bcs, AM_IMM, 1, 2, 0}, {I_lda, AM_INY, 1, 5, 1}, {I_xxx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_ldy, AM_ZPX, 1, 4, 0}, {I_lda, AM_ZPX, 1, 4, 0}, {I_ldx, AM_ZPY, 1, 4, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_clv, AM_IMP, 0, 2, 0}, {I_lda, AM_ABY, 1, 4, 1}, {I_tsx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_ldy, AM_ABX, 1, 4, 1}, {I_lda, AM_ABX, 1, 4, 1}, {I_ldx, AM_ABY, 1, 4, 1}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_cpy, AM_IMM, 1, 2, 0}, {I_cmp, AM_INX, 1, 6, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_cpy, AM_ZP0, 1, 3, 0}, {I_cmp, AM_ZP0, 1, 3, 0}, {I_dec, AM_ZP0, 1, 5, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_iny, AM_IMP, 0, 2, 0}, {I_cmp, AM_IMM, 1, 2, 0}, {I_dex, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_cpy, AM_ABS, 1, 4, 0}, {I_cmp, AM_ABS, 1, 4, 0}, {I_dec, AM_ABS, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_bne, AM_IMM, 1, 2, 0}, {I_cmp, AM_INY, 1, 5, 1}, {I_xxx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_cmp, AM_ZPX, 1, 4, 0}, {I_dec, AM_ZPX, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_cld, AM_IMP, 0, 2, 0}, {I_cmp, AM_ABY, 1, 4, 1}, {I_nop, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_cmp, AM_ABX, 1, 4, 1}, {I_dec, AM_ABX, 1, 7, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_cpx, AM_IMM, 1, 2, 0}, {I_sbc, AM_INX, 1, 6, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_cpx, AM_ZP0, 1, 3, 0}, {I_sbc, AM_ZP0, 1, 3, 0}, {I_inc, AM_ZP0, 1, 5, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_inx, AM_IMP, 0, 2, 0}, {I_sbc, AM_IMM, 1, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_sbc, AM_IMP, 0, 2, 0}, {I_cpx, AM_ABS, 1, 4, 0}, {I_sbc, AM_ABS, 1, 4, 0}, {I_inc, AM_ABS, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0},
+	{I_beq, AM_IMM, 1, 2, 0}, {I_sbc, AM_INY, 1, 5, 1}, {I_xxx, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_sbc, AM_ZPX, 1, 4, 0}, {I_inc, AM_ZPX, 1, 6, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_sed, AM_IMP, 0, 2, 0}, {I_sbc, AM_ABY, 1, 4, 1}, {I_nop, AM_IMP, 0, 2, 0}, {I_xxx, AM_IMP, 0, 2, 0}, {I_nop, AM_IMP, 0, 2, 0}, {I_sbc, AM_ABX, 1, 4, 1}, {I_inc, AM_ABX, 1, 7, 0}, {I_xxx, AM_IMP, 0, 2, 0}
 };
 
-struct instr i_jtable[256] = {
-	{I_brk, AM_IMM, 1}, {I_ora, AM_INX, 1}, {I_xxx, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_ora, AM_ZP0, 1}, {I_asl, AM_ZP0, 1}, {I_xxx, AM_IMP, 0}, {I_php, AM_IMP, 0}, {I_ora, AM_IMM, 1}, {I_asl, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_ora, AM_ABS, 1}, {I_asl, AM_ABS, 1}, {I_xxx, AM_IMP, 0},
-	{I_bpl, AM_IMM, 1}, {I_ora, AM_INY, 1}, {I_xxx, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_ora, AM_ZPX, 1}, {I_asl, AM_ZPX, 1}, {I_xxx, AM_IMP, 0}, {I_clc, AM_IMP, 0}, {I_ora, AM_ABY, 1}, {I_nop, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_ora, AM_ABX, 1}, {I_asl, AM_ABX, 1}, {I_xxx, AM_IMP, 0},
-	{I_jsr, AM_ABS, 1}, {I_and, AM_INX, 1}, {I_xxx, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_bit, AM_ZP0, 1}, {I_and, AM_ZP0, 1}, {I_rol, AM_ZP0, 1}, {I_xxx, AM_IMP, 0}, {I_plp, AM_IMP, 0}, {I_and, AM_IMM, 1}, {I_rol, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_bit, AM_ABS, 1}, {I_and, AM_ABS, 1}, {I_rol, AM_ABS, 1}, {I_xxx, AM_IMP, 0},
-	{I_bmi, AM_IMM, 1}, {I_and, AM_INY, 1}, {I_xxx, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_and, AM_ZPX, 1}, {I_rol, AM_ZPX, 1}, {I_xxx, AM_IMP, 0}, {I_sec, AM_IMP, 0}, {I_and, AM_ABY, 1}, {I_nop, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_and, AM_ABX, 1}, {I_rol, AM_ABX, 1}, {I_xxx, AM_IMP, 0},
-	{I_rti, AM_IMP, 0}, {I_eor, AM_INX, 1}, {I_xxx, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_eor, AM_ZP0, 1}, {I_lsr, AM_ZP0, 1}, {I_xxx, AM_IMP, 0}, {I_pha, AM_IMP, 0}, {I_eor, AM_IMM, 1}, {I_lsr, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_jmp, AM_ABS, 1}, {I_eor, AM_ABS, 1}, {I_lsr, AM_ABS, 1}, {I_xxx, AM_IMP, 0},
-	{I_bvc, AM_IMM, 1}, {I_eor, AM_INY, 1}, {I_xxx, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_eor, AM_ZPX, 1}, {I_lsr, AM_ZPX, 1}, {I_xxx, AM_IMP, 0}, {I_cli, AM_IMP, 0}, {I_eor, AM_ABY, 1}, {I_nop, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_eor, AM_ABX, 1}, {I_lsr, AM_ABX, 1}, {I_xxx, AM_IMP, 0},
-	{I_rts, AM_IMP, 0}, {I_adc, AM_INX, 1}, {I_xxx, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_adc, AM_ZP0, 1}, {I_ror, AM_ZP0, 1}, {I_xxx, AM_IMP, 0}, {I_pla, AM_IMP, 0}, {I_adc, AM_IMM, 1}, {I_ror, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_jmp, AM_IND, 1}, {I_adc, AM_ABS, 1}, {I_ror, AM_ABS, 1}, {I_xxx, AM_IMP, 0},
-	{I_bvs, AM_IMM, 1}, {I_adc, AM_INY, 1}, {I_xxx, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_adc, AM_ZPX, 1}, {I_ror, AM_ZPX, 1}, {I_xxx, AM_IMP, 0}, {I_sei, AM_IMP, 0}, {I_adc, AM_ABY, 1}, {I_nop, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_adc, AM_ABX, 1}, {I_ror, AM_ABX, 1}, {I_xxx, AM_IMP, 0},
-	{I_nop, AM_IMP, 0}, {I_sta, AM_INX, 0}, {I_nop, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_sty, AM_ZP0, 1}, {I_sta, AM_ZP0, 0}, {I_stx, AM_ZP0, 1}, {I_xxx, AM_IMP, 0}, {I_dey, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_txa, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_sty, AM_ABS, 1}, {I_sta, AM_ABS, 0}, {I_stx, AM_ABS, 1}, {I_xxx, AM_IMP, 0},
-	{I_bcc, AM_IMM, 1}, {I_sta, AM_INY, 0}, {I_xxx, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_sty, AM_ZPX, 1}, {I_sta, AM_ZPX, 0}, {I_stx, AM_ZPY, 1}, {I_xxx, AM_IMP, 0}, {I_tya, AM_IMP, 0}, {I_sta, AM_ABY, 0}, {I_txs, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_sta, AM_ABX, 0}, {I_xxx, AM_IMP, 0}, {I_xxx, AM_IMP, 0},
-	{I_ldy, AM_IMM, 1}, {I_lda, AM_INX, 1}, {I_ldx, AM_IMM, 1}, {I_xxx, AM_IMP, 0}, {I_ldy, AM_ZP0, 1}, {I_lda, AM_ZP0, 1}, {I_ldx, AM_ZP0, 1}, {I_xxx, AM_IMP, 0}, {I_tay, AM_IMP, 0}, {I_lda, AM_IMM, 1}, {I_tax, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_ldy, AM_ABS, 1}, {I_lda, AM_ABS, 1}, {I_ldx, AM_ABS, 1}, {I_xxx, AM_IMP, 0},
-	{I_bcs, AM_IMM, 1}, {I_lda, AM_INY, 1}, {I_xxx, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_ldy, AM_ZPX, 1}, {I_lda, AM_ZPX, 1}, {I_ldx, AM_ZPY, 1}, {I_xxx, AM_IMP, 0}, {I_clv, AM_IMP, 0}, {I_lda, AM_ABY, 1}, {I_tsx, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_ldy, AM_ABX, 1}, {I_lda, AM_ABX, 1}, {I_ldx, AM_ABY, 1}, {I_xxx, AM_IMP, 0},
-	{I_cpy, AM_IMM, 1}, {I_cmp, AM_INX, 1}, {I_nop, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_cpy, AM_ZP0, 1}, {I_cmp, AM_ZP0, 1}, {I_dec, AM_ZP0, 1}, {I_xxx, AM_IMP, 0}, {I_iny, AM_IMP, 0}, {I_cmp, AM_IMM, 1}, {I_dex, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_cpy, AM_ABS, 1}, {I_cmp, AM_ABS, 1}, {I_dec, AM_ABS, 1}, {I_xxx, AM_IMP, 0},
-	{I_bne, AM_IMM, 1}, {I_cmp, AM_INY, 1}, {I_xxx, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_cmp, AM_ZPX, 1}, {I_dec, AM_ZPX, 1}, {I_xxx, AM_IMP, 0}, {I_cld, AM_IMP, 0}, {I_cmp, AM_ABY, 1}, {I_nop, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_cmp, AM_ABX, 1}, {I_dec, AM_ABX, 1}, {I_xxx, AM_IMP, 0},
-	{I_cpx, AM_IMM, 1}, {I_sbc, AM_INX, 1}, {I_nop, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_cpx, AM_ZP0, 1}, {I_sbc, AM_ZP0, 1}, {I_inc, AM_ZP0, 1}, {I_xxx, AM_IMP, 0}, {I_inx, AM_IMP, 0}, {I_sbc, AM_IMM, 1}, {I_nop, AM_IMP, 0}, {I_sbc, AM_IMP, 0}, {I_cpx, AM_ABS, 1}, {I_sbc, AM_ABS, 1}, {I_inc, AM_ABS, 1}, {I_xxx, AM_IMP, 0},
-	{I_beq, AM_IMM, 1}, {I_sbc, AM_INY, 1}, {I_xxx, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_sbc, AM_ZPX, 1}, {I_inc, AM_ZPX, 1}, {I_xxx, AM_IMP, 0}, {I_sed, AM_IMP, 0}, {I_sbc, AM_ABY, 1}, {I_nop, AM_IMP, 0}, {I_xxx, AM_IMP, 0}, {I_nop, AM_IMP, 0}, {I_sbc, AM_ABX, 1}, {I_inc, AM_ABX, 1}, {I_xxx, AM_IMP, 0}
-};
+//undocumented on the NMOS: left to I_xxx, or one of the nops standing in (0xeb, a plain sbc, aside)
+int _6502_illegal(uint8_t op) {
+	return i_jtable[op].I_func == I_xxx || (i_jtable[op].I_func == I_nop && op != 0xea);
+}
 
 /*struct instr i_jtable[] = {
 	{I_brk, AM_IMM}, {I_ora, AM_INX}, {I_xxx, AM_IMP}, {I_xxx, AM_IMP}, {I_nop, AM_IMP}, {I_ora, AM_ZP0}, {I_asl, AM_ZP0}, {I_xxx, AM_IMP}, {I_php, AM_IMP}, {I_ora, AM_IMM}, {I_asl, AM_IMP}, {I_xxx, AM_IMP}, {I_nop, AM_IMP}, {I_ora, AM_ABS}, {I_asl, AM_ABS}, {I_xxx, AM_IMP},
@@ -631,39 +640,791 @@ struct instr i_jtable[256] = {
 
 
 
-void _6502_reset() {
-	#if (_6502_RESET_ON_START) //set the program counter to the address taken from the reset vector
-	_PC = get_w(__6502_RESET_V);
-	#else
-	_PC = _6502_START_ADDRESS;
+/*
+	Decimal mode.
+	NMOS adc/sbc for every (carry, a, operand), invalid digits included, following Bruce Clark's
+	"Decimal Mode" (6502.org): adc takes n and v from the sum with only the low digit adjusted and z
+	from the binary sum, while sbc sets every flag as in binary mode.
+	The 65C02 adjusts sbc results its own way and takes n and z from the result.
+*/
+
+uint16_t _6502_bcd_adc[0x20000], _6502_bcd_sbc[0x20000], _6502_bcd_sbc_c[0x20000];
+
+static uint16_t bcd_adc(uint8_t a, uint8_t b, uint8_t c) {
+	int lo = (a & 0x0f) + (b & 0x0f) + c, r, s;
+
+	if (lo >= 0x0a) lo = ((lo + 0x06) & 0x0f) + 0x10;
+	r = (a & 0xf0) + (b & 0xf0) + lo;
+	s = (int8_t) (a & 0xf0) + (int8_t) (b & 0xf0) + lo; //signed, for n and v
+	if (r >= 0xa0) r += 0x60;
+
+	return (r & 0xff) | ((r >= 0x100) << 8) | (!((a + b + c) & 0xff) << 9) | ((s < -128 || s > 127) << 14) | ((s & 0x80) << 8);
+}
+
+static uint16_t bcd_sbc(uint8_t a, uint8_t b, uint8_t c) {
+	int lo = (a & 0x0f) - (b & 0x0f) + c - 1, r, w = a - b + c - 1;
+
+	if (lo < 0) lo = ((lo - 0x06) & 0x0f) - 0x10;
+	r = (a & 0xf0) - (b & 0xf0) + lo;
+	if (r < 0) r -= 0x60;
+
+	return (r & 0xff) | ((w >= 0) << 8) | (!(w & 0xff) << 9) | ((((a ^ b) & (a ^ w) & 0x80) != 0) << 14) | ((w & 0x80) << 8);
+}
+
+#if ((_6502_CPUS) & ((1 << _6502_CPU_65C02) | (1 << _6502_CPU_R65C02)))
+static uint16_t bcd_sbc_c(uint8_t a, uint8_t b, uint8_t c) {
+	int lo = (a & 0x0f) - (b & 0x0f) + c - 1, w = a - b + c - 1, r = w;
+
+	if (r < 0) r -= 0x60;
+	if (lo < 0) r -= 0x06;
+
+	return (r & 0xff) | ((w >= 0) << 8) | (!(r & 0xff) << 9) | ((((a ^ b) & (a ^ w) & 0x80) != 0) << 14) | ((r & 0x80) << 8);
+}
+#endif
+
+void _6502_bcd_init(void) {
+	static atomic_int ready;
+	static atomic_flag busy = ATOMIC_FLAG_INIT;
+
+	if (atomic_load(&ready)) return;
+
+	while (atomic_flag_test_and_set(&busy));
+	if (!atomic_load(&ready)) {
+		for (uint32_t i = 0; i < 0x20000; i++) {
+			_6502_bcd_adc[i] = bcd_adc(i >> 8, i, i >> 16);
+			_6502_bcd_sbc[i] = bcd_sbc(i >> 8, i, i >> 16);
+			#if ((_6502_CPUS) & ((1 << _6502_CPU_65C02) | (1 << _6502_CPU_R65C02)))
+			_6502_bcd_sbc_c[i] = bcd_sbc_c(i >> 8, i, i >> 16);
+			#endif
+		}
+		atomic_store(&ready, 1);
+	}
+	atomic_flag_clear(&busy);
+}
+
+
+
+/*
+	Events.
+	A binary min-heap in the context, ordered by cycle and then by scheduling order.
+*/
+
+static int before(const struct _6502_pending *e, const struct _6502_pending *f) {
+	return e->at < f->at || (e->at == f->at && (int32_t) (e->seq - f->seq) < 0);
+}
+
+static void sift_down(cpu6502_t *cpu, uint16_t i) {
+	struct _6502_pending *q = cpu->event, e = q[i];
+
+	for (uint16_t k; (k = 2 * i + 1) < cpu->nevents; i = k) {
+		if (k + 1 < cpu->nevents && before(&q[k + 1], &q[k])) k++;
+		if (!before(&q[k], &e)) break;
+		q[i] = q[k];
+	}
+
+	q[i] = e;
+}
+
+//fires every event due by now, those scheduled by the callbacks included
+static void fire(cpu6502_t *cpu) {
+	while (cpu->nevents && cpu->event[0].at <= cpu->cycles) {
+		struct _6502_pending e = cpu->event[0];
+
+		cpu->event[0] = cpu->event[--cpu->nevents];
+		sift_down(cpu, 0);
+		e.f(cpu, e.user);
+	}
+}
+
+void _6502_fire(cpu6502_t *cpu) {
+	fire(cpu);
+}
+
+//a run going on has to look at the queue and the irq line again (outside of one, the next run starts with an empty stretch)
+static void wake(cpu6502_t *cpu) {
+	cpu->stop_req |= __6502_REQ_EVENT;
+}
+
+int _6502_schedule(cpu6502_t *cpu, uint64_t at, _6502_event_t f, void *user) {
+	struct _6502_pending *q = cpu->event, e = {at, cpu->event_seq, f, user};
+	uint16_t i;
+
+	if (!f || cpu->nevents == _6502_EVENTS) return -1;
+
+	for (i = cpu->nevents++; i && before(&e, &q[(i - 1) / 2]); i = (i - 1) / 2)
+		q[i] = q[(i - 1) / 2];
+
+	q[i] = e;
+	cpu->event_seq++;
+	wake(cpu);
+
+	return 0;
+}
+
+void _6502_cancel(cpu6502_t *cpu, _6502_event_t f, void *user) {
+	uint16_t n = 0;
+
+	for (uint16_t i = 0; i < cpu->nevents; i++)
+		if (cpu->event[i].f != f || cpu->event[i].user != user) cpu->event[n++] = cpu->event[i];
+
+	cpu->nevents = n;
+	for (uint16_t i = n / 2; i--;)
+		sift_down(cpu, i);
+}
+
+void _6502_irq_set(cpu6502_t *cpu, uint32_t sources) {
+	if (cpu->replay && _6502_replay_input(cpu, __6502_IN_IRQ, cpu->irq | sources)) return;
+	if (sources & ~cpu->irq) wake(cpu);
+	cpu->irq |= sources;
+}
+
+void _6502_irq_clear(cpu6502_t *cpu, uint32_t sources) {
+	if (cpu->replay && _6502_replay_input(cpu, __6502_IN_IRQ, cpu->irq & ~sources)) return;
+	cpu->irq &= ~sources;
+}
+
+
+
+//nothing on the bus: what a context without callbacks (nor a bus compiled in) has until pages get mapped
+static uint8_t open_read(void *user, uint16_t a) {return 0xff;}
+static void open_write(void *user, uint16_t a, uint8_t x) {}
+
+void _6502_init(cpu6502_t *cpu, _6502_read_t read, _6502_write_t write, void *user) {
+	*cpu = (cpu6502_t) {0};
+
+	#ifdef _6502_BUS
+	if (!read) read = __6502_bus_read;
+	if (!write) write = __6502_bus_write;
 	#endif
 
+	if (!read) read = open_read;
+	if (!write) write = open_write;
+
+	cpu->read = read;
+	cpu->write = write;
+	cpu->user = user;
+	cpu->start = (_6502_RESET_ON_START) ? _6502_START_VECTOR : _6502_START_ADDRESS;
+	cpu->variant = _6502_CPU;
+
+	_6502_map_io(cpu, 0, 256, read, write, user);
+	_6502_bcd_init();
+}
+
+void _6502_reset(cpu6502_t *cpu) {
+	_6502_bcd_init(); //(the legacy api never calls _6502_init)
+
+	if (cpu->replay && _6502_replay_input(cpu, __6502_IN_RESET, 0)) return;
+	if (cpu->trap) cpu->trap->v.on = cpu->trap->skip = 0; //a routine being verified won't return anymore
+	cpu->exact.poll = cpu->exact.nmi = cpu->exact.irq = 0;
+
+	_PC = (cpu->start == _6502_START_VECTOR) ? get_w(cpu, __6502_RESET_V) : (uint16_t) cpu->start;
+
 	_A = _X = _Y = 0;
 	_SP = 0xff;
-	_P._raw = 0x30; //0b00110000; //unused flag set
+	_6502_set_p(cpu, 0x30); //0b00110000; //unused flag set
+
+	cpu->cycles += 7;
+}
+
+//the irq line, or the host asking for one
+static void irq(cpu6502_t *cpu) {
+	if (!_P.flags.i) {
+		interr(cpu, __6502_IRQ_V, _6502_get_p(cpu) & (~BIT_O(4)));
+		cpu->cycles += 7;
+
+		#if (_6502_PROFILE)
+		if (cpu->prof) _6502_profile_irq(cpu, cpu->cycles - 7);
+		#endif
+	}
+}
+
+void _6502_interrupt(cpu6502_t *cpu) {
+	if (cpu->replay && _6502_replay_input(cpu, __6502_IN_INTERRUPT, 0)) return;
+
+	if (cpu->exact.on) cpu->exact.irq = 1; //(at the end of the instruction)
+	else irq(cpu);
+}
+
+void _6502_nmi(cpu6502_t *cpu) {
+	if (cpu->replay && _6502_replay_input(cpu, __6502_IN_NMI, 0)) return;
+	if (cpu->exact.on) {
+		cpu->exact.nmi = 1;
+		return;
+	}
+
+	interr(cpu, __6502_NMI_V, _6502_get_p(cpu) & (~BIT_O(4)));
+	cpu->cycles += 7;
+
+	#if (_6502_PROFILE)
+	if (cpu->prof) _6502_profile_irq(cpu, cpu->cycles - 7);
+	#endif
 }
 
-void _6502_interrupt() {
-	if (!_P.flags.i)
-		interr(__6502_IRQ_V, _P._raw & (~BIT_O(4)));
+//_6502_clock with the cycle-exact engine on: the interrupt sequence, or one instruction (stop requests stay pending)
+static void exact_interrupt(cpu6502_t *cpu) {
+	#if (_6502_PROFILE)
+	uint64_t c0 = cpu->cycles;
+
+	if (_6502_exact_interrupt(cpu) && cpu->prof) _6502_profile_irq(cpu, c0);
+	#else
+	_6502_exact_interrupt(cpu);
+	#endif
 }
 
-void _6502_nmi() {
-	interr(__6502_NMI_V, _P._raw & (~BIT_O(4)));
+static void exact_step(cpu6502_t *cpu) {
+	uint8_t req = cpu->stop_req;
+
+	#if (_6502_PROFILE)
+	uint16_t at = _PC;
+	uint64_t c0 = cpu->cycles;
+	#endif
+
+	cpu->stop_req = 0;
+	_6502_exact_run(cpu, 1, UINT64_MAX);
+	cpu->stop_req |= req | ((cpu->stop == _6502_STOP_REQUEST) ? __6502_REQ_STOP : 0) | ((cpu->stop == _6502_STOP_WATCH) ? __6502_REQ_WATCH : 0);
+
+	#if (_6502_PROFILE)
+	if (cpu->prof) _6502_profile_step(cpu, at, c0);
+	#endif
 }
 
-void _6502_clock() {
+static void instruction(cpu6502_t *cpu) {
+	#if (_6502_PROFILE)
+	uint16_t at = _PC;
+	uint64_t c0 = cpu->cycles;
+	#endif
+
 	_IR = _6502_read(_PC++);
 
+	#if (_6502_TRACE)
+	struct _6502_trace *tr = cpu->trace;
+	_6502_trace_rec_t *r = tr ? &tr->rec[tr->hdr->n++ & tr->mask] : NULL;
+
+	if (r) trace_rec(r, cpu, _PC - 1, tr->hdr->ea, _IR, _A, _X, _Y, _SP, _P._raw, _NZ, cpu->cycles);
+	#endif
+
+	cpu->cycles += i_jtable[_IR].cycles;
+
 	//SDL_Log("%02x, %04x\n", _IR, _PC);
 	//amode = i_jtable[_IR].A_func_i;
-	A_funcs[i_jtable[_IR].A_func_i](); //call addressing-mode function
-	fetch = i_jtable[_IR].fetch;
+	A_funcs[i_jtable[_IR].A_func_i](cpu); //call addressing-mode function
+	cpu->fetch = i_jtable[_IR].fetch;
 
-	if (fetch) data = _6502_read(addr);
+	#if (_6502_TRACE)
+	if (r) tr->hdr->ea = cpu->addr; //(some operations use addr as scratch)
+	#endif
 
-	//SDL_Log("%04x\n", addr);
+	if (cpu->fetch) cpu->data = _6502_read(cpu->addr);
+
+	//SDL_Log("%04x\n", cpu->addr);
 
 	//if the flag is true, do a fetch (data = _6502_read(addr))
-	(i_jtable[_IR].I_func)(); //call operative function
+	(i_jtable[_IR].I_func)(cpu); //call operative function
+
+	#if (_6502_PROFILE)
+	if (cpu->prof) _6502_profile_step(cpu, at, c0);
+	#endif
+}
+
+#if ((_6502_CPUS) & ~(1 << _6502_CPU_NMOS))
+static void step(cpu6502_t *cpu); //(see the fused interpreter below)
+#endif
+
+void _6502_clock(cpu6502_t *cpu) {
+	//a pending irq takes the place of the instruction
+	if (cpu->exact.on && EXACT_PENDING(cpu)) exact_interrupt(cpu);
+	else if (!cpu->exact.on && cpu->irq && !_P.flags.i) irq(cpu);
+	else if (TRAPPED(cpu, _PC) && _6502_trap_run(cpu)) ; //the function stood in for the routine
+	else if (cpu->exact.on) exact_step(cpu);
+	#if ((_6502_CPUS) & ~(1 << _6502_CPU_NMOS))
+	else if (cpu->variant != _6502_CPU_NMOS) step(cpu);
+	#endif
+	else instruction(cpu);
+
+	if (VERIFYING(cpu)) _6502_trap_check(cpu);
+	if (cpu->nevents && cpu->event[0].at <= cpu->cycles) fire(cpu);
+}
+
+
+
+/*
+	Idle loops.
+	A loop qualifies when everything from its start to the jump closing it is straight-line, only works
+	on registers and reads nothing that could change under it. Once it goes round with the same registers
+	as the time before, it's bound to keep doing so.
+*/
+
+//instructions that only work on registers (besides reading their operand)
+static void (*const pure[])(cpu6502_t *cpu) = {
+	I_lda, I_ldx, I_ldy, I_tax, I_tay, I_txa, I_tya, I_tsx, I_txs,
+	I_and, I_ora, I_eor, I_bit, I_adc, I_sbc, I_cmp, I_cpx, I_cpy,
+	I_inx, I_iny, I_dex, I_dey, I_clc, I_cld, I_cli, I_clv, I_sec, I_sed, I_sei, I_nop, I_xxx
+};
+
+//code byte, -1 if not in memory
+static int peek(const cpu6502_t *cpu, uint16_t a) {
+	return cpu->rpage[a >> 8] ? cpu->rpage[a >> 8][a & 0xff] : -1;
+}
+
+//(a recording or a replay needs every io read to happen, however long the run)
+static int stable(const cpu6502_t *cpu, uint8_t pg) {
+	return cpu->rpage[pg] || (cpu->idle == _6502_IDLE_IO && !cpu->replay);
+}
+
+static int reads_stable(const cpu6502_t *cpu, const struct instr *in, uint16_t arg) {
+	if (!in->fetch) return 1;
+
+	switch (in->A_func_i) {
+		case AM_IMM: return 1;
+		case AM_ZP0: case AM_ZPX: case AM_ZPY: return stable(cpu, 0);
+		case AM_ABS: return stable(cpu, arg >> 8);
+		case AM_ABX: case AM_ABY: return stable(cpu, arg >> 8) && stable(cpu, (uint16_t) (arg + 0xff) >> 8);
+	}
+
+	return 0; //through a pointer, could be anywhere
+}
+
+//instructions per time round of the loop from 'to' to the jump at 'at' (included). 0 if it doesn't qualify
+static uint8_t idle_body(const cpu6502_t *cpu, uint16_t to, uint16_t at) {
+	uint16_t span = at - to, off, arg;
+	uint8_t k = 1, len;
+	int op, lo, hi;
+
+	if (span > __6502_IDLE_SPAN) return 0;
+
+	for (off = 0; off < span; off += len, k++) {
+		const struct instr *in;
+		size_t i = 0;
+
+		if ((op = peek(cpu, to + off)) < 0 || (lo = peek(cpu, to + off + 1)) < 0 || (hi = peek(cpu, to + off + 2)) < 0)
+			return 0;
+
+		in = &i_jtable[op];
+		len = AM_LEN(in->A_func_i);
+		arg = lo | (hi << 8);
+
+		//(the table only knows what NMOS does with them)
+		if (cpu->variant != _6502_CPU_NMOS && (in->I_func == I_xxx || (in->I_func == I_nop && op != 0xea) || op == 0xeb)) return 0;
+
+		while (i < sizeof(pure) / sizeof(pure[0]) && pure[i] != in->I_func) i++;
+		if (i == sizeof(pure) / sizeof(pure[0]) && !(in->A_func_i == AM_IMP && (in->I_func == I_asl || in->I_func == I_lsr || in->I_func == I_rol || in->I_func == I_ror)))
+			return 0;
+		if (!reads_stable(cpu, in, arg)) return 0;
+	}
+
+	//and it must be closed by the jump
+	if (off != span || (op = peek(cpu, at)) < 0 || (lo = peek(cpu, at + 1)) < 0 || (hi = peek(cpu, at + 2)) < 0)
+		return 0;
+	if ((op & 0x1f) == 0x10 || (op == 0x80 && cpu->variant >= _6502_CPU_65C02)) return ((uint16_t) (at + 2 + (int8_t) lo) == to) ? k : 0;
+	if (op == 0x4c) return ((lo | (hi << 8)) == to) ? k : 0;
+
+	return 0;
+}
+
+static void forget_loop(cpu6502_t *cpu) {
+	cpu->loop.at = 0;
+	cpu->loop.to = 1; //matches no jump that could close a loop
+}
+
+int _6502_idle_loop(cpu6502_t *cpu, uint16_t at, uint16_t to, uint64_t regs, uint64_t n, uint64_t cyc, uint64_t budget, uint64_t until) {
+	uint64_t c = cyc - cpu->loop.cyc, m;
+
+	//first time round, or back from elsewhere (which could have changed anything)
+	if (cpu->loop.at != at || cpu->loop.to != to || (cpu->loop.k && n - cpu->loop.n != cpu->loop.k)) {
+		cpu->loop.at = at;
+		cpu->loop.to = to;
+		cpu->loop.k = idle_body(cpu, to, at);
+		cpu->loop.regs = regs;
+		cpu->loop.n = n;
+		cpu->loop.cyc = cyc;
+		return 0;
+	}
+
+	if (!cpu->loop.k) return 0;
+
+	if (regs != cpu->loop.regs) {
+		cpu->loop.regs = regs;
+		cpu->loop.n = n;
+		cpu->loop.cyc = cyc;
+		return 0;
+	}
+
+	//whole times round that fit before the run would stop
+	m = (budget - n) / cpu->loop.k;
+	if (cyc >= until) m = 0;
+	else if ((until - cyc) / c < m) m = (until - cyc) / c;
+
+	cpu->loop.n = n + m * cpu->loop.k;
+	cpu->loop.cyc = cyc + m * c;
+	cpu->idle_cycles += m * c;
+
+	return m != 0;
+}
+
+void _6502_idle(cpu6502_t *cpu, int mode) {
+	cpu->idle = mode;
+	forget_loop(cpu);
+}
+
+
+
+/*
+	Fused interpreter.
+	Each opcode gets its own handler with the addressing mode and the operation merged together
+	(see 6502_ops.h), and registers live in locals for the whole run.
+*/
+
+#define RD(a)					bus_rd_at(cpu, (a), cyc)
+#define WR(a, x)				bus_wr_at(cpu, (a), (x), cyc)
+
+#define ARG8					RD(pc++)
+#define ARG16					(pc += 2, RD((uint16_t) (pc - 2)) | (RD((uint16_t) (pc - 1)) << 8))
+
+#define STUCK					do {if (!back) {cpu->stop = _6502_STOP_STUCK; goto out;}} while (0) //(idle loops are skipped instead)
+
+//the record of each instruction is written as it starts (and its effective address when the next one does), by every handler's dispatch
+#if (_6502_TRACE)
+#define TRACE_REC				trace_rec(rec++, cpu, pc - 1, ea, op, a, x, y, sp, p._raw, nz, cyc)
+#endif
+#if (_6502_TRACE) && (_6502_COMPUTED_GOTO)
+#define TRACE					if (ring) TRACE_REC
+#else
+#define TRACE
+#endif
+
+//every opcode twice: zero page and stack through the map (OP), or straight to memory when pages 0 and 1 are mapped (ZOP)
+#if (_6502_COMPUTED_GOTO)
+#define OP(h, body)				o_##h: body; NEXT;
+#define LABEL(h, body)			[0x##h] = &&o_##h,
+#define ZOP(h, body)			z_##h: body; NEXT;
+#define ZLABEL(h, body)			[0x##h] = &&z_##h,
+#define NEXT					EDGE; if (n >= budget || cyc >= until || cpu->stop_req) goto out; BREAK; n++; op = RD(pc++); BREAK_OP; TRACE; cyc += CYCLES(op); goto *tab[op]
+#else
+#define OP(h, body)				case 0x##h: body; continue;
+#define ZOP						OP
+#endif
+
+/*
+	One loop per variant, the opcodes and cycle counts of each built in, and a twin with the debugging hooks.
+	Undocumented NMOS opcodes take their usual counts, and 65C02 ones those of the WDC/Rockwell sheets
+	(single byte nops 1 cycle, and 1 more for adc/sbc in decimal mode and bbr/bbs like for branches).
+*/
+
+//control flow opcodes, where the hooked loops count edges (see _6502_cover)
+#define FLOW_NMOS				[0x00] = 1, [0x10] = 1, [0x20] = 1, [0x30] = 1, [0x40] = 1, [0x4c] = 1, [0x50] = 1, [0x60] = 1, [0x6c] = 1, [0x70] = 1, [0x90] = 1, [0xb0] = 1, [0xd0] = 1, [0xf0] = 1
+#define FLOW_65C02				FLOW_NMOS, [0x7c] = 1, [0x80] = 1
+#define FLOW_R65C02				FLOW_65C02, [0x0f] = 1, [0x1f] = 1, [0x2f] = 1, [0x3f] = 1, [0x4f] = 1, [0x5f] = 1, [0x6f] = 1, [0x7f] = 1, \
+								[0x8f] = 1, [0x9f] = 1, [0xaf] = 1, [0xbf] = 1, [0xcf] = 1, [0xdf] = 1, [0xef] = 1, [0xff] = 1
+
+#if ((_6502_CPUS) & ((1 << _6502_CPU_NMOS) | (1 << _6502_CPU_NMOSX)))
+static const uint8_t flow_nmos[256] = {FLOW_NMOS};
+#endif
+
+#if ((_6502_CPUS) & (1 << _6502_CPU_NMOS))
+#define OPCODES(X)				_6502_OPCODES(X)
+#define CYCLES(op)				i_jtable[op].cycles
+#define FLOW					flow_nmos
+#define RUN						run
+#define HOOKS					0
+#include "6502_run.h"
+#define RUN						run_hooked
+#define HOOKS					1
+#include "6502_run.h"
+#undef OPCODES
+#undef CYCLES
+#undef FLOW
+#endif
+
+#if ((_6502_CPUS) & (1 << _6502_CPU_NMOSX))
+static const uint8_t cycles_nmosx[256] = {
+	7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+	6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+	6, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6,
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+	6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6,
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+	2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,
+	2, 6, 2, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5,
+	2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,
+	2, 5, 2, 5, 4, 4, 4, 4, 2, 4, 2, 4, 4, 4, 4, 4,
+	2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+	2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7
+};
+
+#define OPCODES(X)				__6502_OPS_COMMON(X) __6502_OPS_NMOS(X) __6502_OPS_UNDOC(X)
+#define CYCLES(op)				cycles_nmosx[op]
+#define FLOW					flow_nmos
+#define RUN						run_nmosx
+#define HOOKS					0
+#include "6502_run.h"
+#define RUN						run_nmosx_hooked
+#define HOOKS					1
+#include "6502_run.h"
+#undef OPCODES
+#undef CYCLES
+#undef FLOW
+#endif
+
+#if ((_6502_CPUS) & ((1 << _6502_CPU_65C02) | (1 << _6502_CPU_R65C02)))
+//(rmb/smb and bbr/bbs in the x7/xf columns, 1 cycle nops without them)
+#define CYCLES_65C02(b)																	\
+	7, 6, 2, 1, 5, 3, 5, b, 3, 2, 2, 1, 6, 4, 6, b,										\
+	2, 5, 5, 1, 5, 4, 6, b, 2, 4, 2, 1, 6, 4, 6, b,										\
+	6, 6, 2, 1, 3, 3, 5, b, 4, 2, 2, 1, 4, 4, 6, b,										\
+	2, 5, 5, 1, 4, 4, 6, b, 2, 4, 2, 1, 4, 4, 6, b,										\
+	6, 6, 2, 1, 3, 3, 5, b, 3, 2, 2, 1, 3, 4, 6, b,										\
+	2, 5, 5, 1, 4, 4, 6, b, 2, 4, 3, 1, 8, 4, 6, b,										\
+	6, 6, 2, 1, 3, 3, 5, b, 4, 2, 2, 1, 6, 4, 6, b,										\
+	2, 5, 5, 1, 4, 4, 6, b, 2, 4, 4, 1, 6, 4, 6, b,										\
+	2, 6, 2, 1, 3, 3, 3, b, 2, 2, 2, 1, 4, 4, 4, b,										\
+	2, 6, 5, 1, 4, 4, 4, b, 2, 5, 2, 1, 4, 5, 5, b,										\
+	2, 6, 2, 1, 3, 3, 3, b, 2, 2, 2, 1, 4, 4, 4, b,										\
+	2, 5, 5, 1, 4, 4, 4, b, 2, 4, 2, 1, 4, 4, 4, b,										\
+	2, 6, 2, 1, 3, 3, 5, b, 2, 2, 2, 1, 4, 4, 6, b,										\
+	2, 5, 5, 1, 4, 4, 6, b, 2, 4, 3, 1, 4, 4, 7, b,										\
+	2, 6, 2, 1, 3, 3, 5, b, 2, 2, 2, 1, 4, 4, 6, b,										\
+	2, 5, 5, 1, 4, 4, 6, b, 2, 4, 4, 1, 4, 4, 7, b
+#endif
+
+#if ((_6502_CPUS) & (1 << _6502_CPU_65C02))
+static const uint8_t cycles_65c02[256] = {CYCLES_65C02(1)};
+static const uint8_t flow_65c02[256] = {FLOW_65C02};
+
+#define OPCODES(X)				__6502_OPS_COMMON(X) __6502_OPS_CMOS(X) __6502_OPS_CMOS_NOP(X)
+#define CYCLES(op)				cycles_65c02[op]
+#define FLOW					flow_65c02
+#define RUN						run_65c02
+#define HOOKS					0
+#include "6502_run.h"
+#define RUN						run_65c02_hooked
+#define HOOKS					1
+#include "6502_run.h"
+#undef OPCODES
+#undef CYCLES
+#undef FLOW
+#endif
+
+#if ((_6502_CPUS) & (1 << _6502_CPU_R65C02))
+static const uint8_t cycles_r65c02[256] = {CYCLES_65C02(5)};
+static const uint8_t flow_r65c02[256] = {FLOW_R65C02};
+
+#define OPCODES(X)				__6502_OPS_COMMON(X) __6502_OPS_CMOS(X) __6502_OPS_ROCKWELL(X)
+#define CYCLES(op)				cycles_r65c02[op]
+#define FLOW					flow_r65c02
+#define RUN						run_r65c02
+#define HOOKS					0
+#include "6502_run.h"
+#define RUN						run_r65c02_hooked
+#define HOOKS					1
+#include "6502_run.h"
+#undef OPCODES
+#undef CYCLES
+#undef FLOW
+#endif
+
+//by variant, NULL if not compiled in
+static uint64_t (*const runs[4])(cpu6502_t *cpu, uint64_t budget, uint64_t until) = {
+	#if ((_6502_CPUS) & (1 << _6502_CPU_NMOS))
+	[_6502_CPU_NMOS] = run,
+	#endif
+	#if ((_6502_CPUS) & (1 << _6502_CPU_NMOSX))
+	[_6502_CPU_NMOSX] = run_nmosx,
+	#endif
+	#if ((_6502_CPUS) & (1 << _6502_CPU_65C02))
+	[_6502_CPU_65C02] = run_65c02,
+	#endif
+	#if ((_6502_CPUS) & (1 << _6502_CPU_R65C02))
+	[_6502_CPU_R65C02] = run_r65c02,
+	#endif
+};
+
+static uint64_t (*const hooked[4])(cpu6502_t *cpu, uint64_t budget, uint64_t until) = {
+	#if ((_6502_CPUS) & (1 << _6502_CPU_NMOS))
+	[_6502_CPU_NMOS] = run_hooked,
+	#endif
+	#if ((_6502_CPUS) & (1 << _6502_CPU_NMOSX))
+	[_6502_CPU_NMOSX] = run_nmosx_hooked,
+	#endif
+	#if ((_6502_CPUS) & (1 << _6502_CPU_65C02))
+	[_6502_CPU_65C02] = run_65c02_hooked,
+	#endif
+	#if ((_6502_CPUS) & (1 << _6502_CPU_R65C02))
+	[_6502_CPU_R65C02] = run_r65c02_hooked,
+	#endif
+};
+
+//the plain NMOS build calls its loop straight
+#if ((_6502_CPUS) == (1 << _6502_CPU_NMOS))
+#define RUN_CPU(cpu)			run
+#else
+#define RUN_CPU(cpu)			runs[(cpu)->variant]
+#endif
+
+#if ((_6502_CPUS) & ~(1 << _6502_CPU_NMOS))
+//_6502_clock on the other variants: one instruction of their loop, as if it had been stepped (idle loops are never skipped, stop requests stay pending)
+static void step(cpu6502_t *cpu) {
+	uint8_t req = cpu->stop_req, idle = cpu->idle;
+
+	#if (_6502_PROFILE)
+	uint16_t at = _PC;
+	uint64_t c0 = cpu->cycles;
+	#endif
+
+	cpu->stop_req = 0;
+	cpu->idle = 0;
+	runs[cpu->variant](cpu, 1, UINT64_MAX);
+	cpu->idle = idle;
+	cpu->stop_req |= req | ((cpu->stop == _6502_STOP_REQUEST) ? __6502_REQ_STOP : 0) | ((cpu->stop == _6502_STOP_WATCH) ? __6502_REQ_WATCH : 0);
+
+	#if (_6502_PROFILE)
+	if (cpu->prof) _6502_profile_step(cpu, at, c0);
+	#endif
+}
+#endif
+
+int _6502_variant(cpu6502_t *cpu, int variant) {
+	if (variant < 0 || variant > _6502_CPU_R65C02 || !runs[variant] || ((cpu->cache || cpu->exact.on) && variant != _6502_CPU_NMOS)) return -1;
+	#if (_6502_TRACE)
+	if (cpu->trace && variant != cpu->variant) return -1; //(the trace's opcodes are of the variant it started on)
+	#endif
+
+	cpu->variant = variant;
+	forget_loop(cpu);
+
+	return 0;
+}
+
+#if (_6502_TRACE)
+#define TRACING(cpu)			((cpu)->trace != NULL)
+#else
+#define TRACING(cpu)			0
+#endif
+
+//runs stretch after stretch up to the next event, firing events and taking irqs in between
+static uint64_t drive(cpu6502_t *cpu, uint64_t budget, uint64_t until) {
+	uint64_t n = 0;
+
+	#if (_6502_PROFILE)
+	if (cpu->prof) return _6502_profile_run(cpu, budget, until);
+	#endif
+
+	fire(cpu);
+	cpu->stop = _6502_STOP_BUDGET;
+
+	for (;;) {
+		uint64_t stretch = until, k = budget - n, done;
+
+		//(the cycle-exact engine takes interrupts itself, at the end of the instruction letting them in)
+		if (n < budget && cpu->cycles < until && cpu->irq && !_P.flags.i && !cpu->exact.on) irq(cpu);
+
+		//a trap stands in for its routine (engines stop on landing there), or lets it through to be verified
+		if (n < budget && cpu->cycles < until && TRAPPED(cpu, _PC) && !(cpu->exact.on && EXACT_PENDING(cpu)) && _6502_trap_run(cpu)) {
+			n++;
+			fire(cpu);
+			if (cpu->stop != _6502_STOP_BUDGET || n >= budget || cpu->cycles >= until) break;
+			continue;
+		}
+
+		if (cpu->nevents && cpu->event[0].at < stretch) stretch = cpu->event[0].at;
+		if (VERIFYING(cpu) && k > 1) k = 1;
+
+		//events may have changed what idle loops read
+		forget_loop(cpu);
+		if (cpu->exact.on) done = _6502_exact_run(cpu, k, until);
+		else if (HOOKED(cpu)) done = hooked[cpu->variant](cpu, k, stretch);
+		else if (cpu->cache && !TRACING(cpu) && !WATCHING(cpu) && !cpu->replay) done = _6502_cache_run(cpu, k, stretch);
+		else done = RUN_CPU(cpu)(cpu, k, stretch);
+		n += done;
+
+		if (done && VERIFYING(cpu)) _6502_trap_check(cpu);
+		fire(cpu);
+
+		if (cpu->stop != _6502_STOP_BUDGET || n >= budget || cpu->cycles >= until) break;
+	}
+
+	#if (_6502_TRACE)
+	if (cpu->trace && cpu->trace->mode == _6502_TRACE_FLIGHT && cpu->stop != _6502_STOP_BUDGET) _6502_trace_dump(cpu);
+	#endif
+
+	return n;
+}
+
+uint64_t _6502_run(cpu6502_t *cpu, uint64_t budget) {
+	return drive(cpu, budget, UINT64_MAX);
+}
+
+uint64_t _6502_run_until(cpu6502_t *cpu, uint64_t target) {
+	return drive(cpu, UINT64_MAX, target);
+}
+
+void _6502_stop(cpu6502_t *cpu) {
+	cpu->stop_req = __6502_REQ_STOP;
+}
+
+
+
+//what was decoded or translated from the remapped pages is stale, and so is the snapshot base
+static void remapped(cpu6502_t *cpu, uint8_t page, uint16_t n) {
+	for (uint16_t i = 0; i < n; i++)
+		cpu->track[page + i] = NULL;
+	cpu->base = NULL;
+
+	_6502_replay_remapped(cpu, page, n);
+	_6502_watch_remapped(cpu, page, n);
+
+	if (!cpu->cache) return;
+
+	//the cache resolves every handler against the zero page/stack mapping
+	if (page < 2) _6502_cache_flush(cpu);
+	else _6502_cache_invalidate(cpu, page << 8, n << 8);
+
+	#if (_6502_JIT)
+	if (cpu->cache->jit) _6502_jit_remapped(cpu->cache->jit, page, n);
+	#endif
+}
+
+int _6502_map(cpu6502_t *cpu, uint8_t page, uint16_t n, uint8_t *mem, int type) {
+	if (type == _6502_MAP_IO) return _6502_map_io(cpu, page, n, cpu->read, cpu->write, cpu->user);
+	if (page + n > 256 || type < _6502_MAP_IO || type > _6502_MAP_ROM || !mem) return -1;
+
+	for (uint16_t i = 0; i < n; i++) {
+		uint8_t pg = page + i;
+
+		cpu->rpage[pg] = mem + (i << 8);
+		cpu->wpage[pg] = (type == _6502_MAP_RAM) ? mem + (i << 8) : cpu->rom_sink;
+	}
+
+	remapped(cpu, page, n);
+
+	return 0;
+}
+
+int _6502_map_io(cpu6502_t *cpu, uint8_t page, uint16_t n, _6502_read_t read, _6502_write_t write, void *user) {
+	if (page + n > 256 || !read || !write) return -1;
+
+	for (uint16_t i = 0; i < n; i++) {
+		uint8_t pg = page + i;
+
+		cpu->rpage[pg] = cpu->wpage[pg] = NULL;
+		cpu->io[pg].read = read;
+		cpu->io[pg].write = write;
+		cpu->io[pg].user = user;
+	}
+
+	remapped(cpu, page, n);
+
+	return 0;
+}
+
+uint8_t _6502_peek(cpu6502_t *cpu, uint16_t a) {
+	return bus_rd(cpu, a);
+}
+
+void _6502_poke(cpu6502_t *cpu, uint16_t a, uint8_t x) {
+	if (cpu->trap && cpu->trap->log) _6502_trap_store(cpu, a);
+	bus_write(cpu, a, x);
 }
\ No newline at end of file
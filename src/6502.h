@@ -14,6 +14,7 @@
 
 
 #include <stdint.h>
+#include <stdio.h>
 
 
 
@@ -28,24 +29,55 @@
 //some emulating debug flags, dont mind them
 //#define _6502_DEBUG 				1
 //#define _6502_PRINT_STATUS 			1
-//#define _6502_TRACK_ADDR1			0x000c
-//#define _6502_TRACK_ADDR2			0x000d
-//#define _6502_STOP_ENABLED			1
 #define _6502_RESET_ON_START		0
 //#define _6502_GET_I_TIME			1
 
-//#if (_6502_STOP_ENABLED)
-//#define _6502_STOP_AT				0x336d
-//#endif
-
-#if (!_6502_RESET_ON_START)
+//where _6502_reset starts executing by default (cpu->start, see _6502_init). _6502_RESET_ON_START = from the reset vector
+#ifndef _6502_START_ADDRESS
 #define _6502_START_ADDRESS			0x0400
 #endif
+#define _6502_START_VECTOR			(-1) //cpu->start: take it from the reset vector
 
 //#if (_6502_PRINT_STATUS)
 //#define _6502_PRINT_ONLY_ON_STOP	0
 //#endif
 
+//per address, opcode and subroutine profiler (see _6502_profile_enable). 0 = not even compiled in
+#ifndef _6502_PROFILE
+#define _6502_PROFILE				0
+#endif
+
+//binary execution trace to a ring buffer (see _6502_trace_enable). 0 = not even compiled in
+#ifndef _6502_TRACE
+#define _6502_TRACE					0
+#endif
+
+/*
+	CPU variants.
+	Every variant compiled in gets its own fused loop, with its opcodes and cycle counts built in, so
+	running one never checks which it is. _6502_CPU is the one contexts start as; _6502_CPUS, a mask of
+	(1 << variant), lists the variants linked in side by side, for _6502_variant to switch contexts to.
+*/
+
+#define _6502_CPU_NMOS				0 //documented opcodes only, the others as in the decode table (mostly single byte nops)
+#define _6502_CPU_NMOSX				1 //NMOS with the undocumented opcodes (lax, sax, dcp, isc, slo, rla, sre, rra, anc, alr, arr, sbx...), jams stopping it as stuck
+#define _6502_CPU_65C02				2 //bra, phx/phy/plx/ply, stz, trb/tsb, (zp), inc/dec a, the new bit and jmp modes, the NMOS bugs fixed
+#define _6502_CPU_R65C02			3 //65C02 with the Rockwell rmb/smb/bbr/bbs
+
+#define _6502_CPU_NAMES				{"nmos", "nmosx", "65c02", "r65c02"} //by variant, as the tools take them
+
+#ifndef _6502_CPU
+#define _6502_CPU					_6502_CPU_NMOS
+#endif
+
+#ifndef _6502_CPUS
+#define _6502_CPUS					(1 << _6502_CPU)
+#endif
+
+#if !((_6502_CPUS) & (1 << (_6502_CPU)))
+#error "_6502_CPUS must include _6502_CPU"
+#endif
+
 
 
 //extern uint8_t __debug;
@@ -67,22 +99,707 @@ typedef union {
 
 
 /*
-	Yes, i know, global variables. Forgive me.
-	Just didn't want to pass a struct pointer to each static function / use C++ and classes
+	CPU context.
+	Every emulated processor lives in its own cpu6502_t, so any number of them can run side by side
+	(one per thread, or thousands per thread). Nothing in the core touches global state.
+
+	The bus is reached through the memory map (see below): pages not mapped to host memory go to the
+	read/write callbacks, which receive the user pointer untouched.
 */
 
-extern uint16_t _PC;
-extern uint8_t _A, _X, _Y, _SP, _IR;
-extern cpu_s_t _P;
+struct cpu6502;
+
+typedef uint8_t (*_6502_read_t)(void *user, uint16_t a);
+typedef void (*_6502_write_t)(void *user, uint16_t a, uint8_t x);
+typedef void (*_6502_event_t)(struct cpu6502 *cpu, void *user); //(see _6502_schedule)
+typedef void (*_6502_cycle_t)(struct cpu6502 *cpu, void *user, uint64_t cycle, uint16_t a, uint8_t x, int write); //(see _6502_exact)
+
+#define _6502_EVENTS				64 //events pending at once, per context
+
+typedef struct cpu6502 {
+	//registers
+	uint16_t PC;
+	uint8_t A, X, Y, SP, IR;
+	cpu_s_t P; //N and Z aren't kept here but in nz: read and write the whole register with _6502_get_p/_6502_set_p
+	uint16_t nz; //last result the N and Z flags come from: Z = low byte is 0, N = bit 7 of either byte
+
+	//scratch state used while executing an instruction
+	uint16_t addr;
+	uint8_t data, fetch;
+
+	//bus
+	_6502_read_t read;
+	_6502_write_t write;
+	void *user;
+
+	//where _6502_reset sets the program counter, _6502_START_VECTOR = wherever the reset vector points
+	int32_t start;
+
+	//cpu variant (see _6502_variant)
+	uint8_t variant;
+
+	//elapsed clock cycles (base count + page crossing and branch penalties)
+	uint64_t cycles;
+
+	//run loop control (see _6502_run)
+	volatile uint8_t stop_req;
+	uint8_t stop;
+
+	//idle loop skipping (see _6502_idle)
+	uint8_t idle;
+	uint64_t idle_cycles; //cycles skipped so far
+	struct {
+		uint16_t at, to; //the backward jump or branch last taken, and where it went
+		uint8_t k; //instructions per time round, jump included. 0 = the loop doesn't qualify
+		uint64_t regs, n, cyc; //registers, instruction and cycle count the last time round
+	} loop;
+
+	//event queue and irq line (see _6502_schedule)
+	uint32_t irq; //sources holding the irq line low
+	uint32_t event_seq; //scheduling order, for events due at the same cycle
+	uint16_t nevents;
+	struct _6502_pending {
+		uint64_t at;
+		uint32_t seq;
+		_6502_event_t f;
+		void *user;
+	} event[_6502_EVENTS]; //min-heap on (at, seq)
+
+	//cycle-exact engine (see _6502_exact)
+	struct {
+		uint8_t on;
+		uint8_t poll; //the irq line as the last instruction's last cycle sampled it
+		uint8_t nmi, irq; //_6502_nmi/_6502_interrupt called, waiting for the end of the instruction
+		uint8_t mid; //events are firing in the middle of an instruction or interrupt sequence
+		_6502_cycle_t hook;
+		void *user;
+	} exact;
+
+	//predecoded block cache, NULL when disabled (see _6502_cache_enable)
+	struct _6502_cache *cache;
+
+	//memory map, one entry per 256 byte page (see _6502_map)
+	uint8_t *rpage[256], *wpage[256]; //host memory read/written directly, NULL = io callbacks
+	struct {
+		_6502_read_t read;
+		_6502_write_t write;
+		void *user;
+	} io[256]; //callbacks of the pages that aren't mapped, the context's read/write unless _6502_map_io says otherwise
+	uint8_t rom_sink[256]; //where writes to read-only pages end up
+
+	//snapshot write tracking (see _6502_snapshot)
+	const struct _6502_snapshot *base; //the snapshot memory was last captured into or restored from, NULL = none
+	uint64_t base_id;
+	uint8_t *track[256]; //ram pages tracked since then (write protected until their first store)
+	uint8_t dirty[256]; //pages stored to since then
+	uint16_t ndirty;
+
+	//breakpoints and watchpoints, NULL when none were ever set (see _6502_watch)
+	struct _6502_watch *watch;
+	struct {
+		uint16_t addr;
+		uint8_t kind; //_6502_WATCH_EXEC, _READ, _WRITE or _OPCODE (the _6502_TRAP_ outputs differing for _6502_STOP_TRAP)
+		uint8_t value; //byte read or written, the opcode for opcode breakpoints (0 for the others)
+	} hit; //what ended the last run with _6502_STOP_BREAK, _6502_STOP_WATCH or _6502_STOP_TRAP
+
+	//recording or replay going on, NULL when neither (see _6502_record)
+	struct _6502_replay *replay;
+
+	//host functions standing in for guest routines, NULL when none were ever set (see _6502_trap)
+	struct _6502_traps *trap;
+
+	//edge coverage, map NULL when off (see _6502_cover)
+	struct {
+		uint8_t *map;
+		uint32_t mask;
+		uint16_t prev; //where the last edge went, hashed and shifted
+		uint32_t *touched, ntouched; //counters gone from 0 to 1, NULL when not kept (see _6502_cover_touched)
+	} cover;
+
+	#if (_6502_PROFILE)
+	struct _6502_profile *prof; //NULL when disabled (see _6502_profile_enable)
+	#endif
+
+	#if (_6502_TRACE)
+	struct _6502_trace *trace; //NULL when disabled (see _6502_trace_enable)
+	#endif
+} cpu6502_t;
+
+
+
+//reasons for _6502_run to return (cpu->stop)
+#define _6502_STOP_BUDGET			0 //the whole budget was executed
+#define _6502_STOP_STUCK			1 //a jump or a taken branch landed on itself
+#define _6502_STOP_REQUEST			2 //_6502_stop() was called (e.g. from a bus callback, or another thread)
+#define _6502_STOP_BREAK			3 //pc reached a breakpoint, the instruction there isn't executed yet (cpu->hit)
+#define _6502_STOP_WATCH			4 //the instruction just executed accessed a watched address (cpu->hit)
+#define _6502_STOP_TRAP				5 //a routine being verified returned something else than its trap (cpu->hit)
+
+
 
+//read and write NULL: the bus compiled in with _6502_BUS (see 6502_ops.h), or else an empty one (reads $ff, writes
+//are dropped) for contexts whose pages all get mapped with _6502_map
+void _6502_init(cpu6502_t *cpu, _6502_read_t read, _6502_write_t write, void *user);
 
+//switches the context to another variant compiled in. 0 on success, -1 if not compiled in, the block cache or the cycle-exact engine is on (NMOS only), or tracing
+int _6502_variant(cpu6502_t *cpu, int variant);
 
+void _6502_reset(cpu6502_t *cpu);
+void _6502_interrupt(cpu6502_t *cpu);
+void _6502_nmi(cpu6502_t *cpu);
+void _6502_clock(cpu6502_t *cpu);
+
+/*
+	Executes up to 'budget' instructions in a single fused loop and returns how many were executed.
+	Registers are kept in locals while running, so bus callbacks must not rely on the context's registers
+	(cpu->cycles aside, which is brought up to date before every io callback).
+*/
+uint64_t _6502_run(cpu6502_t *cpu, uint64_t budget);
+//same, but runs until cpu->cycles reaches 'target' (finishing the instruction that crosses it)
+uint64_t _6502_run_until(cpu6502_t *cpu, uint64_t target);
+void _6502_stop(cpu6502_t *cpu);
+
+/*
+	Idle loops.
+	With skipping on, _6502_run notices the guest waiting: a jump or branch onto itself, or a short
+	straight-line loop (up to 32 bytes) that only reads memory and works on registers, going round twice
+	with the same registers. Since only an interrupt or the host can get it out of there, the rest of the
+	loop is skipped at once, up to the next scheduled event or the budget or cycle target of the run,
+	leaving the count of instructions and cycles exactly as if it had run.
+	cpu->idle_cycles adds up the cycles skipped. Loops reading io pages only qualify with _6502_IDLE_IO,
+	which promises those reads have no side effects and don't change within a run.
+	The profiler, when enabled, steps through idle loops like through any other code.
+*/
+
+#define _6502_IDLE_OFF				0 //jumps onto themselves end the run (_6502_STOP_STUCK)
+#define _6502_IDLE_MEM				1
+#define _6502_IDLE_IO				2
+
+void _6502_idle(cpu6502_t *cpu, int mode);
+
+
+
+/*
+	Events.
+	Devices schedule callbacks at future cycle counts instead of being polled after every instruction:
+	_6502_run and _6502_run_until execute uninterrupted up to the next deadline, then fire whatever is due
+	in order of cycle (and of scheduling, for the same cycle) with the context's registers up to date, so
+	callbacks may call _6502_interrupt/_6502_nmi, schedule more events or touch the irq line. _6502_clock
+	fires them after the instruction that reaches them, and takes a pending irq instead of executing one.
+	The irq line is level triggered: while any source holds it, an irq is taken before the next instruction
+	whenever i is clear, which includes right after cli, plp or rti clear it. The device releases the line
+	once acknowledged.
+	Called from a bus callback in the middle of a run, these end the stretch being executed so the new
+	deadline or line state is seen at the next instruction; cpu->cycles then is the count at the
+	instruction doing the access, whatever the engine.
+	Events and the irq line are the host's state: snapshots don't hold them, _6502_reset leaves them alone.
+*/
+
+int _6502_schedule(cpu6502_t *cpu, uint64_t at, _6502_event_t f, void *user); //0 on success, -1 if the queue is full or f is NULL
+void _6502_cancel(cpu6502_t *cpu, _6502_event_t f, void *user); //drops every pending event with this callback and user pointer
+void _6502_irq_set(cpu6502_t *cpu, uint32_t sources); //the sources (bitmask) pull the irq line
+void _6502_irq_clear(cpu6502_t *cpu, uint32_t sources);
+
+//the status register as software sees it (bits 4 and 5 always read as set)
+static inline uint8_t _6502_get_p(const cpu6502_t *cpu) {
+	return (cpu->P._raw & 0x7d) | (!(cpu->nz & 0xff) << 1) | ((cpu->nz | cpu->nz >> 8) & 0x80);
+}
+
+static inline void _6502_set_p(cpu6502_t *cpu, uint8_t x) {
+	cpu->P._raw = x | 0x30;
+	cpu->nz = ((x & 0x80) << 8) | !(x & 0x02);
+}
+
+
+
+/*
+	Cycle-exact engine (NMOS).
+	For hardware where the sequence of bus cycles matters (io with side effects on reads, registers
+	written twice by read-modify-write instructions), runs can go through a second engine instead of
+	the fused loop: every cycle of an instruction is a bus access of its own, made in the order and at
+	the address the NMOS makes it, dummy ones included (the operand read again while indexing zero
+	page, the unfixed address read before a page crossing is fixed or a store or rmw through abs,x,
+	abs,y or (zp),y, the old value written back by rmw before the new one, the stack read before
+	pulling, the byte after an implied opcode). cpu->cycles is the cycle of the access for the io
+	callbacks, and the hook, if any, sees every access right after it's made.
+	Events fire before the access of the cycle they're due at (between instructions for those due by
+	the end of one, as when stepping), and the irq line is sampled before every cycle: what the last
+	cycle of an instruction saw decides whether the interrupt sequence (7 cycles, pushes and vector
+	reads included) comes next: cli and plp clearing i let an irq in one instruction late, sei and
+	plp setting it one instruction late too, rti at once, and a taken branch not crossing a page
+	doesn't look at the line.
+	_6502_interrupt and _6502_nmi are taken the same way, at the end of the instruction going on (or
+	before the next one), and _6502_clock steps through interrupt sequences as it does instructions.
+	Instruction and cycle counts are those of the fused loop. Idle loops aren't skipped, and the
+	cache, JIT and batch lanes aren't used; breakpoints and watches work, opcode breakpoints only on
+	mapped pages, while coverage and the trace aren't kept.
+*/
+
+//switches the context to the engine (on = 1) or back. 0 on success, -1 if not an NMOS context
+int _6502_exact(cpu6502_t *cpu, int on);
+//calls f after every bus cycle the engine makes (write = 1 for stores), NULL for none
+void _6502_exact_hook(cpu6502_t *cpu, _6502_cycle_t f, void *user);
+
+
+
+/*
+	Memory map.
+	Every page starts out as io, reaching the callbacks given to _6502_init. Mapping pages as ram or rom
+	turns their accesses (opcode fetches included) into a single indexed load/store on host memory;
+	_6502_map_io gives a range its own callbacks, so devices don't need a chain of address compares.
+	With pages 0 and 1 mapped, zero page and stack accesses skip the lookup altogether: while running,
+	they may be remapped to other memory but not to io.
+	Remapping invalidates the block cache for the pages involved.
+*/
+
+#define _6502_MAP_IO				0
+#define _6502_MAP_RAM				1
+#define _6502_MAP_ROM				2 //writes are dropped
+
+//maps pages [page, page + n) to 'mem' (n * 256 bytes; io goes back to the _6502_init callbacks). 0 on success, -1 on a bad range or type
+int _6502_map(cpu6502_t *cpu, uint8_t page, uint16_t n, uint8_t *mem, int type);
+int _6502_map_io(cpu6502_t *cpu, uint8_t page, uint16_t n, _6502_read_t read, _6502_write_t write, void *user); //read and write are required
+
+//a byte through the map, as the guest would access it (the block cache sees the store)
+uint8_t _6502_peek(cpu6502_t *cpu, uint16_t a);
+void _6502_poke(cpu6502_t *cpu, uint16_t a, uint8_t x);
+
+
+
+/*
+	Breakpoints and watchpoints.
+	Any number of addresses can be watched, at no cost for the pages holding none: a run with breakpoints
+	goes through a second fused loop per variant, checking a per-page count before every instruction
+	(and the per-address kinds only on pages that have some) and a per-opcode flag once it's fetched; pages with read/write watches get the
+	watch's callbacks in the memory map in place of their own, and forward every access to what was
+	mapped there before (ram, rom, io or a snapshot's write tracking), remapping included.
+	A breakpoint stops the run before the instruction at its address (_6502_STOP_BREAK); the next run
+	executes it, and stops there again only once it comes back (or after a snapshot is restored). A watchpoint stops the run after the
+	instruction that made the access (_6502_STOP_WATCH); cpu->hit tells which address, kind and byte,
+	the first one of the instruction. _6502_clock leaves a watch hit pending: the next run returns it at once.
+	Opcode breakpoints stop the run the same way before any instruction with that opcode (the profiler,
+	stepping through _6502_clock, only stops at addresses).
+	While anything is watched, runs go through the plain fused loop (no cache, JIT or batch lanes), and
+	watching pages 0 or 1 takes zero page and stack accesses through the map too. Watches may be set
+	from bus callbacks (the stretch being run ends); _6502_unwatch_all only between runs.
+*/
+
+#define _6502_WATCH_EXEC			1 //breakpoint
+#define _6502_WATCH_READ			2
+#define _6502_WATCH_WRITE			4
+#define _6502_WATCH_VALUE			8 //with _READ/_WRITE: only when the byte read or written is 'value'
+#define _6502_WATCH_OPCODE			16 //(cpu->hit only) an opcode breakpoint, see _6502_break_op
+
+#define _6502_BREAK_ILLEGAL			(-1) //_6502_break_op: every opcode the NMOS doesn't document, for NMOS contexts (the other variants define them all)
+
+//watches [a, a + len) for 'kind' (bitmask), added to what they already watch. 0 on success, -1 on a bad range or kind, or if out of memory
+int _6502_watch(cpu6502_t *cpu, uint16_t a, uint32_t len, int kind, uint8_t value);
+void _6502_unwatch(cpu6502_t *cpu, uint16_t a, uint32_t len, int kind); //stops watching those kinds (a value match goes with the last of them)
+//stops runs before executing opcode 'op' anywhere (on = 1) or not anymore, like a breakpoint. 0 on success, -1 if out of memory
+int _6502_break_op(cpu6502_t *cpu, int op, int on);
+void _6502_unwatch_all(cpu6502_t *cpu); //and frees what watching took
+
+
+
+/*
+	Edge coverage.
+	With a map given, runs count every edge taken, AFL style: after each branch (taken or not), jump,
+	jsr, rts, rti and brk, the counter at cur ^ prev is bumped, cur being where it went hashed as AFL's
+	QEMU mode does ((pc >> 4) ^ (pc << 8), masked to the map), and prev becomes cur >> 1. With a 64K map
+	the layout is AFL's own, so it can live in its shared memory. Runs go through the loop that checks
+	breakpoints; interrupts taken and _6502_clock steps aren't counted.
+*/
+
+//counts edges into map[size] (size a power of two), from no previous edge. NULL stops counting. 0 on success, -1 on a bad size
+int _6502_cover(cpu6502_t *cpu, uint8_t *map, uint32_t size);
+//lists in list[size] the counters that go from 0 to 1, in cpu->cover.ntouched (NULL for none), so a host can clear and scan just
+//those. Counters then wrap from 255 to 1, AFL's NeverZero, so each is listed once until the host zeroes it and ntouched again
+void _6502_cover_touched(cpu6502_t *cpu, uint32_t *list);
+
+
+
+/*
+	Traps.
+	A host function can stand in for the guest routine at an address: when a run gets there (through
+	jsr, jmp, rti, or by starting there), the function runs instead, on the context's registers and on
+	memory through _6502_peek/_6502_poke, and the run goes on as if the routine had returned: the
+	cycles given plus what the function returns are charged (the jsr was already), and the return
+	address is pulled off the stack as rts would. A routine only branched into runs as guest code.
+	With _6502_TRAP_VERIFY, every call runs both: the function first, its stores undone and the
+	registers put back, then the guest routine, stepped until it returns (pc back after the jsr, the
+	stack where the function left it). The registers in the trap's flags and the bytes either of them
+	stored (ram and rom pages are compared whole, the stack only above sp, io ones at the function's
+	stores) must then be what the function made them, or the run stops (_6502_STOP_TRAP) with the
+	routine's own results in place: cpu->hit.addr is the trap, hit.kind the outputs that differ. A
+	routine that hasn't returned after _6502_TRAP_LIMIT cycles stops the run the same way, with
+	hit.kind _6502_TRAP_LOST, and is left running.
+	Stores are undone through the map, so functions being verified should only touch ram.
+	While a routine is being verified, runs take it one instruction at a time; batch lanes aren't
+	used by contexts with traps.
+*/
+
+#define _6502_TRAPS					255 //per context
+
+#define _6502_TRAP_A				1 //outputs compared when verifying
+#define _6502_TRAP_X				2
+#define _6502_TRAP_Y				4
+#define _6502_TRAP_P				8 //n, v, z and c
+#define _6502_TRAP_MEM				16 //(cpu->hit only, stores are always compared)
+#define _6502_TRAP_VERIFY			32
+#define _6502_TRAP_LOST				64 //(cpu->hit only) the routine being verified didn't return in time
+
+#define _6502_TRAP_LIMIT			100000000 //cycles a routine being verified gets to return
+
+//the routine, on cpu and memory. Returns the cycles it took beyond the trap's fixed cost
+typedef uint32_t (*_6502_trap_t)(cpu6502_t *cpu, void *user);
+
+typedef struct {
+	uint64_t calls; //run natively
+	uint64_t verified, failed; //guest runs that matched the function, and that didn't
+	uint64_t guest_cycles; //taken by the verified ones, jsr excluded, to set the cost from
+} _6502_trap_stats_t;
+
+//traps 'addr' (replacing what was there). 0 on success, -1 on bad flags, with _6502_TRAPS set already or if out of memory
+int _6502_trap(cpu6502_t *cpu, uint16_t addr, _6502_trap_t f, void *user, uint32_t cycles, int flags);
+void _6502_untrap(cpu6502_t *cpu, uint16_t addr);
+void _6502_untrap_all(cpu6502_t *cpu); //and frees what trapping took
+_6502_trap_stats_t _6502_trap_stats(const cpu6502_t *cpu, uint16_t addr); //zeroes if not trapped
+
+
+
+/*
+	Program images.
+	_6502_image_open splits a program file into segments without reading it: the file is mapped private
+	(the file itself is never written), and _6502_image_load points the memory map straight at it, so
+	nothing is copied upfront and mapping it as ram only copies the host pages the guest stores to.
+	Only whole pages can be mapped that way: the bytes of pages a segment covers in part are copied into
+	'mem' (64K, indexed by address) and those pages are mapped to it instead. Intel HEX being text, it's
+	decoded once into a buffer the segments then point to.
+	The image must stay open as long as a context maps it. Contexts loading the same image as ram share
+	its pages, each one sees the others' stores: load it as rom, or open it once per context.
+*/
+
+#define _6502_IMAGE_RAW				0 //the whole file, at the load address given
+#define _6502_IMAGE_PRG				1 //a 2 byte load address (little endian), then the data
+#define _6502_IMAGE_HEX				2 //Intel HEX: data, end of file and start address records, 16 bit addresses only
+
+#define _6502_IMAGE_SEGMENTS		32
+
+typedef struct _6502_image {
+	int format;
+	int32_t entry; //start address the file gives, -1 = none (a prg starts at its load address, hex at its start address record)
+
+	uint16_t nseg;
+	struct {
+		uint16_t addr;
+		uint32_t len; //1 to 0x10000 - addr bytes
+		const uint8_t *data;
+	} seg[_6502_IMAGE_SEGMENTS];
+
+	uint8_t *buf; //the file mapping, or the decoded hex
+	size_t size;
+	int mapped;
+} _6502_image_t;
+
+int _6502_image_format(const char *path); //from the extension: .prg, .hex or .ihx, raw for anything else
+//'load' only matters for raw images. 0 on success, -1 if unreadable, malformed or not fitting in 64K
+int _6502_image_open(_6502_image_t *img, const char *path, int format, uint16_t load);
+//maps the segments as ram or rom. 0 on success, -1 on a bad type or if mem is needed but NULL (nothing is mapped then)
+int _6502_image_load(cpu6502_t *cpu, const _6502_image_t *img, uint8_t *mem, int type);
+void _6502_image_close(_6502_image_t *img);
+
+
+
+/*
+	Snapshots.
+	A snapshot holds the registers, the cycle count and every page mapped as ram (rom and io pages are
+	the host's business). Taking or restoring one write protects the ram pages in the map, so the first
+	store to each of them marks it dirty and lifts the protection; later stores run at full speed.
+	Restoring the snapshot the context was last synced with then only copies back the dirty pages (plus
+	zero page and stack, which are never protected), while any other snapshot, or a remap in between,
+	costs a full copy. Pages the snapshot holds but the context doesn't map as ram are skipped.
+	Snapshots are read-only once taken: any number of contexts, in any thread, can restore the same one.
+	The file written by _6502_snapshot_save is the in-memory layout (host byte order, versioned), so
+	_6502_snapshot_load just maps it.
+*/
+
+typedef struct _6502_snapshot _6502_snapshot_t;
+
+_6502_snapshot_t *_6502_snapshot(cpu6502_t *cpu); //NULL if out of memory
+void _6502_restore(cpu6502_t *cpu, const _6502_snapshot_t *s);
+void _6502_snapshot_free(_6502_snapshot_t *s);
+int _6502_snapshot_save(const _6502_snapshot_t *s, const char *path); //0 on success, -1 on i/o errors
+_6502_snapshot_t *_6502_snapshot_load(const char *path); //NULL if unreadable, or not a snapshot of this version
+
+
+
+/*
+	Record and replay.
+	A recording logs everything coming from outside the guest: the bytes read from io pages (see
+	_6502_map_io), and the host's _6502_interrupt, _6502_nmi, _6502_reset and irq line changes with the
+	cycle count they came at (cycles tell instruction boundaries apart, every instruction taking some).
+	Every 'interval' cycles it also writes a keyframe: the registers, the irq line and the ram pages
+	changed since the keyframe before (all of them every _6502_REPLAY_FULL keyframes). Io reads are
+	stored run length encoded, the rest as varints, and the file is written chunk by chunk as it goes
+	(flushed at every keyframe), so a recording cut short replays up to its last keyframe.
+	Replaying needs a context set up like the recorded one (same variant, same pages mapped as ram,
+	rom and io, rom contents included): its io pages then read from the log and drop writes, and the
+	host's inputs come from the log too, through events the replay schedules. The context is run as
+	usual (breakpoints, watches, the trace or the profiler on); _6502_replay_seek restores the
+	keyframe before a cycle count and runs from there, and _6502_replay_back steps instructions back
+	the same way.
+	While recording or replaying, runs go through the fused loop (no block cache or JIT, flushed once
+	either is over) and loops polling io pages aren't skipped. With the cycle-exact engine, keyframes
+	wait for the end of the instruction their cycle falls in. Memory the host changes behind the guest's back isn't recorded,
+	nor are snapshots restored in the meantime; keyframes take a snapshot of the context (see
+	_6502_snapshot), so do a replay's seeks.
+*/
+
+#define _6502_REPLAY_INTERVAL		1000000 //default cycles between keyframes
+#define _6502_REPLAY_FULL			16 //every so many keyframes, one with every ram page
+
+typedef struct _6502_replay _6502_replay_t;
+
+//records the context to 'path' from now on, with a keyframe every 'interval' cycles (0 = _6502_REPLAY_INTERVAL). 0 on success, -1 on i/o errors, if out of memory or busy already
+int _6502_record(cpu6502_t *cpu, const char *path, uint64_t interval);
+int _6502_record_stop(cpu6502_t *cpu); //writes what's left and closes the file. 0 on success, -1 on i/o errors (then or while recording)
+
+//replays 'path' in the context, from its first keyframe. NULL if unreadable, malformed, of a variant not compiled in, out of memory or busy already
+_6502_replay_t *_6502_replay_open(cpu6502_t *cpu, const char *path);
+void _6502_replay_close(_6502_replay_t *r); //the context is left where it is, with its own io back
+//to the first instruction boundary at or after 'cycle'. 0 on success, -1 if the recording ends before (the context is then at its end)
+int _6502_replay_seek(_6502_replay_t *r, uint64_t cycle);
+//'n' instructions back (interrupts taken don't count). 0 on success, -1 if the recording starts after (the context is then at its start)
+int _6502_replay_back(_6502_replay_t *r, uint64_t n);
+uint64_t _6502_replay_start(const _6502_replay_t *r); //cycle count of the first keyframe
+uint64_t _6502_replay_end(const _6502_replay_t *r); //where the recording stopped (its last keyframe, if it was cut short)
+
+
+
+/*
+	Profiler (built with _6502_PROFILE set to 1).
+	While enabled, every instruction is stepped through _6502_clock (_6502_run included, whatever the
+	engine) and charged to its address and opcode. jsr/brk/interrupts open a frame and rts/rti close
+	every frame the stack pointer has risen above, so subroutines get inclusive and exclusive cycles and
+	the calling contexts are kept for flamegraphs. Taken backward jumps and branches count as loops.
+*/
+
+#if (_6502_PROFILE)
+typedef struct _6502_profile {
+	uint64_t exec[0x10000], cycles[0x10000]; //per address of the opcode
+	uint64_t op_exec[256], op_cycles[256]; //per opcode
+	uint64_t calls[0x10000], incl[0x10000], excl[0x10000]; //per subroutine entry point (inclusive counts nested recursion more than once)
+	uint64_t back[0x10000]; //taken backward jumps/branches per address of the jump
+	uint16_t back_to[0x10000]; //and where they go
+	struct prof_ctx *ctx; //calling contexts and open frames
+} _6502_profile_t;
+
+int _6502_profile_enable(cpu6502_t *cpu); //0 on success, -1 if out of memory
+void _6502_profile_disable(cpu6502_t *cpu);
+void _6502_profile_clear(cpu6502_t *cpu);
+//the top 'n' loops, subroutines and opcodes as text
+void _6502_profile_report(const cpu6502_t *cpu, FILE *fp, int n);
+//one "caller;callee cycles" line per calling context, for flamegraph.pl and friends
+void _6502_profile_folded(const cpu6502_t *cpu, FILE *fp);
+#endif
+
+
+
+/*
+	Trace (built with _6502_TRACE set to 1).
+	While enabled, every instruction appends a fixed-size record to a ring buffer holding the last
+	'records' of them (rounded up to a power of 2). _6502_run steps through the plain fused loop, the block
+	cache and the JIT are left alone until tracing stops and flushed then; idle loops skipped (see _6502_idle)
+	leave no record.
+	_6502_TRACE_FILE maps the file itself as the ring, so whatever was written is on disk even if the
+	process dies (not on Windows). _6502_TRACE_FLIGHT keeps the ring in memory and writes it out when a run stops early
+	(_6502_STOP_STUCK, _6502_STOP_REQUEST), on _6502_trace_dump and when disabled.
+	The file is a header followed by the ring, in host byte order; c6502-trace turns it into text.
+*/
+
+#define _6502_TRACE_FILE			0
+#define _6502_TRACE_FLIGHT			1
+
+#define _6502_TRACE_MAGIC			"c6502trc"
+#define _6502_TRACE_VERSION			4
+
+typedef struct {
+	char magic[8];
+	uint32_t version, size; //size of a record
+	uint64_t cap; //records in the ring
+	uint64_t n; //records written so far: the last min(n, cap) are in the ring, the oldest at n % cap
+	uint16_t ea; //the effective address the last one used
+	uint8_t variant; //the context's (_6502_CPU_*), which the opcodes are of
+	uint8_t pad[5];
+} _6502_trace_hdr_t;
+
+typedef struct {
+	uint64_t cycles; //at the start of the instruction
+	uint16_t pc, ea; //where the instruction is, and the effective address the one before it used (see _6502_trace_ea)
+	uint8_t op, arg[2]; //opcode and operand bytes (0 when not in mapped memory)
+	uint8_t a, x, y, sp, p; //registers before it ran, N and Z of p left to nz (see _6502_trace_p)
+	uint16_t nz; //the result N and Z came from, as in cpu6502_t
+	uint8_t pad[2];
+} _6502_trace_rec_t;
+
+//the whole status register of a record
+static inline uint8_t _6502_trace_p(const _6502_trace_rec_t *r) {
+	return (r->p & 0x7d) | (!(r->nz & 0xff) << 1) | ((r->nz | r->nz >> 8) & 0x80);
+}
+
+//the effective address record 'i' (of all those written, in the ring) used, stale for modes without one
+static inline uint16_t _6502_trace_ea(const _6502_trace_hdr_t *h, const _6502_trace_rec_t *ring, uint64_t i) {
+	return (i + 1 < h->n) ? ring[(i + 1) & (h->cap - 1)].ea : h->ea;
+}
+
+#if (_6502_TRACE)
+int _6502_trace_enable(cpu6502_t *cpu, const char *path, uint64_t records, int mode); //0 on success, -1 on i/o errors or if out of memory
+void _6502_trace_disable(cpu6502_t *cpu);
+int _6502_trace_dump(cpu6502_t *cpu); //flight recorder: writes the ring to the file. 0 on success, -1 on i/o errors
+#endif
+
+
+
+/*
+	Batch.
+	_6502_batch_run runs many contexts over the same budget, as _6502_run would run each of them (same
+	registers, memory, cycle counts and stop reasons), _6502_BATCH_LANES of them at a time in lock step:
+	an instruction is executed at once for every context at the same pc, with the host's vector unit
+	doing the arithmetic. Meant for the same code over different data (e.g. a routine over many inputs),
+	where contexts keep to the same path most of the time; contexts wandering off wait for the others
+	to catch up with them. Contexts with events pending, the irq line held, idle loop skipping, the
+	block cache, the cycle-exact engine, the profiler, the trace, watches, coverage or traps on, or of another variant than NMOS, simply run through _6502_run.
+	Io callbacks are called in each context's own order, but interleaved between contexts. A stop
+	request made from another thread is seen within 256 instructions (from a callback, at once).
+	Without GCC vector extensions it comes down to a loop over _6502_run.
+*/
+
+//contexts in lock step (8, 16 or 32): one 16 bit lane each in the widest vector register the batch engine is compiled for
+#ifndef _6502_BATCH_LANES
+#if defined(__AVX512BW__)
+#define _6502_BATCH_LANES			32
+#elif defined(__AVX2__)
+#define _6502_BATCH_LANES			16
+#else
+#define _6502_BATCH_LANES			8
+#endif
+#endif
+
+//runs cpu[0 .. n) for up to 'budget' instructions each, putting how many in count[] (if not NULL). Returns the sum
+uint64_t _6502_batch_run(cpu6502_t *const *cpu, int n, uint64_t budget, uint64_t *count);
+
+
+
+/*
+	Block cache.
+	Once enabled, _6502_run executes straight-line runs of predecoded instructions (opcode and operand
+	read once, handler resolved once) instead of fetching through the bus every time. Only code in mapped
+	memory is decoded: an instruction with a byte on an io page is fetched through the callbacks every
+	time it runs, as by the plain loop, and never kept.
+	Writes going through the core invalidate the blocks they hit. Memory changed behind the core's back
+	(host pokes, bank switching) must be reported with _6502_cache_invalidate / _6502_cache_flush.
+*/
+
+typedef struct {
+	uint64_t hits, misses, invalidations;
+	uint64_t recompiled; //blocks run from an attached recompiled table (see _6502_recomp_attach)
+} _6502_cache_stats_t;
+
+int _6502_cache_enable(cpu6502_t *cpu); //0 on success, -1 if out of memory or not an NMOS context
+void _6502_cache_disable(cpu6502_t *cpu);
+void _6502_cache_flush(cpu6502_t *cpu);
+void _6502_cache_invalidate(cpu6502_t *cpu, uint16_t a, uint32_t len);
+_6502_cache_stats_t _6502_cache_stats(const cpu6502_t *cpu);
+
+
+
+/*
+	JIT (x86-64 hosts).
+	On top of the block cache: blocks that keep being hit are translated to native code, with A, X, Y
+	and the carry/zero flags held in host registers. Pages mapped as ram or rom are read and written
+	directly, everything else still goes through the io callbacks. brk, rti, jmp (abs) and
+	jumps onto themselves are left to the interpreter, as are blocks too long for the remaining budget.
+	Self-modifying code is handled like in the cache: a store hitting decoded code ends the block.
+	Remapping pages (bank switching from an io callback included) ends the block too when it read
+	them, and drops just the translations that did; pages remapped once are read through the page
+	table from then on. Translated blocks go on straight into one another (returns through a lookup of the cache) as long
+	as the interpreter wouldn't have stopped in between: within the budget and before the next event,
+	no irq pending, no stop requested, no idle loop detection or traps set. The code buffer is never
+	writable and executable at the same time.
+*/
+
+typedef struct {
+	uint64_t blocks, runs, flushes; //blocks translated, translated blocks executed, code buffer flushes
+	uint64_t chained; //translated blocks entered straight from another one (not counted in runs)
+} _6502_jit_stats_t;
+
+int _6502_jit_enable(cpu6502_t *cpu); //enables the block cache too. 0 on success, -1 if not supported by the host, out of memory or not an NMOS context
+void _6502_jit_disable(cpu6502_t *cpu);
+_6502_jit_stats_t _6502_jit_stats(const cpu6502_t *cpu);
+
+
+
+/*
+	Static recompilation.
+	c6502-recomp turns the code of an image into C ahead of time: starting from its entry point and
+	vectors, it follows branches, jumps and calls, and writes one function per block the cache would
+	decode there, running the same handlers with operands and addresses as constants. Compiled with the
+	host compiler and linked with the core, the table it defines is attached to a context: a block the
+	cache decodes at an address the table has, with the very bytes recompiled, then runs the function.
+	Everything else (code only reached through computed jumps or rts tricks, code built in ram, code
+	overwritten since) is interpreted by the cache as usual. Budgets, idle loops, irq polling, io
+	callbacks and self-modifying code behave exactly as without the table.
+*/
+
+struct _6502_recomp_run; //the limits of the cache's run, as seen by a recompiled block (6502_ops.h)
+
+typedef struct {
+	uint16_t pc, len; //address and length in bytes
+	uint8_t n, cyc; //instructions, and the most cycles they can take
+	const uint8_t *code; //the bytes recompiled
+	void (*run)(cpu6502_t *cpu, struct _6502_recomp_run *r);
+} _6502_recomp_block_t;
+
+typedef struct {
+	uint32_t n;
+	const _6502_recomp_block_t *blk; //by address
+} _6502_recomp_t;
+
+int _6502_recomp_attach(cpu6502_t *cpu, const _6502_recomp_t *rc); //enables the block cache too. 0 on success, -1 if out of memory or not an NMOS context
+void _6502_recomp_detach(cpu6502_t *cpu);
+
+
+
+/*
+	Legacy single-instance api.
+	Define _6502_LEGACY_API to 1 before including this header to keep using the old global register names
+	and argument-less calls. They all operate on the default context _6502_cpu, whose bus is routed to
+	the link-time _6502_read/_6502_write symbols (which the including program must then define).
+*/
+
+extern cpu6502_t _6502_cpu;
+
+#if (_6502_LEGACY_API)
 extern uint8_t _6502_read(uint16_t);
 extern void _6502_write(uint16_t, uint8_t);
 
+static inline uint8_t __6502_legacy_read(void *user, uint16_t a) {(void) user; return _6502_read(a);}
+static inline void __6502_legacy_write(void *user, uint16_t a, uint8_t x) {(void) user; _6502_write(a, x);}
+
+#define _PC							(_6502_cpu.PC)
+#define _A							(_6502_cpu.A)
+#define _X							(_6502_cpu.X)
+#define _Y							(_6502_cpu.Y)
+#define _SP							(_6502_cpu.SP)
+#define _IR							(_6502_cpu.IR)
+#define _P							(_6502_cpu.P)
 
+//_P is kept whole between calls, N and Z move in and out of the context's lazy form around each of them
+#define __6502_LEGACY_CALL(f)		(_6502_set_p(&_6502_cpu, _P._raw), (f)(&_6502_cpu), (_P._raw = _6502_get_p(&_6502_cpu)))
 
-void _6502_reset();
-void _6502_interrupt();
-void _6502_nmi();
-void _6502_clock();
\ No newline at end of file
+//the parenthesized names call the real functions, bypassing these macros
+#define _6502_reset()				((_6502_cpu.read = __6502_legacy_read), (_6502_cpu.write = __6502_legacy_write), _6502_map(&_6502_cpu, 0, 256, NULL, _6502_MAP_IO), __6502_LEGACY_CALL(_6502_reset))
+#define _6502_interrupt()			__6502_LEGACY_CALL(_6502_interrupt)
+#define _6502_nmi()					__6502_LEGACY_CALL(_6502_nmi)
+#define _6502_clock()				__6502_LEGACY_CALL(_6502_clock)
+#endif
\ No newline at end of file
@@ -0,0 +1,813 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <string.h>
+
+#include "6502.h"
+#include "6502_ops.h"
+
+
+
+/*
+	Lock-step batch interpreter.
+	Up to _6502_BATCH_LANES contexts are loaded into vectors, one lane each (registers widened to 16
+	bits, cycle and instruction counts to 64). Every step takes the lowest pc among the lanes still
+	running and executes its instruction at once for every lane sitting at that pc on the same opcode:
+	addressing, alu and flags are computed for all lanes with GCC vector extensions, then blended into
+	the lanes taking part, while memory is gathered and scattered lane by lane through each context's
+	own map. Lanes a branch sent elsewhere wait until the lowest pc catches up with them, which is where
+	diverging loops and ifs join again.
+	While the lanes of a step go on together, still ahead of the waiting ones and with no io callback in
+	between, the next step takes them as they are: no lead is picked, no opcode compared, no blending
+	when they're all the lanes. Operand bytes are read once when all the lanes run the same host memory
+	(e.g. one rom image), zero page and stack come straight from pointers kept for each lane, and cycle
+	and instruction counts add up in 16 bit lanes, spilled into the 64 bit ones now and then.
+	brk, rti and jmp (abs) step their lanes through _6502_run, one instruction. Lanes that need anything
+	_6502_run would do besides executing (events, the irq line, idle loops, the cache, the profiler or
+	the trace) run through it from the start, or from the instruction where that need shows up.
+*/
+
+#if defined(__GNUC__)
+
+#define L						_6502_BATCH_LANES
+
+typedef uint16_t vw __attribute__((vector_size(2 * L)));
+typedef uint64_t vq __attribute__((vector_size(8 * L)));
+
+struct batch {
+	cpu6502_t *const *cpu; //all the contexts, lanes are loaded from here in order
+	int ncpu, next;
+	uint64_t budget, *count, total;
+
+	cpu6502_t *lane[L];
+	int ctx[L]; //index in cpu[] of each lane
+	uint32_t live;
+	uint64_t quiet; //steps before a lane can run out of budget
+
+	vw pc, a, x, y, sp, p, nz, ir; //p as in cpu_s_t, nz as in cpu6502_t
+	vq cyc, n;
+	vw dcyc, dn; //what the last steps added to cyc and n, spilled into them every SPILL steps and before they're read
+	int steps;
+
+	uint32_t bcd; //lanes doing adc/sbc in decimal mode, and their results from the tables
+	uint16_t bcd_w[L];
+
+	uint32_t group; //the lanes of the last step, when it left them at one pc in the same code page, ahead of the others (see lockstep)
+	uint16_t gpc, gwait; //where they are, and the lowest pc of the lanes waiting
+	vw gm;
+	const uint8_t *gcode;
+	int io; //an io callback or the scalar core ran since stop requests were last looked at (it might have mapped, stopped or scheduled anything)
+	int cpage; //the code page all the lanes have the same memory in, -1 if not known
+	const uint8_t *ccode;
+	vw livem; //live as a mask
+
+	uint8_t *low[L]; //each lane's zero page and stack, when they're ram mapped in one piece (lowok), else scratch
+	uint32_t lowok;
+	uint8_t scratch[0x200];
+};
+
+#define ALL(v)					((vw) {0} + (uint16_t) (v))
+#define MASK(v)					((vw) ((v) != 0)) //0xffff where v isn't 0
+#define SEL(k, x, y)			(((x) & (k)) | ((y) & ~(k)))
+#define WIDE(v)					__builtin_convertvector((vw) (v), vq)
+#define SPILL					4096 //steps of at most 8 cycles each in 16 bits
+
+#define EACH(i, bits)			for (uint32_t b_ = (bits), i; b_ && (i = __builtin_ctz(b_), 1); b_ &= b_ - 1)
+
+//lanes as a bit set and as a mask
+static inline uint32_t lanes(const vw *m) {
+	uint16_t e[L];
+	uint32_t bits = 0;
+
+	memcpy(e, m, sizeof(e));
+	for (int i = 0; i < L; i++)
+		bits |= (uint32_t) (e[i] & 1) << i;
+
+	return bits;
+}
+
+static inline void mask(uint32_t bits, vw *m) {
+	vw one, lo = {0};
+
+	//lanes 16 and up take their bit from the high half
+	for (int i = 0; i < L; i++)
+		one[i] = 1u << (i & 15), lo[i] = (i < 16) ? 0xffff : 0;
+
+	*m = MASK(SEL(lo, ALL(bits), ALL(bits >> 16)) & one);
+}
+
+
+
+//what drive does once a stretch is over: the events due fire (through an empty run, which leaves cpu->stop alone otherwise)
+static void settle(cpu6502_t *cpu) {
+	uint8_t stop = cpu->stop;
+
+	if (!cpu->nevents) return;
+
+	_6502_run(cpu, 0);
+	cpu->stop = stop;
+}
+
+//the lane from (or back to) its context
+static void load(struct batch *B, int i, int c) {
+	cpu6502_t *cpu = B->cpu[c];
+
+	B->lane[i] = cpu;
+	B->ctx[i] = c;
+	B->live |= 1u << i;
+	B->livem[i] = 0xffff;
+	B->group = 0;
+	B->cpage = -1;
+
+	B->pc[i] = cpu->PC;
+	B->a[i] = cpu->A; B->x[i] = cpu->X; B->y[i] = cpu->Y; B->sp[i] = cpu->SP;
+	B->p[i] = cpu->P._raw;
+	B->nz[i] = cpu->nz;
+	B->ir[i] = cpu->IR;
+	B->cyc[i] = cpu->cycles;
+	B->dcyc[i] = 0;
+
+	if (cpu->rpage[0] && cpu->wpage[0] == cpu->rpage[0] && cpu->rpage[1] == cpu->rpage[0] + 0x100 && cpu->wpage[1] == cpu->rpage[1]) {
+		B->low[i] = cpu->wpage[0];
+		B->lowok |= 1u << i;
+	} else {
+		B->low[i] = B->scratch;
+		B->lowok &= ~(1u << i);
+	}
+}
+
+static void store(const struct batch *B, int i) {
+	cpu6502_t *cpu = B->lane[i];
+
+	cpu->PC = B->pc[i];
+	cpu->A = B->a[i]; cpu->X = B->x[i]; cpu->Y = B->y[i]; cpu->SP = B->sp[i];
+	cpu->P._raw = B->p[i];
+	cpu->nz = B->nz[i];
+	cpu->IR = B->ir[i];
+	cpu->cycles = B->cyc[i];
+}
+
+//the lowest of the lanes
+static inline uint16_t lowest(const vw *v) {
+	uint16_t low = 0xffff;
+
+	for (int i = 0; i < L; i++)
+		low = ((*v)[i] < low) ? (*v)[i] : low;
+
+	return low;
+}
+
+static void spill(struct batch *B) {
+	B->cyc += WIDE(B->dcyc);
+	B->n += WIDE(B->dn);
+	B->dcyc = B->dn = (vw) {0};
+	B->steps = 0;
+}
+
+//whatever _6502_run would do besides executing instructions: none of it happens in lanes
+static int plain(const cpu6502_t *cpu) {
+	if (cpu->stop_req || cpu->nevents || cpu->irq || cpu->idle || cpu->cache || cpu->exact.on || cpu->variant != _6502_CPU_NMOS || WATCHING(cpu) || cpu->trap) return 0;
+
+	#if (_6502_PROFILE)
+	if (cpu->prof) return 0;
+	#endif
+	#if (_6502_TRACE)
+	if (cpu->trace) return 0;
+	#endif
+
+	return 1;
+}
+
+static void done(struct batch *B, int c, uint64_t n) {
+	if (B->count) B->count[c] = n;
+	B->total += n;
+}
+
+//the context, if any, that takes the lane next (the others run by themselves)
+static void refill(struct batch *B, int i) {
+	while (B->next < B->ncpu) {
+		int c = B->next++;
+		cpu6502_t *cpu = B->cpu[c];
+
+		if (plain(cpu)) {
+			cpu->stop = _6502_STOP_BUDGET;
+			load(B, i, c);
+			B->n[i] = 0;
+			B->dn[i] = 0;
+			return;
+		}
+
+		done(B, c, _6502_run(cpu, B->budget));
+	}
+}
+
+/*
+	The lane is done with: the context goes on from there through _6502_run, exactly as the fused loop
+	would have gone on after stopping before that instruction (the stop request handled like it does,
+	then events fire and the run carries on if there's budget left).
+*/
+static void leave(struct batch *B, int i) {
+	cpu6502_t *cpu = B->lane[i];
+	uint64_t n;
+
+	spill(B);
+	n = B->n[i];
+	store(B, i);
+	B->live &= ~(1u << i);
+	B->livem[i] = 0;
+	B->group = 0;
+	B->io = 1;
+
+	if (cpu->stop_req) {
+		if (cpu->stop_req & __6502_REQ_STOP) cpu->stop = _6502_STOP_REQUEST;
+		else if (cpu->stop_req & __6502_REQ_WATCH) cpu->stop = _6502_STOP_WATCH;
+		cpu->stop_req = 0;
+	}
+
+	if (cpu->stop == _6502_STOP_BUDGET && n < B->budget) n += _6502_run(cpu, B->budget - n);
+	else settle(cpu);
+
+	done(B, B->ctx[i], n);
+
+	refill(B, i);
+}
+
+//one instruction of each lane through the scalar core
+static void scalar(struct batch *B, uint32_t bits) {
+	spill(B);
+	B->io = 1;
+	EACH(i, bits) {
+		cpu6502_t *cpu = B->lane[i];
+		uint64_t n = B->n[i] + 1;
+
+		store(B, i);
+		_6502_run(cpu, 1);
+		load(B, i, B->ctx[i]);
+		B->n[i] = n;
+
+		if (cpu->stop != _6502_STOP_BUDGET || !plain(cpu)) leave(B, i);
+	}
+}
+
+
+
+//memory, lane by lane, each lane's cycle count brought up to date for the io callbacks ('dc' is what the instruction added so far)
+static inline void gather(struct batch *B, uint32_t bits, const vw *ea, const vw *dc, vw *d) {
+	uint16_t a[L], r[L] = {0};
+
+	memcpy(a, ea, sizeof(a));
+	EACH(i, bits) {
+		cpu6502_t *cpu = B->lane[i];
+		const uint8_t *m = cpu->rpage[a[i] >> 8];
+
+		if (m) r[i] = m[a[i] & 0xff];
+		else r[i] = bus_rd_at(cpu, a[i], B->cyc[i] + B->dcyc[i] + (*dc)[i]), B->io = 1;
+	}
+	memcpy(d, r, sizeof(r));
+}
+
+static inline void scatter(struct batch *B, uint32_t bits, const vw *ea, const vw *x, const vw *dc) {
+	uint16_t a[L], v[L];
+
+	memcpy(a, ea, sizeof(a));
+	memcpy(v, x, sizeof(v));
+	EACH(i, bits) {
+		cpu6502_t *cpu = B->lane[i];
+		uint8_t *m = cpu->wpage[a[i] >> 8];
+
+		if (m) m[a[i] & 0xff] = v[i];
+		else bus_wr_at(cpu, a[i], v[i], B->cyc[i] + B->dcyc[i] + (*dc)[i]), B->io = 1;
+	}
+}
+
+//zero page and stack of lanes that all have them in ram: straight from the pointers kept at load, every
+//lane at once (ea is below $200 in all of them, and the others read their own memory or write the scratch)
+static inline void gather_low(struct batch *B, uint32_t bits, const vw *ea, const vw *dc, vw *d) {
+	uint16_t a[L], r[L];
+
+	if ((bits & B->lowok) != bits) {
+		gather(B, bits, ea, dc, d);
+		return;
+	}
+
+	memcpy(a, ea, sizeof(a));
+	for (int i = 0; i < L; i++)
+		r[i] = B->low[i][a[i]];
+	memcpy(d, r, sizeof(r));
+}
+
+static inline void scatter_low(struct batch *B, uint32_t bits, const vw *ea, const vw *x, const vw *dc) {
+	uint16_t a[L], v[L];
+
+	if ((bits & B->lowok) != bits) {
+		scatter(B, bits, ea, x, dc);
+		return;
+	}
+
+	memcpy(a, ea, sizeof(a));
+	memcpy(v, x, sizeof(v));
+	for (int i = 0; i < L; i++)
+		((bits >> i & 1) ? B->low[i] : B->scratch)[a[i]] = v[i];
+}
+
+//an operand byte read lane by lane, where the lanes don't share the memory holding it (see ARG8)
+static void operand(struct batch *B, uint32_t bits, uint16_t at, const vw *dc, vw *d) {
+	vw e = ALL(at);
+
+	gather(B, bits, &e, dc, d);
+}
+
+//the operation macros of 6502_ops.h, over vectors of lanes
+#undef NZ
+#undef LZ
+#undef LN
+#undef P_GET
+#undef P_SET
+#undef EA_ZP0
+#undef EA_ZPX
+#undef EA_ZPY
+#undef EA_ABS
+#undef EA_ABX
+#undef EA_ABY
+#undef EA_INX
+#undef EA_INY
+#undef PAGE
+#undef R_IMM
+#undef R_ZP0
+#undef R_ZPX
+#undef R_ZPY
+#undef R_ABS
+#undef R_ABX
+#undef R_ABY
+#undef R_INX
+#undef R_INY
+#undef M_ZP0
+#undef M_ZPX
+#undef M_ABS
+#undef M_ABX
+#undef LD
+#undef ST
+#undef TR
+#undef AND
+#undef ORA
+#undef EOR
+#undef BIT
+#undef ADC_BIN
+#undef ADC
+#undef SBC
+#undef CP
+#undef INC
+#undef DEC
+#undef ASL
+#undef LSR
+#undef ROL
+#undef ROR
+#undef RMW
+#undef PUSH
+#undef PULL
+#undef PHA
+#undef PHP
+#undef PLA
+#undef PLP
+#undef BRANCH
+#undef JMP_ABS
+#undef JSR
+#undef RTS
+
+#define RD(v, e)				(t_ = (e), gather(B, bits, &t_, &dc, &v))
+#define WR(e, x)				(t_ = (e), u_ = (x), scatter(B, bits, &t_, &u_, &dc))
+#define RD_LOW(v, e)			(t_ = (e), gather_low(B, bits, &t_, &dc, &v)) //e below $200
+#define WR_LOW(e, x)			(t_ = (e), u_ = (x), scatter_low(B, bits, &t_, &u_, &dc))
+
+#define ARG8(v)					((shared && (at >> 8) == (lpc >> 8)) ? (void) (v = ALL(shared[at++ & 0xff])) : operand(B, bits, at++, &dc, &v)) //one read when the lanes share it
+#define ARG16(v)				(ARG8(v), ARG8(w), v |= w << 8)
+
+#define CYC(v)					(dc += (v) & m)
+
+#define NZ(r)					(nz = (r))
+#define LZ						MASK((nz & 0xff) == 0)
+#define LN						MASK(((nz | nz >> 8) & 0x80) != 0)
+#define P_GET					((p & 0x7d) | (LZ & 0x02) | (LN & 0x80))
+#define P_SET(v)				(p = (v) | 0x30, nz = ((v) & 0x80) << 8 | (MASK(((v) & 0x02) == 0) & 1))
+#define FLAG(f, k)				(p = (p & ~(f)) | ((k) & (f))) //set bit f where k is all ones
+
+#define EA_ZP0					ARG8(ea)
+#define EA_ZPX					(ARG8(ea), ea = (ea + x) & 0xff)
+#define EA_ZPY					(ARG8(ea), ea = (ea + y) & 0xff)
+#define EA_ABS					ARG16(ea)
+#define EA_ABX					(EA_ABS, ea += x)
+#define EA_ABY					(EA_ABS, ea += y)
+#define EA_INX					(ARG8(t), t = (t + x) & 0xff, RD_LOW(ea, t), RD_LOW(w, (t + 1) & 0xff), ea |= w << 8) //the pointer wraps within the zero page, as in 6502_ops.h
+#define EA_INY					(ARG8(t), RD_LOW(ea, t), RD_LOW(w, (t + 1) & 0xff), ea = (ea | w << 8) + y)
+
+#define PAGE(r)					CYC(MASK((ea & 0xff) < (r)) & 1)
+
+#define R_IMM					ARG8(d)
+#define R_ZP0					(EA_ZP0, RD_LOW(d, ea))
+#define R_ZPX					(EA_ZPX, RD_LOW(d, ea))
+#define R_ZPY					(EA_ZPY, RD_LOW(d, ea))
+#define R_ABS					(EA_ABS, RD(d, ea))
+#define R_ABX					(EA_ABX, PAGE(x), RD(d, ea))
+#define R_ABY					(EA_ABY, PAGE(y), RD(d, ea))
+#define R_INX					(EA_INX, RD(d, ea))
+#define R_INY					(EA_INY, PAGE(y), RD(d, ea))
+
+#define M_ZP0					R_ZP0
+#define M_ZPX					R_ZPX
+#define M_ABS					R_ABS
+#define M_ABX					(EA_ABX, RD(d, ea))
+
+#define LD(r)					(r = d, NZ(r))
+#define ST(r)					WR(ea, r)
+#define ST_LOW(r)				WR_LOW(ea, r)
+#define TR(s, r)				(r = s, NZ(r))
+
+#define AND						(a &= d, NZ(a))
+#define ORA						(a |= d, NZ(a))
+#define EOR						(a ^= d, NZ(a))
+#define BIT						(nz = (a & d) | ((d & 0x80) << 8), FLAG(0x40, MASK(d & 0x40)))
+
+//binary for every lane, then the lanes in decimal mode are redone from the tables
+#define ADC_BIN					(w = a + d + (p & 1), FLAG(0x01, MASK(w > 0xff)), FLAG(0x40, MASK((a ^ w) & (d ^ w) & 0x80)), a = w & 0xff, NZ(a))
+#define ADC						(bcd(B, bits, &p, &a, &d, _6502_bcd_adc), ADC_BIN, bcd_out(B, &p, &a, &nz))
+#define SBC						(bcd(B, bits, &p, &a, &d, _6502_bcd_sbc), d = ~d & 0xff, ADC_BIN, bcd_out(B, &p, &a, &nz))
+
+#define CP(r)					(FLAG(0x01, MASK(r >= d)), NZ((r - d) & 0xff))
+
+#define INC(r)					(r = (r + 1) & 0xff, NZ(r))
+#define DEC(r)					(r = (r - 1) & 0xff, NZ(r))
+#define ASL(r)					(FLAG(0x01, MASK(r & 0x80)), r = (r << 1) & 0xff, NZ(r))
+#define LSR(r)					(FLAG(0x01, MASK(r & 0x01)), r >>= 1, NZ(r))
+#define ROL(r)					(t = p & 1, FLAG(0x01, MASK(r & 0x80)), r = ((r << 1) | t) & 0xff, NZ(r))
+#define ROR(r)					(t = p & 1, FLAG(0x01, MASK(r & 0x01)), r = (r >> 1) | (t << 7), NZ(r))
+#define RMW(OP)					(OP(d), WR(ea, d))
+#define RMW_LOW(OP)				(OP(d), WR_LOW(ea, d))
+
+#define PUSH(v)					(WR_LOW(sp | 0x100, v), sp = (sp - 1) & 0xff)
+#define PULL(v)					(sp = (sp + 1) & 0xff, RD_LOW(v, sp | 0x100))
+
+#define PHA						PUSH(a)
+#define PHP						PUSH(P_GET)
+#define PLA						(PULL(a), NZ(a))
+#define PLP						(PULL(t), P_SET(t))
+
+//taken lanes move (a lane branching onto itself is stuck), the others fall through
+#define BRANCH(k)				(ARG8(d), w = ALL(at) + d - ((d & 0x80) << 1), t = (k) & m, CYC(t & (1 + (MASK((w ^ at) > 0xff) & 1))), pc = SEL(t, w, ALL(at)), stuck = t & MASK(d == 0xfe), jumped = 1)
+#define JMP_ABS					(EA_ABS, pc = ea, stuck = MASK(ea == lpc), jumped = 1)
+#define JSR						(EA_ABS, PUSH(ALL(at - 1) >> 8), PUSH(ALL(at - 1) & 0xff), pc = ea, jumped = 1)
+#define RTS						(PULL(pc), PULL(w), pc = (pc | w << 8) + 1, jumped = 1)
+
+
+
+//decimal mode adc/sbc: the lanes with d set look their result up before the binary one is worked out for all, then get it back
+static inline void bcd(struct batch *B, uint32_t bits, const vw *p, const vw *a, const vw *d, const uint16_t *tab) {
+	vw dec = MASK(*p & 0x08);
+
+	B->bcd = lanes(&dec) & bits;
+
+	EACH(i, B->bcd) B->bcd_w[i] = tab[(((*p)[i] & 1) << 16) | ((*a)[i] << 8) | (*d)[i]];
+}
+
+static inline void bcd_out(const struct batch *B, vw *p, vw *a, vw *nz) {
+	if (!B->bcd) return;
+
+	EACH(i, B->bcd) {
+		uint16_t w = B->bcd_w[i];
+
+		(*a)[i] = w & 0xff;
+		(*p)[i] = ((*p)[i] & ~0x41) | ((w >> 8) & 0x01) | ((w >> 8) & 0x40);
+		(*nz)[i] = (((w >> 8) & 0x80) << 8) | !(w & 0x200);
+	}
+}
+
+static void lockstep(struct batch *B) {
+	while (B->live) {
+		uint32_t bits, stuck_bits = 0, group;
+		vw m;
+		uint16_t lpc = 0xffff;
+		const uint8_t *shared;
+		uint8_t op;
+
+		//lanes out of budget leave (a lane takes an instruction at most per step, so only once 'quiet' steps went by)
+		if (!B->quiet) {
+			spill(B);
+			EACH(i, B->live) if (B->n[i] >= B->budget) leave(B, i);
+
+			B->quiet = B->budget;
+			EACH(i, B->live) if (B->budget - B->n[i] < B->quiet) B->quiet = B->budget - B->n[i];
+		}
+
+		//so do lanes with a stop request, which only io callbacks can make (or another thread, looked at every 256 steps)
+		if (B->io || !(B->steps & 0xff)) {
+			B->io = 0;
+			B->cpage = -1;
+			EACH(i, B->live) if (B->lane[i]->stop_req) leave(B, i);
+			if (!B->live) continue;
+		}
+
+		//the lanes of the last step, still together and ahead of the others: no lead to pick, no code to compare
+		group = B->group;
+		B->group = 0;
+		if (group) {
+			bits = group;
+			lpc = B->gpc;
+			shared = B->gcode;
+			m = B->gm;
+			op = shared[lpc & 0xff];
+			goto step;
+		}
+
+		//the lowest pc leads
+		m = B->pc | ~B->livem;
+		lpc = lowest(&m);
+		m = MASK(B->pc == ALL(lpc)) & B->livem;
+		bits = lanes(&m);
+
+		//the opcode is peeked from memory (the lanes fetch it for real in the scalar core), code in io pages goes there
+		if ((lpc >> 8) != B->cpage) {
+			int lead = __builtin_ctz(bits), same = 1;
+
+			shared = B->lane[lead]->rpage[lpc >> 8];
+			if (!shared) {
+				leave(B, lead);
+				continue;
+			}
+
+			//all the lanes running the same memory there is the usual case, and then it holds until a lane is loaded or io runs
+			EACH(i, B->live) same &= B->lane[i]->rpage[lpc >> 8] == shared;
+			if (same) {
+				B->cpage = lpc >> 8;
+				B->ccode = shared;
+			}
+		}
+
+		if ((lpc >> 8) == B->cpage) {
+			shared = B->ccode;
+			op = shared[lpc & 0xff];
+		} else {
+			int same = 1;
+
+			op = shared[lpc & 0xff];
+			EACH(i, bits) {
+				const uint8_t *code = B->lane[i]->rpage[lpc >> 8];
+
+				if (code == shared) continue;
+				if (!code || code[lpc & 0xff] != op) bits &= ~(1u << i);
+				same = 0;
+			}
+			if (!same) shared = NULL;
+			mask(bits, &m);
+		}
+
+	step:
+		B->quiet--;
+
+		if (op == 0x00 || op == 0x40 || op == 0x6c) {
+			scalar(B, bits);
+			continue;
+		}
+
+		vw pc = B->pc, a = B->a, x = B->x, y = B->y, sp = B->sp, p = B->p, nz = B->nz;
+		vw ea = {0}, d = {0}, t = {0}, w = {0}, stuck = {0}, dc, t_, u_;
+		uint16_t at = lpc + 1;
+		int jumped = 0;
+
+		dc = ALL(i_jtable[op].cycles) & m;
+
+		switch (op) {
+			case 0x01: R_INX; ORA; break;
+			case 0x05: R_ZP0; ORA; break;
+			case 0x06: M_ZP0; RMW_LOW(ASL); break;
+			case 0x08: PHP; break;
+			case 0x09: R_IMM; ORA; break;
+			case 0x0a: ASL(a); break;
+			case 0x0d: R_ABS; ORA; break;
+			case 0x0e: M_ABS; RMW(ASL); break;
+			case 0x10: BRANCH(~LN); break;
+			case 0x11: R_INY; ORA; break;
+			case 0x15: R_ZPX; ORA; break;
+			case 0x16: M_ZPX; RMW_LOW(ASL); break;
+			case 0x18: p &= ~0x01; break;
+			case 0x19: R_ABY; ORA; break;
+			case 0x1d: R_ABX; ORA; break;
+			case 0x1e: M_ABX; RMW(ASL); break;
+			case 0x20: JSR; break;
+			case 0x21: R_INX; AND; break;
+			case 0x24: R_ZP0; BIT; break;
+			case 0x25: R_ZP0; AND; break;
+			case 0x26: M_ZP0; RMW_LOW(ROL); break;
+			case 0x28: PLP; break;
+			case 0x29: R_IMM; AND; break;
+			case 0x2a: ROL(a); break;
+			case 0x2c: R_ABS; BIT; break;
+			case 0x2d: R_ABS; AND; break;
+			case 0x2e: M_ABS; RMW(ROL); break;
+			case 0x30: BRANCH(LN); break;
+			case 0x31: R_INY; AND; break;
+			case 0x35: R_ZPX; AND; break;
+			case 0x36: M_ZPX; RMW_LOW(ROL); break;
+			case 0x38: p |= 0x01; break;
+			case 0x39: R_ABY; AND; break;
+			case 0x3d: R_ABX; AND; break;
+			case 0x3e: M_ABX; RMW(ROL); break;
+			case 0x41: R_INX; EOR; break;
+			case 0x45: R_ZP0; EOR; break;
+			case 0x46: M_ZP0; RMW_LOW(LSR); break;
+			case 0x48: PHA; break;
+			case 0x49: R_IMM; EOR; break;
+			case 0x4a: LSR(a); break;
+			case 0x4c: JMP_ABS; break;
+			case 0x4d: R_ABS; EOR; break;
+			case 0x4e: M_ABS; RMW(LSR); break;
+			case 0x50: BRANCH(~MASK(p & 0x40)); break;
+			case 0x51: R_INY; EOR; break;
+			case 0x55: R_ZPX; EOR; break;
+			case 0x56: M_ZPX; RMW_LOW(LSR); break;
+			case 0x58: p &= ~0x04; break;
+			case 0x59: R_ABY; EOR; break;
+			case 0x5d: R_ABX; EOR; break;
+			case 0x5e: M_ABX; RMW(LSR); break;
+			case 0x60: RTS; break;
+			case 0x61: R_INX; ADC; break;
+			case 0x65: R_ZP0; ADC; break;
+			case 0x66: M_ZP0; RMW_LOW(ROR); break;
+			case 0x68: PLA; break;
+			case 0x69: R_IMM; ADC; break;
+			case 0x6a: ROR(a); break;
+			case 0x6d: R_ABS; ADC; break;
+			case 0x6e: M_ABS; RMW(ROR); break;
+			case 0x70: BRANCH(MASK(p & 0x40)); break;
+			case 0x71: R_INY; ADC; break;
+			case 0x75: R_ZPX; ADC; break;
+			case 0x76: M_ZPX; RMW_LOW(ROR); break;
+			case 0x78: p |= 0x04; break;
+			case 0x79: R_ABY; ADC; break;
+			case 0x7d: R_ABX; ADC; break;
+			case 0x7e: M_ABX; RMW(ROR); break;
+			case 0x81: EA_INX; ST(a); break;
+			case 0x84: EA_ZP0; ST_LOW(y); break;
+			case 0x85: EA_ZP0; ST_LOW(a); break;
+			case 0x86: EA_ZP0; ST_LOW(x); break;
+			case 0x88: DEC(y); break;
+			case 0x8a: TR(x, a); break;
+			case 0x8c: EA_ABS; ST(y); break;
+			case 0x8d: EA_ABS; ST(a); break;
+			case 0x8e: EA_ABS; ST(x); break;
+			case 0x90: BRANCH(~MASK(p & 0x01)); break;
+			case 0x91: EA_INY; ST(a); break;
+			case 0x94: EA_ZPX; ST_LOW(y); break;
+			case 0x95: EA_ZPX; ST_LOW(a); break;
+			case 0x96: EA_ZPY; ST_LOW(x); break;
+			case 0x98: TR(y, a); break;
+			case 0x99: EA_ABY; ST(a); break;
+			case 0x9a: sp = x; break;
+			case 0x9d: EA_ABX; ST(a); break;
+			case 0xa0: R_IMM; LD(y); break;
+			case 0xa1: R_INX; LD(a); break;
+			case 0xa2: R_IMM; LD(x); break;
+			case 0xa4: R_ZP0; LD(y); break;
+			case 0xa5: R_ZP0; LD(a); break;
+			case 0xa6: R_ZP0; LD(x); break;
+			case 0xa8: TR(a, y); break;
+			case 0xa9: R_IMM; LD(a); break;
+			case 0xaa: TR(a, x); break;
+			case 0xac: R_ABS; LD(y); break;
+			case 0xad: R_ABS; LD(a); break;
+			case 0xae: R_ABS; LD(x); break;
+			case 0xb0: BRANCH(MASK(p & 0x01)); break;
+			case 0xb1: R_INY; LD(a); break;
+			case 0xb4: R_ZPX; LD(y); break;
+			case 0xb5: R_ZPX; LD(a); break;
+			case 0xb6: R_ZPY; LD(x); break;
+			case 0xb8: p &= ~0x40; break;
+			case 0xb9: R_ABY; LD(a); break;
+			case 0xba: TR(sp, x); break;
+			case 0xbc: R_ABX; LD(y); break;
+			case 0xbd: R_ABX; LD(a); break;
+			case 0xbe: R_ABY; LD(x); break;
+			case 0xc0: R_IMM; CP(y); break;
+			case 0xc1: R_INX; CP(a); break;
+			case 0xc4: R_ZP0; CP(y); break;
+			case 0xc5: R_ZP0; CP(a); break;
+			case 0xc6: M_ZP0; RMW_LOW(DEC); break;
+			case 0xc8: INC(y); break;
+			case 0xc9: R_IMM; CP(a); break;
+			case 0xca: DEC(x); break;
+			case 0xcc: R_ABS; CP(y); break;
+			case 0xcd: R_ABS; CP(a); break;
+			case 0xce: M_ABS; RMW(DEC); break;
+			case 0xd0: BRANCH(~LZ); break;
+			case 0xd1: R_INY; CP(a); break;
+			case 0xd5: R_ZPX; CP(a); break;
+			case 0xd6: M_ZPX; RMW_LOW(DEC); break;
+			case 0xd8: p &= ~0x08; break;
+			case 0xd9: R_ABY; CP(a); break;
+			case 0xdd: R_ABX; CP(a); break;
+			case 0xde: M_ABX; RMW(DEC); break;
+			case 0xe0: R_IMM; CP(x); break;
+			case 0xe1: R_INX; SBC; break;
+			case 0xe4: R_ZP0; CP(x); break;
+			case 0xe5: R_ZP0; SBC; break;
+			case 0xe6: M_ZP0; RMW_LOW(INC); break;
+			case 0xe8: INC(x); break;
+			case 0xe9: R_IMM; SBC; break;
+			case 0xeb: d = a; SBC; break; //(quirk of i_jtable, see 6502_ops.h)
+			case 0xec: R_ABS; CP(x); break;
+			case 0xed: R_ABS; SBC; break;
+			case 0xee: M_ABS; RMW(INC); break;
+			case 0xf0: BRANCH(LZ); break;
+			case 0xf1: R_INY; SBC; break;
+			case 0xf5: R_ZPX; SBC; break;
+			case 0xf6: M_ZPX; RMW_LOW(INC); break;
+			case 0xf8: p |= 0x08; break;
+			case 0xf9: R_ABY; SBC; break;
+			case 0xfd: R_ABX; SBC; break;
+			case 0xfe: M_ABX; RMW(INC); break;
+			default: break; //nops and illegal opcodes: just the opcode
+		}
+
+		if (!jumped) pc = ALL(at);
+
+		//(lanes that aren't live needn't keep anything)
+		if (bits == B->live) {
+			B->pc = pc;
+			B->a = a; B->x = x; B->y = y; B->sp = sp;
+			B->p = p;
+			B->nz = nz;
+			B->ir = ALL(op);
+		} else {
+			B->pc = SEL(m, pc, B->pc);
+			B->a = SEL(m, a, B->a); B->x = SEL(m, x, B->x); B->y = SEL(m, y, B->y); B->sp = SEL(m, sp, B->sp);
+			B->p = SEL(m, p, B->p);
+			B->nz = SEL(m, nz, B->nz);
+			B->ir = SEL(m, ALL(op), B->ir);
+		}
+		B->dcyc += dc;
+		B->dn += m & 1;
+		if (++B->steps == SPILL) spill(B);
+
+		//the lanes keep together for the next step if they ran shared code, went on to one pc in the same page,
+		//still lower than any other lane's (which don't move meanwhile), and no io callback ran
+		if (shared && !B->io) {
+			uint16_t next = B->pc[__builtin_ctz(bits)];
+			vw at_next = MASK(B->pc == ALL(next));
+
+			if ((next >> 8) == (lpc >> 8) && (!jumped || (lanes(&at_next) & bits) == bits)) {
+				vw wait = B->pc | ~(B->livem & ~m);
+
+				if (!group) B->gwait = lowest(&wait);
+				if (next < B->gwait) {
+					B->group = bits;
+					B->gpc = next;
+					B->gcode = shared;
+					B->gm = m;
+				}
+			}
+		}
+
+		//a jump or branch onto itself ends the lane, as it ends _6502_run
+		if (jumped) stuck_bits = lanes(&stuck) & bits;
+		EACH(i, stuck_bits) {
+			B->lane[i]->stop = _6502_STOP_STUCK;
+			leave(B, i);
+		}
+	}
+}
+
+uint64_t _6502_batch_run(cpu6502_t *const *cpu, int n, uint64_t budget, uint64_t *count) {
+	struct batch B = {.cpu = cpu, .ncpu = n, .budget = budget, .count = count};
+
+	for (int i = 0; i < L; i++) {
+		B.low[i] = B.scratch;
+		refill(&B, i);
+	}
+
+	lockstep(&B);
+
+	return B.total;
+}
+
+#else
+
+uint64_t _6502_batch_run(cpu6502_t *const *cpu, int n, uint64_t budget, uint64_t *count) {
+	uint64_t total = 0;
+
+	for (int c = 0; c < n; c++) {
+		uint64_t k = _6502_run(cpu[c], budget);
+
+		if (count) count[c] = k;
+		total += k;
+	}
+
+	return total;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,401 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "6502.h"
+#include "6502_ops.h"
+
+
+
+static void invalidate_page(struct _6502_cache *c, uint8_t pg) {
+	c->gen[pg]++;
+	memset(c->code[pg], 0, sizeof(c->code[pg]));
+	#if (_6502_JIT)
+	if (c->jit) _6502_jit_page(c->jit, pg, 0);
+	#endif
+
+	c->stats.invalidations++;
+	c->smc = 1;
+}
+
+void _6502_cache_written(struct _6502_cache *c, uint16_t a) {
+	if (c->code[a >> 8][(a & 0xff) >> 3] & BIT_O(a & 7))
+		invalidate_page(c, a >> 8);
+}
+
+
+
+//branches, jumps, calls, returns and brk end a block
+static int ends_block(uint8_t op) {
+	switch (op) {
+		case 0x00: case 0x20: case 0x40: case 0x4c: case 0x60: case 0x6c:
+		case 0x10: case 0x30: case 0x50: case 0x70: case 0x90: case 0xb0: case 0xd0: case 0xf0:
+			return 1;
+	}
+
+	return 0;
+}
+
+//the table's block at b's address, if it was recompiled from the bytes just decoded
+static const _6502_recomp_block_t *recompiled(const _6502_recomp_t *rc, const struct block *b) {
+	const _6502_recomp_block_t *r;
+	uint32_t lo = 0, hi = rc->n, k = 0;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+
+		if (rc->blk[mid].pc < b->pc) lo = mid + 1;
+		else hi = mid;
+	}
+
+	if (lo == rc->n || (r = &rc->blk[lo])->pc != b->pc || r->n != b->n) return NULL;
+
+	for (int i = 0; i < b->n; i++) {
+		const struct bop *o = &b->ops[i];
+		uint8_t len = AM_LEN(i_jtable[o->op].A_func_i);
+
+		if (k + len > r->len || r->code[k] != o->op || (len > 1 && r->code[k + 1] != (uint8_t) o->arg) || (len > 2 && r->code[k + 2] != o->arg >> 8)) return NULL;
+		k += len;
+	}
+
+	return (k == r->len) ? r : NULL;
+}
+
+//a code byte, on a page with memory behind it
+static uint8_t mem(const cpu6502_t *cpu, uint16_t a) {
+	return cpu->rpage[a >> 8][a & 0xff];
+}
+
+//0 if the first instruction isn't all in memory: read through the io callbacks, decoding would have side effects
+static int decode(cpu6502_t *cpu, struct _6502_cache *c, struct block *b, uint16_t pc) {
+	uint16_t at = pc;
+	uint8_t op, len;
+
+	b->pc = pc;
+	b->n = 0;
+
+	//stops at the first instruction starting in the next page, so a block covers at most two pages, or not in memory
+	while (b->n < __6502_CACHE_OPS && cpu->rpage[at >> 8]) {
+		struct bop *o;
+
+		op = mem(cpu, at);
+		len = AM_LEN(i_jtable[op].A_func_i);
+		if (!cpu->rpage[(uint16_t) (at + len - 1) >> 8]) break;
+
+		o = &b->ops[b->n++];
+		o->op = op;
+		o->cyc = i_jtable[op].cycles;
+		o->arg = (len > 1) ? mem(cpu, at + 1) : 0;
+		if (len > 2) o->arg |= mem(cpu, at + 2) << 8;
+
+		for (; len; len--, at++)
+			c->code[at >> 8][(at & 0xff) >> 3] |= BIT_O(at & 7);
+
+		if (ends_block(op) || (at >> 8) != (pc >> 8)) break;
+	}
+
+	if (!b->n) return 0;
+
+	b->pg[0] = pc >> 8;
+	b->pg[1] = (uint16_t) (at - 1) >> 8;
+	b->gen[0] = c->gen[b->pg[0]];
+	b->gen[1] = c->gen[b->pg[1]];
+
+	b->hot = 0;
+	b->native = NULL;
+	b->aot = c->recomp ? recompiled(c->recomp, b) : NULL;
+
+	#if (_6502_JIT)
+	if (c->jit) {
+		_6502_jit_page(c->jit, b->pg[0], 1);
+		_6502_jit_page(c->jit, b->pg[1], 1);
+	}
+	#endif
+
+	return 1;
+}
+
+//the instruction at pc fetched through the bus as the plain loop does, every time it runs (the block isn't kept)
+static void fetch(cpu6502_t *cpu, struct block *b, uint16_t pc, uint64_t cyc) {
+	struct bop *o = &b->ops[0];
+	uint8_t len;
+
+	o->op = bus_rd_at(cpu, pc, cyc);
+	o->cyc = i_jtable[o->op].cycles;
+	len = AM_LEN(i_jtable[o->op].A_func_i);
+	cyc += o->cyc;
+
+	o->arg = (len > 1) ? bus_rd_at(cpu, pc + 1, cyc) : 0;
+	if (len > 2) o->arg |= bus_rd_at(cpu, pc + 2, cyc) << 8;
+
+	b->pc = pc;
+	b->n = 1;
+	b->native = NULL;
+	b->aot = NULL;
+}
+
+
+
+/*
+	Block executor.
+	Same handlers as the plain fused loop (6502_ops.h), but operands come from the predecoded block.
+	pc is still advanced as if the bytes were fetched, so everything that looks at it behaves the same.
+*/
+
+#if (_6502_JIT)
+//address of the block's instruction i
+static uint16_t op_at(const struct block *b, uint32_t i) {
+	uint16_t at = b->pc;
+
+	while (i--)
+		at += AM_LEN(i_jtable[b->ops[i].op].A_func_i);
+
+	return at;
+}
+#endif
+
+static inline void wr(cpu6502_t *cpu, struct _6502_cache *c, uint16_t a, uint8_t x, uint64_t cyc) {
+	bus_wr_at(cpu, a, x, cyc);
+	_6502_cache_written(c, a);
+}
+
+static inline void zwr(cpu6502_t *cpu, struct _6502_cache *c, uint16_t a, uint8_t x) {
+	zp_wr(cpu, a, x);
+	_6502_cache_written(c, a);
+}
+
+#define RD(a)						bus_rd_at(cpu, (a), cyc)
+#define WR(a, x)					wr(cpu, c, (a), (x), cyc)
+
+#define ARG8						(pc++, (uint8_t) o->arg)
+#define ARG16						(pc += 2, o->arg)
+
+#define STUCK						do {if (!back) {cpu->stop = _6502_STOP_STUCK; goto out;}} while (0)
+#define LIMIT						(n >= budget || cyc >= until || cpu->stop_req)
+
+//moving the registers in and out of the context around translated blocks
+#define SAVE						(cpu->PC = pc, cpu->A = a, cpu->X = x, cpu->Y = y, cpu->SP = sp, cpu->P = p, cpu->nz = nz, cpu->IR = op, cpu->cycles = cyc)
+#define LOAD						(pc = cpu->PC, a = cpu->A, x = cpu->X, y = cpu->Y, sp = cpu->SP, p = cpu->P, nz = cpu->nz, op = cpu->IR, cyc = cpu->cycles)
+
+//every opcode twice, like in the plain loop: zero page and stack through the map (OP) or straight to memory (ZOP)
+#if (_6502_COMPUTED_GOTO)
+#define OP(h, body)					o_##h: body; NEXT;
+#define LABEL(h, body)				[0x##h] = &&o_##h,
+#define ZOP(h, body)				z_##h: body; NEXT;
+#define ZLABEL(h, body)				[0x##h] = &&z_##h,
+#define NEXT						if (++o == end || c->smc) goto done; if (LIMIT) goto out; n++; pc++; cyc += o->cyc; op = o->op; goto *o->h
+#else
+#define OP(h, body)					case 0x##h: body; break;
+#define ZOP							OP
+#endif
+
+uint64_t _6502_cache_run(cpu6502_t *cpu, uint64_t budget, uint64_t until) {
+	struct _6502_cache *c = cpu->cache;
+	struct block *b, one;
+	const struct bop *o, *end;
+
+	uint16_t pc = cpu->PC, ea, w;
+	uint8_t a = cpu->A, x = cpu->X, y = cpu->Y, sp = cpu->SP, op = cpu->IR, d, t;
+	cpu_s_t p = cpu->P;
+	uint16_t nz = cpu->nz;
+	uint64_t n = 0, cyc = cpu->cycles;
+	const uint8_t back = cpu->idle ? 0x80 : 0;
+
+	#if (_6502_COMPUTED_GOTO)
+	static const void *const ops[256] = {_6502_OPCODES(LABEL)};
+	static const void *const zops[256] = {_6502_OPCODES(ZLABEL)};
+	const void *const *tab = ZP_MAPPED(cpu) ? zops : ops;
+	#else
+	const int zp = ZP_MAPPED(cpu);
+	#endif
+
+	cpu->stop = _6502_STOP_BUDGET;
+
+	for (;;) {
+		if (LIMIT) break;
+
+		b = &c->blk[HASH(pc)];
+
+		if (b->n && b->pc == pc && b->gen[0] == c->gen[b->pg[0]] && b->gen[1] == c->gen[b->pg[1]]) {
+			c->stats.hits++;
+
+			#if (_6502_JIT)
+			if (c->jit && !b->aot && (b->native || (++b->hot == __6502_JIT_HOT && _6502_jit_compile(c->jit, b)))
+				&& n + b->nat_n <= budget && cyc + b->nat_cyc < until && !(b->nat_bcd && p.flags.d)) {
+				uint64_t k;
+
+				//(going on from block to block would skip the idle loop and trap checks below)
+				SAVE;
+				n += k = _6502_jit_exec(cpu, b, budget - n, (back || cpu->trap) ? 0 : until);
+				LOAD;
+				if (back && pc == b->pc) LOOP(op_at(b, k - 1), pc); //the block went round
+				IRQ_POLL; //(translations end after cli/plp)
+				TRAP_POLL; //(and after jsr/jmp, translated)
+				continue;
+			}
+			#endif
+		} else {
+			c->stats.misses++;
+			if (!decode(cpu, c, b, pc)) fetch(cpu, b = &one, pc, cyc);
+
+			#if (_6502_COMPUTED_GOTO)
+			for (int i = 0; i < b->n; i++)
+				b->ops[i].h = tab[b->ops[i].op];
+			#endif
+		}
+
+		//(the function checks the limits after every instruction but the last, as NEXT does)
+		if (b->aot && n + b->n <= budget && cyc + b->aot->cyc < until) {
+			struct _6502_recomp_run r = {n, budget, until, back};
+
+			SAVE;
+			c->smc = 0;
+			b->aot->run(cpu, &r);
+			LOAD;
+			n = r.n;
+			until = r.until;
+			c->stats.recompiled++;
+
+			if (cpu->stop != _6502_STOP_BUDGET) goto out;
+			continue;
+		}
+
+		o = b->ops;
+		end = o + b->n;
+		c->smc = 0;
+
+		#if (_6502_COMPUTED_GOTO)
+		n++; pc++; cyc += o->cyc; op = o->op;
+		goto *o->h;
+		{
+			#define ZRD(a)					RD(a)
+			#define ZWR(a, x)				WR(a, x)
+			_6502_OPCODES(OP)
+		}
+		{
+			#undef ZRD
+			#undef ZWR
+			#define ZRD(a)					ZP_RD(a)
+			#define ZWR(a, x)				zwr(cpu, c, (a), (x))
+			_6502_OPCODES(ZOP)
+		}
+	done:;
+		#else
+		for (;;) {
+			n++; pc++; cyc += o->cyc; op = o->op;
+
+			if (!zp) switch (op) {
+				#define ZRD(a)				RD(a)
+				#define ZWR(a, x)			WR(a, x)
+				_6502_OPCODES(OP)
+			} else switch (op) {
+				#undef ZRD
+				#undef ZWR
+				#define ZRD(a)				ZP_RD(a)
+				#define ZWR(a, x)			zwr(cpu, c, (a), (x))
+				_6502_OPCODES(ZOP)
+			}
+
+			if (++o == end || c->smc) break;
+			if (LIMIT) goto out;
+		}
+		#endif
+	}
+
+out:
+	if (cpu->stop_req) {
+		if (cpu->stop_req & __6502_REQ_STOP) cpu->stop = _6502_STOP_REQUEST;
+		else if (cpu->stop_req & __6502_REQ_WATCH) cpu->stop = _6502_STOP_WATCH;
+		cpu->stop_req = 0;
+	}
+
+	cpu->PC = pc;
+	cpu->A = a; cpu->X = x; cpu->Y = y; cpu->SP = sp;
+	cpu->P = p;
+	cpu->nz = nz;
+	cpu->IR = op;
+	cpu->cycles = cyc;
+
+	return n;
+}
+
+
+
+int _6502_cache_enable(cpu6502_t *cpu) {
+	if (cpu->cache) return 0;
+	if (cpu->variant != _6502_CPU_NMOS) return -1; //(blocks are decoded with i_jtable)
+
+	cpu->cache = calloc(1, sizeof(struct _6502_cache));
+	return cpu->cache ? 0 : -1;
+}
+
+void _6502_cache_disable(cpu6502_t *cpu) {
+	if (!cpu->cache) return;
+
+	_6502_jit_disable(cpu);
+	free(cpu->cache);
+	cpu->cache = NULL;
+}
+
+void _6502_cache_flush(cpu6502_t *cpu) {
+	if (!cpu->cache) return;
+
+	for (int i = 0; i < 256; i++)
+		cpu->cache->gen[i]++;
+
+	memset(cpu->cache->code, 0, sizeof(cpu->cache->code));
+	cpu->cache->smc = 1;
+
+	#if (_6502_JIT)
+	if (cpu->cache->jit)
+		for (int i = 0; i < 256; i++)
+			_6502_jit_page(cpu->cache->jit, i, 0);
+	#endif
+}
+
+//what the plain loop stored (it runs instead of the cache while watching, recording or replaying) never reached the cache
+void _6502_cache_stale(cpu6502_t *cpu) {
+	_6502_cache_flush(cpu);
+
+	#if (_6502_JIT)
+	if (cpu->cache && cpu->cache->jit) _6502_jit_remap(cpu->cache->jit);
+	#endif
+}
+
+void _6502_cache_invalidate(cpu6502_t *cpu, uint16_t a, uint32_t len) {
+	if (!cpu->cache) return;
+
+	for (; len; len--, a++)
+		_6502_cache_written(cpu->cache, a);
+}
+
+int _6502_recomp_attach(cpu6502_t *cpu, const _6502_recomp_t *rc) {
+	if (_6502_cache_enable(cpu)) return -1;
+
+	//blocks decoded so far get decoded again, and matched against the table
+	cpu->cache->recomp = rc;
+	_6502_cache_flush(cpu);
+
+	return 0;
+}
+
+void _6502_recomp_detach(cpu6502_t *cpu) {
+	if (!cpu->cache || !cpu->cache->recomp) return;
+
+	cpu->cache->recomp = NULL;
+	_6502_cache_flush(cpu);
+}
+
+_6502_cache_stats_t _6502_cache_stats(const cpu6502_t *cpu) {
+	return cpu->cache ? cpu->cache->stats : (_6502_cache_stats_t) {0};
+}
\ No newline at end of file
@@ -0,0 +1,228 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include "6502.h"
+#include "6502_ops.h"
+
+
+
+/*
+	The NMOS opcode list of 6502_ops.h, with the macros below in place of the fused loop's: every access
+	is a cycle of its own and counts itself, so an instruction's cycles come from the accesses it makes
+	(they add up to the decode table's). Before each one, the events due by its cycle fire with the
+	registers written back to the context, and the irq line is sampled into poll.
+*/
+
+#define SAVE					(cpu->PC = pc, cpu->A = a, cpu->X = x, cpu->Y = y, cpu->SP = sp, cpu->P = p, cpu->nz = nz, cpu->cycles = cyc)
+#define LOAD					(pc = cpu->PC, a = cpu->A, x = cpu->X, y = cpu->Y, sp = cpu->SP, p = cpu->P, nz = cpu->nz, cyc = cpu->cycles, poll = cpu->exact.poll)
+
+#define DUE						((cpu->nevents && cpu->event[0].at <= cyc) ? (void) (SAVE, cpu->exact.mid = 1, _6502_fire(cpu), cpu->exact.mid = 0) : (void) 0)
+#define SAMPLE					(poll = cpu->irq && !p.flags.i)
+
+#define RD(ad)					(DUE, SAMPLE, cycle_rd(cpu, (ad), cyc++))
+#define WR(ad, v)				(DUE, SAMPLE, cycle_wr(cpu, (ad), (v), cyc++))
+#define ZRD(ad)					RD(ad)
+#define ZWR(ad, v)				WR(ad, v)
+#define DUMMY(ad)				((void) RD(ad))
+#define QUIET(ad)				(DUE, (void) cycle_rd(cpu, (ad), cyc++)) //without sampling the irq line
+
+#define ARG8					RD(pc++)
+
+#define STUCK					do {if (!cpu->idle) {cpu->stop = _6502_STOP_STUCK; goto out;}} while (0)
+
+//(each access is sequenced: no two of them in the same expression)
+#undef EA_ZPX
+#undef EA_ZPY
+#undef EA_ABS
+#undef EA_INX
+#undef EA_INY
+#undef PAGE
+#undef W_ABX
+#undef W_ABY
+#undef W_INY
+#undef M_ABX
+#undef RMW
+#undef ZRMW
+#undef BRANCH
+#undef JMP_ABS
+#undef JMP_IND
+#undef JSR
+#undef RTS
+#undef RTI
+#undef BRK
+#undef IRQ_POLL
+#undef PLA
+#undef PLP
+
+//indexing zero page reads the base first
+#define EA_ZPX					(t = ARG8, DUMMY(t), ea = (t + x) & 0xff)
+#define EA_ZPY					(t = ARG8, DUMMY(t), ea = (t + y) & 0xff)
+#define EA_ABS					(ea = ARG8, ea |= ARG8 << 8)
+#define EA_INX					(t = ARG8, DUMMY(t), t += x, ea = ZRD(t), ea |= ZRD((uint8_t) (t + 1)) << 8)
+#define EA_INY					(t = ARG8, ea = ZRD(t), ea |= ZRD((uint8_t) (t + 1)) << 8, ea += y)
+
+//the address before the carry into its high byte is read first: by loads crossing a page, always by stores and rmw
+#define UNFIXED(r)				DUMMY(ea - (((ea & 0xff) < (r)) << 8))
+#define PAGE(r)					(((ea & 0xff) < (r)) ? UNFIXED(r) : (void) 0)
+#define W_ABX					(EA_ABX, UNFIXED(x))
+#define W_ABY					(EA_ABY, UNFIXED(y))
+#define W_INY					(EA_INY, UNFIXED(y))
+#define M_ABX					(W_ABX, d = RD(ea))
+
+//rmw writes back what it read, then the result
+#define RMW(OP)					(WR(ea, d), OP(d), WR(ea, d))
+#define ZRMW(OP)				RMW(OP)
+
+//a taken branch reads the next opcode (without looking at the irq line), and the wrong page if it crosses one
+#define BRANCH(c)				do {d = ARG8; if (c) {w = pc + (int8_t) d; if ((pc ^ w) > 0xff) {DUMMY(pc); DUMMY((pc & 0xff00) | (w & 0xff));} else QUIET(pc); pc = w; if (d == 0xfe) STUCK;}} while (0)
+
+#define JMP_ABS					do {EA_ABS; w = pc - 3; pc = ea; if (pc == w) STUCK; TRAP_POLL;} while (0)
+#define JMP_IND					(EA_ABS, w = RD(ea), w |= RD((ea & 0xff00) | ((ea + 1) & 0xff)) << 8, pc = ea = w, TRAP_POLL)
+#define JSR						(ea = ARG8, DUMMY(__6502_STACK_BOTTOM + sp), PUSH(pc >> 8), PUSH(pc), ea |= RD(pc) << 8, pc = ea, TRAP_POLL)
+#define RTS						(DUMMY(__6502_STACK_BOTTOM + sp), pc = PULL(), pc |= PULL() << 8, DUMMY(pc), pc++)
+#define RTI						(DUMMY(__6502_STACK_BOTTOM + sp), t = PULL(), P_SET(t), pc = PULL(), pc |= PULL() << 8, TRAP_POLL)
+#define BRK						((void) ARG8, PUSH(pc >> 8), PUSH(pc), PUSH(P_GET | 0x30), p.flags.i = 1, pc = RD(__6502_BRK_V), pc |= RD(__6502_BRK_V + 1) << 8)
+#define IRQ_POLL				do {} while (0) //(the line is sampled every cycle)
+#define PLA						(DUMMY(__6502_STACK_BOTTOM + sp), a = PULL(), NZ(a))
+#define PLP						(DUMMY(__6502_STACK_BOTTOM + sp), t = PULL(), P_SET(t))
+
+#define OP(h, body)				case 0x##h: body; break;
+
+
+
+//one bus cycle, at cycle 'cyc'
+static inline uint8_t cycle_rd(cpu6502_t *cpu, uint16_t a, uint64_t cyc) {
+	uint8_t x = bus_rd_at(cpu, a, cyc);
+
+	if (cpu->exact.hook) cpu->exact.hook(cpu, cpu->exact.user, cyc, a, x, 0);
+	return x;
+}
+
+static inline void cycle_wr(cpu6502_t *cpu, uint16_t a, uint8_t x, uint64_t cyc) {
+	bus_wr_at(cpu, a, x, cyc);
+	if (cpu->cache) _6502_cache_written(cpu->cache, a);
+	if (cpu->exact.hook) cpu->exact.hook(cpu, cpu->exact.user, cyc, a, x, 1);
+}
+
+
+
+int _6502_exact_interrupt(cpu6502_t *cpu) {
+	uint16_t pc = cpu->PC, v = cpu->exact.nmi ? __6502_NMI_V : __6502_IRQ_V;
+	uint8_t a = cpu->A, x = cpu->X, y = cpu->Y, sp = cpu->SP, poll = cpu->exact.poll;
+	cpu_s_t p = cpu->P;
+	uint16_t nz = cpu->nz;
+	uint64_t cyc = cpu->cycles;
+
+	//(the host's irq, unlike one the line got in, is dropped while i is set)
+	if (!cpu->exact.nmi && !poll && p.flags.i) {
+		cpu->exact.irq = 0;
+		return 0;
+	}
+
+	if (cpu->exact.nmi) cpu->exact.nmi = 0;
+	else cpu->exact.irq = 0;
+
+	//the opcode fetch made and dropped twice, then brk without the b flag
+	DUMMY(pc);
+	DUMMY(pc);
+	PUSH(pc >> 8);
+	PUSH(pc);
+	PUSH(P_GET & ~BIT_O(4));
+	p.flags.i = 1;
+	pc = RD(v);
+	pc |= RD(v + 1) << 8;
+
+	SAVE;
+	cpu->exact.poll = poll;
+
+	return 1;
+}
+
+uint64_t _6502_exact_run(cpu6502_t *cpu, uint64_t budget, uint64_t until) {
+	uint16_t pc = cpu->PC, ea = 0, w;
+	uint8_t a = cpu->A, x = cpu->X, y = cpu->Y, sp = cpu->SP, op = cpu->IR, d, t, poll = cpu->exact.poll;
+	cpu_s_t p = cpu->P;
+	uint16_t nz = cpu->nz;
+	uint64_t n = 0, cyc = cpu->cycles;
+	const uint8_t *m;
+
+	cpu->stop = _6502_STOP_BUDGET;
+
+	for (;;) {
+		if (n >= budget || cyc >= until || cpu->stop_req) break;
+
+		//events due by the end of the last instruction fire in between, as with _6502_clock: an interrupt they ask for goes in first
+		if (cpu->nevents && cpu->event[0].at <= cyc) {
+			cpu->exact.poll = poll;
+			SAVE;
+			_6502_fire(cpu);
+			LOAD;
+		}
+
+		//what the last instruction let in, or the host asked for
+		if (poll || cpu->exact.nmi || cpu->exact.irq) {
+			cpu->exact.poll = poll;
+			SAVE;
+			_6502_exact_interrupt(cpu);
+			LOAD;
+			continue;
+		}
+
+		//(opcode breakpoints look at the opcode before it's fetched: only on mapped pages, where that has no side effects)
+		if (cpu->watch) {
+			if (cpu->watch->exec[pc >> 8] && _6502_break_at(cpu, pc, cyc)) break;
+			if (cpu->watch->nops && (m = cpu->rpage[pc >> 8]) && cpu->watch->ops[m[pc & 0xff]] && _6502_break_op_at(cpu, pc, m[pc & 0xff], cyc)) break;
+		}
+
+		n++;
+		op = RD(pc++);
+
+		//implied opcodes read the next byte and drop it
+		if (i_jtable[op].A_func_i == AM_IMP) DUMMY(pc);
+
+		switch (op) {
+			_6502_OPCODES(OP)
+		}
+	}
+
+out:
+	if (cpu->stop_req) {
+		if (cpu->stop_req & __6502_REQ_STOP) cpu->stop = _6502_STOP_REQUEST;
+		else if (cpu->stop_req & __6502_REQ_WATCH) cpu->stop = _6502_STOP_WATCH;
+		cpu->stop_req = 0;
+	}
+
+	SAVE;
+	cpu->IR = op;
+	cpu->exact.poll = poll;
+
+	return n;
+}
+
+
+
+int _6502_exact(cpu6502_t *cpu, int on) {
+	if (on && cpu->variant != _6502_CPU_NMOS) return -1;
+
+	//the fused loop takes interrupts at once: what's pending goes in now
+	if (!on)
+		while (cpu->exact.on && EXACT_PENDING(cpu)) _6502_exact_interrupt(cpu);
+	else if (!cpu->exact.on) cpu->exact.poll = cpu->exact.nmi = cpu->exact.irq = 0;
+
+	cpu->exact.on = on != 0;
+
+	return 0;
+}
+
+void _6502_exact_hook(cpu6502_t *cpu, _6502_cycle_t f, void *user) {
+	cpu->exact.hook = f;
+	cpu->exact.user = user;
+}
\ No newline at end of file
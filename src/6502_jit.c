@@ -0,0 +1,1244 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "6502.h"
+#include "6502_ops.h"
+
+#if (_6502_JIT)
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+
+#define __6502_JIT_ARENA			(4 << 20) //bytes of executable memory, flushed whole when full
+#define __6502_JIT_MAX_BLOCK		(16 << 10) //worst case size of a translated block
+
+/*
+	What the translated code sees (pointed by r15).
+	While translated code runs, a, x, y, c and z live in host registers, also when a block goes on into
+	the next one, and are written back when it leaves to the interpreter.
+*/
+
+struct jstate {
+	uint8_t a, x, y, sp;
+	uint8_t c, z, n, v; //carry (0/1), zero flag as a result byte (0 = set), negative in bit 7, overflow (0/1)
+	uint8_t p; //the other bits of P (i, d, b, u)
+	uint8_t t; //scratch
+	uint8_t ir; //opcode of the last instruction executed
+	uint32_t pc, ea;
+	uint64_t cyc;
+	uint64_t count, budget, until; //instructions executed since entered, and the limits the next block has to fit in
+	uint64_t chained; //blocks entered straight from another one
+	uint8_t *link; //exit that left for a constant pc, to be pointed at the translation of that pc
+	const uint32_t *gen; //page generations of the cache
+	const uint8_t *smc; //the cache's, also set when memory read at constant addresses gets remapped
+	const struct block *blk; //blocks of the cache
+	cpu6502_t *cpu;
+	uintptr_t rmap[256], wmap[256]; //host address of the page minus (page << 8), so that map[a >> 8] + a points to 'a'. 0 = go through the bus
+	uint32_t mgen[256]; //per page mapping generation, bumped when a page that translations read at constant addresses gets remapped
+};
+
+typedef void (*enter_t)(struct jstate *s, const void *at);
+
+struct _6502_jit {
+	struct jstate s;
+	uint8_t *code;
+	size_t used, base, page; //bytes of the arena taken, of them by the shared code at its start, host page size
+	uint8_t *enter, *exit, *dispatch; //shared code, see stubs()
+	uint8_t fixed[256]; //translations made since the page was last mapped read it at constant addresses
+	uint8_t banked[256]; //the page was remapped since the JIT was enabled: constant reads of it go through rmap
+	_6502_jit_stats_t stats;
+};
+
+
+
+//bus access of the translated code, for what isn't plain memory. 'cyc': cycles into the block, up to the instruction doing it
+static uint32_t jit_rd(struct jstate *s, uint32_t a, uint32_t cyc) {
+	return bus_rd_at(s->cpu, a, s->cyc + cyc);
+}
+
+//returns nonzero when the write hit decoded code, the block has to end right after the instruction
+static uint32_t jit_wr(struct jstate *s, uint32_t a, uint32_t x, uint32_t cyc) {
+	struct _6502_cache *c = s->cpu->cache;
+
+	bus_wr_at(s->cpu, a, x, s->cyc + cyc);
+	_6502_cache_written(c, a);
+
+	return c->smc;
+}
+
+static void flush(struct _6502_jit *j) {
+	struct _6502_cache *c = j->s.cpu->cache;
+
+	for (int i = 0; i < __6502_CACHE_BLOCKS; i++) {
+		c->blk[i].native = NULL;
+		c->blk[i].hot = 0;
+	}
+
+	//(from an io callback remapping memory: the running block ends without entering any other, they could be gone)
+	j->used = j->base;
+	j->s.link = NULL;
+	j->s.until = 0;
+	memset(j->fixed, 0, sizeof(j->fixed));
+	j->stats.flushes++;
+}
+
+//the arena is never writable and executable at once: the pages about to be written are switched to writable, then back
+static int protect(struct _6502_jit *j, uint8_t *at, size_t len, int write) {
+	uintptr_t from = (uintptr_t) at & ~(j->page - 1), to = ((uintptr_t) at + len + j->page - 1) & ~(j->page - 1);
+
+	if (to > (uintptr_t) j->code + __6502_JIT_ARENA) to = (uintptr_t) j->code + __6502_JIT_ARENA;
+	return mprotect((void *) from, to - from, PROT_READ | (write ? PROT_WRITE : PROT_EXEC));
+}
+
+//when the pages can't be made executable again nothing translated can be run, it's all dropped
+static int seal(struct _6502_jit *j, uint8_t *at, size_t len) {
+	if (!protect(j, at, len, 0)) return 0;
+
+	flush(j);
+	return -1;
+}
+
+
+
+/*
+	x86-64 encoder.
+	Just the forms the translator needs: register/register and register/[base + index * scale + disp32]
+	operands, opcodes of one or two (0x0fXX) bytes.
+*/
+
+enum {RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15};
+
+//register roles while a block runs, all callee saved so the bus callbacks leave them alone
+#define RA							R12
+#define RX							R13
+#define RY							R14
+#define RC							RBX
+#define RZ							RBP
+#define RS							R15
+
+#define S(f)						((int32_t) offsetof(struct jstate, f))
+
+#define CC_O						0x0
+#define CC_C						0x2
+#define CC_NC						0x3
+#define CC_Z						0x4
+#define CC_NZ						0x5
+#define CC_A						0x7
+
+//pending exits, emitted after the block
+struct stub {
+	uint8_t *at;
+	uint16_t pc, cyc;
+	uint8_t n, op, chain;
+};
+
+struct emit {
+	uint8_t *p;
+	struct _6502_jit *j;
+
+	//the instruction being translated: address of the next one, instructions and cycles done once it completes, opcode
+	uint16_t next, cyc;
+	uint8_t n, op;
+	uint8_t bus; //it reads through the bus
+
+	uint8_t pg[__6502_JIT_PAGES]; //pages past the stack read at constant addresses, resolved at translation time
+	int npg;
+
+	struct stub stub[2 * __6502_CACHE_OPS + 2];
+	uint8_t *fail[8 + __6502_JIT_PAGES]; //entry checks that failed, see check()
+	int nstub, nfail;
+};
+
+#define B(x)						(*e->p++ = (uint8_t) (x))
+
+static void imm32(struct emit *e, uint32_t x) {
+	memcpy(e->p, &x, 4);
+	e->p += 4;
+}
+
+static void opc(struct emit *e, int op) {
+	if (op > 0xff) B(op >> 8);
+	B(op);
+}
+
+//the REX prefix is always there when spl..dil could be meant, so byte operands never get ah..bh
+static void rr(struct emit *e, int w, int op, int reg, int rm) {
+	int rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+
+	if (rex != 0x40 || (reg & ~3) == 4 || (rm & ~3) == 4) B(rex);
+	opc(e, op);
+	B(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void rm(struct emit *e, int w, int op, int reg, int base, int index, int scale, int32_t disp) {
+	int rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >= 0 ? index >> 3 : 0) << 1) | (base >> 3);
+
+	if (rex != 0x40 || (reg & ~3) == 4) B(rex);
+	opc(e, op);
+
+	if (index < 0 && (base & 7) != 4) {
+		B(0x80 | ((reg & 7) << 3) | (base & 7));
+	} else {
+		B(0x84 | ((reg & 7) << 3));
+		B((scale << 6) | (((index < 0 ? RSP : index) & 7) << 3) | (base & 7));
+	}
+
+	imm32(e, disp);
+}
+
+//op reg, [r15 + field]
+#define SM(w, op, reg, f)			rm(e, (w), (op), (reg), RS, -1, 0, S(f))
+
+static void mov_ri(struct emit *e, int r, uint32_t x) {
+	if (r >= 8) B(0x41);
+	B(0xb8 + (r & 7));
+	imm32(e, x);
+}
+
+static void mov_rq(struct emit *e, int r, uint64_t x) {
+	B(0x48 | (r >> 3));
+	B(0xb8 + (r & 7));
+	memcpy(e->p, &x, 8);
+	e->p += 8;
+}
+
+static void call(struct emit *e, const void *f) {
+	uint64_t x = (uintptr_t) f;
+
+	B(0x48); B(0xb8); //mov rax, imm64
+	memcpy(e->p, &x, 8);
+	e->p += 8;
+	B(0xff); B(0xd0); //call rax
+}
+
+static uint8_t *jcc(struct emit *e, int cc) {
+	B(0x0f); B(0x80 + cc);
+	imm32(e, 0);
+	return e->p - 4;
+}
+
+static uint8_t *jmp(struct emit *e) {
+	B(0xe9);
+	imm32(e, 0);
+	return e->p - 4;
+}
+
+static void patch(uint8_t *at, const uint8_t *to) {
+	int32_t d = to - (at + 4);
+	memcpy(at, &d, 4);
+}
+
+
+
+/*
+	Block exits.
+	They add the cycles known at translation time and the instructions done to the state, and go on
+	with the next pc without going back to the interpreter when they can: a constant one through a jump
+	that leaves (telling _6502_jit_exec where it is) until it gets patched to the entry of that pc's
+	translation, a dynamic one (rts, in ecx) through the dispatcher, which looks it up in the cache.
+	Penalties only known at run time are added on the spot.
+*/
+
+static void leave(struct emit *e, int pc, uint8_t n, uint16_t cyc, uint8_t op, int chain) {
+	SM(1, 0x81, 0, cyc); imm32(e, cyc); //add qword [cyc], imm32
+	SM(1, 0x81, 0, count); imm32(e, n);
+	SM(0, 0xc6, 0, ir); B(op); //mov byte [ir], imm8
+
+	if (pc < 0) {
+		patch(jmp(e), e->j->dispatch);
+		return;
+	}
+
+	if (chain) {
+		uint8_t *site = jmp(e); //(to the next instruction, until linked)
+
+		mov_rq(e, RAX, (uintptr_t) site);
+		SM(1, 0x89, RAX, link); //mov [link], rax
+	}
+
+	SM(0, 0xc7, 0, pc); imm32(e, pc); //mov dword [pc], imm32
+	patch(jmp(e), e->j->exit);
+}
+
+static void leave_if(struct emit *e, int cc, uint16_t pc, uint8_t n, uint16_t cyc, int chain) {
+	e->stub[e->nstub++] = (struct stub) {jcc(e, cc), pc, cyc, n, e->op, chain};
+}
+
+static void fail_if(struct emit *e, int cc) {
+	e->fail[e->nfail++] = jcc(e, cc);
+}
+
+/*
+	Entry of a block from another one.
+	It is entered only if the interpreter would run it at that point: the remaining budget and the
+	cycles before the next event fit it, no irq could be taken, nobody asked to stop, d is clear for
+	binary adc/sbc, the code it was translated from hasn't changed since and neither has the memory
+	it reads at constant addresses.
+*/
+static void check(struct emit *e, const struct block *b, uint8_t n, uint8_t max, int bcd) {
+	uint8_t *irq;
+
+	SM(1, 0x8b, RAX, cyc); //mov rax, [cyc]
+	rr(e, 1, 0x81, 0, RAX); imm32(e, max); //add rax, imm32
+	SM(1, 0x3b, RAX, until); //cmp rax, [until]
+	fail_if(e, CC_NC);
+
+	SM(1, 0x8b, RAX, count);
+	rr(e, 1, 0x81, 0, RAX); imm32(e, n);
+	SM(1, 0x3b, RAX, budget);
+	fail_if(e, CC_A);
+
+	SM(1, 0x8b, RAX, gen);
+	rm(e, 0, 0x81, 7, RAX, -1, 0, b->pg[0] * 4); imm32(e, b->gen[0]); //cmp dword [rax + page * 4], imm32
+	fail_if(e, CC_NZ);
+	rm(e, 0, 0x81, 7, RAX, -1, 0, b->pg[1] * 4); imm32(e, b->gen[1]);
+	fail_if(e, CC_NZ);
+
+	for (int i = 0; i < e->npg; i++) {
+		rm(e, 0, 0x81, 7, RS, -1, 0, S(mgen) + e->pg[i] * 4); imm32(e, e->j->s.mgen[e->pg[i]]); //cmp dword [mgen + page * 4], imm32
+		fail_if(e, CC_NZ);
+	}
+
+	SM(1, 0x8b, RAX, cpu);
+	rm(e, 0, 0x80, 7, RAX, -1, 0, offsetof(cpu6502_t, stop_req)); B(0); //cmp byte [rax + stop_req], 0
+	fail_if(e, CC_NZ);
+	rm(e, 0, 0x81, 7, RAX, -1, 0, offsetof(cpu6502_t, irq)); imm32(e, 0);
+	irq = jcc(e, CC_Z);
+	SM(0, 0xf6, 0, p); B(BIT_O(2)); //test byte [p], i
+	fail_if(e, CC_Z);
+	patch(irq, e->p);
+
+	if (bcd) {
+		SM(0, 0xf6, 0, p); B(BIT_O(3));
+		fail_if(e, CC_NZ);
+	}
+
+	SM(1, 0xff, 0, chained); //inc qword [chained]
+}
+
+//exits taken conditionally, and the way out of check()
+static void tails(struct emit *e, uint16_t pc) {
+	for (int i = 0; i < e->nstub; i++) {
+		patch(e->stub[i].at, e->p);
+		leave(e, e->stub[i].pc, e->stub[i].n, e->stub[i].cyc, e->stub[i].op, e->stub[i].chain);
+	}
+
+	for (int i = 0; i < e->nfail; i++)
+		patch(e->fail[i], e->p);
+
+	SM(0, 0xc7, 0, pc); imm32(e, pc);
+	patch(jmp(e), e->j->exit);
+}
+
+/*
+	Code shared by the blocks, at the start of the arena.
+	enter(s, at) saves the host registers, loads the guest ones and jumps to 'at'; exit writes them back
+	and returns from it; dispatch goes on to the translation of the pc in ecx if there is one.
+*/
+static void stubs(struct _6502_jit *j) {
+	struct emit o = {.p = j->code, .j = j}, *e = &o;
+	const int32_t blk_pc = offsetof(struct block, pc), blk_n = offsetof(struct block, n);
+	const int32_t blk_native = offsetof(struct block, native), blk_chain = offsetof(struct block, chain);
+
+	j->exit = e->p;
+	SM(0, 0x88, RA, a); //mov [a], r12b
+	SM(0, 0x88, RX, x);
+	SM(0, 0x88, RY, y);
+	SM(0, 0x88, RC, c);
+	SM(0, 0x88, RZ, z);
+	rr(e, 1, 0x83, 0, RSP); B(8); //add rsp, 8
+	B(0x41); B(0x5f); B(0x41); B(0x5e); B(0x41); B(0x5d); B(0x41); B(0x5c); //pop r15..r12
+	B(0x5d); B(0x5b); //pop rbp, rbx
+	B(0xc3);
+
+	j->enter = e->p;
+	B(0x53); B(0x55); //push rbx, rbp
+	B(0x41); B(0x54); B(0x41); B(0x55); B(0x41); B(0x56); B(0x41); B(0x57); //push r12..r15
+	rr(e, 1, 0x83, 5, RSP); B(8); //sub rsp, 8 (aligns the calls)
+	rr(e, 1, 0x89, RDI, RS); //mov r15, rdi
+	SM(0, 0x0fb6, RA, a); //movzx r12d, byte [a]
+	SM(0, 0x0fb6, RX, x);
+	SM(0, 0x0fb6, RY, y);
+	SM(0, 0x0fb6, RC, c);
+	SM(0, 0x0fb6, RZ, z);
+	rr(e, 0, 0xff, 4, RSI); //jmp rsi
+
+	j->dispatch = e->p;
+	SM(0, 0x89, RCX, pc); //mov [pc], ecx
+	rr(e, 0, 0x89, RCX, RAX); //mov eax, ecx
+	rr(e, 0, 0xc1, 5, RAX); B(10); //shr eax, 10
+	rr(e, 0, 0x31, RCX, RAX); //xor eax, ecx
+	rr(e, 0, 0x81, 4, RAX); imm32(e, __6502_CACHE_BLOCKS - 1); //and eax, imm32 (HASH)
+	rr(e, 0, 0x69, RAX, RAX); imm32(e, sizeof(struct block)); //imul eax, eax, imm32
+	SM(1, 0x03, RAX, blk); //add rax, [blk]
+	rm(e, 0, 0x0fb7, RDX, RAX, -1, 0, blk_pc); //movzx edx, word [rax + pc]
+	rr(e, 0, 0x39, RCX, RDX); //cmp edx, ecx
+	patch(jcc(e, CC_NZ), j->exit);
+	rm(e, 0, 0x0fb7, RDX, RAX, -1, 0, blk_n);
+	rr(e, 0, 0x85, RDX, RDX); //test edx, edx
+	patch(jcc(e, CC_Z), j->exit);
+	rm(e, 1, 0x83, 7, RAX, -1, 0, blk_native); B(0); //cmp qword [rax + native], 0
+	patch(jcc(e, CC_Z), j->exit);
+	rm(e, 0, 0xff, 4, RAX, -1, 0, blk_chain); //jmp [rax + chain]
+
+	j->base = j->used = e->p - j->code;
+}
+
+
+
+/*
+	Memory.
+	Reads leave the byte zero-extended in eax, writes store dl. Runtime addresses are passed in ecx.
+	Reads of constant addresses in mapped memory are resolved at translation time, for the zero page,
+	the stack and the pages listed in e->pg (see fixed()): remapping one of them ends the running block
+	and drops the translations reading it; pages remapped before are looked up in rmap instead.
+	Writes always look wmap up, since it changes when code gets decoded in a page.
+*/
+
+static void rd_slow(struct emit *e) {
+	rr(e, 1, 0x89, RS, RDI); //mov rdi, r15
+	mov_ri(e, RDX, e->cyc);
+	call(e, jit_rd);
+	rr(e, 0, 0x0fb6, RAX, RAX); //movzx eax, al
+	e->bus = 1;
+}
+
+//is the byte at 'a' read straight from the host memory mapped there at translation time
+static int fixed(const struct emit *e, uint16_t a) {
+	uint8_t pg = a >> 8;
+
+	if (!e->j->s.cpu->rpage[pg]) return 0;
+	if (pg < 2) return 1; //(remapping them flushes everything)
+
+	for (int i = 0; i < e->npg; i++)
+		if (e->pg[i] == pg) return 1;
+
+	return 0;
+}
+
+static void rd_at(struct emit *e, uint16_t a) {
+	uint8_t *slow, *done;
+
+	if (fixed(e, a)) {
+		uint64_t x = (uintptr_t) (e->j->s.cpu->rpage[a >> 8] + (a & 0xff));
+
+		B(0x48); B(0xb8); //mov rax, imm64
+		memcpy(e->p, &x, 8);
+		e->p += 8;
+		rm(e, 0, 0x0fb6, RAX, RAX, -1, 0, 0); //movzx eax, byte [rax]
+	} else if (e->j->s.cpu->rpage[a >> 8]) {
+		rm(e, 1, 0x8b, RAX, RS, -1, 0, S(rmap) + (a >> 8) * 8); //mov rax, [rmap + page * 8]
+		rr(e, 1, 0x85, RAX, RAX);
+		slow = jcc(e, CC_Z);
+		rm(e, 0, 0x0fb6, RAX, RAX, -1, 0, a); //movzx eax, byte [rax + a]
+		done = jmp(e);
+
+		patch(slow, e->p);
+		mov_ri(e, RSI, a);
+		rd_slow(e);
+		patch(done, e->p);
+	} else {
+		mov_ri(e, RSI, a);
+		rd_slow(e);
+	}
+}
+
+static void rd_rt(struct emit *e) {
+	uint8_t *slow, *done;
+
+	rr(e, 0, 0x89, RCX, RDX); //mov edx, ecx
+	rr(e, 0, 0xc1, 5, RDX); B(8); //shr edx, 8
+	rm(e, 1, 0x8b, RAX, RS, RDX, 3, S(rmap)); //mov rax, [rmap + rdx * 8]
+	rr(e, 1, 0x85, RAX, RAX); //test rax, rax
+	slow = jcc(e, CC_Z);
+	rm(e, 0, 0x0fb6, RAX, RAX, RCX, 0, 0); //movzx eax, byte [rax + rcx]
+	done = jmp(e);
+
+	patch(slow, e->p);
+	rr(e, 0, 0x89, RCX, RSI); //mov esi, ecx
+	rd_slow(e);
+	patch(done, e->p);
+}
+
+//'check': leave the block after this instruction if the write hit decoded code
+static void wr_slow(struct emit *e, int check) {
+	rr(e, 1, 0x89, RS, RDI); //mov rdi, r15
+	mov_ri(e, RCX, e->cyc);
+	call(e, jit_wr);
+
+	if (check) {
+		rr(e, 0, 0x85, RAX, RAX); //test eax, eax
+		leave_if(e, CC_NZ, e->next, e->n, e->cyc, 0);
+	}
+}
+
+//after an instruction reading through the bus: leave the block if a callback remapped memory it reads at constant addresses
+static void rd_check(struct emit *e) {
+	SM(1, 0x8b, RAX, smc); //mov rax, [smc]
+	rm(e, 0, 0x80, 7, RAX, -1, 0, 0); B(0); //cmp byte [rax], 0
+	leave_if(e, CC_NZ, e->next, e->n, e->cyc, 0);
+}
+
+static void wr_at(struct emit *e, uint16_t a, int check) {
+	uint8_t *slow, *done;
+
+	rm(e, 1, 0x8b, RAX, RS, -1, 0, S(wmap) + (a >> 8) * 8); //mov rax, [wmap + page * 8]
+	rr(e, 1, 0x85, RAX, RAX);
+	slow = jcc(e, CC_Z);
+	rm(e, 0, 0x88, RDX, RAX, -1, 0, a); //mov [rax + a], dl
+	done = jmp(e);
+
+	patch(slow, e->p);
+	mov_ri(e, RSI, a);
+	wr_slow(e, check);
+	patch(done, e->p);
+}
+
+static void wr_rt(struct emit *e, int check) {
+	uint8_t *slow, *done;
+
+	rr(e, 0, 0x89, RCX, R8); //mov r8d, ecx
+	rr(e, 0, 0xc1, 5, R8); B(8); //shr r8d, 8
+	rm(e, 1, 0x8b, RAX, RS, R8, 3, S(wmap)); //mov rax, [wmap + r8 * 8]
+	rr(e, 1, 0x85, RAX, RAX);
+	slow = jcc(e, CC_Z);
+	rm(e, 0, 0x88, RDX, RAX, RCX, 0, 0); //mov [rax + rcx], dl
+	done = jmp(e);
+
+	patch(slow, e->p);
+	rr(e, 0, 0x89, RCX, RSI); //mov esi, ecx
+	wr_slow(e, check);
+	patch(done, e->p);
+}
+
+//ecx = pointer read as lo in [t], hi in eax
+static void pointer(struct emit *e) {
+	rr(e, 0, 0xc1, 4, RAX); B(8); //shl eax, 8
+	SM(0, 0x0fb6, RCX, t); //movzx ecx, byte [t]
+	rr(e, 0, 0x09, RAX, RCX); //or ecx, eax
+}
+
+//page crossing penalty: cyc += ((base & 0xff) + index) >> 8, with the base low byte in edx
+static void cross(struct emit *e, int index) {
+	rr(e, 0, 0x0fb6, RAX, index); //movzx eax, index
+	rr(e, 0, 0x01, RAX, RDX); //add edx, eax
+	rr(e, 0, 0xc1, 5, RDX); B(8); //shr edx, 8
+	SM(1, 0x01, RDX, cyc); //add [cyc], rdx
+}
+
+/*
+	Effective address of the instruction, following the same quirks as EA_xxx in 6502_ops.h.
+	Returns 1 when it is the constant o->arg (zp, abs), otherwise it is left in ecx.
+*/
+static int address(struct emit *e, const struct bop *o, int page) {
+	int m = i_jtable[o->op].A_func_i;
+	int r = (m == AM_ZPX || m == AM_ABX || m == AM_INX) ? RX : RY;
+
+	switch (m) {
+		case AM_ZP0:
+		case AM_ABS:
+			return 1;
+
+		case AM_ZPX:
+		case AM_ZPY:
+			rr(e, 0, 0x0fb6, RCX, r); //movzx ecx, index
+			rr(e, 0, 0x80, 0, RCX); B(o->arg); //add cl, imm8
+			return 0;
+
+		case AM_ABX:
+		case AM_ABY:
+			if (page) {
+				mov_ri(e, RDX, o->arg & 0xff);
+				cross(e, r);
+			}
+
+			rr(e, 0, 0x0fb6, RCX, r);
+			rr(e, 0, 0x81, 0, RCX); imm32(e, o->arg); //add ecx, imm32
+			rr(e, 0, 0x0fb7, RCX, RCX); //movzx ecx, cx
+			return 0;
+
+		case AM_INX:
+			rr(e, 0, 0x0fb6, RCX, RX);
+			rr(e, 0, 0x80, 0, RCX); B(o->arg);
+			SM(0, 0x89, RCX, ea); //mov [ea], ecx
+			rd_rt(e);
+			SM(0, 0x88, RAX, t); //mov [t], al
+			SM(0, 0x8b, RCX, ea); //mov ecx, [ea]
+			rr(e, 0, 0xfe, 0, RCX); //inc cl (the pointer wraps within the zero page)
+			rd_rt(e);
+			pointer(e);
+			return 0;
+
+		case AM_INY:
+			rd_at(e, o->arg & 0xff);
+			SM(0, 0x88, RAX, t);
+			rd_at(e, (uint8_t) (o->arg + 1));
+			pointer(e);
+
+			if (page) {
+				rr(e, 0, 0x0fb6, RDX, RCX); //movzx edx, cl
+				cross(e, RY);
+			}
+
+			rr(e, 0, 0x0fb6, RAX, RY);
+			rr(e, 0, 0x01, RAX, RCX); //add ecx, eax
+			rr(e, 0, 0x0fb7, RCX, RCX);
+			return 0;
+	}
+
+	return 0;
+}
+
+//operand of a reading instruction, in eax
+static void operand(struct emit *e, const struct bop *o) {
+	if (i_jtable[o->op].A_func_i == AM_IMM)
+		mov_ri(e, RAX, o->arg & 0xff);
+	else if (address(e, o, i_jtable[o->op].page))
+		rd_at(e, o->arg);
+	else
+		rd_rt(e);
+}
+
+//stores register r to the instruction's address
+static void store(struct emit *e, const struct bop *o, int r) {
+	if (address(e, o, 0)) {
+		rr(e, 0, 0x89, r, RDX); //mov edx, r
+		wr_at(e, o->arg, 1);
+	} else {
+		rr(e, 0, 0x89, r, RDX);
+		wr_rt(e, 1);
+	}
+}
+
+//stack: push edx / pull into eax
+static void push(struct emit *e, int check) {
+	SM(0, 0x0fb6, RCX, sp); //movzx ecx, byte [sp]
+	rr(e, 0, 0x81, 1, RCX); imm32(e, __6502_STACK_BOTTOM); //or ecx, 0x100
+	SM(0, 0xfe, 1, sp); //dec byte [sp]
+	wr_rt(e, check);
+}
+
+static void pull(struct emit *e) {
+	SM(0, 0xfe, 0, sp); //inc byte [sp]
+	SM(0, 0x0fb6, RCX, sp);
+	rr(e, 0, 0x81, 1, RCX); imm32(e, __6502_STACK_BOTTOM);
+	rd_rt(e);
+}
+
+
+
+/*
+	Translator.
+	Flags: c and z stay in registers, n and v in the state. The n/z update of an instruction is dropped
+	when the next instruction touching them overwrites them before anything (a branch, php, the end of
+	the block, a store that could end it) looks at them.
+*/
+
+#define NZ_SET						1
+#define NZ_GET						2
+#define NZ_EXIT						4 //sets them, but may end the block right after (rmw)
+
+static int nz_use(uint8_t op) {
+	switch (op) {
+		case 0x10: case 0x30: case 0xd0: case 0xf0: //bpl bmi bne beq
+		case 0x08: case 0x48: //php pha
+		case 0x81: case 0x85: case 0x8d: case 0x91: case 0x95: case 0x99: case 0x9d: //sta
+		case 0x86: case 0x8e: case 0x96: case 0x84: case 0x8c: case 0x94: //stx sty
+			return NZ_GET;
+
+		case 0x06: case 0x0e: case 0x16: case 0x1e: case 0x26: case 0x2e: case 0x36: case 0x3e: //asl rol
+		case 0x46: case 0x4e: case 0x56: case 0x5e: case 0x66: case 0x6e: case 0x76: case 0x7e: //lsr ror
+		case 0xc6: case 0xce: case 0xd6: case 0xde: case 0xe6: case 0xee: case 0xf6: case 0xfe: //dec inc
+			return NZ_SET | NZ_EXIT;
+
+		case 0x01: case 0x05: case 0x09: case 0x0d: case 0x11: case 0x15: case 0x19: case 0x1d: //ora
+		case 0x21: case 0x25: case 0x29: case 0x2d: case 0x31: case 0x35: case 0x39: case 0x3d: //and
+		case 0x41: case 0x45: case 0x49: case 0x4d: case 0x51: case 0x55: case 0x59: case 0x5d: //eor
+		case 0x61: case 0x65: case 0x69: case 0x6d: case 0x71: case 0x75: case 0x79: case 0x7d: //adc
+		case 0xa1: case 0xa5: case 0xa9: case 0xad: case 0xb1: case 0xb5: case 0xb9: case 0xbd: //lda
+		case 0xc1: case 0xc5: case 0xc9: case 0xcd: case 0xd1: case 0xd5: case 0xd9: case 0xdd: //cmp
+		case 0xe1: case 0xe5: case 0xe9: case 0xed: case 0xf1: case 0xf5: case 0xf9: case 0xfd: case 0xeb: //sbc
+		case 0xa2: case 0xa6: case 0xae: case 0xb6: case 0xbe: case 0xa0: case 0xa4: case 0xac: case 0xb4: case 0xbc: //ldx ldy
+		case 0xe0: case 0xe4: case 0xec: case 0xc0: case 0xc4: case 0xcc: case 0x24: case 0x2c: //cpx cpy bit
+		case 0x0a: case 0x2a: case 0x4a: case 0x6a: //asl rol lsr ror a
+		case 0xe8: case 0xc8: case 0xca: case 0x88: //inx iny dex dey
+		case 0xaa: case 0xa8: case 0x8a: case 0x98: case 0xba: //tax tay txa tya tsx
+		case 0x68: case 0x28: //pla plp
+			return NZ_SET;
+	}
+
+	return 0;
+}
+
+//brk, rti, jmp (abs) and jumps/branches onto themselves stay with the interpreter
+static int supported(const struct bop *o, uint16_t pc) {
+	switch (o->op) {
+		case 0x00: case 0x40: case 0x6c:
+			return 0;
+
+		case 0x4c:
+			return o->arg != pc;
+
+		case 0x10: case 0x30: case 0x50: case 0x70: case 0x90: case 0xb0: case 0xd0: case 0xf0:
+			return (o->arg & 0xff) != 0xfe;
+	}
+
+	return 1;
+}
+
+//the constant address the instruction reads (the pointer for (zp),y), -1 if none; 'bus' tells if it may read through the bus at all
+static int32_t reads(const struct bop *o, int *bus) {
+	int m = i_jtable[o->op].A_func_i;
+
+	switch (o->op) {
+		case 0x84: case 0x85: case 0x86: case 0x8c: case 0x8d: case 0x8e: //stores
+		case 0x81: case 0x91: case 0x94: case 0x95: case 0x96: case 0x99: case 0x9d:
+		case 0x20: case 0x4c: //jsr, jmp
+			*bus = 0;
+			return -1;
+
+		case 0x28: case 0x68: //plp, pla
+			*bus = 1;
+			return -1;
+	}
+
+	*bus = m != AM_IMP && m != AM_IMM;
+	if (m == AM_ZP0 || m == AM_ABS) return o->arg;
+	if (m == AM_INY) return o->arg & 0xff;
+
+	return -1;
+}
+
+static int arith(uint8_t op) {
+	return (op & 0xe3) == 0x61 || (op & 0xe3) == 0xe1 || op == 0xeb; //adc, sbc
+}
+
+static void nz(struct emit *e, int r, int live) {
+	if (!live) return;
+
+	rr(e, 0, 0x89, r, RZ); //mov ebp, r
+	SM(0, 0x88, r, n); //mov [n], r8
+}
+
+//read-modify-write, 'op' being the x86 group 2 (/4 shl, /5 shr, /2 rcl, /3 rcr) or group 4 (inc, dec) operation
+static void rmw(struct emit *e, const struct bop *o, int grp, int op) {
+	int cst = address(e, o, 0);
+
+	if (cst) {
+		rd_at(e, o->arg);
+	} else {
+		SM(0, 0x89, RCX, ea);
+		rd_rt(e);
+	}
+
+	if (grp == 0xd0) {
+		if (op == 2 || op == 3) rr(e, 0, 0x0fba, 4, RC), B(0); //bt ebx, 0
+		rr(e, 0, 0xd0, op, RAX);
+		rr(e, 0, 0x0f92, 0, RC); //setc bl
+	} else {
+		rr(e, 0, 0xfe, op, RAX);
+	}
+
+	nz(e, RAX, 1);
+	rr(e, 0, 0x89, RAX, RDX);
+
+	if (cst) {
+		wr_at(e, o->arg, 1);
+	} else {
+		SM(0, 0x8b, RCX, ea);
+		wr_rt(e, 1);
+	}
+}
+
+static void shift_a(struct emit *e, int op, int live) {
+	if (op == 2 || op == 3) rr(e, 0, 0x0fba, 4, RC), B(0);
+	rr(e, 0, 0xd0, op, RA);
+	rr(e, 0, 0x0f92, 0, RC);
+	nz(e, RA, live);
+}
+
+static void adc(struct emit *e, int sub, int live) {
+	if (sub) {
+		rr(e, 0, 0x80, 7, RC); B(1); //cmp bl, 1: x86 borrow = !c
+		rr(e, 0, 0x18, RAX, RA); //sbb r12b, al
+		rr(e, 0, 0x0f93, 0, RC); //setnc bl
+	} else {
+		rr(e, 0, 0x0fba, 4, RC); B(0);
+		rr(e, 0, 0x10, RAX, RA); //adc r12b, al
+		rr(e, 0, 0x0f92, 0, RC);
+	}
+
+	SM(0, 0x0f90, 0, v); //seto [v]
+	nz(e, RA, live);
+}
+
+static void cmp(struct emit *e, int r, int live) {
+	rr(e, 0, 0x89, r, RCX); //mov ecx, r
+	rr(e, 0, 0x28, RAX, RCX); //sub cl, al
+	rr(e, 0, 0x0f93, 0, RC); //setnc bl
+	nz(e, RCX, live);
+}
+
+static void branch(struct emit *e, const struct bop *o, int cc) {
+	uint16_t w = e->next + (int8_t) o->arg;
+
+	leave_if(e, cc, w, e->n, e->cyc + 1 + ((e->next ^ w) > 0xff), 1);
+	leave(e, e->next, e->n, e->cyc, e->op, 1);
+}
+
+//emits one instruction. Returns 1 if it ended the block
+static int translate(struct emit *e, const struct bop *o, int live) {
+	uint8_t op = o->op;
+
+	switch (op) {
+		case 0xa1: case 0xa5: case 0xa9: case 0xad: case 0xb1: case 0xb5: case 0xb9: case 0xbd: //lda
+			operand(e, o); rr(e, 0, 0x89, RAX, RA); nz(e, RA, live); break;
+		case 0xa2: case 0xa6: case 0xae: case 0xb6: case 0xbe: //ldx
+			operand(e, o); rr(e, 0, 0x89, RAX, RX); nz(e, RX, live); break;
+		case 0xa0: case 0xa4: case 0xac: case 0xb4: case 0xbc: //ldy
+			operand(e, o); rr(e, 0, 0x89, RAX, RY); nz(e, RY, live); break;
+
+		case 0x81: case 0x85: case 0x8d: case 0x91: case 0x95: case 0x99: case 0x9d: //sta
+			store(e, o, RA); break;
+		case 0x86: case 0x8e: case 0x96: //stx
+			store(e, o, RX); break;
+		case 0x84: case 0x8c: case 0x94: //sty
+			store(e, o, RY); break;
+
+		case 0x01: case 0x05: case 0x09: case 0x0d: case 0x11: case 0x15: case 0x19: case 0x1d: //ora
+			operand(e, o); rr(e, 0, 0x08, RAX, RA); nz(e, RA, live); break;
+		case 0x21: case 0x25: case 0x29: case 0x2d: case 0x31: case 0x35: case 0x39: case 0x3d: //and
+			operand(e, o); rr(e, 0, 0x20, RAX, RA); nz(e, RA, live); break;
+		case 0x41: case 0x45: case 0x49: case 0x4d: case 0x51: case 0x55: case 0x59: case 0x5d: //eor
+			operand(e, o); rr(e, 0, 0x30, RAX, RA); nz(e, RA, live); break;
+		case 0x61: case 0x65: case 0x69: case 0x6d: case 0x71: case 0x75: case 0x79: case 0x7d: //adc
+			operand(e, o); adc(e, 0, live); break;
+		case 0xe1: case 0xe5: case 0xe9: case 0xed: case 0xf1: case 0xf5: case 0xf9: case 0xfd: //sbc
+			operand(e, o); adc(e, 1, live); break;
+		case 0xeb: //sbc a (quirk of the table)
+			rr(e, 0, 0x89, RA, RAX); adc(e, 1, live); break;
+
+		case 0xc1: case 0xc5: case 0xc9: case 0xcd: case 0xd1: case 0xd5: case 0xd9: case 0xdd: //cmp
+			operand(e, o); cmp(e, RA, live); break;
+		case 0xe0: case 0xe4: case 0xec: //cpx
+			operand(e, o); cmp(e, RX, live); break;
+		case 0xc0: case 0xc4: case 0xcc: //cpy
+			operand(e, o); cmp(e, RY, live); break;
+
+		case 0x24: case 0x2c: //bit
+			operand(e, o);
+
+			if (live) {
+				rr(e, 0, 0x89, RAX, RZ); //mov ebp, eax
+				rr(e, 0, 0x21, RA, RZ); //and ebp, r12d
+				SM(0, 0x88, RAX, n);
+			}
+
+			rr(e, 0, 0xc1, 5, RAX); B(6); //shr eax, 6
+			rr(e, 0, 0x83, 4, RAX); B(1); //and eax, 1
+			SM(0, 0x88, RAX, v);
+			break;
+
+		case 0x06: case 0x0e: case 0x16: case 0x1e: rmw(e, o, 0xd0, 4); break; //asl
+		case 0x26: case 0x2e: case 0x36: case 0x3e: rmw(e, o, 0xd0, 2); break; //rol
+		case 0x46: case 0x4e: case 0x56: case 0x5e: rmw(e, o, 0xd0, 5); break; //lsr
+		case 0x66: case 0x6e: case 0x76: case 0x7e: rmw(e, o, 0xd0, 3); break; //ror
+		case 0xe6: case 0xee: case 0xf6: case 0xfe: rmw(e, o, 0xfe, 0); break; //inc
+		case 0xc6: case 0xce: case 0xd6: case 0xde: rmw(e, o, 0xfe, 1); break; //dec
+
+		case 0x0a: shift_a(e, 4, live); break; //asl a
+		case 0x2a: shift_a(e, 2, live); break; //rol a
+		case 0x4a: shift_a(e, 5, live); break; //lsr a
+		case 0x6a: shift_a(e, 3, live); break; //ror a
+
+		case 0xe8: rr(e, 0, 0xfe, 0, RX); nz(e, RX, live); break; //inx
+		case 0xca: rr(e, 0, 0xfe, 1, RX); nz(e, RX, live); break; //dex
+		case 0xc8: rr(e, 0, 0xfe, 0, RY); nz(e, RY, live); break; //iny
+		case 0x88: rr(e, 0, 0xfe, 1, RY); nz(e, RY, live); break; //dey
+
+		case 0xaa: rr(e, 0, 0x89, RA, RX); nz(e, RX, live); break; //tax
+		case 0xa8: rr(e, 0, 0x89, RA, RY); nz(e, RY, live); break; //tay
+		case 0x8a: rr(e, 0, 0x89, RX, RA); nz(e, RA, live); break; //txa
+		case 0x98: rr(e, 0, 0x89, RY, RA); nz(e, RA, live); break; //tya
+		case 0xba: SM(0, 0x0fb6, RX, sp); nz(e, RX, live); break; //tsx
+		case 0x9a: SM(0, 0x88, RX, sp); break; //txs
+
+		case 0x18: rr(e, 0, 0x31, RC, RC); break; //clc
+		case 0x38: mov_ri(e, RC, 1); break; //sec
+		case 0xb8: SM(0, 0xc6, 0, v); B(0); break; //clv
+		case 0x58: SM(0, 0x80, 4, p); B(~BIT_O(2)); break; //cli
+		case 0x78: SM(0, 0x80, 1, p); B(BIT_O(2)); break; //sei
+		case 0xd8: SM(0, 0x80, 4, p); B(~BIT_O(3)); break; //cld
+		case 0xf8: SM(0, 0x80, 1, p); B(BIT_O(3)); break; //sed
+
+		case 0x48: //pha
+			rr(e, 0, 0x89, RA, RDX);
+			push(e, 1);
+			break;
+
+		case 0x68: //pla
+			pull(e);
+			rr(e, 0, 0x89, RAX, RA);
+			nz(e, RA, live);
+			break;
+
+		case 0x08: //php
+			SM(0, 0x0fb6, RDX, p);
+			rr(e, 0, 0x83, 4, RDX); B(0x3c); //and edx, 0x3c
+			rr(e, 0, 0x09, RC, RDX); //or edx, ebx
+			rr(e, 0, 0x31, RAX, RAX); //xor eax, eax
+			rr(e, 0, 0x85, RZ, RZ); //test ebp, ebp
+			rr(e, 0, 0x0f94, 0, RAX); //sete al
+			rr(e, 0, 0xd1, 4, RAX); //shl eax, 1
+			rr(e, 0, 0x09, RAX, RDX);
+			SM(0, 0x0fb6, RAX, v);
+			rr(e, 0, 0xc1, 4, RAX); B(6);
+			rr(e, 0, 0x09, RAX, RDX);
+			SM(0, 0x0fb6, RAX, n);
+			rr(e, 0, 0x81, 4, RAX); imm32(e, 0x80);
+			rr(e, 0, 0x09, RAX, RDX);
+			push(e, 1);
+			break;
+
+		case 0x28: //plp
+			pull(e);
+			rr(e, 0, 0x89, RAX, RDX);
+			rr(e, 0, 0x83, 1, RDX); B(0x30); //or edx, 0x30
+			SM(0, 0x88, RDX, p);
+			SM(0, 0x88, RAX, n);
+			rr(e, 0, 0x89, RAX, RC);
+			rr(e, 0, 0x83, 4, RC); B(1); //c = p & 1
+			rr(e, 0, 0x89, RAX, RZ);
+			rr(e, 0, 0xf7, 2, RZ); //not ebp
+			rr(e, 0, 0x83, 4, RZ); B(2); //z = ~p & 2
+			rr(e, 0, 0xc1, 5, RAX); B(6);
+			rr(e, 0, 0x83, 4, RAX); B(1);
+			SM(0, 0x88, RAX, v);
+			break;
+
+		case 0x4c: //jmp abs
+			leave(e, o->arg, e->n, e->cyc, op, 1);
+			return 1;
+
+		case 0x20: //jsr abs
+			mov_ri(e, RDX, (uint16_t) (e->next - 1) >> 8);
+			push(e, 0);
+			mov_ri(e, RDX, (e->next - 1) & 0xff);
+			push(e, 0);
+			leave(e, o->arg, e->n, e->cyc, op, 1);
+			return 1;
+
+		case 0x60: //rts
+			pull(e);
+			SM(0, 0x88, RAX, t);
+			pull(e);
+			pointer(e);
+			rr(e, 0, 0xff, 0, RCX); //inc ecx
+			rr(e, 0, 0x0fb7, RCX, RCX);
+			leave(e, -1, e->n, e->cyc, op, 0);
+			return 1;
+
+		case 0x10: SM(0, 0xf6, 0, n); B(0x80); branch(e, o, CC_Z); return 1; //bpl
+		case 0x30: SM(0, 0xf6, 0, n); B(0x80); branch(e, o, CC_NZ); return 1; //bmi
+		case 0x50: SM(0, 0xf6, 0, v); B(1); branch(e, o, CC_Z); return 1; //bvc
+		case 0x70: SM(0, 0xf6, 0, v); B(1); branch(e, o, CC_NZ); return 1; //bvs
+		case 0x90: rr(e, 0, 0x85, RC, RC); branch(e, o, CC_Z); return 1; //bcc
+		case 0xb0: rr(e, 0, 0x85, RC, RC); branch(e, o, CC_NZ); return 1; //bcs
+		case 0xd0: rr(e, 0, 0x85, RZ, RZ); branch(e, o, CC_NZ); return 1; //bne
+		case 0xf0: rr(e, 0, 0x85, RZ, RZ); branch(e, o, CC_Z); return 1; //beq
+
+		default: //nops and illegal opcodes, 1 byte and no effect
+			break;
+	}
+
+	return 0;
+}
+
+int _6502_jit_compile(struct _6502_jit *j, struct block *b) {
+	struct emit e = {.j = j};
+	uint8_t live[__6502_CACHE_OPS], io[__6502_CACHE_OPS];
+	uint16_t pc = b->pc, cyc = 0, max = 0;
+	int n, i, need = 1, bcd = 0, last, bus;
+
+	for (n = 0; n < b->n && supported(&b->ops[n], pc); n++)
+		pc += AM_LEN(i_jtable[b->ops[n].op].A_func_i);
+
+	//cli and plp end the translation, so the interpreter takes a pending irq right after them
+	for (i = 0; i < n; i++)
+		if (b->ops[i].op == 0x58 || b->ops[i].op == 0x28) n = i + 1;
+
+	//adc/sbc are translated for binary mode, and the block isn't run while d is set: so it can't set d (sed, plp) ahead of them
+	for (i = n; i--;) {
+		if (arith(b->ops[i].op)) bcd = 1;
+		else if (bcd && (b->ops[i].op == 0xf8 || b->ops[i].op == 0x28)) n = i, bcd = 0;
+	}
+
+	if (!n) return 0;
+
+	//pages read at constant addresses, and the last instruction reading one of them
+	for (i = 0, last = -1; i < n; i++) {
+		int32_t a = reads(&b->ops[i], &bus);
+		uint8_t pg = a >> 8;
+
+		if (a < 0 || !j->s.cpu->rpage[pg]) continue;
+		if (pg >= 2 && !fixed(&e, a) && (j->banked[pg] || e.npg == __6502_JIT_PAGES)) continue;
+		if (pg >= 2 && !fixed(&e, a)) e.pg[e.npg++] = pg;
+
+		last = i;
+	}
+
+	//an io callback may remap them: an instruction reading through the bus before that can end the block
+	for (i = 0; i < n; i++) {
+		int32_t a = reads(&b->ops[i], &bus);
+
+		io[i] = i < last && bus && (a < 0 || i_jtable[b->ops[i].op].A_func_i == AM_INY || !fixed(&e, a));
+	}
+
+	for (i = n; i--;) {
+		int f = nz_use(b->ops[i].op);
+
+		live[i] = need || (f & NZ_EXIT) || io[i];
+		if (f & NZ_SET) need = 0;
+		if (f & NZ_GET) need = 1;
+	}
+
+	for (i = 0; i < n; i++)
+		max += b->ops[i].cyc + i_jtable[b->ops[i].op].page + 2 * ((b->ops[i].op & 0x1f) == 0x10);
+
+	if (__6502_JIT_ARENA - j->used < __6502_JIT_MAX_BLOCK)
+		flush(j);
+
+	e.p = j->code + j->used;
+	if (protect(j, e.p, __6502_JIT_MAX_BLOCK, 1)) return 0;
+
+	b->chain = e.p;
+	check(&e, b, n, max, bcd);
+	b->native = e.p;
+
+	for (i = 0, pc = b->pc; i < n; i++) {
+		const struct bop *o = &b->ops[i];
+
+		e.next = pc + AM_LEN(i_jtable[o->op].A_func_i);
+		e.n = i + 1;
+		e.cyc = cyc + o->cyc;
+		e.op = o->op;
+		e.bus = 0;
+
+		if (translate(&e, o, live[i])) break;
+
+		if (io[i] && e.bus)
+			rd_check(&e);
+
+		pc = e.next;
+		cyc = e.cyc;
+	}
+
+	if (i == n)
+		leave(&e, pc, n, cyc, b->ops[n - 1].op, 1);
+
+	tails(&e, b->pc);
+
+	if (seal(j, j->code + j->used, __6502_JIT_MAX_BLOCK)) return 0;
+
+	b->nat_n = n;
+	b->nat_cyc = max;
+	b->nat_bcd = bcd;
+	b->nat_npg = e.npg;
+	memcpy(b->nat_pg, e.pg, e.npg);
+
+	for (i = 0; i < e.npg; i++)
+		j->fixed[e.pg[i]] = 1;
+
+	j->used = e.p - j->code;
+	j->stats.blocks++;
+
+	return 1;
+}
+
+
+
+uint64_t _6502_jit_exec(cpu6502_t *cpu, struct block *b, uint64_t budget, uint64_t until) {
+	struct _6502_jit *j = cpu->cache->jit;
+	struct jstate *s = &j->s;
+	uint64_t flushes = j->stats.flushes;
+
+	//the last run left for this block through an exit not linked yet
+	if (s->link) {
+		if (s->pc == b->pc && !protect(j, s->link, 4, 1)) {
+			patch(s->link, b->chain);
+			seal(j, s->link, 4);
+		}
+
+		s->link = NULL;
+	}
+
+	s->a = cpu->A; s->x = cpu->X; s->y = cpu->Y; s->sp = cpu->SP;
+	s->c = cpu->P.flags.c;
+	s->z = cpu->nz;
+	s->n = cpu->nz | cpu->nz >> 8;
+	s->v = cpu->P.flags.v;
+	s->p = cpu->P._raw;
+	s->cyc = cpu->cycles;
+	s->count = 0;
+	s->budget = budget;
+	s->until = until;
+	cpu->cache->smc = 0;
+
+	((enter_t) j->enter)(s, b->native);
+
+	//(a callback flushed the arena: the exit that left isn't there any more)
+	if (j->stats.flushes != flushes) s->link = NULL;
+
+	cpu->PC = s->pc;
+	cpu->A = s->a; cpu->X = s->x; cpu->Y = s->y; cpu->SP = s->sp;
+	cpu->P._raw = (s->p & 0x3c) | s->c | (s->v << 6);
+	cpu->nz = ((s->n & 0x80) << 8) | !!s->z;
+	cpu->IR = s->ir;
+	cpu->cycles = s->cyc;
+
+	j->stats.runs++;
+	return s->count;
+}
+
+//pages holding decoded code are written through the bus, so the cache sees the write
+void _6502_jit_page(struct _6502_jit *j, uint8_t pg, int code) {
+	uint8_t *m = j->s.cpu->wpage[pg];
+
+	j->s.wmap[pg] = (!code && m) ? (uintptr_t) m - (pg << 8) : 0;
+}
+
+static void reload(struct _6502_jit *j, uint8_t pg) {
+	cpu6502_t *cpu = j->s.cpu;
+
+	j->s.rmap[pg] = cpu->rpage[pg] ? (uintptr_t) cpu->rpage[pg] - (pg << 8) : 0;
+	_6502_jit_page(j, pg, page_code(cpu->cache, pg));
+}
+
+//the memory map changed: reload the page tables, constant reads are resolved at translation time
+void _6502_jit_remap(struct _6502_jit *j) {
+	for (int pg = 0; pg < 256; pg++)
+		reload(j, pg);
+
+	flush(j);
+}
+
+//only pages [page, page + n) did: what read them at constant addresses goes, the running block included
+void _6502_jit_remapped(struct _6502_jit *j, uint8_t page, uint16_t n) {
+	struct _6502_cache *c = j->s.cpu->cache;
+	int stale = 0;
+
+	if (page < 2) {
+		_6502_jit_remap(j);
+		return;
+	}
+
+	for (uint16_t i = 0; i < n; i++) {
+		uint8_t pg = page + i;
+
+		reload(j, pg);
+		j->banked[pg] = 1;
+
+		if (j->fixed[pg]) {
+			j->fixed[pg] = 0;
+			j->s.mgen[pg]++;
+			stale = 1;
+		}
+	}
+
+	if (!stale) return;
+
+	for (int k = 0; k < __6502_CACHE_BLOCKS; k++) {
+		struct block *b = &c->blk[k];
+
+		for (int i = 0; b->native && i < b->nat_npg; i++) {
+			if (b->nat_pg[i] >= page && b->nat_pg[i] < page + n) {
+				b->native = NULL;
+				b->hot = 0;
+			}
+		}
+	}
+
+	c->smc = 1;
+}
+
+
+
+int _6502_jit_enable(cpu6502_t *cpu) {
+	struct _6502_jit *j;
+
+	if (_6502_cache_enable(cpu)) return -1;
+	if (cpu->cache->jit) return 0;
+
+	j = calloc(1, sizeof(struct _6502_jit));
+	if (!j) return -1;
+
+	j->code = mmap(NULL, __6502_JIT_ARENA, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (j->code == MAP_FAILED) {
+		free(j);
+		return -1;
+	}
+
+	j->page = sysconf(_SC_PAGESIZE);
+	stubs(j);
+
+	if (protect(j, j->code, j->base, 0)) {
+		munmap(j->code, __6502_JIT_ARENA);
+		free(j);
+		return -1;
+	}
+
+	j->s.cpu = cpu;
+	j->s.gen = cpu->cache->gen;
+	j->s.smc = &cpu->cache->smc;
+	j->s.blk = cpu->cache->blk;
+	cpu->cache->jit = j;
+	_6502_jit_remap(j);
+
+	return 0;
+}
+
+void _6502_jit_disable(cpu6502_t *cpu) {
+	struct _6502_jit *j = cpu->cache ? cpu->cache->jit : NULL;
+
+	if (!j) return;
+
+	flush(j);
+	munmap(j->code, __6502_JIT_ARENA);
+	free(j);
+	cpu->cache->jit = NULL;
+}
+
+_6502_jit_stats_t _6502_jit_stats(const cpu6502_t *cpu) {
+	_6502_jit_stats_t st = {0};
+
+	if (cpu->cache && cpu->cache->jit) {
+		st = cpu->cache->jit->stats;
+		st.chained = cpu->cache->jit->s.chained;
+	}
+
+	return st;
+}
+
+
+
+#else
+
+
+
+int _6502_jit_enable(cpu6502_t *cpu) {return -1;}
+void _6502_jit_disable(cpu6502_t *cpu) {}
+_6502_jit_stats_t _6502_jit_stats(const cpu6502_t *cpu) {return (_6502_jit_stats_t) {0};}
+#endif
\ No newline at end of file
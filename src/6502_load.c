@@ -0,0 +1,258 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "6502.h"
+
+
+
+//private and writable: pages mapped as ram are copied by the host on the first store, the file stays as it is
+static int map_file(_6502_image_t *img, const char *path) {
+	#if !defined(_WIN32)
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st) || st.st_size <= 0) {
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+
+	img->size = st.st_size;
+	img->buf = mmap(NULL, img->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	img->mapped = 1;
+	close(fd);
+
+	if (img->buf == MAP_FAILED) {
+		img->buf = NULL;
+		return -1;
+	}
+	#else
+	FILE *fp = fopen(path, "rb");
+	long size;
+
+	if (fp == NULL)
+		return -1;
+
+	fseek(fp, 0L, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+
+	img->size = size;
+	img->buf = (size > 0) ? malloc(size) : NULL;
+	img->mapped = 0;
+	if (!img->buf || fread(img->buf, img->size, 1, fp) != 1) {
+		fclose(fp);
+		free(img->buf);
+		img->buf = NULL;
+		return -1;
+	}
+	fclose(fp);
+	#endif
+
+	return 0;
+}
+
+static void unmap_file(_6502_image_t *img) {
+	#if !defined(_WIN32)
+	if (img->mapped) munmap(img->buf, img->size);
+	else
+	#endif
+	free(img->buf);
+
+	img->buf = NULL;
+}
+
+//(len is a file size for raw and prg images: anything past 64K is rejected, not truncated)
+static int segment(_6502_image_t *img, uint32_t addr, size_t len, const uint8_t *data) {
+	if (!len || addr > 0x10000 || len > 0x10000 - addr || img->nseg == _6502_IMAGE_SEGMENTS) return -1;
+
+	img->seg[img->nseg].addr = addr;
+	img->seg[img->nseg].len = len;
+	img->seg[img->nseg].data = data;
+	img->nseg++;
+
+	return 0;
+}
+
+
+
+static int hex_byte(const uint8_t *s) {
+	static const char digits[] = "0123456789abcdef";
+	const char *h = isxdigit(s[0]) ? strchr(digits, tolower(s[0])) : NULL;
+	const char *l = isxdigit(s[1]) ? strchr(digits, tolower(s[1])) : NULL;
+
+	return (h && l) ? ((h - digits) << 4) | (l - digits) : -1;
+}
+
+/*
+	Decodes the records into a 64K buffer, every contiguous run of bytes written becoming a segment.
+	Extended segment/linear address records are only accepted as long as they stay below 64K.
+*/
+static uint8_t *hex(_6502_image_t *img, const uint8_t *s, size_t size) {
+	uint8_t *mem = calloc(1, 0x10000), used[0x10000 / 8] = {0}, rec[255 + 5];
+	const uint8_t *end = s + size;
+	int eof = 0;
+
+	if (!mem) return NULL;
+
+	while (s < end && !eof) {
+		int n, sum = 0;
+
+		if (isspace(*s)) {
+			s++;
+			continue;
+		}
+		if (*s++ != ':' || end - s < 10) goto bad;
+
+		//count, address, type, data and checksum all add up to 0
+		if ((n = hex_byte(s)) < 0 || end - s < 2 * (n + 5)) goto bad;
+		for (int i = 0; i < n + 5; i++, s += 2) {
+			int b = hex_byte(s);
+			if (b < 0) goto bad;
+			rec[i] = b;
+			sum += b;
+		}
+		if (sum & 0xff) goto bad;
+
+		uint32_t a = (rec[1] << 8) | rec[2];
+		const uint8_t *d = rec + 4;
+
+		switch (rec[3]) {
+			case 0x00:
+				if (a + n > 0x10000) goto bad;
+				memcpy(mem + a, d, n);
+				for (int i = 0; i < n; i++) used[(a + i) >> 3] |= 1 << ((a + i) & 7);
+				break;
+			case 0x01: eof = 1; break;
+			case 0x02: case 0x04: //nothing above 64K
+				if (n != 2 || d[0] || d[1]) goto bad;
+				break;
+			case 0x03: case 0x05: //cs:ip or eip, either way it has to be a 16 bit address
+				if (n != 4) goto bad;
+				a = (rec[3] == 0x03) ? ((d[0] << 12) | (d[1] << 4)) + ((d[2] << 8) | d[3]) : ((uint32_t) d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3];
+				if (a > 0xffff) goto bad;
+				img->entry = a;
+				break;
+			default: goto bad;
+		}
+	}
+	if (!eof) goto bad;
+
+	for (uint32_t a = 0, b; a < 0x10000; a = b) {
+		for (b = a; b < 0x10000 && (used[b >> 3] & (1 << (b & 7))); b++);
+
+		if (b == a) b++;
+		else if (segment(img, a, b - a, mem + a)) goto bad;
+	}
+
+	if (img->nseg) return mem;
+
+	bad:
+	free(mem);
+	return NULL;
+}
+
+
+
+int _6502_image_format(const char *path) {
+	const char *ext = strrchr(path, '.');
+	char e[4] = {0};
+
+	if (!ext || strlen(ext) > 4 || strchr(ext, '/')) return _6502_IMAGE_RAW;
+
+	for (int i = 0; ext[i + 1]; i++) e[i] = tolower((unsigned char) ext[i + 1]);
+
+	if (!strcmp(e, "prg")) return _6502_IMAGE_PRG;
+	if (!strcmp(e, "hex") || !strcmp(e, "ihx")) return _6502_IMAGE_HEX;
+
+	return _6502_IMAGE_RAW;
+}
+
+int _6502_image_open(_6502_image_t *img, const char *path, int format, uint16_t load) {
+	*img = (_6502_image_t) {0};
+	img->format = format;
+	img->entry = -1;
+
+	if (format < _6502_IMAGE_RAW || format > _6502_IMAGE_HEX || map_file(img, path)) return -1;
+
+	switch (format) {
+		case _6502_IMAGE_RAW:
+			if (!segment(img, load, img->size, img->buf)) return 0;
+			break;
+
+		case _6502_IMAGE_PRG:
+			if (img->size > 2 && !segment(img, img->buf[0] | (img->buf[1] << 8), img->size - 2, img->buf + 2)) {
+				img->entry = img->seg[0].addr;
+				return 0;
+			}
+			break;
+
+		case _6502_IMAGE_HEX: {
+			//the text isn't needed once decoded
+			uint8_t *mem = hex(img, img->buf, img->size);
+
+			if (mem) {
+				unmap_file(img);
+				img->buf = mem;
+				img->size = 0x10000;
+				img->mapped = 0;
+				return 0;
+			}
+			break;
+		}
+	}
+
+	_6502_image_close(img);
+	return -1;
+}
+
+int _6502_image_load(cpu6502_t *cpu, const _6502_image_t *img, uint8_t *mem, int type) {
+	if (type != _6502_MAP_RAM && type != _6502_MAP_ROM) return -1;
+
+	//pages covered in part need somewhere to be copied to
+	for (int i = 0; i < img->nseg && !mem; i++)
+		if ((img->seg[i].addr & 0xff) || (img->seg[i].len & 0xff)) return -1;
+
+	for (int i = 0; i < img->nseg; i++) {
+		uint32_t a = img->seg[i].addr, end = a + img->seg[i].len;
+
+		for (uint32_t pg = a >> 8; pg <= (end - 1) >> 8; pg++) {
+			uint32_t lo = (a > (pg << 8)) ? a : (pg << 8), hi = (end < ((pg + 1) << 8)) ? end : ((pg + 1) << 8);
+			const uint8_t *d = img->seg[i].data + (lo - a);
+
+			if (hi - lo == 256) {
+				_6502_map(cpu, pg, 1, (uint8_t *) d, type);
+			} else {
+				memcpy(mem + lo, d, hi - lo);
+				_6502_map(cpu, pg, 1, mem + (pg << 8), type);
+			}
+		}
+	}
+
+	return 0;
+}
+
+void _6502_image_close(_6502_image_t *img) {
+	if (img->buf) unmap_file(img);
+
+	img->nseg = 0;
+}
\ No newline at end of file
@@ -0,0 +1,1088 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+/*
+	Internal to the core, not part of the public api.
+
+	Shared pieces of the fused interpreters: the decode table, the operation macros and the opcode list.
+	The macros work on the locals every engine keeps its registers in:
+		pc, a, x, y, sp, p		registers
+		nz						last result, holding N and Z (the ones in p are stale, see cpu6502_t)
+		ea, d, t, w				effective address, operand and temporaries
+		cyc						cycle counter
+		n, budget, until		instructions executed and the run's limits
+		back					0x80 with idle loop skipping on, 0 otherwise (see LOOP)
+
+	and expect the including engine to define:
+		RD(a), WR(a, x)			bus access
+		ZRD(a), ZWR(a, x)		zero page and stack access (0x0000 - 0x01ff)
+		ARG8, ARG16				fetch the operand of the current instruction, advancing pc
+		STUCK					what to do when a jump or branch lands on itself
+*/
+
+
+
+#pragma once
+
+
+
+#include <string.h>
+
+#include "6502.h"
+
+
+
+#if !defined(_6502_COMPUTED_GOTO) && defined(__GNUC__)
+#define _6502_COMPUTED_GOTO		1
+#endif
+
+//x86-64 translator for hot blocks (6502_jit.c), needs mmap
+#if !defined(_6502_JIT) && defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+#define _6502_JIT				1
+#endif
+
+#define BIT_O(bit)				(1 << (bit))
+
+#define AM_IMP					0
+#define AM_IMM					1
+#define AM_ZP0					2
+#define AM_ZPX					3
+#define AM_ZPY					4
+#define AM_ABS					5
+#define AM_ABX					6
+#define AM_ABY					7
+#define AM_IND					8
+#define AM_INX					9
+#define AM_INY					10
+
+//instruction length (opcode included) of an addressing mode
+#define AM_LEN(m)				((m) == AM_IMP ? 1 : ((m) >= AM_ABS && (m) <= AM_IND) ? 3 : 2)
+
+
+
+struct instr {
+	void (*I_func)(cpu6502_t *cpu);
+	uint8_t A_func_i : 4;
+	uint8_t fetch : 1; //1 = we want to fetch the data from the prepared address, after the addressing-mode function, 0 = we don't
+	uint8_t cycles : 3; //base cycle count
+	uint8_t page : 1; //1 = one more cycle when the indexed address crosses a page (reading abs,x / abs,y / (zp),y)
+};
+
+extern const struct instr i_jtable[256];
+
+//decimal mode adc/sbc (NMOS), indexed by (carry << 16) | (a << 8) | operand: the result in the low byte, c/z/v/n in the high one (laid out as in P)
+extern uint16_t _6502_bcd_adc[0x20000], _6502_bcd_sbc[0x20000];
+extern uint16_t _6502_bcd_sbc_c[0x20000]; //65C02 sbc (its adc only differs in n and z), filled when a 65C02 variant is compiled in
+void _6502_bcd_init(void); //fills them, once per process
+
+
+
+/*
+	Compile-time bus (built with _6502_BUS naming a header, e.g. make BUS=path/to/bus.h).
+	The header defines _6502_BUS_READ(user, a) and _6502_BUS_WRITE(user, a, x), as static inline
+	functions or macros. Contexts given NULL callbacks by _6502_init get it as their io, and accesses
+	going there are compiled into every handler in place of a call through the page's pointer (a
+	compare with a link-time constant tells them apart). Pages with callbacks of their own
+	(_6502_map_io, watches, snapshot tracking, replays) still go through those.
+*/
+
+#ifdef _6502_BUS
+#include _6502_BUS
+
+//the bus as callbacks, standing for it in the memory map (6502.c)
+uint8_t __6502_bus_read(void *user, uint16_t a);
+void __6502_bus_write(void *user, uint16_t a, uint8_t x);
+#endif
+
+static inline uint8_t io_rd(cpu6502_t *cpu, uint16_t a) {
+	#ifdef _6502_BUS
+	if (cpu->io[a >> 8].read == __6502_bus_read) return _6502_BUS_READ(cpu->io[a >> 8].user, a);
+	#endif
+	return cpu->io[a >> 8].read(cpu->io[a >> 8].user, a);
+}
+
+static inline void io_wr(cpu6502_t *cpu, uint16_t a, uint8_t x) {
+	#ifdef _6502_BUS
+	if (cpu->io[a >> 8].write == __6502_bus_write) {
+		_6502_BUS_WRITE(cpu->io[a >> 8].user, a, x);
+		return;
+	}
+	#endif
+	cpu->io[a >> 8].write(cpu->io[a >> 8].user, a, x);
+}
+
+
+
+//memory map lookup (see _6502_map): host memory if the page is mapped, the io callbacks otherwise
+static inline uint8_t bus_rd(cpu6502_t *cpu, uint16_t a) {
+	const uint8_t *m = cpu->rpage[a >> 8];
+
+	if (m) return m[a & 0xff];
+	return io_rd(cpu, a);
+}
+
+static inline void bus_wr(cpu6502_t *cpu, uint16_t a, uint8_t x) {
+	uint8_t *m = cpu->wpage[a >> 8];
+
+	if (m) m[a & 0xff] = x;
+	else io_wr(cpu, a, x);
+}
+
+//the same from inside a run, bringing the context's cycle count up to date for the io callbacks (see _6502_schedule)
+static inline uint8_t bus_rd_at(cpu6502_t *cpu, uint16_t a, uint64_t cyc) {
+	const uint8_t *m = cpu->rpage[a >> 8];
+
+	if (m) return m[a & 0xff];
+	cpu->cycles = cyc;
+	return io_rd(cpu, a);
+}
+
+static inline void bus_wr_at(cpu6502_t *cpu, uint16_t a, uint8_t x, uint64_t cyc) {
+	uint8_t *m = cpu->wpage[a >> 8];
+
+	if (m) m[a & 0xff] = x;
+	else {
+		cpu->cycles = cyc;
+		io_wr(cpu, a, x);
+	}
+}
+
+//zero page and stack when pages 0 and 1 are mapped: no lookup at all
+#define ZP_MAPPED(cpu)			((cpu)->rpage[0] && (cpu)->rpage[1] && (cpu)->wpage[0] && (cpu)->wpage[1])
+#define ZP_RD(a)				zp_rd(cpu, (a))
+#define ZP_WR(a, x)				zp_wr(cpu, (a), (x))
+
+static inline uint8_t zp_rd(cpu6502_t *cpu, uint16_t a) {return cpu->rpage[a >> 8][a & 0xff];}
+static inline void zp_wr(cpu6502_t *cpu, uint16_t a, uint8_t x) {cpu->wpage[a >> 8][a & 0xff] = x;}
+
+
+
+
+//block cache (6502_cache.c)
+#define __6502_CACHE_BLOCKS			1024 //direct mapped slots, power of 2
+#define __6502_CACHE_OPS			32 //max instructions per block
+#define __6502_JIT_PAGES			4 //max pages a translation reads at constant addresses straight from host memory
+
+#define HASH(pc)					(((pc) ^ ((pc) >> 10)) & (__6502_CACHE_BLOCKS - 1))
+
+
+
+//predecoded instruction
+struct bop {
+	#if (_6502_COMPUTED_GOTO)
+	const void *h; //handler, resolved the first time the block runs
+	#endif
+	uint16_t arg; //operand: immediate value, branch offset or the effective address of zp/abs modes (base address when indexed)
+	uint8_t op, cyc;
+};
+
+struct block {
+	uint16_t pc, n; //start address, number of instructions (0 = empty slot)
+	uint8_t pg[2]; //first and last page the block's bytes lie in
+	uint32_t gen[2]; //generations of those pages when decoded
+	struct bop ops[__6502_CACHE_OPS];
+
+	//translation (6502_jit.c)
+	uint32_t hot; //hits since decoded
+	void *native; //translated code, NULL if none
+	void *chain; //its entry from other translated blocks, which checks first what the interpreter would
+	uint8_t nat_n, nat_cyc; //instructions it covers, and the most cycles they can take
+	uint8_t nat_bcd; //it has adc/sbc, translated for binary mode only (so not run while d is set)
+	uint8_t nat_pg[__6502_JIT_PAGES], nat_npg; //pages past the stack it reads at constant addresses, from the memory mapped at translation time
+
+	const _6502_recomp_block_t *aot; //recompiled ahead of time, NULL if not (see _6502_recomp_attach)
+};
+
+struct _6502_cache {
+	uint32_t gen[256]; //per page write generation, bumped when decoded code in the page gets overwritten
+	uint8_t code[256][32]; //per page bitmap of the decoded bytes
+	uint8_t smc; //a write hit decoded code while running a block
+	_6502_cache_stats_t stats;
+	struct _6502_jit *jit; //NULL unless _6502_jit_enable
+	const _6502_recomp_t *recomp; //NULL unless _6502_recomp_attach
+	struct block blk[__6502_CACHE_BLOCKS];
+};
+
+//does the page hold decoded code
+static inline int page_code(const struct _6502_cache *c, uint8_t pg) {
+	uint8_t code = 0;
+
+	for (int k = 0; k < 32; k++)
+		code |= c->code[pg][k];
+
+	return code != 0;
+}
+
+uint64_t _6502_cache_run(cpu6502_t *cpu, uint64_t budget, uint64_t until);
+void _6502_cache_written(struct _6502_cache *c, uint16_t a); //to be called after every write going through the core
+void _6502_cache_stale(cpu6502_t *cpu); //flushes the cache (and the JIT's view of the map) after runs of the plain loop
+
+//a recompiled block (6502_recomp.h) runs on the registers in the context, and on the cache's n, budget, until and back, handed back updated
+struct _6502_recomp_run {
+	uint64_t n, budget, until;
+	uint8_t back;
+};
+
+//idle loops (6502.c): called on taken backward jumps, returns 1 if it skipped ahead (to cpu->loop.n and cpu->loop.cyc)
+#define __6502_IDLE_SPAN			32 //longest loop looked at, in bytes
+
+int _6502_idle_loop(cpu6502_t *cpu, uint16_t at, uint16_t to, uint64_t regs, uint64_t n, uint64_t cyc, uint64_t budget, uint64_t until);
+
+//cpu->stop_req bits: _6502_stop was called, the event queue/irq line changed while running (the run ends, see _6502_schedule), a watchpoint was hit
+#define __6502_REQ_STOP				1
+#define __6502_REQ_EVENT			2
+#define __6502_REQ_WATCH			4
+
+//breakpoints and watchpoints (6502_watch.c)
+struct _6502_watch {
+	uint8_t kind[0x10000], value[0x10000]; //by address
+	uint16_t exec[256], rw[256]; //addresses with a breakpoint, with a read/write watch, by page
+	uint32_t nexec, nrw;
+	uint8_t ops[256]; //opcode breakpoints
+	uint16_t nops;
+	int32_t at; //breakpoint the last run stopped at (-1 = none), let through by the next one if still at the same cycle
+	uint64_t at_cyc;
+	uint8_t hooked[256]; //pages whose map entries are the watch's own
+	struct {
+		uint8_t *rpage, *wpage;
+		_6502_read_t read;
+		_6502_write_t write;
+		void *user;
+	} saved[256]; //and what they hold instead
+};
+
+//anything watched or counted: runs take the plain loop, breakpoints and coverage the hooked one
+#define WATCHING(cpu)			(((cpu)->watch && ((cpu)->watch->nexec || (cpu)->watch->nrw || (cpu)->watch->nops)) || (cpu)->cover.map)
+#define BREAKING(cpu)			((cpu)->watch && ((cpu)->watch->nexec || (cpu)->watch->nops))
+#define HOOKED(cpu)				(BREAKING(cpu) || (cpu)->cover.map)
+
+int _6502_break_at(cpu6502_t *cpu, uint16_t pc, uint64_t cyc); //on a page with breakpoints: 1 if the run stops before 'pc'
+int _6502_break_op_at(cpu6502_t *cpu, uint16_t pc, uint8_t op, uint64_t cyc); //same for an opcode with a breakpoint, fetched from 'pc'
+int _6502_illegal(uint8_t op); //undocumented on the NMOS, as the decode table has it (6502.c)
+void _6502_watch_lift(cpu6502_t *cpu); //puts the map back as it would be without watches (around snapshots)
+void _6502_watch_hook(cpu6502_t *cpu); //and the watches back in
+void _6502_watch_remapped(cpu6502_t *cpu, uint8_t page, uint16_t n); //the pages were mapped anew: watches go back on top
+
+//record and replay (6502_replay.c)
+#define __6502_IN_IRQ				0 //the irq line changed (to the level given)
+#define __6502_IN_INTERRUPT			1 //_6502_interrupt
+#define __6502_IN_NMI				2
+#define __6502_IN_RESET				3
+
+int _6502_replay_input(cpu6502_t *cpu, uint8_t kind, uint32_t arg); //logs a host input while recording. 1 if the core must ignore it (replaying)
+void _6502_replay_remapped(cpu6502_t *cpu, uint8_t page, uint16_t n); //the pages were mapped anew: io ones go through the log again
+
+//traps (6502_trap.c)
+struct _6502_traps {
+	uint8_t at[0x10000]; //slot + 1 of the trap at each address, 0 = none
+	struct {
+		_6502_trap_t f; //NULL = free slot
+		void *user;
+		uint32_t cycles;
+		uint16_t addr;
+		uint8_t flags;
+		_6502_trap_stats_t stats;
+	} trap[_6502_TRAPS];
+	uint8_t skip; //the routine at pc is let through once, to be verified
+	uint8_t log; //_6502_poke journals stores (the function is running to be verified)
+
+	//the routine being verified, and what the function made of it
+	struct {
+		uint8_t on, slot;
+		uint16_t ret; //pc and stack pointer once it returns
+		uint8_t sp;
+		uint8_t a, x, y, p;
+		uint64_t c0; //cycle count when it started
+	} v;
+	uint32_t n; //bytes stored to
+	uint16_t addr[0x10000];
+	uint8_t old[0x10000], want[0x10000], logged[0x10000]; //by address
+
+	//the readable pages as the routine starts, with the function's stores in: whatever the routine stores there is compared too
+	uint8_t expect[0x10000], page[256];
+};
+
+//pc is on a trap (to run), a routine is being verified (one instruction at a time)
+#define TRAPPED(cpu, pc)		((cpu)->trap && (cpu)->trap->at[pc] && !(cpu)->trap->skip)
+#define VERIFYING(cpu)			((cpu)->trap && (cpu)->trap->v.on)
+
+int _6502_trap_run(cpu6502_t *cpu); //at a trap: 1 if the function stood in for the routine, 0 if the routine is to run (verified)
+void _6502_trap_check(cpu6502_t *cpu); //after each instruction of a routine being verified
+void _6502_trap_store(cpu6502_t *cpu, uint16_t a); //_6502_poke, before storing
+
+//cycle-exact engine (6502_exact.c): an interrupt to take before the next instruction
+#define EXACT_PENDING(cpu)		((cpu)->exact.nmi || (cpu)->exact.irq || (cpu)->exact.poll)
+
+uint64_t _6502_exact_run(cpu6502_t *cpu, uint64_t budget, uint64_t until); //in place of the fused loop, firing events itself
+int _6502_exact_interrupt(cpu6502_t *cpu); //the sequence of the interrupt pending (nmi first), on the context. 1 if one was taken
+void _6502_fire(cpu6502_t *cpu); //fires the events due by cpu->cycles (6502.c)
+
+//snapshots (6502_snapshot.c), for keyframes
+const uint8_t *_6502_snapshot_page(const _6502_snapshot_t *s, uint8_t pg); //the page as the snapshot holds it, NULL if it doesn't
+//a snapshot of the context's ram pages, holding mem[] (by address) and the registers and cycle count of 'regs' instead. NULL if out of memory
+_6502_snapshot_t *_6502_snapshot_of(cpu6502_t *cpu, const cpu6502_t *regs, const uint8_t *mem);
+
+//profiler (6502_profile.c)
+#if (_6502_PROFILE)
+void _6502_profile_step(cpu6502_t *cpu, uint16_t at, uint64_t c0); //after an instruction that started at 'at', at cycle 'c0'
+void _6502_profile_irq(cpu6502_t *cpu, uint64_t c0); //after an interrupt was taken
+uint64_t _6502_profile_run(cpu6502_t *cpu, uint64_t budget, uint64_t until); //_6502_run, one _6502_clock at a time
+#endif
+
+//trace (6502_trace.c)
+#if (_6502_TRACE)
+struct _6502_trace {
+	_6502_trace_hdr_t *hdr; //followed by the ring
+	_6502_trace_rec_t *rec;
+	uint64_t mask;
+	size_t size; //of the header and the ring
+	int mode;
+	char *path;
+};
+
+//fills the record of the instruction at 'pc', with the effective address of the one before (known once it has run)
+static inline void trace_rec(_6502_trace_rec_t *r, const cpu6502_t *cpu, uint16_t pc, uint16_t ea, uint8_t op, uint8_t a, uint8_t x, uint8_t y, uint8_t sp, uint8_t p, uint16_t nz, uint64_t cyc) {
+	const uint8_t *m = cpu->rpage[pc >> 8];
+	uint16_t arg = 0;
+
+	//the operand bytes, from memory only (reading io could have side effects)
+	if ((pc & 0xff) < 0xfe) {
+		#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+		if (m) memcpy(&arg, m + (pc & 0xff) + 1, 2);
+		#else
+		if (m) arg = m[(pc & 0xff) + 1] | m[(pc & 0xff) + 2] << 8;
+		#endif
+	} else {
+		const uint8_t *m1 = cpu->rpage[(uint16_t) (pc + 1) >> 8], *m2 = cpu->rpage[(uint16_t) (pc + 2) >> 8];
+
+		if (m1) arg = m1[(pc + 1) & 0xff];
+		if (m2) arg |= m2[(pc + 2) & 0xff] << 8;
+	}
+
+	#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	//(three stores rather than one per field, the flags as they are: the record is written for every instruction)
+	uint64_t w1 = pc | (uint64_t) ea << 16 | (uint64_t) op << 32 | (uint64_t) arg << 40 | (uint64_t) a << 56;
+	uint64_t w2 = x | (uint64_t) y << 8 | (uint64_t) sp << 16 | (uint64_t) p << 24 | (uint64_t) nz << 32;
+
+	r->cycles = cyc;
+	memcpy(&r->pc, &w1, 8);
+	memcpy(&r->x, &w2, 8);
+	#else
+	*r = (_6502_trace_rec_t) {cyc, pc, ea, op, {arg, arg >> 8}, a, x, y, sp, p, nz, {0}};
+	#endif
+}
+#endif
+
+//jit (6502_jit.c)
+#define __6502_JIT_HOT				8 //hits before a block gets translated
+
+int _6502_jit_compile(struct _6502_jit *j, struct block *b); //0 if nothing could be translated
+uint64_t _6502_jit_exec(cpu6502_t *cpu, struct block *b, uint64_t budget, uint64_t until); //runs the translation through the context's registers, and the blocks it leads to within the limits. Returns the instructions executed
+void _6502_jit_page(struct _6502_jit *j, uint8_t pg, int code); //the page has started/stopped holding decoded code
+void _6502_jit_remap(struct _6502_jit *j); //the memory map changed
+void _6502_jit_remapped(struct _6502_jit *j, uint8_t page, uint16_t n); //just pages [page, page + n) were mapped anew
+
+
+
+#define PUSH(x)					ZWR(__6502_STACK_BOTTOM + (sp--), (x))
+#define PULL()					ZRD(__6502_STACK_BOTTOM + (++sp))
+
+//flags are only worked out of the last result when something looks at them
+#define NZ(r)					(nz = (r))
+#define LZ(nz)					(!((nz) & 0xff))
+#define LN(nz)					((((nz) | (nz) >> 8) >> 7) & 1)
+
+//the whole status register, and back
+#define P_GET					((p._raw & 0x7d) | (LZ(nz) << 1) | (LN(nz) << 7))
+#define P_SET(v)				(p._raw = (v) | 0x30, nz = (((v) & 0x80) << 8) | !((v) & 0x02))
+
+//effective address calculation
+#define EA_ZP0					(ea = ARG8)
+#define EA_ZPX					(ea = (ARG8 + x) & 0xff)
+#define EA_ZPY					(ea = (ARG8 + y) & 0xff)
+#define EA_ABS					(ea = ARG16)
+#define EA_ABX					(EA_ABS, ea += x)
+#define EA_ABY					(EA_ABS, ea += y)
+#define EA_INX					(t = (ARG8 + x) & 0xff, ea = ZRD(t) | (ZRD((uint8_t) (t + 1)) << 8))
+#define EA_INY					(t = ARG8, ea = (ZRD(t) | (ZRD((uint8_t) (t + 1)) << 8)) + y)
+
+//page crossing penalty of the indexed reads ('ea' already indexed by 'r')
+#define PAGE(r)					(cyc += (ea & 0xff) < (r))
+
+//reading (operand in 'd'), read-modify-write and writing forms
+#define R_IMM					(d = ARG8)
+#define R_ZP0					(EA_ZP0, d = ZRD(ea))
+#define R_ZPX					(EA_ZPX, d = ZRD(ea))
+#define R_ZPY					(EA_ZPY, d = ZRD(ea))
+#define R_ABS					(EA_ABS, d = RD(ea))
+#define R_ABX					(EA_ABX, PAGE(x), d = RD(ea))
+#define R_ABY					(EA_ABY, PAGE(y), d = RD(ea))
+#define R_INX					(EA_INX, d = RD(ea))
+#define R_INY					(EA_INY, PAGE(y), d = RD(ea))
+
+#define M_ZP0					(EA_ZP0, d = ZRD(ea))
+#define M_ZPX					(EA_ZPX, d = ZRD(ea))
+#define M_ABS					(EA_ABS, d = RD(ea))
+#define M_ABX					(EA_ABX, d = RD(ea))
+
+#define W_ZP0					EA_ZP0
+#define W_ZPX					EA_ZPX
+#define W_ZPY					EA_ZPY
+#define W_ABS					EA_ABS
+#define W_ABX					EA_ABX
+#define W_ABY					EA_ABY
+#define W_INX					EA_INX
+#define W_INY					EA_INY
+
+//operations
+#define LD(r)					(r = d, NZ(r))
+#define ST(r)					WR(ea, r)
+#define ZST(r)					ZWR(ea, r)
+#define TR(s, r)				(r = s, NZ(r))
+
+#define AND						(a &= d, NZ(a))
+#define ORA						(a |= d, NZ(a))
+#define EOR						(a ^= d, NZ(a))
+#define BIT						(nz = (a & d) | ((d & 0x80) << 8), p.flags.v = (d >> 6) & 1)
+
+#define ADC_BIN					(w = a + d + p.flags.c, p.flags.c = w > 0xff, p.flags.v = ((a ^ w) & (d ^ w) & BIT_O(7)) > 0, a = w, NZ(a))
+#define ADC_BCD(tab)			(w = tab[(p.flags.c << 16) | (a << 8) | d], a = w, p.flags.c = (w >> 8) & 1, p.flags.v = (w >> 14) & 1, nz = (((w >> 8) & 0x80) << 8) | !(w & 0x200))
+#define ADC						(p.flags.d ? ADC_BCD(_6502_bcd_adc) : ADC_BIN)
+#define SBC						(p.flags.d ? ADC_BCD(_6502_bcd_sbc) : (d = ~d, ADC_BIN))
+
+#define CP(r)					(p.flags.c = r >= d, t = r - d, NZ(t))
+#define CMP						CP(a)
+#define CPX						CP(x)
+#define CPY						CP(y)
+
+#define INC(r)					(++r, NZ(r))
+#define DEC(r)					(--r, NZ(r))
+#define ASL(r)					(p.flags.c = r >> 7, r <<= 1, NZ(r))
+#define LSR(r)					(p.flags.c = r & 1, r >>= 1, NZ(r))
+#define ROL(r)					(t = p.flags.c, p.flags.c = r >> 7, r = (r << 1) | t, NZ(r))
+#define ROR(r)					(t = p.flags.c, p.flags.c = r & 1, r = (r >> 1) | (t << 7), NZ(r))
+#define RMW(OP)					(OP(d), WR(ea, d))
+#define ZRMW(OP)				(OP(d), ZWR(ea, d))
+
+//a taken backward jump or branch: when it closes an idle loop, the rest of the loop is skipped (see _6502_idle)
+#define REGS					((uint64_t) nz << 40 | (uint64_t) p._raw << 32 | (uint32_t) sp << 24 | (uint32_t) y << 16 | (uint32_t) x << 8 | a)
+#define LOOP(at, to)			do {if (_6502_idle_loop(cpu, (at), (to), REGS, n, cyc, budget, until)) n = cpu->loop.n, cyc = cpu->loop.cyc;} while (0)
+
+#define BRANCH(c)				do {d = ARG8; if (c) {w = pc + (int8_t) d; cyc += 1 + ((pc ^ w) > 0xff); if (d & back) LOOP(pc - 2, w); pc = w; if (d == 0xfe) STUCK;}} while (0)
+
+#define JMP_ABS					do {EA_ABS; w = pc - 3; pc = ea; if (back && ea <= w) LOOP(w, ea); if (pc == w) STUCK; TRAP_POLL;} while (0)
+#define JMP_IND					(EA_ABS, w = RD(ea) | (RD((ea & 0xff00) | ((ea + 1) & 0xff)) << 8), pc = ea = w, TRAP_POLL)
+#define JSR						(EA_ABS, pc--, PUSH(pc >> 8), PUSH(pc), pc = ea, TRAP_POLL)
+#define RTS						(pc = PULL(), pc |= PULL() << 8, pc++)
+#define RTI						(t = PULL(), P_SET(t), pc = PULL(), pc |= PULL() << 8, TRAP_POLL)
+#define BRK						((void) ARG8, PUSH(pc >> 8), PUSH(pc), PUSH(P_GET | 0x30), p.flags.i = 1, pc = RD(__6502_BRK_V) | (RD(__6502_BRK_V + 1) << 8))
+
+//i was just cleared: with the irq line held, the run ends so the irq is taken before the next instruction
+#define IRQ_POLL				do {if (cpu->irq && !p.flags.i) until = 0;} while (0)
+//landed on a trap: the run ends there, for drive() to call it
+#define TRAP_POLL				((cpu->trap && cpu->trap->at[pc]) ? (void) (until = 0) : (void) 0)
+
+#define PHA						PUSH(a)
+#define PHP						PUSH(P_GET)
+#define PLA						(a = PULL(), NZ(a))
+#define PLP						(t = PULL(), P_SET(t))
+
+
+
+//undocumented NMOS operations
+#define JAM						pc--; STUCK //halts the cpu for good
+#define SBX						(p.flags.c = (a & x) >= d, x = (a & x) - d, NZ(x))
+#define ARR_BIN					(a &= d, ROR(a), p.flags.c = (a >> 6) & 1, p.flags.v = ((a >> 6) ^ (a >> 5)) & 1)
+#define ARR_BCD					(t = a & d, a = (t >> 1) | (p.flags.c << 7), NZ(a), p.flags.v = ((t ^ a) >> 6) & 1, \
+								((t & 0x0f) + (t & 0x01) > 0x05) ? (a = (a & 0xf0) | ((a + 0x06) & 0x0f)) : 0, \
+								p.flags.c = (t & 0xf0) + (t & 0x10) > 0x50, p.flags.c ? (a += 0x60) : 0)
+#define ARR						(p.flags.d ? ARR_BCD : ARR_BIN)
+//sha/shx/shy/tas store r and the high byte of the base address + 1, which also becomes the high byte of the address when indexing by i crossed a page
+#define SH(r, i)				(t = (r) & (((ea - (i)) >> 8) + 1), ((ea & 0xff) < (i)) ? (ea = (ea & 0xff) | (t << 8)) : 0, WR(ea, t))
+
+#define M_ABY					(EA_ABY, d = RD(ea))
+#define M_INX					(EA_INX, d = RD(ea))
+#define M_INY					(EA_INY, d = RD(ea))
+
+//65C02
+#define EA_IZP					(t = ARG8, ea = ZRD(t) | (ZRD((uint8_t) (t + 1)) << 8))
+#define R_IZP					(EA_IZP, d = RD(ea))
+#define W_IZP					EA_IZP
+
+#define Z_ONLY(r)				(nz = (LN(nz) << 15) | ((r) != 0)) //z from r, n left as it was
+#define TSB						(Z_ONLY(a & d), d |= a)
+#define TRB						(Z_ONLY(a & d), d &= ~a)
+
+//decimal mode sets n and z from the result, for one more cycle
+#define ADC_C					(p.flags.d ? (ADC_BCD(_6502_bcd_adc), NZ(a), cyc++) : ADC_BIN)
+#define SBC_C					(p.flags.d ? (ADC_BCD(_6502_bcd_sbc_c), cyc++) : (d = ~d, ADC_BIN))
+
+#define JMP_IND_C				(EA_ABS, w = RD(ea) | (RD((uint16_t) (ea + 1)) << 8), pc = ea = w, TRAP_POLL) //no page wrap
+#define JMP_INX					(EA_ABX, w = RD(ea) | (RD((uint16_t) (ea + 1)) << 8), pc = ea = w, TRAP_POLL)
+
+//Rockwell bit operations. bbr/bbs branch from the end of their 3 bytes, with the bit tested in t
+#define RMB(b)					(M_ZP0, d &= ~BIT_O(b), ZWR(ea, d))
+#define SMB(b)					(M_ZP0, d |= BIT_O(b), ZWR(ea, d))
+#define BB(c)					do {R_ZP0; t = d; d = ARG8; if (c) {w = pc + (int8_t) d; cyc += 1 + ((pc ^ w) > 0xff); pc = w; if (d == 0xfd) STUCK;}} while (0)
+
+
+
+/*
+	Every opcode as X(opcode, handler), in lists a variant's loop is put together from (see _6502_CPU):
+		NMOS					COMMON, NMOS and NOP, with the same quirks as i_jtable (_6502_OPCODES)
+		NMOS with illegals		COMMON, NMOS and UNDOC
+		65C02					COMMON, CMOS and CMOS_NOP
+		Rockwell 65C02			COMMON, CMOS and ROCKWELL
+	so every opcode is in exactly one list of each variant; tables of handlers index them by opcode.
+	The dummy reads the table does for jmp/jsr/stx/sty are left out.
+*/
+
+//documented, and the same on every variant
+#define __6502_OPS_COMMON(X) \
+	X(01, R_INX; ORA)							/* ora (zp,x) */ \
+	X(05, R_ZP0; ORA)							/* ora zp */ \
+	X(06, M_ZP0; ZRMW(ASL))						/* asl zp */ \
+	X(08, PHP)									/* php */ \
+	X(09, R_IMM; ORA)							/* ora # */ \
+	X(0a, ASL(a))								/* asl a */ \
+	X(0d, R_ABS; ORA)							/* ora abs */ \
+	X(0e, M_ABS; RMW(ASL))						/* asl abs */ \
+	X(10, BRANCH(!LN(nz)))					/* bpl rel */ \
+	X(11, R_INY; ORA)							/* ora (zp),y */ \
+	X(15, R_ZPX; ORA)							/* ora zp,x */ \
+	X(16, M_ZPX; ZRMW(ASL))						/* asl zp,x */ \
+	X(18, p.flags.c = 0)						/* clc */ \
+	X(19, R_ABY; ORA)							/* ora abs,y */ \
+	X(1d, R_ABX; ORA)							/* ora abs,x */ \
+	X(20, JSR)									/* jsr abs */ \
+	X(21, R_INX; AND)							/* and (zp,x) */ \
+	X(24, R_ZP0; BIT)							/* bit zp */ \
+	X(25, R_ZP0; AND)							/* and zp */ \
+	X(26, M_ZP0; ZRMW(ROL))						/* rol zp */ \
+	X(28, PLP; IRQ_POLL)						/* plp */ \
+	X(29, R_IMM; AND)							/* and # */ \
+	X(2a, ROL(a))								/* rol a */ \
+	X(2c, R_ABS; BIT)							/* bit abs */ \
+	X(2d, R_ABS; AND)							/* and abs */ \
+	X(2e, M_ABS; RMW(ROL))						/* rol abs */ \
+	X(30, BRANCH(LN(nz)))					/* bmi rel */ \
+	X(31, R_INY; AND)							/* and (zp),y */ \
+	X(35, R_ZPX; AND)							/* and zp,x */ \
+	X(36, M_ZPX; ZRMW(ROL))						/* rol zp,x */ \
+	X(38, p.flags.c = 1)						/* sec */ \
+	X(39, R_ABY; AND)							/* and abs,y */ \
+	X(3d, R_ABX; AND)							/* and abs,x */ \
+	X(40, RTI; IRQ_POLL)						/* rti */ \
+	X(41, R_INX; EOR)							/* eor (zp,x) */ \
+	X(45, R_ZP0; EOR)							/* eor zp */ \
+	X(46, M_ZP0; ZRMW(LSR))						/* lsr zp */ \
+	X(48, PHA)									/* pha */ \
+	X(49, R_IMM; EOR)							/* eor # */ \
+	X(4a, LSR(a))								/* lsr a */ \
+	X(4c, JMP_ABS)								/* jmp abs */ \
+	X(4d, R_ABS; EOR)							/* eor abs */ \
+	X(4e, M_ABS; RMW(LSR))						/* lsr abs */ \
+	X(50, BRANCH(!p.flags.v))					/* bvc rel */ \
+	X(51, R_INY; EOR)							/* eor (zp),y */ \
+	X(55, R_ZPX; EOR)							/* eor zp,x */ \
+	X(56, M_ZPX; ZRMW(LSR))						/* lsr zp,x */ \
+	X(58, p.flags.i = 0; IRQ_POLL)				/* cli */ \
+	X(59, R_ABY; EOR)							/* eor abs,y */ \
+	X(5d, R_ABX; EOR)							/* eor abs,x */ \
+	X(60, RTS)									/* rts */ \
+	X(66, M_ZP0; ZRMW(ROR))						/* ror zp */ \
+	X(68, PLA)									/* pla */ \
+	X(6a, ROR(a))								/* ror a */ \
+	X(6e, M_ABS; RMW(ROR))						/* ror abs */ \
+	X(70, BRANCH(p.flags.v))					/* bvs rel */ \
+	X(76, M_ZPX; ZRMW(ROR))						/* ror zp,x */ \
+	X(78, p.flags.i = 1)						/* sei */ \
+	X(81, W_INX; ST(a))							/* sta (zp,x) */ \
+	X(84, W_ZP0; ZST(y))						/* sty zp */ \
+	X(85, W_ZP0; ZST(a))						/* sta zp */ \
+	X(86, W_ZP0; ZST(x))						/* stx zp */ \
+	X(88, DEC(y))								/* dey */ \
+	X(8a, TR(x, a))								/* txa */ \
+	X(8c, W_ABS; ST(y))							/* sty abs */ \
+	X(8d, W_ABS; ST(a))							/* sta abs */ \
+	X(8e, W_ABS; ST(x))							/* stx abs */ \
+	X(90, BRANCH(!p.flags.c))					/* bcc rel */ \
+	X(91, W_INY; ST(a))							/* sta (zp),y */ \
+	X(94, W_ZPX; ZST(y))						/* sty zp,x */ \
+	X(95, W_ZPX; ZST(a))						/* sta zp,x */ \
+	X(96, W_ZPY; ZST(x))						/* stx zp,y */ \
+	X(98, TR(y, a))								/* tya */ \
+	X(99, W_ABY; ST(a))							/* sta abs,y */ \
+	X(9a, sp = x)								/* txs */ \
+	X(9d, W_ABX; ST(a))							/* sta abs,x */ \
+	X(a0, R_IMM; LD(y))							/* ldy # */ \
+	X(a1, R_INX; LD(a))							/* lda (zp,x) */ \
+	X(a2, R_IMM; LD(x))							/* ldx # */ \
+	X(a4, R_ZP0; LD(y))							/* ldy zp */ \
+	X(a5, R_ZP0; LD(a))							/* lda zp */ \
+	X(a6, R_ZP0; LD(x))							/* ldx zp */ \
+	X(a8, TR(a, y))								/* tay */ \
+	X(a9, R_IMM; LD(a))							/* lda # */ \
+	X(aa, TR(a, x))								/* tax */ \
+	X(ac, R_ABS; LD(y))							/* ldy abs */ \
+	X(ad, R_ABS; LD(a))							/* lda abs */ \
+	X(ae, R_ABS; LD(x))							/* ldx abs */ \
+	X(b0, BRANCH(p.flags.c))					/* bcs rel */ \
+	X(b1, R_INY; LD(a))							/* lda (zp),y */ \
+	X(b4, R_ZPX; LD(y))							/* ldy zp,x */ \
+	X(b5, R_ZPX; LD(a))							/* lda zp,x */ \
+	X(b6, R_ZPY; LD(x))							/* ldx zp,y */ \
+	X(b8, p.flags.v = 0)						/* clv */ \
+	X(b9, R_ABY; LD(a))							/* lda abs,y */ \
+	X(ba, TR(sp, x))							/* tsx */ \
+	X(bc, R_ABX; LD(y))							/* ldy abs,x */ \
+	X(bd, R_ABX; LD(a))							/* lda abs,x */ \
+	X(be, R_ABY; LD(x))							/* ldx abs,y */ \
+	X(c0, R_IMM; CPY)							/* cpy # */ \
+	X(c1, R_INX; CMP)							/* cmp (zp,x) */ \
+	X(c4, R_ZP0; CPY)							/* cpy zp */ \
+	X(c5, R_ZP0; CMP)							/* cmp zp */ \
+	X(c6, M_ZP0; ZRMW(DEC))						/* dec zp */ \
+	X(c8, INC(y))								/* iny */ \
+	X(c9, R_IMM; CMP)							/* cmp # */ \
+	X(ca, DEC(x))								/* dex */ \
+	X(cc, R_ABS; CPY)							/* cpy abs */ \
+	X(cd, R_ABS; CMP)							/* cmp abs */ \
+	X(ce, M_ABS; RMW(DEC))						/* dec abs */ \
+	X(d0, BRANCH(!LZ(nz)))					/* bne rel */ \
+	X(d1, R_INY; CMP)							/* cmp (zp),y */ \
+	X(d5, R_ZPX; CMP)							/* cmp zp,x */ \
+	X(d6, M_ZPX; ZRMW(DEC))						/* dec zp,x */ \
+	X(d8, p.flags.d = 0)						/* cld */ \
+	X(d9, R_ABY; CMP)							/* cmp abs,y */ \
+	X(dd, R_ABX; CMP)							/* cmp abs,x */ \
+	X(de, M_ABX; RMW(DEC))						/* dec abs,x */ \
+	X(e0, R_IMM; CPX)							/* cpx # */ \
+	X(e4, R_ZP0; CPX)							/* cpx zp */ \
+	X(e6, M_ZP0; ZRMW(INC))						/* inc zp */ \
+	X(e8, INC(x))								/* inx */ \
+	X(ea, )										/* nop */ \
+	X(ec, R_ABS; CPX)							/* cpx abs */ \
+	X(ee, M_ABS; RMW(INC))						/* inc abs */ \
+	X(f0, BRANCH(LZ(nz)))					/* beq rel */ \
+	X(f6, M_ZPX; ZRMW(INC))						/* inc zp,x */ \
+	X(f8, p.flags.d = 1)						/* sed */ \
+	X(fe, M_ABX; RMW(INC))						/* inc abs,x */
+
+//documented, but changed on the 65C02
+#define __6502_OPS_NMOS(X) \
+	X(00, BRK)									/* brk */ \
+	X(1e, M_ABX; RMW(ASL))						/* asl abs,x */ \
+	X(3e, M_ABX; RMW(ROL))						/* rol abs,x */ \
+	X(5e, M_ABX; RMW(LSR))						/* lsr abs,x */ \
+	X(61, R_INX; ADC)							/* adc (zp,x) */ \
+	X(65, R_ZP0; ADC)							/* adc zp */ \
+	X(69, R_IMM; ADC)							/* adc # */ \
+	X(6c, JMP_IND)								/* jmp (abs) */ \
+	X(6d, R_ABS; ADC)							/* adc abs */ \
+	X(71, R_INY; ADC)							/* adc (zp),y */ \
+	X(75, R_ZPX; ADC)							/* adc zp,x */ \
+	X(79, R_ABY; ADC)							/* adc abs,y */ \
+	X(7d, R_ABX; ADC)							/* adc abs,x */ \
+	X(7e, M_ABX; RMW(ROR))						/* ror abs,x */ \
+	X(e1, R_INX; SBC)							/* sbc (zp,x) */ \
+	X(e5, R_ZP0; SBC)							/* sbc zp */ \
+	X(e9, R_IMM; SBC)							/* sbc # */ \
+	X(ed, R_ABS; SBC)							/* sbc abs */ \
+	X(f1, R_INY; SBC)							/* sbc (zp),y */ \
+	X(f5, R_ZPX; SBC)							/* sbc zp,x */ \
+	X(f9, R_ABY; SBC)							/* sbc abs,y */ \
+	X(fd, R_ABX; SBC)							/* sbc abs,x */
+
+//what NMOS takes for nops in i_jtable
+#define __6502_OPS_NOP(X) \
+	X(02, )										/* illegal */ \
+	X(03, )										/* illegal */ \
+	X(04, )										/* nop */ \
+	X(07, )										/* illegal */ \
+	X(0b, )										/* illegal */ \
+	X(0c, )										/* nop */ \
+	X(0f, )										/* illegal */ \
+	X(12, )										/* illegal */ \
+	X(13, )										/* illegal */ \
+	X(14, )										/* nop */ \
+	X(17, )										/* illegal */ \
+	X(1a, )										/* nop */ \
+	X(1b, )										/* illegal */ \
+	X(1c, )										/* nop */ \
+	X(1f, )										/* illegal */ \
+	X(22, )										/* illegal */ \
+	X(23, )										/* illegal */ \
+	X(27, )										/* illegal */ \
+	X(2b, )										/* illegal */ \
+	X(2f, )										/* illegal */ \
+	X(32, )										/* illegal */ \
+	X(33, )										/* illegal */ \
+	X(34, )										/* nop */ \
+	X(37, )										/* illegal */ \
+	X(3a, )										/* nop */ \
+	X(3b, )										/* illegal */ \
+	X(3c, )										/* nop */ \
+	X(3f, )										/* illegal */ \
+	X(42, )										/* illegal */ \
+	X(43, )										/* illegal */ \
+	X(44, )										/* nop */ \
+	X(47, )										/* illegal */ \
+	X(4b, )										/* illegal */ \
+	X(4f, )										/* illegal */ \
+	X(52, )										/* illegal */ \
+	X(53, )										/* illegal */ \
+	X(54, )										/* nop */ \
+	X(57, )										/* illegal */ \
+	X(5a, )										/* nop */ \
+	X(5b, )										/* illegal */ \
+	X(5c, )										/* nop */ \
+	X(5f, )										/* illegal */ \
+	X(62, )										/* illegal */ \
+	X(63, )										/* illegal */ \
+	X(64, )										/* nop */ \
+	X(67, )										/* illegal */ \
+	X(6b, )										/* illegal */ \
+	X(6f, )										/* illegal */ \
+	X(72, )										/* illegal */ \
+	X(73, )										/* illegal */ \
+	X(74, )										/* nop */ \
+	X(77, )										/* illegal */ \
+	X(7a, )										/* nop */ \
+	X(7b, )										/* illegal */ \
+	X(7c, )										/* nop */ \
+	X(7f, )										/* illegal */ \
+	X(80, )										/* nop */ \
+	X(82, )										/* nop */ \
+	X(83, )										/* illegal */ \
+	X(87, )										/* illegal */ \
+	X(89, )										/* nop */ \
+	X(8b, )										/* illegal */ \
+	X(8f, )										/* illegal */ \
+	X(92, )										/* illegal */ \
+	X(93, )										/* illegal */ \
+	X(97, )										/* illegal */ \
+	X(9b, )										/* illegal */ \
+	X(9c, )										/* nop */ \
+	X(9e, )										/* illegal */ \
+	X(9f, )										/* illegal */ \
+	X(a3, )										/* illegal */ \
+	X(a7, )										/* illegal */ \
+	X(ab, )										/* illegal */ \
+	X(af, )										/* illegal */ \
+	X(b2, )										/* illegal */ \
+	X(b3, )										/* illegal */ \
+	X(b7, )										/* illegal */ \
+	X(bb, )										/* illegal */ \
+	X(bf, )										/* illegal */ \
+	X(c2, )										/* nop */ \
+	X(c3, )										/* illegal */ \
+	X(c7, )										/* illegal */ \
+	X(cb, )										/* illegal */ \
+	X(cf, )										/* illegal */ \
+	X(d2, )										/* illegal */ \
+	X(d3, )										/* illegal */ \
+	X(d4, )										/* nop */ \
+	X(d7, )										/* illegal */ \
+	X(da, )										/* nop */ \
+	X(db, )										/* illegal */ \
+	X(dc, )										/* nop */ \
+	X(df, )										/* illegal */ \
+	X(e2, )										/* nop */ \
+	X(e3, )										/* illegal */ \
+	X(e7, )										/* illegal */ \
+	X(eb, d = a; SBC)							/* sbc a (quirk of the table above) */ \
+	X(ef, )										/* illegal */ \
+	X(f2, )										/* illegal */ \
+	X(f3, )										/* illegal */ \
+	X(f4, )										/* nop */ \
+	X(f7, )										/* illegal */ \
+	X(fa, )										/* nop */ \
+	X(fb, )										/* illegal */ \
+	X(fc, )										/* nop */ \
+	X(ff, )										/* illegal */
+
+#define _6502_OPCODES(X)		__6502_OPS_COMMON(X) __6502_OPS_NMOS(X) __6502_OPS_NOP(X)
+
+//undocumented NMOS opcodes: the stable ones, jams, nops of the right length and the unstable ones as the usual approximations
+#define __6502_OPS_UNDOC(X) \
+	X(02, JAM)									/* jam */ \
+	X(03, M_INX; RMW(ASL); ORA)					/* slo (zp,x) */ \
+	X(04, R_ZP0)								/* nop zp */ \
+	X(07, M_ZP0; ZRMW(ASL); ORA)				/* slo zp */ \
+	X(0b, R_IMM; AND; p.flags.c = a >> 7)		/* anc # */ \
+	X(0c, R_ABS)								/* nop abs */ \
+	X(0f, M_ABS; RMW(ASL); ORA)					/* slo abs */ \
+	X(12, JAM)									/* jam */ \
+	X(13, M_INY; RMW(ASL); ORA)					/* slo (zp),y */ \
+	X(14, R_ZPX)								/* nop zp,x */ \
+	X(17, M_ZPX; ZRMW(ASL); ORA)				/* slo zp,x */ \
+	X(1a, )										/* nop */ \
+	X(1b, M_ABY; RMW(ASL); ORA)					/* slo abs,y */ \
+	X(1c, R_ABX)								/* nop abs,x */ \
+	X(1f, M_ABX; RMW(ASL); ORA)					/* slo abs,x */ \
+	X(22, JAM)									/* jam */ \
+	X(23, M_INX; RMW(ROL); AND)					/* rla (zp,x) */ \
+	X(27, M_ZP0; ZRMW(ROL); AND)				/* rla zp */ \
+	X(2b, R_IMM; AND; p.flags.c = a >> 7)		/* anc # */ \
+	X(2f, M_ABS; RMW(ROL); AND)					/* rla abs */ \
+	X(32, JAM)									/* jam */ \
+	X(33, M_INY; RMW(ROL); AND)					/* rla (zp),y */ \
+	X(34, R_ZPX)								/* nop zp,x */ \
+	X(37, M_ZPX; ZRMW(ROL); AND)				/* rla zp,x */ \
+	X(3a, )										/* nop */ \
+	X(3b, M_ABY; RMW(ROL); AND)					/* rla abs,y */ \
+	X(3c, R_ABX)								/* nop abs,x */ \
+	X(3f, M_ABX; RMW(ROL); AND)					/* rla abs,x */ \
+	X(42, JAM)									/* jam */ \
+	X(43, M_INX; RMW(LSR); EOR)					/* sre (zp,x) */ \
+	X(44, R_ZP0)								/* nop zp */ \
+	X(47, M_ZP0; ZRMW(LSR); EOR)				/* sre zp */ \
+	X(4b, R_IMM; AND; LSR(a))					/* alr # */ \
+	X(4f, M_ABS; RMW(LSR); EOR)					/* sre abs */ \
+	X(52, JAM)									/* jam */ \
+	X(53, M_INY; RMW(LSR); EOR)					/* sre (zp),y */ \
+	X(54, R_ZPX)								/* nop zp,x */ \
+	X(57, M_ZPX; ZRMW(LSR); EOR)				/* sre zp,x */ \
+	X(5a, )										/* nop */ \
+	X(5b, M_ABY; RMW(LSR); EOR)					/* sre abs,y */ \
+	X(5c, R_ABX)								/* nop abs,x */ \
+	X(5f, M_ABX; RMW(LSR); EOR)					/* sre abs,x */ \
+	X(62, JAM)									/* jam */ \
+	X(63, M_INX; RMW(ROR); ADC)					/* rra (zp,x) */ \
+	X(64, R_ZP0)								/* nop zp */ \
+	X(67, M_ZP0; ZRMW(ROR); ADC)				/* rra zp */ \
+	X(6b, R_IMM; ARR)							/* arr # */ \
+	X(6f, M_ABS; RMW(ROR); ADC)					/* rra abs */ \
+	X(72, JAM)									/* jam */ \
+	X(73, M_INY; RMW(ROR); ADC)					/* rra (zp),y */ \
+	X(74, R_ZPX)								/* nop zp,x */ \
+	X(77, M_ZPX; ZRMW(ROR); ADC)				/* rra zp,x */ \
+	X(7a, )										/* nop */ \
+	X(7b, M_ABY; RMW(ROR); ADC)					/* rra abs,y */ \
+	X(7c, R_ABX)								/* nop abs,x */ \
+	X(7f, M_ABX; RMW(ROR); ADC)					/* rra abs,x */ \
+	X(80, (void) ARG8)							/* nop # */ \
+	X(82, (void) ARG8)							/* nop # */ \
+	X(83, W_INX; ST(a & x))						/* sax (zp,x) */ \
+	X(87, W_ZP0; ZST(a & x))					/* sax zp */ \
+	X(89, (void) ARG8)							/* nop # */ \
+	X(8b, R_IMM; a = (a | 0xee) & x & d; NZ(a))	/* xaa # (unstable) */ \
+	X(8f, W_ABS; ST(a & x))						/* sax abs */ \
+	X(92, JAM)									/* jam */ \
+	X(93, W_INY; SH(a & x, y))					/* sha (zp),y (unstable) */ \
+	X(97, W_ZPY; ZST(a & x))					/* sax zp,y */ \
+	X(9b, W_ABY; sp = a & x; SH(sp, y))			/* tas abs,y (unstable) */ \
+	X(9c, W_ABX; SH(y, x))						/* shy abs,x (unstable) */ \
+	X(9e, W_ABY; SH(x, y))						/* shx abs,y (unstable) */ \
+	X(9f, W_ABY; SH(a & x, y))					/* sha abs,y (unstable) */ \
+	X(a3, R_INX; LD(a); x = a)					/* lax (zp,x) */ \
+	X(a7, R_ZP0; LD(a); x = a)					/* lax zp */ \
+	X(ab, R_IMM; a = x = (a | 0xee) & d; NZ(a))	/* lxa # (unstable) */ \
+	X(af, R_ABS; LD(a); x = a)					/* lax abs */ \
+	X(b2, JAM)									/* jam */ \
+	X(b3, R_INY; LD(a); x = a)					/* lax (zp),y */ \
+	X(b7, R_ZPY; LD(a); x = a)					/* lax zp,y */ \
+	X(bb, R_ABY; a = x = sp = d & sp; NZ(a))	/* las abs,y */ \
+	X(bf, R_ABY; LD(a); x = a)					/* lax abs,y */ \
+	X(c2, (void) ARG8)							/* nop # */ \
+	X(c3, M_INX; RMW(DEC); CMP)					/* dcp (zp,x) */ \
+	X(c7, M_ZP0; ZRMW(DEC); CMP)				/* dcp zp */ \
+	X(cb, R_IMM; SBX)							/* sbx # */ \
+	X(cf, M_ABS; RMW(DEC); CMP)					/* dcp abs */ \
+	X(d2, JAM)									/* jam */ \
+	X(d3, M_INY; RMW(DEC); CMP)					/* dcp (zp),y */ \
+	X(d4, R_ZPX)								/* nop zp,x */ \
+	X(d7, M_ZPX; ZRMW(DEC); CMP)				/* dcp zp,x */ \
+	X(da, )										/* nop */ \
+	X(db, M_ABY; RMW(DEC); CMP)					/* dcp abs,y */ \
+	X(dc, R_ABX)								/* nop abs,x */ \
+	X(df, M_ABX; RMW(DEC); CMP)					/* dcp abs,x */ \
+	X(e2, (void) ARG8)							/* nop # */ \
+	X(e3, M_INX; RMW(INC); SBC)					/* isc (zp,x) */ \
+	X(e7, M_ZP0; ZRMW(INC); SBC)				/* isc zp */ \
+	X(eb, R_IMM; SBC)							/* sbc # (usbc) */ \
+	X(ef, M_ABS; RMW(INC); SBC)					/* isc abs */ \
+	X(f2, JAM)									/* jam */ \
+	X(f3, M_INY; RMW(INC); SBC)					/* isc (zp),y */ \
+	X(f4, R_ZPX)								/* nop zp,x */ \
+	X(f7, M_ZPX; ZRMW(INC); SBC)				/* isc zp,x */ \
+	X(fa, )										/* nop */ \
+	X(fb, M_ABY; RMW(INC); SBC)					/* isc abs,y */ \
+	X(fc, R_ABX)								/* nop abs,x */ \
+	X(ff, M_ABX; RMW(INC); SBC)					/* isc abs,x */
+
+//65C02 (and the NMOS ones it changes), undefined opcodes being nops of their length
+#define __6502_OPS_CMOS(X) \
+	X(00, BRK; p.flags.d = 0)					/* brk */ \
+	X(02, (void) ARG8)							/* nop # */ \
+	X(03, )										/* nop */ \
+	X(04, M_ZP0; TSB; ZWR(ea, d))				/* tsb zp */ \
+	X(0b, )										/* nop */ \
+	X(0c, M_ABS; TSB; WR(ea, d))				/* tsb abs */ \
+	X(12, R_IZP; ORA)							/* ora (zp) */ \
+	X(13, )										/* nop */ \
+	X(14, M_ZP0; TRB; ZWR(ea, d))				/* trb zp */ \
+	X(1a, INC(a))								/* inc a */ \
+	X(1b, )										/* nop */ \
+	X(1c, M_ABS; TRB; WR(ea, d))				/* trb abs */ \
+	X(1e, M_ABX; PAGE(x); RMW(ASL))				/* asl abs,x */ \
+	X(22, (void) ARG8)							/* nop # */ \
+	X(23, )										/* nop */ \
+	X(2b, )										/* nop */ \
+	X(32, R_IZP; AND)							/* and (zp) */ \
+	X(33, )										/* nop */ \
+	X(34, R_ZPX; BIT)							/* bit zp,x */ \
+	X(3a, DEC(a))								/* dec a */ \
+	X(3b, )										/* nop */ \
+	X(3c, R_ABX; BIT)							/* bit abs,x */ \
+	X(3e, M_ABX; PAGE(x); RMW(ROL))				/* rol abs,x */ \
+	X(42, (void) ARG8)							/* nop # */ \
+	X(43, )										/* nop */ \
+	X(44, R_ZP0)								/* nop zp */ \
+	X(4b, )										/* nop */ \
+	X(52, R_IZP; EOR)							/* eor (zp) */ \
+	X(53, )										/* nop */ \
+	X(54, R_ZPX)								/* nop zp,x */ \
+	X(5a, PUSH(y))								/* phy */ \
+	X(5b, )										/* nop */ \
+	X(5c, EA_ABS)								/* nop abs (8 cycles) */ \
+	X(5e, M_ABX; PAGE(x); RMW(LSR))				/* lsr abs,x */ \
+	X(61, R_INX; ADC_C)							/* adc (zp,x) */ \
+	X(62, (void) ARG8)							/* nop # */ \
+	X(63, )										/* nop */ \
+	X(64, W_ZP0; ZST(0))						/* stz zp */ \
+	X(65, R_ZP0; ADC_C)							/* adc zp */ \
+	X(69, R_IMM; ADC_C)							/* adc # */ \
+	X(6b, )										/* nop */ \
+	X(6c, JMP_IND_C)							/* jmp (abs) */ \
+	X(6d, R_ABS; ADC_C)							/* adc abs */ \
+	X(71, R_INY; ADC_C)							/* adc (zp),y */ \
+	X(72, R_IZP; ADC_C)							/* adc (zp) */ \
+	X(73, )										/* nop */ \
+	X(74, W_ZPX; ZST(0))						/* stz zp,x */ \
+	X(75, R_ZPX; ADC_C)							/* adc zp,x */ \
+	X(79, R_ABY; ADC_C)							/* adc abs,y */ \
+	X(7a, y = PULL(); NZ(y))					/* ply */ \
+	X(7b, )										/* nop */ \
+	X(7c, JMP_INX)								/* jmp (abs,x) */ \
+	X(7d, R_ABX; ADC_C)							/* adc abs,x */ \
+	X(7e, M_ABX; PAGE(x); RMW(ROR))				/* ror abs,x */ \
+	X(80, BRANCH(1))							/* bra rel */ \
+	X(82, (void) ARG8)							/* nop # */ \
+	X(83, )										/* nop */ \
+	X(89, R_IMM; Z_ONLY(a & d))					/* bit # */ \
+	X(8b, )										/* nop */ \
+	X(92, W_IZP; ST(a))							/* sta (zp) */ \
+	X(93, )										/* nop */ \
+	X(9b, )										/* nop */ \
+	X(9c, W_ABS; ST(0))							/* stz abs */ \
+	X(9e, W_ABX; ST(0))							/* stz abs,x */ \
+	X(a3, )										/* nop */ \
+	X(ab, )										/* nop */ \
+	X(b2, R_IZP; LD(a))							/* lda (zp) */ \
+	X(b3, )										/* nop */ \
+	X(bb, )										/* nop */ \
+	X(c2, (void) ARG8)							/* nop # */ \
+	X(c3, )										/* nop */ \
+	X(cb, )										/* nop */ \
+	X(d2, R_IZP; CMP)							/* cmp (zp) */ \
+	X(d3, )										/* nop */ \
+	X(d4, R_ZPX)								/* nop zp,x */ \
+	X(da, PUSH(x))								/* phx */ \
+	X(db, )										/* nop */ \
+	X(dc, R_ABS)								/* nop abs */ \
+	X(e1, R_INX; SBC_C)							/* sbc (zp,x) */ \
+	X(e2, (void) ARG8)							/* nop # */ \
+	X(e3, )										/* nop */ \
+	X(e5, R_ZP0; SBC_C)							/* sbc zp */ \
+	X(e9, R_IMM; SBC_C)							/* sbc # */ \
+	X(eb, )										/* nop */ \
+	X(ed, R_ABS; SBC_C)							/* sbc abs */ \
+	X(f1, R_INY; SBC_C)							/* sbc (zp),y */ \
+	X(f2, R_IZP; SBC_C)							/* sbc (zp) */ \
+	X(f3, )										/* nop */ \
+	X(f4, R_ZPX)								/* nop zp,x */ \
+	X(f5, R_ZPX; SBC_C)							/* sbc zp,x */ \
+	X(f9, R_ABY; SBC_C)							/* sbc abs,y */ \
+	X(fa, x = PULL(); NZ(x))					/* plx */ \
+	X(fb, )										/* nop */ \
+	X(fc, R_ABS)								/* nop abs */ \
+	X(fd, R_ABX; SBC_C)							/* sbc abs,x */
+
+//rmb/smb/bbr/bbs, single byte nops on the 65C02 without them
+#define __6502_OPS_CMOS_NOP(X) \
+	X(07, )										/* nop */ \
+	X(0f, )										/* nop */ \
+	X(17, )										/* nop */ \
+	X(1f, )										/* nop */ \
+	X(27, )										/* nop */ \
+	X(2f, )										/* nop */ \
+	X(37, )										/* nop */ \
+	X(3f, )										/* nop */ \
+	X(47, )										/* nop */ \
+	X(4f, )										/* nop */ \
+	X(57, )										/* nop */ \
+	X(5f, )										/* nop */ \
+	X(67, )										/* nop */ \
+	X(6f, )										/* nop */ \
+	X(77, )										/* nop */ \
+	X(7f, )										/* nop */ \
+	X(87, )										/* nop */ \
+	X(8f, )										/* nop */ \
+	X(97, )										/* nop */ \
+	X(9f, )										/* nop */ \
+	X(a7, )										/* nop */ \
+	X(af, )										/* nop */ \
+	X(b7, )										/* nop */ \
+	X(bf, )										/* nop */ \
+	X(c7, )										/* nop */ \
+	X(cf, )										/* nop */ \
+	X(d7, )										/* nop */ \
+	X(df, )										/* nop */ \
+	X(e7, )										/* nop */ \
+	X(ef, )										/* nop */ \
+	X(f7, )										/* nop */ \
+	X(ff, )										/* nop */
+
+#define __6502_OPS_ROCKWELL(X) \
+	X(07, RMB(0))								/* rmb0 zp */ \
+	X(0f, BB(!(t & BIT_O(0))))					/* bbr0 zp,rel */ \
+	X(17, RMB(1))								/* rmb1 zp */ \
+	X(1f, BB(!(t & BIT_O(1))))					/* bbr1 zp,rel */ \
+	X(27, RMB(2))								/* rmb2 zp */ \
+	X(2f, BB(!(t & BIT_O(2))))					/* bbr2 zp,rel */ \
+	X(37, RMB(3))								/* rmb3 zp */ \
+	X(3f, BB(!(t & BIT_O(3))))					/* bbr3 zp,rel */ \
+	X(47, RMB(4))								/* rmb4 zp */ \
+	X(4f, BB(!(t & BIT_O(4))))					/* bbr4 zp,rel */ \
+	X(57, RMB(5))								/* rmb5 zp */ \
+	X(5f, BB(!(t & BIT_O(5))))					/* bbr5 zp,rel */ \
+	X(67, RMB(6))								/* rmb6 zp */ \
+	X(6f, BB(!(t & BIT_O(6))))					/* bbr6 zp,rel */ \
+	X(77, RMB(7))								/* rmb7 zp */ \
+	X(7f, BB(!(t & BIT_O(7))))					/* bbr7 zp,rel */ \
+	X(87, SMB(0))								/* smb0 zp */ \
+	X(8f, BB(t & BIT_O(0)))						/* bbs0 zp,rel */ \
+	X(97, SMB(1))								/* smb1 zp */ \
+	X(9f, BB(t & BIT_O(1)))						/* bbs1 zp,rel */ \
+	X(a7, SMB(2))								/* smb2 zp */ \
+	X(af, BB(t & BIT_O(2)))						/* bbs2 zp,rel */ \
+	X(b7, SMB(3))								/* smb3 zp */ \
+	X(bf, BB(t & BIT_O(3)))						/* bbs3 zp,rel */ \
+	X(c7, SMB(4))								/* smb4 zp */ \
+	X(cf, BB(t & BIT_O(4)))						/* bbs4 zp,rel */ \
+	X(d7, SMB(5))								/* smb5 zp */ \
+	X(df, BB(t & BIT_O(5)))						/* bbs5 zp,rel */ \
+	X(e7, SMB(6))								/* smb6 zp */ \
+	X(ef, BB(t & BIT_O(6)))						/* bbs6 zp,rel */ \
+	X(f7, SMB(7))								/* smb7 zp */ \
+	X(ff, BB(t & BIT_O(7)))						/* bbs7 zp,rel */
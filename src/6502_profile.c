@@ -0,0 +1,381 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "6502.h"
+#include "6502_ops.h"
+
+
+
+#if (_6502_PROFILE)
+
+
+
+#define __6502_PROFILE_DEPTH		256 //open frames tracked, deeper calls are charged to the deepest one
+#define __6502_PROFILE_NODES		(1 << 20) //calling contexts, same when they run out
+
+//a calling context: the subroutine at 'pc' called through the context 'parent'
+struct node {
+	uint32_t parent;
+	uint16_t pc;
+	uint64_t self; //cycles spent in it, callees excluded
+};
+
+struct frame {
+	uint32_t node;
+	uint8_t sp; //stack pointer right after the call, the frame closes once a return takes it above
+	uint64_t entry; //cycle count at the call
+};
+
+struct prof_ctx {
+	struct node *node; //node 0 is the top level
+	uint32_t nodes, cap;
+	uint32_t *hash; //(parent, pc) -> node + 1, open addressing
+	uint32_t hcap;
+	struct frame frame[__6502_PROFILE_DEPTH];
+	int depth;
+};
+
+static uint32_t slot(const struct prof_ctx *x, uint32_t parent, uint16_t pc) {
+	return ((parent * 0x9e3779b1u) ^ (pc * 0x85ebca6bu)) & (x->hcap - 1);
+}
+
+static int grow(struct prof_ctx *x) {
+	struct node *node = realloc(x->node, x->cap * 2 * sizeof(struct node));
+	uint32_t *hash = calloc(x->hcap * 2, sizeof(uint32_t));
+
+	if (node) x->node = node;
+	if (!node || !hash) {
+		free(hash);
+		return -1;
+	}
+
+	free(x->hash);
+	x->hash = hash;
+	x->cap *= 2;
+	x->hcap *= 2;
+
+	for (uint32_t i = 1; i < x->nodes; i++) {
+		uint32_t h = slot(x, x->node[i].parent, x->node[i].pc);
+
+		while (x->hash[h]) h = (h + 1) & (x->hcap - 1);
+		x->hash[h] = i + 1;
+	}
+
+	return 0;
+}
+
+//the context for 'pc' called from 'parent', created if needed. 'parent' itself when out of room
+static uint32_t child(struct prof_ctx *x, uint32_t parent, uint16_t pc) {
+	uint32_t h = slot(x, parent, pc), i;
+
+	for (; (i = x->hash[h]); h = (h + 1) & (x->hcap - 1))
+		if (x->node[i - 1].parent == parent && x->node[i - 1].pc == pc) return i - 1;
+
+	if (x->nodes == __6502_PROFILE_NODES) return parent;
+	if (x->nodes == x->cap) {
+		if (grow(x)) return parent;
+		return child(x, parent, pc);
+	}
+
+	i = x->nodes++;
+	x->node[i] = (struct node) {parent, pc, 0};
+	x->hash[h] = i + 1;
+
+	return i;
+}
+
+static void enter(_6502_profile_t *p, uint16_t pc, uint8_t sp, uint64_t now) {
+	struct prof_ctx *x = p->ctx;
+
+	if (x->depth == __6502_PROFILE_DEPTH) return;
+
+	x->frame[x->depth] = (struct frame) {child(x, x->depth ? x->frame[x->depth - 1].node : 0, pc), sp, now};
+	x->depth++;
+	p->calls[pc]++;
+}
+
+//closes every frame the return took the stack pointer above (so pla/pla + rts unwinds properly)
+static void leave(_6502_profile_t *p, uint8_t sp, uint64_t now) {
+	struct prof_ctx *x = p->ctx;
+
+	for (; x->depth && x->frame[x->depth - 1].sp < sp; x->depth--) {
+		const struct frame *f = &x->frame[x->depth - 1];
+
+		p->incl[x->node[f->node].pc] += now - f->entry;
+	}
+}
+
+static void charge(_6502_profile_t *p, uint64_t c) {
+	struct prof_ctx *x = p->ctx;
+	uint32_t cur = x->depth ? x->frame[x->depth - 1].node : 0;
+
+	x->node[cur].self += c;
+	if (cur) p->excl[x->node[cur].pc] += c;
+}
+
+
+
+void _6502_profile_step(cpu6502_t *cpu, uint16_t at, uint64_t c0) {
+	_6502_profile_t *p = cpu->prof;
+	uint64_t c = cpu->cycles - c0;
+	uint8_t op = cpu->IR;
+
+	p->exec[at]++;
+	p->cycles[at] += c;
+	p->op_exec[op]++;
+	p->op_cycles[op] += c;
+	charge(p, c);
+
+	switch (op) {
+		case 0x00: case 0x20: //brk, jsr
+			enter(p, cpu->PC, cpu->SP, cpu->cycles);
+			break;
+
+		case 0x40: case 0x60: //rti, rts
+			leave(p, cpu->SP, cpu->cycles);
+			break;
+
+		case 0x4c: case 0x6c:
+		case 0x10: case 0x30: case 0x50: case 0x70: case 0x90: case 0xb0: case 0xd0: case 0xf0:
+			if (cpu->PC < at) {
+				p->back[at]++;
+				p->back_to[at] = cpu->PC;
+			}
+			break;
+	}
+}
+
+void _6502_profile_irq(cpu6502_t *cpu, uint64_t c0) {
+	enter(cpu->prof, cpu->PC, cpu->SP, c0);
+	charge(cpu->prof, cpu->cycles - c0);
+}
+
+uint64_t _6502_profile_run(cpu6502_t *cpu, uint64_t budget, uint64_t until) {
+	uint64_t n = 0;
+
+	cpu->stop = _6502_STOP_BUDGET;
+
+	while (n < budget && cpu->cycles < until && !(cpu->stop_req & (__6502_REQ_STOP | __6502_REQ_WATCH))) {
+		uint16_t at = cpu->PC;
+
+		if (BREAKING(cpu) && cpu->watch->exec[at >> 8] && _6502_break_at(cpu, at, cpu->cycles)) break;
+		_6502_clock(cpu);
+		n++;
+		if (cpu->stop == _6502_STOP_TRAP) break;
+
+		//(other variants step through their own loop, which tells)
+		if (cpu->PC == at && (cpu->IR == 0x4c || (cpu->IR & 0x1f) == 0x10 || (cpu->variant != _6502_CPU_NMOS && cpu->stop == _6502_STOP_STUCK))) {
+			cpu->stop = _6502_STOP_STUCK;
+			break;
+		}
+	}
+
+	if (cpu->stop_req) {
+		if (cpu->stop_req & __6502_REQ_STOP) cpu->stop = _6502_STOP_REQUEST;
+		else if (cpu->stop_req & __6502_REQ_WATCH) cpu->stop = _6502_STOP_WATCH;
+		cpu->stop_req = 0;
+	}
+
+	return n;
+}
+
+
+
+int _6502_profile_enable(cpu6502_t *cpu) {
+	_6502_profile_t *p;
+	struct prof_ctx *x;
+
+	if (cpu->prof) return 0;
+
+	p = calloc(1, sizeof(_6502_profile_t));
+	x = calloc(1, sizeof(struct prof_ctx));
+	if (p && x) {
+		x->cap = 1024;
+		x->hcap = 2048;
+		x->node = malloc(x->cap * sizeof(struct node));
+		x->hash = calloc(x->hcap, sizeof(uint32_t));
+	}
+
+	if (!p || !x || !x->node || !x->hash) {
+		if (x) {
+			free(x->node);
+			free(x->hash);
+		}
+		free(x);
+		free(p);
+		return -1;
+	}
+
+	x->node[0] = (struct node) {0, 0, 0};
+	x->nodes = 1;
+	p->ctx = x;
+	cpu->prof = p;
+
+	return 0;
+}
+
+void _6502_profile_disable(cpu6502_t *cpu) {
+	if (!cpu->prof) return;
+
+	free(cpu->prof->ctx->node);
+	free(cpu->prof->ctx->hash);
+	free(cpu->prof->ctx);
+	free(cpu->prof);
+	cpu->prof = NULL;
+}
+
+void _6502_profile_clear(cpu6502_t *cpu) {
+	struct prof_ctx *x;
+
+	if (!cpu->prof) return;
+
+	x = cpu->prof->ctx;
+	memset(cpu->prof, 0, offsetof(_6502_profile_t, ctx));
+	memset(x->hash, 0, x->hcap * sizeof(uint32_t));
+	x->node[0].self = 0;
+	x->nodes = 1;
+	x->depth = 0;
+}
+
+
+
+struct rank {
+	uint64_t key;
+	uint32_t i;
+};
+
+static int by_key(const void *a, const void *b) {
+	uint64_t x = ((const struct rank *) a)->key, y = ((const struct rank *) b)->key;
+
+	return (x < y) - (x > y);
+}
+
+//indices of the 'len' entries sorted by decreasing key, zero keys dropped. returns how many are left
+static uint32_t ranked(struct rank *r, uint32_t len) {
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < len; i++)
+		if (r[i].key) r[n++] = r[i];
+
+	qsort(r, n, sizeof(struct rank), by_key);
+
+	return n;
+}
+
+static double pct(uint64_t x, uint64_t total) {
+	return total ? 100.0 * x / total : 0;
+}
+
+void _6502_profile_report(const cpu6502_t *cpu, FILE *fp, int n) {
+	const _6502_profile_t *p = cpu->prof;
+	const struct prof_ctx *x;
+	struct rank *r;
+	uint64_t *incl, total = 0, instr = 0;
+	uint32_t k;
+
+	if (!p) return;
+
+	x = p->ctx;
+	r = malloc(0x10000 * sizeof(struct rank));
+	incl = malloc(0x10000 * sizeof(uint64_t));
+	if (!r || !incl) {
+		free(r);
+		free(incl);
+		return;
+	}
+
+	for (int i = 0; i < 256; i++) {
+		total += p->op_cycles[i];
+		instr += p->op_exec[i];
+	}
+
+	fprintf(fp, "instructions:\t%" PRIu64 "\ncycles:\t\t%" PRIu64 "\n", instr, total);
+
+	//a loop is the range between a taken backward jump/branch and its target
+	for (uint32_t i = 0; i < 0x10000; i++) {
+		r[i] = (struct rank) {0, i};
+		if (!p->back[i]) continue;
+
+		for (uint32_t a = p->back_to[i]; a <= i; a++)
+			r[i].key += p->cycles[a];
+	}
+
+	k = ranked(r, 0x10000);
+	fprintf(fp, "\nhot loops:\n");
+	for (uint32_t i = 0; i < k && i < (uint32_t) n; i++)
+		fprintf(fp, "\t$%04x-$%04x\titerations %-12" PRIu64 "\tcycles %-12" PRIu64 " (%5.1f%%)\n",
+			p->back_to[r[i].i], r[i].i, p->back[r[i].i], r[i].key, pct(r[i].key, total));
+
+	//frames still open count up to now
+	memcpy(incl, p->incl, 0x10000 * sizeof(uint64_t));
+	for (int i = 0; i < x->depth; i++)
+		incl[x->node[x->frame[i].node].pc] += cpu->cycles - x->frame[i].entry;
+
+	for (uint32_t i = 0; i < 0x10000; i++)
+		r[i] = (struct rank) {p->calls[i] ? incl[i] : 0, i};
+
+	k = ranked(r, 0x10000);
+	fprintf(fp, "\nsubroutines:\n");
+	for (uint32_t i = 0; i < k && i < (uint32_t) n; i++)
+		fprintf(fp, "\t$%04x\tcalls %-12" PRIu64 "\tinclusive %-12" PRIu64 " (%5.1f%%)\texclusive %-12" PRIu64 " (%5.1f%%)\n",
+			r[i].i, p->calls[r[i].i], r[i].key, pct(r[i].key, total), p->excl[r[i].i], pct(p->excl[r[i].i], total));
+
+	for (uint32_t i = 0; i < 0x10000; i++)
+		r[i] = (struct rank) {p->cycles[i], i};
+
+	k = ranked(r, 0x10000);
+	fprintf(fp, "\nhot addresses:\n");
+	for (uint32_t i = 0; i < k && i < (uint32_t) n; i++)
+		fprintf(fp, "\t$%04x\texec %-12" PRIu64 "\tcycles %-12" PRIu64 " (%5.1f%%)\n", r[i].i, p->exec[r[i].i], r[i].key, pct(r[i].key, total));
+
+	for (uint32_t i = 0; i < 256; i++)
+		r[i] = (struct rank) {p->op_cycles[i], i};
+
+	k = ranked(r, 256);
+	fprintf(fp, "\nopcodes:\n");
+	for (uint32_t i = 0; i < k && i < (uint32_t) n; i++)
+		fprintf(fp, "\t$%02x\texec %-12" PRIu64 "\tcycles %-12" PRIu64 " (%5.1f%%)\n", r[i].i, p->op_exec[r[i].i], r[i].key, pct(r[i].key, total));
+
+	free(r);
+	free(incl);
+}
+
+void _6502_profile_folded(const cpu6502_t *cpu, FILE *fp) {
+	const struct prof_ctx *x;
+	uint16_t path[__6502_PROFILE_DEPTH + 1];
+
+	if (!cpu->prof) return;
+
+	x = cpu->prof->ctx;
+
+	for (uint32_t i = 0; i < x->nodes; i++) {
+		int len = 0;
+
+		if (!x->node[i].self) continue;
+
+		for (uint32_t j = i; j; j = x->node[j].parent)
+			path[len++] = x->node[j].pc;
+
+		fprintf(fp, "top");
+		while (len--)
+			fprintf(fp, ";$%04x", path[len]);
+		fprintf(fp, " %" PRIu64 "\n", x->node[i].self);
+	}
+}
+
+
+
+#endif
\ No newline at end of file
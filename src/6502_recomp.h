@@ -0,0 +1,90 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+/*
+	Included by the C c6502-recomp writes, not part of the public api.
+
+	A recompiled block is the handlers of its instructions (6502_ops.h) one after the other, as the cache
+	would run them, with the address, opcode, base cycles and operand of each instruction spelled out:
+
+		static void b_c002(cpu6502_t *cpu, struct _6502_recomp_run *r) {
+			ENTER;
+		top:
+			I(0xc002, 0x9d, 5, 0x0200) W_ABX; ST(a); NEXT;
+			I(0xc005, 0xe8, 2, 0x0000) INC(x);
+			I(0xc006, 0xd0, 2, 0x00fa) BRANCH(!LZ(nz));
+			AGAIN(0xc002, 3, 11);
+		out:
+			LEAVE;
+		}
+
+	(sta $0200,x / inx / bne back to the sta: LZ(nz) is Z, so bne branches on !LZ(nz), as in the opcode list.)
+
+	The cache only calls it with room for every instruction in the budget and for the most cycles it can
+	take before 'until', so only irq polling, stop requests and stores hitting decoded code can end it
+	early, which NEXT checks for after the instructions that can do any of that. A block that loops
+	onto itself goes round in the function (AGAIN) as long as the cache would call it again.
+*/
+
+
+
+#pragma once
+
+
+
+#include "6502.h"
+#include "6502_ops.h"
+
+
+
+static inline void recomp_wr(cpu6502_t *cpu, uint16_t a, uint8_t x, uint64_t cyc) {
+	bus_wr_at(cpu, a, x, cyc);
+	_6502_cache_written(cpu->cache, a);
+}
+
+#define RD(a)					bus_rd_at(cpu, (a), cyc)
+#define WR(a, x)				recomp_wr(cpu, (a), (x), cyc)
+#define ZRD(a)					RD(a)
+#define ZWR(a, x)				WR(a, x)
+
+#define ARG8					(pc++, (uint8_t) arg)
+#define ARG16					(pc += 2, arg)
+
+#define STUCK					do {if (!back) {cpu->stop = _6502_STOP_STUCK; goto out;}} while (0)
+#define LIMIT					(n >= budget || cyc >= until || cpu->stop_req)
+
+//the registers out of the context and the limits out of the cache's run, and back
+#define ENTER \
+	struct _6502_cache *c = cpu->cache; \
+	uint16_t pc, ea, w, arg; \
+	uint8_t a = cpu->A, x = cpu->X, y = cpu->Y, sp = cpu->SP, op, d, t; \
+	cpu_s_t p = cpu->P; \
+	uint16_t nz = cpu->nz; \
+	uint64_t cyc = cpu->cycles, n = r->n, budget = r->budget, until = r->until; \
+	const uint8_t back = r->back; \
+	(void) c; (void) ea; (void) w; (void) d; (void) t; (void) arg; (void) budget; (void) back
+
+#define LEAVE \
+	cpu->PC = pc; \
+	cpu->A = a; cpu->X = x; cpu->Y = y; cpu->SP = sp; \
+	cpu->P = p; \
+	cpu->nz = nz; \
+	cpu->IR = op; \
+	cpu->cycles = cyc; \
+	r->n = n; \
+	r->until = until
+
+//one instruction: the opcode fetched from 'at', its operand (if any) still to be
+#define I(at, o, k, v)			n++; pc = (at) + 1; cyc += (k); op = (o); arg = (v);
+#define NEXT					if (c->smc || LIMIT) goto out
+
+//the block went back to its start: once more, if the cache would run it whole again
+#define AGAIN(at, k, most)		if (pc == (at) && !c->smc && !cpu->stop_req && n + (k) <= budget && cyc + (most) < until) goto top
\ No newline at end of file
@@ -0,0 +1,822 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "6502.h"
+#include "6502_ops.h"
+
+
+
+#define __6502_REPLAY_MAGIC			"c6502rpl"
+#define __6502_REPLAY_VERSION		1
+
+#define CHUNK						(64 << 10) //encoded reads or inputs written at once, in bytes
+#define LITERAL						128 //longest literal run
+#define REPEAT						4 //shortest repeat run
+
+//chunk kinds
+#define C_READS						1
+#define C_INPUTS					2
+#define C_KEY						3
+#define C_END						4
+
+
+
+/*
+	The file is a header and a sequence of chunks, in host byte order. Reads and inputs are two streams
+	of their own, interleaved chunk by chunk, so each can be read at its own pace: a read may come after
+	an input in the log and still be needed before the input is due (an irq raised by an io write, then
+	a read, in the same instruction). Both are flushed before every keyframe, so replaying from a
+	keyframe reads both from the chunk after it.
+		reads		runs, each a varint (length << 1 | repeated) followed by the byte repeated or the literal bytes
+		inputs		a kind, the cycle count as a varint delta from the input before in the chunk, the irq level (varint) for __6502_IN_IRQ
+		keyframe	struct key, then its pages: the page number and the 256 bytes as runs
+		end			the cycle count the recording stopped at (8 bytes)
+*/
+
+struct head {
+	char magic[8];
+	uint32_t version;
+	uint8_t variant, pad[3];
+	uint64_t interval;
+};
+
+struct chunk {
+	uint8_t kind, pad[3];
+	uint32_t len; //bytes following
+};
+
+struct key {
+	uint64_t cycles;
+	uint32_t irq;
+	uint16_t PC;
+	uint8_t A, X, Y, SP, P, IR;
+	uint8_t full; //every ram page, not only the ones changed since the keyframe before
+	uint8_t pad;
+	uint16_t pages;
+};
+
+struct buf {
+	uint8_t *p;
+	size_t len, cap;
+	int err; //out of memory, what didn't fit was dropped
+};
+
+//run length encoder: a byte coming in goes into the repeat, which becomes a run or joins the literal bytes once another one comes
+struct rle {
+	uint8_t v, lit[LITERAL];
+	uint32_t nlit;
+	uint64_t rep; //times v came in a row so far
+};
+
+//where a replay reads one of the streams
+struct cursor {
+	long next; //offset of the chunk to look at next
+	uint8_t *buf;
+	size_t len, pos, cap;
+	uint64_t left; //bytes left in the run being read
+	uint8_t lit, v;
+	uint64_t last; //cycle count of the input before
+};
+
+struct _6502_replay {
+	cpu6502_t *cpu;
+	int replaying;
+	FILE *fp;
+	uint64_t interval;
+
+	//io pages go through the log, these are what they were mapped to
+	uint8_t wrapped[256];
+	struct {
+		_6502_read_t read;
+		_6502_write_t write;
+		void *user;
+	} saved[256];
+
+	//recording
+	int err;
+	struct buf reads, inputs, tmp;
+	struct rle rle;
+	uint64_t last; //cycle count of the input before in the chunk
+	uint64_t keys; //keyframes written
+	_6502_snapshot_t *prev; //memory as of the keyframe before
+
+	//replaying
+	struct kf {
+		long off; //of the keyframe's payload
+		uint32_t len;
+		uint8_t full;
+		uint64_t cycles;
+	} *kf;
+	size_t nkf, cap;
+	uint64_t end;
+	struct cursor rd, in;
+	struct {
+		int valid;
+		uint8_t kind;
+		uint32_t arg;
+		uint64_t at;
+	} next; //the input due next, read ahead
+	int busy; //an input of the log is being applied, the core takes it
+	int ended; //the log ran out
+	uint8_t *mem; //64K, keyframes are rebuilt in
+	_6502_snapshot_t *snap; //the last one rebuilt
+	size_t snap_kf;
+	uint32_t snap_irq;
+};
+
+
+
+//room for n more bytes. -1 if out of memory
+static int reserve(struct buf *b, size_t n) {
+	size_t cap = b->cap ? b->cap : CHUNK + 1024;
+	uint8_t *p;
+
+	if (b->len + n <= b->cap) return 0;
+
+	while (cap < b->len + n) cap *= 2;
+	if (!(p = realloc(b->p, cap))) {
+		b->err = 1;
+		return -1;
+	}
+	b->p = p;
+	b->cap = cap;
+
+	return 0;
+}
+
+static void put(struct buf *b, const void *x, size_t n) {
+	if (reserve(b, n)) return;
+
+	memcpy(b->p + b->len, x, n);
+	b->len += n;
+}
+
+static void put_var(struct buf *b, uint64_t v) {
+	uint8_t x[10], n = 0;
+
+	for (; v >= 0x80; v >>= 7)
+		x[n++] = v | 0x80;
+	x[n++] = v;
+
+	put(b, x, n);
+}
+
+static int get_var(const uint8_t *p, size_t len, size_t *pos, uint64_t *v) {
+	*v = 0;
+
+	for (int s = 0; s < 64; s += 7) {
+		if (*pos >= len) return -1;
+		*v |= (uint64_t) (p[*pos] & 0x7f) << s;
+		if (!(p[(*pos)++] & 0x80)) return 0;
+	}
+
+	return -1;
+}
+
+static void literals(struct rle *e, struct buf *b) {
+	if (!e->nlit) return;
+
+	put_var(b, e->nlit << 1);
+	put(b, e->lit, e->nlit);
+	e->nlit = 0;
+}
+
+//what the repeat came to
+static void settle(struct rle *e, struct buf *b) {
+	if (e->rep >= REPEAT) {
+		literals(e, b);
+		put_var(b, e->rep << 1 | 1);
+		put(b, &e->v, 1);
+	} else {
+		for (; e->rep; e->rep--) {
+			if (e->nlit == LITERAL) literals(e, b);
+			e->lit[e->nlit++] = e->v;
+		}
+	}
+
+	e->rep = 0;
+}
+
+static inline void rle_put(struct rle *e, struct buf *b, uint8_t x) {
+	if (e->rep && x == e->v) {
+		e->rep++;
+		return;
+	}
+
+	settle(e, b);
+	e->v = x;
+	e->rep = 1;
+}
+
+static void rle_finish(struct rle *e, struct buf *b) {
+	settle(e, b);
+	literals(e, b);
+}
+
+//n bytes out of runs
+static int unrle(const uint8_t *p, size_t len, size_t *pos, uint8_t *out, size_t n) {
+	while (n) {
+		uint64_t h, k;
+
+		if (get_var(p, len, pos, &h) || !(k = h >> 1) || k > n) return -1;
+
+		if (h & 1) {
+			if (*pos >= len) return -1;
+			memset(out, p[(*pos)++], k);
+		} else {
+			if (len - *pos < k) return -1;
+			memcpy(out, p + *pos, k);
+			*pos += k;
+		}
+
+		out += k;
+		n -= k;
+	}
+
+	return 0;
+}
+
+
+
+static uint8_t rec_read(void *user, uint16_t a);
+static void rec_write(void *user, uint16_t a, uint8_t x);
+static uint8_t log_read(void *user, uint16_t a);
+static void log_write(void *user, uint16_t a, uint8_t x);
+
+static void wrap(struct _6502_replay *r, uint8_t pg) {
+	cpu6502_t *cpu = r->cpu;
+
+	if (r->wrapped[pg] || cpu->rpage[pg]) return;
+
+	r->saved[pg].read = cpu->io[pg].read;
+	r->saved[pg].write = cpu->io[pg].write;
+	r->saved[pg].user = cpu->io[pg].user;
+	r->wrapped[pg] = 1;
+
+	cpu->io[pg].read = r->replaying ? log_read : rec_read;
+	cpu->io[pg].write = r->replaying ? log_write : rec_write;
+	cpu->io[pg].user = cpu;
+}
+
+static void unwrap(struct _6502_replay *r, uint8_t pg) {
+	cpu6502_t *cpu = r->cpu;
+
+	if (!r->wrapped[pg]) return;
+
+	cpu->io[pg].read = r->saved[pg].read;
+	cpu->io[pg].write = r->saved[pg].write;
+	cpu->io[pg].user = r->saved[pg].user;
+	r->wrapped[pg] = 0;
+}
+
+//underneath the watches, if any
+static void wrap_all(struct _6502_replay *r, int on) {
+	_6502_watch_lift(r->cpu);
+	for (int pg = 0; pg < 256; pg++) {
+		if (on) wrap(r, pg);
+		else unwrap(r, pg);
+	}
+	_6502_watch_hook(r->cpu);
+}
+
+void _6502_replay_remapped(cpu6502_t *cpu, uint8_t page, uint16_t n) {
+	struct _6502_replay *r = cpu->replay;
+
+	if (!r) return;
+
+	//_6502_map leaves the io entries as they were, _6502_map_io replaces them
+	for (uint16_t i = 0; i < n; i++) {
+		uint8_t pg = page + i;
+
+		if (cpu->io[pg].read == rec_read || cpu->io[pg].read == log_read) unwrap(r, pg);
+		r->wrapped[pg] = 0;
+		wrap(r, pg);
+	}
+}
+
+
+
+/*
+	Recording.
+*/
+
+static void emit(struct _6502_replay *r, uint8_t kind, struct buf *b) {
+	struct chunk h = {kind, {0}, b->len};
+
+	if (!b->len && (kind == C_READS || kind == C_INPUTS)) return;
+	if (b->err || fwrite(&h, sizeof(h), 1, r->fp) != 1 || (b->len && fwrite(b->p, b->len, 1, r->fp) != 1)) r->err = 1;
+
+	b->len = 0;
+	if (kind == C_INPUTS) r->last = 0;
+}
+
+static uint8_t rec_read(void *user, uint16_t a) {
+	cpu6502_t *cpu = user;
+	struct _6502_replay *r = cpu->replay;
+	uint8_t pg = a >> 8, x = r->saved[pg].read(r->saved[pg].user, a);
+
+	rle_put(&r->rle, &r->reads, x);
+	if (r->reads.len >= CHUNK) emit(r, C_READS, &r->reads);
+
+	return x;
+}
+
+static void rec_write(void *user, uint16_t a, uint8_t x) {
+	cpu6502_t *cpu = user;
+	struct _6502_replay *r = cpu->replay;
+
+	r->saved[a >> 8].write(r->saved[a >> 8].user, a, x);
+}
+
+int _6502_replay_input(cpu6502_t *cpu, uint8_t kind, uint32_t arg) {
+	struct _6502_replay *r = cpu->replay;
+
+	if (r->replaying) return !r->busy;
+
+	//(what would change nothing)
+	if ((kind == __6502_IN_IRQ && arg == cpu->irq) || (kind == __6502_IN_INTERRUPT && cpu->P.flags.i)) return 0;
+
+	put(&r->inputs, &kind, 1);
+	put_var(&r->inputs, cpu->cycles - r->last);
+	if (kind == __6502_IN_IRQ) put_var(&r->inputs, arg);
+	r->last = cpu->cycles;
+
+	if (r->inputs.len >= CHUNK) emit(r, C_INPUTS, &r->inputs);
+
+	return 0;
+}
+
+//everything logged so far goes before the keyframe
+static void key(struct _6502_replay *r) {
+	cpu6502_t *cpu = r->cpu;
+	_6502_snapshot_t *s = _6502_snapshot(cpu);
+	struct key k = {cpu->cycles, cpu->irq, cpu->PC, cpu->A, cpu->X, cpu->Y, cpu->SP, _6502_get_p(cpu), cpu->IR, !r->prev || !(r->keys % _6502_REPLAY_FULL), 0, 0};
+
+	if (!s) {
+		r->err = 1;
+		return;
+	}
+
+	rle_finish(&r->rle, &r->reads);
+	emit(r, C_READS, &r->reads);
+	emit(r, C_INPUTS, &r->inputs);
+
+	r->tmp.len = 0;
+	put(&r->tmp, &k, sizeof(k));
+
+	for (int pg = 0; pg < 256; pg++) {
+		const uint8_t *m = _6502_snapshot_page(s, pg), *o = r->prev ? _6502_snapshot_page(r->prev, pg) : NULL;
+		struct rle e = {0};
+		uint8_t x = pg;
+
+		if (!m || (!k.full && o && !memcmp(m, o, 256))) continue;
+
+		put(&r->tmp, &x, 1);
+		for (int i = 0; i < 256; i++)
+			rle_put(&e, &r->tmp, m[i]);
+		rle_finish(&e, &r->tmp);
+		k.pages++;
+	}
+
+	if (!r->tmp.err) memcpy(r->tmp.p + offsetof(struct key, pages), &k.pages, sizeof(k.pages));
+	emit(r, C_KEY, &r->tmp);
+	if (fflush(r->fp)) r->err = 1;
+
+	_6502_snapshot_free(r->prev);
+	r->prev = s;
+	r->keys++;
+}
+
+static void keyframe(cpu6502_t *cpu, void *user) {
+	struct _6502_replay *r = user;
+
+	//(the cycle-exact engine fires events between the accesses of an instruction: the keyframe waits for
+	//the end of it, and of the interrupt sequence it lets in, to take registers a replay can start from)
+	if (cpu->exact.on && (cpu->exact.mid || EXACT_PENDING(cpu))) {
+		if (_6502_schedule(cpu, cpu->cycles + 1, keyframe, r)) r->err = 1;
+		return;
+	}
+
+	key(r);
+	if (_6502_schedule(cpu, cpu->cycles + r->interval, keyframe, r)) r->err = 1;
+}
+
+static void done(struct _6502_replay *r) {
+	cpu6502_t *cpu = r->cpu;
+
+	wrap_all(r, 0);
+	_6502_cancel(cpu, keyframe, r);
+
+	//the plain loop ran instead of the cache meanwhile
+	_6502_cache_stale(cpu);
+
+	_6502_snapshot_free(r->prev);
+	_6502_snapshot_free(r->snap);
+	free(r->reads.p);
+	free(r->inputs.p);
+	free(r->tmp.p);
+	free(r->rd.buf);
+	free(r->in.buf);
+	free(r->kf);
+	free(r->mem);
+	free(r);
+
+	cpu->replay = NULL;
+}
+
+int _6502_record(cpu6502_t *cpu, const char *path, uint64_t interval) {
+	struct _6502_replay *r;
+	struct head h = {__6502_REPLAY_MAGIC, __6502_REPLAY_VERSION, cpu->variant, {0}, interval ? interval : _6502_REPLAY_INTERVAL};
+
+	if (cpu->replay || !(r = calloc(1, sizeof(struct _6502_replay)))) return -1;
+	if (!(r->fp = fopen(path, "wb"))) {
+		free(r);
+		return -1;
+	}
+
+	r->cpu = cpu;
+	r->interval = h.interval;
+	cpu->replay = r;
+	wrap_all(r, 1);
+
+	if (fwrite(&h, sizeof(h), 1, r->fp) != 1) r->err = 1;
+	key(r);
+
+	if (r->err || _6502_schedule(cpu, cpu->cycles + r->interval, keyframe, r)) {
+		fclose(r->fp);
+		remove(path);
+		done(r);
+		return -1;
+	}
+
+	return 0;
+}
+
+int _6502_record_stop(cpu6502_t *cpu) {
+	struct _6502_replay *r = cpu->replay;
+	int ok;
+
+	if (!r || r->replaying) return -1;
+
+	rle_finish(&r->rle, &r->reads);
+	emit(r, C_READS, &r->reads);
+	emit(r, C_INPUTS, &r->inputs);
+
+	r->tmp.len = 0;
+	put(&r->tmp, &cpu->cycles, sizeof(cpu->cycles));
+	emit(r, C_END, &r->tmp);
+
+	ok = !r->err;
+	ok &= fclose(r->fp) == 0;
+	done(r);
+
+	return ok ? 0 : -1;
+}
+
+
+
+/*
+	Replaying.
+*/
+
+//the next chunk of a kind, skipping the others. -1 at the end (or where the recording was cut short)
+static int load(struct _6502_replay *r, struct cursor *c, uint8_t kind) {
+	struct chunk h;
+
+	do {
+		if (fseek(r->fp, c->next, SEEK_SET) || fread(&h, sizeof(h), 1, r->fp) != 1 || h.kind == C_END) return -1;
+		c->next += sizeof(h) + h.len;
+	} while (h.kind != kind);
+
+	if (h.len > c->cap) {
+		uint8_t *p = realloc(c->buf, h.len);
+
+		if (!p) return -1;
+		c->buf = p;
+		c->cap = h.len;
+	}
+
+	if (fread(c->buf, 1, h.len, r->fp) != h.len) return -1;
+
+	c->len = h.len;
+	c->pos = 0;
+	c->left = 0;
+	c->last = 0;
+
+	return 0;
+}
+
+static int next_read(struct _6502_replay *r) {
+	struct cursor *c = &r->rd;
+
+	while (!c->left) {
+		uint64_t h;
+
+		if (c->pos == c->len && load(r, c, C_READS)) return -1;
+		if (get_var(c->buf, c->len, &c->pos, &h) || !(h >> 1)) return -1;
+
+		c->left = h >> 1;
+		c->lit = !(h & 1);
+		if (!c->lit) {
+			if (c->pos == c->len) return -1;
+			c->v = c->buf[c->pos++];
+		} else if (c->len - c->pos < c->left) return -1;
+	}
+
+	c->left--;
+	return c->lit ? c->buf[c->pos++] : c->v;
+}
+
+//the read comes from the log, the end of it stops the run
+static uint8_t log_read(void *user, uint16_t a) {
+	cpu6502_t *cpu = user;
+	struct _6502_replay *r = cpu->replay;
+	int x = next_read(r);
+
+	(void) a;
+
+	if (x < 0) {
+		r->ended = 1;
+		_6502_stop(cpu);
+		return 0;
+	}
+
+	return x;
+}
+
+static void log_write(void *user, uint16_t a, uint8_t x) {
+	(void) user; (void) a; (void) x;
+}
+
+//reads the next input ahead. 0 if there's none left
+static int next(struct _6502_replay *r) {
+	struct cursor *c = &r->in;
+	uint64_t d, arg = 0;
+	uint8_t kind;
+
+	if (r->next.valid) return 1;
+	if (c->pos == c->len && load(r, c, C_INPUTS)) return 0;
+
+	kind = c->buf[c->pos++];
+	if (get_var(c->buf, c->len, &c->pos, &d) || (kind == __6502_IN_IRQ && get_var(c->buf, c->len, &c->pos, &arg)) || kind > __6502_IN_RESET) {
+		c->pos = c->len;
+		return 0;
+	}
+
+	c->last += d;
+	r->next.valid = 1;
+	r->next.kind = kind;
+	r->next.arg = arg;
+	r->next.at = c->last;
+
+	return 1;
+}
+
+//the inputs due by now (at the end of the instruction that was running for those from io callbacks), as the host gave them
+static void due(cpu6502_t *cpu, void *user) {
+	struct _6502_replay *r = user;
+
+	while (next(r) && r->next.at <= cpu->cycles) {
+		r->busy = 1;
+		switch (r->next.kind) {
+			case __6502_IN_IRQ:
+				_6502_irq_clear(cpu, ~r->next.arg);
+				_6502_irq_set(cpu, r->next.arg);
+				break;
+			case __6502_IN_INTERRUPT: _6502_interrupt(cpu); break;
+			case __6502_IN_NMI: _6502_nmi(cpu); break;
+			case __6502_IN_RESET: _6502_reset(cpu); break;
+		}
+		r->busy = 0;
+		r->next.valid = 0;
+	}
+
+	if (r->next.valid) _6502_schedule(cpu, r->next.at, due, r);
+}
+
+//the keyframe's pages into mem[]
+static int pages(struct _6502_replay *r, size_t i, struct key *k) {
+	const struct kf *f = &r->kf[i];
+	size_t pos = sizeof(struct key);
+
+	r->tmp.len = 0;
+	if (reserve(&r->tmp, f->len) || fseek(r->fp, f->off, SEEK_SET) || fread(r->tmp.p, 1, f->len, r->fp) != f->len) return -1;
+
+	memcpy(k, r->tmp.p, sizeof(struct key));
+	for (uint16_t n = 0; n < k->pages; n++) {
+		uint8_t pg;
+
+		if (pos >= f->len) return -1;
+		pg = r->tmp.p[pos++];
+		if (unrle(r->tmp.p, f->len, &pos, r->mem + (pg << 8), 256)) return -1;
+	}
+
+	return 0;
+}
+
+static void rewind_to(struct cursor *c, long off) {
+	c->next = off;
+	c->len = c->pos = 0;
+	c->left = 0;
+	c->last = 0;
+}
+
+//to keyframe i, rebuilt from the full one before (unless it's the one rebuilt last), with both streams read from there
+static int restore(struct _6502_replay *r, size_t i) {
+	cpu6502_t *cpu = r->cpu;
+
+	if (!r->snap || r->snap_kf != i) {
+		cpu6502_t *regs;
+		_6502_snapshot_t *s;
+		struct key k;
+		size_t j = i;
+
+		while (j && !r->kf[j].full) j--;
+		for (; j <= i; j++)
+			if (pages(r, j, &k)) return -1;
+
+		if (!(regs = calloc(1, sizeof(cpu6502_t)))) return -1;
+		regs->cycles = k.cycles;
+		regs->PC = k.PC;
+		regs->A = k.A; regs->X = k.X; regs->Y = k.Y; regs->SP = k.SP; regs->IR = k.IR;
+		_6502_set_p(regs, k.P);
+
+		s = _6502_snapshot_of(cpu, regs, r->mem);
+		free(regs);
+		if (!s) return -1;
+
+		_6502_snapshot_free(r->snap);
+		r->snap = s;
+		r->snap_kf = i;
+		r->snap_irq = k.irq;
+	}
+
+	_6502_restore(cpu, r->snap);
+	cpu->irq = r->snap_irq;
+
+	rewind_to(&r->rd, r->kf[i].off + r->kf[i].len);
+	rewind_to(&r->in, r->kf[i].off + r->kf[i].len);
+	r->next.valid = 0;
+	r->ended = 0;
+
+	_6502_cancel(cpu, due, r);
+	due(cpu, r);
+
+	return 0;
+}
+
+//the last keyframe at or before 'cycle' (the first one if none)
+static size_t keyframe_at(const struct _6502_replay *r, uint64_t cycle) {
+	size_t lo = 0, hi = r->nkf;
+
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+
+		if (r->kf[mid].cycles <= cycle) lo = mid;
+		else hi = mid;
+	}
+
+	return lo;
+}
+
+//runs through whatever stops on the way (breakpoints, watches, loops onto themselves skipped as idle)
+static uint64_t forward(struct _6502_replay *r, uint64_t budget, uint64_t until) {
+	cpu6502_t *cpu = r->cpu;
+	uint8_t idle = cpu->idle;
+	uint64_t n = 0;
+
+	if (!idle) _6502_idle(cpu, _6502_IDLE_MEM);
+	while (n < budget && cpu->cycles < until && !r->ended) {
+		uint64_t k = (until == UINT64_MAX) ? _6502_run(cpu, budget - n) : _6502_run_until(cpu, until);
+
+		n += k;
+		if (!k && cpu->stop != _6502_STOP_BREAK) break;
+	}
+	if (!idle) _6502_idle(cpu, idle);
+
+	return n;
+}
+
+//(the header and every chunk, keyframes indexed)
+static int scan(struct _6502_replay *r) {
+	struct chunk h;
+	long off = sizeof(struct head), size;
+
+	if (fseek(r->fp, 0, SEEK_END) || (size = ftell(r->fp)) < 0) return -1;
+
+	while (off + (long) sizeof(h) <= size && !fseek(r->fp, off, SEEK_SET) && fread(&h, sizeof(h), 1, r->fp) == 1) {
+		if (off + (long) sizeof(h) + h.len > size) break;
+
+		if (h.kind == C_KEY) {
+			struct key k;
+			struct kf *kf;
+
+			if (h.len < sizeof(k) || fread(&k, sizeof(k), 1, r->fp) != 1) return -1;
+			if (r->nkf == r->cap) {
+				if (!(kf = realloc(r->kf, (r->cap ? 2 * r->cap : 64) * sizeof(struct kf)))) return -1;
+				r->kf = kf;
+				r->cap = r->cap ? 2 * r->cap : 64;
+			}
+
+			r->kf[r->nkf++] = (struct kf) {off + sizeof(h), h.len, k.full, k.cycles};
+			r->end = k.cycles;
+		} else if (h.kind == C_END) {
+			if (h.len != sizeof(r->end) || fread(&r->end, sizeof(r->end), 1, r->fp) != 1) return -1;
+			break;
+		}
+
+		off += sizeof(h) + h.len;
+	}
+
+	return (r->nkf && r->kf[0].full) ? 0 : -1;
+}
+
+_6502_replay_t *_6502_replay_open(cpu6502_t *cpu, const char *path) {
+	struct _6502_replay *r;
+	struct head h;
+
+	if (cpu->replay || !(r = calloc(1, sizeof(struct _6502_replay)))) return NULL;
+
+	r->cpu = cpu;
+	r->replaying = 1;
+	if (!(r->fp = fopen(path, "rb")) || fread(&h, sizeof(h), 1, r->fp) != 1 || memcmp(h.magic, __6502_REPLAY_MAGIC, 8) ||
+		h.version != __6502_REPLAY_VERSION || _6502_variant(cpu, h.variant) || scan(r) || !(r->mem = calloc(1, 0x10000))) {
+		if (r->fp) fclose(r->fp);
+		free(r->kf);
+		free(r->mem);
+		free(r);
+		return NULL;
+	}
+
+	r->interval = h.interval;
+	cpu->replay = r;
+	wrap_all(r, 1);
+
+	if (restore(r, 0)) {
+		_6502_replay_close(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+void _6502_replay_close(_6502_replay_t *r) {
+	if (!r) return;
+
+	_6502_cancel(r->cpu, due, r);
+	fclose(r->fp);
+	done(r);
+}
+
+int _6502_replay_seek(_6502_replay_t *r, uint64_t cycle) {
+	cpu6502_t *cpu = r->cpu;
+	uint64_t to = (cycle < r->end) ? cycle : r->end;
+	size_t i = keyframe_at(r, to);
+
+	//ahead within the same keyframe: no need to go back to it
+	if ((r->ended || cpu->cycles > to || cpu->cycles < r->kf[i].cycles) && restore(r, i)) return -1;
+
+	forward(r, UINT64_MAX, to);
+
+	return (cpu->cycles >= cycle) ? 0 : -1;
+}
+
+int _6502_replay_back(_6502_replay_t *r, uint64_t n) {
+	cpu6502_t *cpu = r->cpu;
+	uint64_t at = cpu->cycles, m = 0;
+	size_t i = keyframe_at(r, at ? at - 1 : 0);
+
+	//instructions from the keyframe to here, going back a keyframe at a time if not enough
+	for (;; i--) {
+		if (restore(r, i)) return -1;
+		m = forward(r, UINT64_MAX, at);
+		if (m >= n || !i) break;
+	}
+
+	if (restore(r, i)) return -1;
+	if (m < n) return -1;
+	forward(r, m - n, UINT64_MAX);
+
+	return 0;
+}
+
+uint64_t _6502_replay_start(const _6502_replay_t *r) {
+	return r->kf[0].cycles;
+}
+
+uint64_t _6502_replay_end(const _6502_replay_t *r) {
+	return r->end;
+}
\ No newline at end of file
@@ -0,0 +1,150 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+/*
+	Internal to the core, not part of the public api.
+
+	The fused loop of 6502.c, included there once per variant compiled in (see _6502_CPUS) with
+		RUN						the name of the function
+		OPCODES(X)				the variant's opcodes (see 6502_ops.h)
+		CYCLES(op)				the base cycles of an opcode
+		FLOW					its control flow opcodes, a 256 entry table (see _6502_cover)
+		HOOKS					1 for the loop checking breakpoints and counting edges (see _6502_watch)
+	defined, and the bus, operand and dispatch macros of the fused interpreter in place.
+*/
+
+
+
+//after an instruction: the edge it took, if it could take one. Then before the next: address and opcode breakpoints
+#if (HOOKS)
+#define EDGE					if (cmap && n && FLOW[op]) {w = (pc >> 4) ^ (pc << 8); ck = (w ^ cprev) & cmask; BUMP(ck); cprev = (w & cmask) >> 1;}
+#define BUMP(k)					if (!clist) cmap[k]++; else if (!cmap[k]++) clist[cpu->cover.ntouched++] = k; else if (!cmap[k]) cmap[k] = 1 //listing the counters it brings up from 0, if asked to (see _6502_cover_touched)
+#define BREAK					if (cpu->watch && cpu->watch->exec[pc >> 8] && _6502_break_at(cpu, pc, cyc)) goto out; else ir = op
+#define BREAK_OP				if (cpu->watch && cpu->watch->ops[op] && _6502_break_op_at(cpu, pc - 1, op, cyc)) {pc--; n--; op = ir; goto out;} //(not fetched after all)
+#else
+#define EDGE
+#define BREAK
+#define BREAK_OP
+#endif
+
+
+
+static uint64_t RUN(cpu6502_t *cpu, uint64_t budget, uint64_t until) {
+	uint16_t pc = _PC, ea = 0, w;
+	uint8_t a = _A, x = _X, y = _Y, sp = _SP, op = _IR, d, t;
+	cpu_s_t p = _P;
+	uint16_t nz = _NZ;
+	uint64_t n = 0, cyc = cpu->cycles;
+	const uint8_t back = cpu->idle ? 0x80 : 0;
+
+	#if (HOOKS)
+	uint8_t *const cmap = cpu->cover.map;
+	const uint32_t cmask = cpu->cover.mask;
+	uint32_t *const clist = cpu->cover.touched;
+	uint16_t cprev = cpu->cover.prev, ck;
+	uint8_t ir = op; //the last opcode executed
+	#endif
+
+	#if (_6502_TRACE)
+	_6502_trace_rec_t *const ring = cpu->trace ? cpu->trace->rec : NULL;
+	_6502_trace_rec_t *rec = ring ? ring + (cpu->trace->hdr->n & cpu->trace->mask) : NULL;
+
+	//(the run ends where the ring wraps around, for records to be written one after the other; the next one gets the last one's ea)
+	if (ring && budget > (uint64_t) (ring + cpu->trace->mask + 1 - rec)) budget = ring + cpu->trace->mask + 1 - rec;
+	if (ring) ea = cpu->trace->hdr->ea;
+	#endif
+
+	#if (_6502_COMPUTED_GOTO)
+	static const void *const ops[256] = {OPCODES(LABEL)};
+	static const void *const zops[256] = {OPCODES(ZLABEL)};
+	const void *const *tab = ZP_MAPPED(cpu) ? zops : ops;
+	#else
+	const int zp = ZP_MAPPED(cpu);
+	#endif
+
+	cpu->stop = _6502_STOP_BUDGET;
+
+	for (;;) {
+		EDGE;
+		if (n >= budget || cyc >= until || cpu->stop_req) break;
+		BREAK;
+		n++;
+		op = RD(pc++);
+		BREAK_OP;
+
+		#if (_6502_TRACE)
+		if (ring) TRACE_REC;
+		#endif
+
+		cyc += CYCLES(op);
+
+		#if (_6502_COMPUTED_GOTO)
+		goto *tab[op];
+		{
+		#else
+		if (!zp) switch (op) {
+		#endif
+			#define ZRD(a)				RD(a)
+			#define ZWR(a, x)			WR(a, x)
+			OPCODES(OP)
+		}
+
+		//(each case continues, so without computed goto only one of the two switches runs)
+		#if (!_6502_COMPUTED_GOTO)
+		switch (op) {
+		#else
+		{
+		#endif
+			#undef ZRD
+			#undef ZWR
+			#define ZRD(a)				ZP_RD(a)
+			#define ZWR(a, x)			ZP_WR(a, x)
+			OPCODES(ZOP)
+		}
+	}
+
+out:
+	#if (HOOKS)
+	cpu->cover.prev = cprev;
+	#endif
+
+	#if (_6502_TRACE)
+	if (ring) {
+		cpu->trace->hdr->ea = ea;
+		cpu->trace->hdr->n += rec - (ring + (cpu->trace->hdr->n & cpu->trace->mask));
+	}
+	#endif
+
+	if (cpu->stop_req) {
+		if (cpu->stop_req & __6502_REQ_STOP) cpu->stop = _6502_STOP_REQUEST;
+		else if (cpu->stop_req & __6502_REQ_WATCH) cpu->stop = _6502_STOP_WATCH;
+		cpu->stop_req = 0;
+	}
+
+	_PC = pc;
+	_A = a; _X = x; _Y = y; _SP = sp; _IR = op;
+	_P = p;
+	_NZ = nz;
+	cpu->cycles = cyc;
+
+	return n;
+}
+
+
+
+#undef RUN
+#undef HOOKS
+#undef EDGE
+#undef BUMP
+#undef BREAK
+#undef BREAK_OP
+#undef ZRD
+#undef ZWR
\ No newline at end of file
@@ -0,0 +1,327 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "6502.h"
+#include "6502_ops.h"
+
+
+
+#define __6502_SNAPSHOT_MAGIC		"c6502snp"
+#define __6502_SNAPSHOT_VERSION		1
+
+//the serialized form, also used in memory
+struct image {
+	char magic[8];
+	uint32_t version;
+	uint32_t pages; //pages stored in data
+	uint64_t cycles;
+	uint16_t PC;
+	uint8_t A, X, Y, SP, P, IR;
+	uint16_t slot[256]; //where each page is stored in data, plus 1 (0 = not stored)
+	uint8_t data[][256];
+};
+
+struct _6502_snapshot {
+	uint64_t id; //unique in the process, so a freed base can't be mistaken for a new snapshot at the same address
+	size_t size;
+	int mapped; //image is a mapped file
+	struct image *img;
+};
+
+static atomic_uint_least64_t ids; //the only process-wide state in the core, hence atomic
+
+
+
+//host memory of a ram page, tracked or not. NULL for rom and io
+static uint8_t *ram(cpu6502_t *cpu, uint8_t pg) {
+	if (cpu->track[pg]) return cpu->track[pg];
+	return (cpu->wpage[pg] != cpu->rom_sink) ? cpu->wpage[pg] : NULL;
+}
+
+//the JIT keeps its own copy of the write pointers
+static void wpage_changed(cpu6502_t *cpu, uint8_t pg) {
+	#if (_6502_JIT)
+	if (cpu->cache && cpu->cache->jit) _6502_jit_page(cpu->cache->jit, pg, page_code(cpu->cache, pg));
+	#else
+	(void) cpu; (void) pg;
+	#endif
+}
+
+//first store to a protected page: note it and let the following ones go straight to memory
+static void tracked_write(void *user, uint16_t a, uint8_t x) {
+	cpu6502_t *cpu = user;
+	uint8_t pg = a >> 8;
+
+	cpu->wpage[pg] = cpu->track[pg];
+	cpu->dirty[cpu->ndirty++] = pg;
+	wpage_changed(cpu, pg);
+
+	cpu->wpage[pg][a & 0xff] = x;
+}
+
+//the page was overwritten behind the core's back
+static void restored(cpu6502_t *cpu, uint8_t pg) {
+	if (cpu->cache && page_code(cpu->cache, pg)) _6502_cache_invalidate(cpu, pg << 8, 256);
+}
+
+static void protect(cpu6502_t *cpu, uint8_t pg) {
+	cpu->wpage[pg] = NULL;
+	cpu->io[pg].write = tracked_write;
+	cpu->io[pg].user = cpu;
+	wpage_changed(cpu, pg);
+}
+
+//start tracking every ram page but zero page and stack, which the direct path always writes
+static void track(cpu6502_t *cpu, const _6502_snapshot_t *s) {
+	for (int pg = 2; pg < 256; pg++) {
+		uint8_t *m = ram(cpu, pg);
+
+		cpu->track[pg] = m;
+		if (m && cpu->wpage[pg]) protect(cpu, pg);
+	}
+
+	cpu->base = s;
+	cpu->base_id = s->id;
+	cpu->ndirty = 0;
+}
+
+
+
+//the context's ram pages, out of its memory or out of mem[] (by address), and the registers of 'regs'
+static _6502_snapshot_t *image_of(cpu6502_t *cpu, const cpu6502_t *regs, const uint8_t *mem) {
+	_6502_snapshot_t *s;
+	struct image *img;
+	uint32_t pages = 0;
+
+	for (int pg = 0; pg < 256; pg++)
+		pages += ram(cpu, pg) != NULL;
+
+	s = malloc(sizeof(_6502_snapshot_t));
+	img = calloc(1, sizeof(struct image) + pages * 256);
+	if (!s || !img) {
+		free(s);
+		free(img);
+		return NULL;
+	}
+
+	memcpy(img->magic, __6502_SNAPSHOT_MAGIC, 8);
+	img->version = __6502_SNAPSHOT_VERSION;
+	img->cycles = regs->cycles;
+	img->PC = regs->PC;
+	img->A = regs->A; img->X = regs->X; img->Y = regs->Y; img->SP = regs->SP;
+	img->P = _6502_get_p(regs); img->IR = regs->IR;
+
+	for (int pg = 0; pg < 256; pg++) {
+		uint8_t *m = ram(cpu, pg);
+
+		if (!m) continue;
+		memcpy(img->data[img->pages], mem ? mem + (pg << 8) : m, 256);
+		img->slot[pg] = ++img->pages;
+	}
+
+	s->id = atomic_fetch_add(&ids, 1) + 1;
+	s->size = sizeof(struct image) + pages * 256;
+	s->mapped = 0;
+	s->img = img;
+
+	return s;
+}
+
+static _6502_snapshot_t *capture(cpu6502_t *cpu) {
+	_6502_snapshot_t *s = image_of(cpu, cpu, NULL);
+
+	if (s) track(cpu, s);
+
+	return s;
+}
+
+static void restore(cpu6502_t *cpu, const _6502_snapshot_t *s) {
+	const struct image *img = s->img;
+
+	if (cpu->base == s && cpu->base_id == s->id) {
+		//only what was written since the last sync
+		for (uint16_t i = 0; i < cpu->ndirty; i++) {
+			uint8_t pg = cpu->dirty[i];
+
+			if (!cpu->track[pg]) continue;
+			if (img->slot[pg]) memcpy(cpu->track[pg], img->data[img->slot[pg] - 1], 256);
+			protect(cpu, pg);
+			restored(cpu, pg);
+		}
+
+		cpu->ndirty = 0;
+
+		for (int pg = 0; pg < 2; pg++) {
+			uint8_t *m = ram(cpu, pg);
+
+			if (!m || !img->slot[pg]) continue;
+			memcpy(m, img->data[img->slot[pg] - 1], 256);
+			restored(cpu, pg);
+		}
+	} else {
+		for (int pg = 0; pg < 256; pg++) {
+			uint8_t *m = ram(cpu, pg);
+
+			if (m && img->slot[pg]) memcpy(m, img->data[img->slot[pg] - 1], 256);
+		}
+
+		_6502_cache_flush(cpu);
+		track(cpu, s);
+	}
+
+	cpu->cycles = img->cycles;
+	cpu->PC = img->PC;
+	cpu->A = img->A; cpu->X = img->X; cpu->Y = img->Y; cpu->SP = img->SP;
+	_6502_set_p(cpu, img->P); cpu->IR = img->IR;
+}
+
+//watched pages are seen through, as they are mapped underneath
+_6502_snapshot_t *_6502_snapshot(cpu6502_t *cpu) {
+	_6502_snapshot_t *s;
+
+	_6502_watch_lift(cpu);
+	s = capture(cpu);
+	_6502_watch_hook(cpu);
+
+	return s;
+}
+
+//(and a breakpoint the context stopped at isn't where it is anymore)
+void _6502_restore(cpu6502_t *cpu, const _6502_snapshot_t *s) {
+	_6502_watch_lift(cpu);
+	restore(cpu, s);
+	_6502_watch_hook(cpu);
+
+	if (cpu->watch) cpu->watch->at = -1;
+}
+
+_6502_snapshot_t *_6502_snapshot_of(cpu6502_t *cpu, const cpu6502_t *regs, const uint8_t *mem) {
+	_6502_snapshot_t *s;
+
+	_6502_watch_lift(cpu);
+	s = image_of(cpu, regs, mem);
+	_6502_watch_hook(cpu);
+
+	return s;
+}
+
+const uint8_t *_6502_snapshot_page(const _6502_snapshot_t *s, uint8_t pg) {
+	return s->img->slot[pg] ? s->img->data[s->img->slot[pg] - 1] : NULL;
+}
+
+void _6502_snapshot_free(_6502_snapshot_t *s) {
+	if (!s) return;
+
+	#if !defined(_WIN32)
+	if (s->mapped) munmap(s->img, s->size);
+	else
+	#endif
+	free(s->img);
+
+	free(s);
+}
+
+
+
+int _6502_snapshot_save(const _6502_snapshot_t *s, const char *path) {
+	FILE *fp = fopen(path, "wb");
+	int ok;
+
+	if (fp == NULL)
+		return -1;
+
+	ok = fwrite(s->img, s->size, 1, fp) == 1;
+	ok &= fclose(fp) == 0;
+
+	return ok ? 0 : -1;
+}
+
+//header, version and the page count against the size
+static int valid(const struct image *img, size_t size) {
+	if (size < sizeof(struct image) || memcmp(img->magic, __6502_SNAPSHOT_MAGIC, 8) || img->version != __6502_SNAPSHOT_VERSION)
+		return 0;
+	if (img->pages > 256 || size != sizeof(struct image) + img->pages * 256)
+		return 0;
+
+	for (int pg = 0; pg < 256; pg++)
+		if (img->slot[pg] > img->pages) return 0;
+
+	return 1;
+}
+
+_6502_snapshot_t *_6502_snapshot_load(const char *path) {
+	_6502_snapshot_t *s = malloc(sizeof(_6502_snapshot_t));
+	if (!s) return NULL;
+
+	#if !defined(_WIN32)
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st) || st.st_size < (off_t) sizeof(struct image)) {
+		if (fd >= 0) close(fd);
+		free(s);
+		return NULL;
+	}
+
+	//private and read-only: restoring copies out of the page cache, nothing is read upfront
+	s->size = st.st_size;
+	s->img = mmap(NULL, s->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	s->mapped = 1;
+	close(fd);
+
+	if (s->img == MAP_FAILED) {
+		free(s);
+		return NULL;
+	}
+	#else
+	FILE *fp = fopen(path, "rb");
+
+	if (fp == NULL) {
+		free(s);
+		return NULL;
+	}
+
+	fseek(fp, 0L, SEEK_END);
+	s->size = ftell(fp);
+	rewind(fp);
+
+	s->img = malloc(s->size ? s->size : 1);
+	s->mapped = 0;
+	if (!s->img || fread(s->img, s->size, 1, fp) != 1) {
+		fclose(fp);
+		free(s->img);
+		free(s);
+		return NULL;
+	}
+	fclose(fp);
+	#endif
+
+	if (!valid(s->img, s->size)) {
+		_6502_snapshot_free(s);
+		return NULL;
+	}
+
+	s->id = atomic_fetch_add(&ids, 1) + 1;
+
+	return s;
+}
\ No newline at end of file
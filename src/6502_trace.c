@@ -0,0 +1,133 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "6502.h"
+#include "6502_ops.h"
+
+
+
+#if (_6502_TRACE)
+
+
+
+//the ring, header included, backed by the file itself
+static int map_file(struct _6502_trace *t, const char *path) {
+	#if !defined(_WIN32)
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	void *m;
+
+	if (fd < 0) return -1;
+
+	if (ftruncate(fd, t->size)) {
+		close(fd);
+		return -1;
+	}
+
+	m = mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) return -1;
+
+	t->hdr = m;
+	return 0;
+	#else
+	(void) t; (void) path;
+	return -1;
+	#endif
+}
+
+int _6502_trace_enable(cpu6502_t *cpu, const char *path, uint64_t records, int mode) {
+	struct _6502_trace *t;
+	uint64_t cap = 1;
+
+	if (cpu->trace) _6502_trace_disable(cpu);
+	if (mode != _6502_TRACE_FILE && mode != _6502_TRACE_FLIGHT) return -1;
+
+	while (cap < records) cap <<= 1;
+
+	t = calloc(1, sizeof(struct _6502_trace));
+	if (!t) return -1;
+
+	t->size = sizeof(_6502_trace_hdr_t) + cap * sizeof(_6502_trace_rec_t);
+	t->mode = mode;
+	t->mask = cap - 1;
+	t->path = malloc(strlen(path) + 1);
+
+	if (!t->path || (mode == _6502_TRACE_FILE ? map_file(t, path) : !(t->hdr = calloc(1, t->size)))) {
+		free(t->path);
+		free(t);
+		return -1;
+	}
+
+	strcpy(t->path, path);
+	memcpy(t->hdr->magic, _6502_TRACE_MAGIC, 8);
+	t->hdr->version = _6502_TRACE_VERSION;
+	t->hdr->size = sizeof(_6502_trace_rec_t);
+	t->hdr->cap = cap;
+	t->hdr->n = 0;
+	t->hdr->ea = 0;
+	t->hdr->variant = cpu->variant;
+	t->rec = (_6502_trace_rec_t *) (t->hdr + 1);
+
+	cpu->trace = t;
+
+	return 0;
+}
+
+void _6502_trace_disable(cpu6502_t *cpu) {
+	struct _6502_trace *t = cpu->trace;
+
+	if (!t) return;
+
+	if (t->mode == _6502_TRACE_FLIGHT) {
+		_6502_trace_dump(cpu);
+		free(t->hdr);
+	}
+	#if !defined(_WIN32)
+	else munmap(t->hdr, t->size);
+	#endif
+
+	free(t->path);
+	free(t);
+	cpu->trace = NULL;
+	_6502_cache_stale(cpu);
+}
+
+int _6502_trace_dump(cpu6502_t *cpu) {
+	const struct _6502_trace *t = cpu->trace;
+	FILE *fp;
+	int ok;
+
+	if (!t || t->mode != _6502_TRACE_FLIGHT) return 0;
+
+	//only as much of the ring as was filled
+	fp = fopen(t->path, "wb");
+	if (fp == NULL)
+		return -1;
+
+	ok = fwrite(t->hdr, sizeof(_6502_trace_hdr_t) + (t->hdr->n < t->hdr->cap ? t->hdr->n : t->hdr->cap) * sizeof(_6502_trace_rec_t), 1, fp) == 1;
+	ok &= fclose(fp) == 0;
+
+	return ok ? 0 : -1;
+}
+
+
+
+#endif
\ No newline at end of file
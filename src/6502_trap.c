@@ -0,0 +1,214 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "6502.h"
+#include "6502_ops.h"
+
+
+
+#define OUTPUTS						(_6502_TRAP_A | _6502_TRAP_X | _6502_TRAP_Y | _6502_TRAP_P)
+#define P_COMPARED					0xc3 //n, v, z and c
+
+
+
+static struct _6502_traps *traps(cpu6502_t *cpu) {
+	if (!cpu->trap) cpu->trap = calloc(1, sizeof(struct _6502_traps));
+
+	return cpu->trap;
+}
+
+//what rts would do
+static void rts(cpu6502_t *cpu) {
+	uint16_t pc = _6502_peek(cpu, __6502_STACK_BOTTOM + (++cpu->SP));
+
+	pc |= _6502_peek(cpu, __6502_STACK_BOTTOM + (++cpu->SP)) << 8;
+	cpu->PC = pc + 1;
+}
+
+//free stack, at or below sp
+static int dead(const cpu6502_t *cpu, uint16_t a) {
+	return (a >> 8) == (__6502_STACK_BOTTOM >> 8) && (a & 0xff) <= cpu->SP;
+}
+
+static void verify_off(struct _6502_traps *t) {
+	t->v.on = t->skip = 0;
+}
+
+
+
+int _6502_trap(cpu6502_t *cpu, uint16_t addr, _6502_trap_t f, void *user, uint32_t cycles, int flags) {
+	struct _6502_traps *t;
+	int slot;
+
+	if (!f || (flags & ~(OUTPUTS | _6502_TRAP_VERIFY))) return -1;
+	if (!(t = traps(cpu))) return -1;
+
+	if (t->at[addr]) slot = t->at[addr] - 1;
+	else {
+		for (slot = 0; slot < _6502_TRAPS && t->trap[slot].f; slot++);
+		if (slot == _6502_TRAPS) return -1;
+
+		memset(&t->trap[slot].stats, 0, sizeof(t->trap[slot].stats));
+	}
+
+	t->trap[slot].f = f;
+	t->trap[slot].user = user;
+	t->trap[slot].cycles = cycles;
+	t->trap[slot].addr = addr;
+	t->trap[slot].flags = flags;
+	t->at[addr] = slot + 1;
+
+	//a run going on ends, to stop at it
+	cpu->stop_req |= __6502_REQ_EVENT;
+
+	return 0;
+}
+
+void _6502_untrap(cpu6502_t *cpu, uint16_t addr) {
+	struct _6502_traps *t = cpu->trap;
+	uint8_t slot;
+
+	if (!t || !t->at[addr]) return;
+
+	slot = t->at[addr] - 1;
+	if (t->v.on && t->v.slot == slot) verify_off(t);
+
+	t->trap[slot].f = NULL;
+	t->at[addr] = 0;
+}
+
+void _6502_untrap_all(cpu6502_t *cpu) {
+	free(cpu->trap);
+	cpu->trap = NULL;
+}
+
+_6502_trap_stats_t _6502_trap_stats(const cpu6502_t *cpu, uint16_t addr) {
+	const struct _6502_traps *t = cpu->trap;
+
+	if (!t || !t->at[addr]) return (_6502_trap_stats_t) {0};
+
+	return t->trap[t->at[addr] - 1].stats;
+}
+
+
+
+void _6502_trap_store(cpu6502_t *cpu, uint16_t a) {
+	struct _6502_traps *t = cpu->trap;
+
+	if (t->logged[a]) return;
+
+	t->logged[a] = 1;
+	t->old[a] = _6502_peek(cpu, a);
+	t->addr[t->n++] = a;
+}
+
+int _6502_trap_run(cpu6502_t *cpu) {
+	struct _6502_traps *t = cpu->trap;
+	uint8_t slot = t->at[cpu->PC] - 1, a = cpu->A, x = cpu->X, y = cpu->Y, sp = cpu->SP, p = _6502_get_p(cpu);
+	uint64_t c0 = cpu->cycles;
+
+	//(routines called by the one being verified run natively if trusted, or as guest code)
+	if (!(t->trap[slot].flags & _6502_TRAP_VERIFY)) {
+		t->trap[slot].stats.calls++;
+		cpu->cycles += t->trap[slot].cycles + t->trap[slot].f(cpu, t->trap[slot].user);
+		rts(cpu);
+		return 1;
+	}
+
+	if (t->v.on) return 0;
+
+	//the function first, journaling its stores
+	t->n = 0;
+	t->log = 1;
+	t->trap[slot].f(cpu, t->trap[slot].user);
+	t->log = 0;
+	rts(cpu);
+
+	t->v.on = 1;
+	t->v.slot = slot;
+	t->v.ret = cpu->PC;
+	t->v.sp = cpu->SP;
+	t->v.a = cpu->A;
+	t->v.x = cpu->X;
+	t->v.y = cpu->Y;
+	t->v.p = _6502_get_p(cpu);
+	t->v.c0 = c0;
+
+	//then everything as it was, for the routine to run
+	for (uint32_t i = 0; i < t->n; i++) {
+		uint16_t at = t->addr[i];
+
+		t->want[at] = _6502_peek(cpu, at);
+		_6502_poke(cpu, at, t->old[at]);
+		t->logged[at] = 0;
+	}
+
+	for (int pg = 0; pg < 256; pg++)
+		if ((t->page[pg] = cpu->rpage[pg] != NULL)) memcpy(t->expect + (pg << 8), cpu->rpage[pg], 0x100);
+	for (uint32_t i = 0; i < t->n; i++) t->expect[t->addr[i]] = t->want[t->addr[i]];
+
+	cpu->PC = t->trap[slot].addr;
+	cpu->A = a;
+	cpu->X = x;
+	cpu->Y = y;
+	cpu->SP = sp;
+	_6502_set_p(cpu, p);
+	cpu->cycles = c0;
+
+	t->skip = 1;
+
+	return 0;
+}
+
+void _6502_trap_check(cpu6502_t *cpu) {
+	struct _6502_traps *t = cpu->trap;
+	uint8_t flags = t->trap[t->v.slot].flags, kind = 0;
+
+	t->skip = 0;
+	if (cpu->PC != t->v.ret || cpu->SP != t->v.sp) {
+		if (cpu->cycles - t->v.c0 < _6502_TRAP_LIMIT) return;
+		kind = _6502_TRAP_LOST;
+		goto failed;
+	}
+
+	if ((flags & _6502_TRAP_A) && cpu->A != t->v.a) kind |= _6502_TRAP_A;
+	if ((flags & _6502_TRAP_X) && cpu->X != t->v.x) kind |= _6502_TRAP_X;
+	if ((flags & _6502_TRAP_Y) && cpu->Y != t->v.y) kind |= _6502_TRAP_Y;
+	if ((flags & _6502_TRAP_P) && ((_6502_get_p(cpu) ^ t->v.p) & P_COMPARED)) kind |= _6502_TRAP_P;
+
+	//what either of them stored: the pages readable directly whole, the function's stores elsewhere. The
+	//stack only above sp: what the routine pushed and pulled is left below it, where the function never wrote
+	for (int pg = 0; pg < 256 && !(kind & _6502_TRAP_MEM); pg++) {
+		int from = (pg == (__6502_STACK_BOTTOM >> 8)) ? cpu->SP + 1 : 0;
+
+		if (t->page[pg] && cpu->rpage[pg] && memcmp(cpu->rpage[pg] + from, t->expect + (pg << 8) + from, 0x100 - from)) kind |= _6502_TRAP_MEM;
+	}
+	for (uint32_t i = 0; i < t->n && !(kind & _6502_TRAP_MEM); i++)
+		if (!t->page[t->addr[i] >> 8] && !dead(cpu, t->addr[i]) && _6502_peek(cpu, t->addr[i]) != t->want[t->addr[i]]) kind |= _6502_TRAP_MEM;
+
+	if (!kind) {
+		t->v.on = 0;
+		t->trap[t->v.slot].stats.verified++;
+		t->trap[t->v.slot].stats.guest_cycles += cpu->cycles - t->v.c0;
+		return;
+	}
+
+	failed:
+	t->v.on = 0;
+	t->trap[t->v.slot].stats.failed++;
+	cpu->hit.addr = t->trap[t->v.slot].addr;
+	cpu->hit.kind = kind;
+	cpu->hit.value = 0;
+	cpu->stop = _6502_STOP_TRAP;
+}
\ No newline at end of file
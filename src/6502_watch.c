@@ -0,0 +1,271 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "6502.h"
+#include "6502_ops.h"
+
+
+
+#define KINDS						(_6502_WATCH_EXEC | _6502_WATCH_READ | _6502_WATCH_WRITE | _6502_WATCH_VALUE)
+#define RW							(_6502_WATCH_READ | _6502_WATCH_WRITE)
+
+
+
+//the first hit of an instruction is the one reported
+static void hit(cpu6502_t *cpu, uint16_t a, uint8_t kind, uint8_t x) {
+	if (cpu->stop_req & __6502_REQ_WATCH) return;
+
+	cpu->hit.addr = a;
+	cpu->hit.kind = kind;
+	cpu->hit.value = x;
+	cpu->stop_req |= __6502_REQ_WATCH;
+}
+
+static int matches(const struct _6502_watch *w, uint16_t a, uint8_t kind, uint8_t x) {
+	return (w->kind[a] & kind) && (!(w->kind[a] & _6502_WATCH_VALUE) || w->value[a] == x);
+}
+
+static uint8_t watch_read(void *user, uint16_t a);
+static void watch_write(void *user, uint16_t a, uint8_t x);
+
+static void lift(cpu6502_t *cpu, uint8_t pg) {
+	struct _6502_watch *w = cpu->watch;
+
+	if (!w->hooked[pg]) return;
+
+	cpu->rpage[pg] = w->saved[pg].rpage;
+	cpu->wpage[pg] = w->saved[pg].wpage;
+	cpu->io[pg].read = w->saved[pg].read;
+	cpu->io[pg].write = w->saved[pg].write;
+	cpu->io[pg].user = w->saved[pg].user;
+	w->hooked[pg] = 0;
+}
+
+static void hook(cpu6502_t *cpu, uint8_t pg) {
+	struct _6502_watch *w = cpu->watch;
+
+	if (w->hooked[pg] || !w->rw[pg]) return;
+
+	w->saved[pg].rpage = cpu->rpage[pg];
+	w->saved[pg].wpage = cpu->wpage[pg];
+	w->saved[pg].read = cpu->io[pg].read;
+	w->saved[pg].write = cpu->io[pg].write;
+	w->saved[pg].user = cpu->io[pg].user;
+	w->hooked[pg] = 1;
+
+	cpu->rpage[pg] = cpu->wpage[pg] = NULL;
+	cpu->io[pg].read = watch_read;
+	cpu->io[pg].write = watch_write;
+	cpu->io[pg].user = cpu;
+}
+
+//memory is accessed straight, callbacks with the page lifted (they may remap it, or write protection may let stores through)
+static uint8_t watch_read(void *user, uint16_t a) {
+	cpu6502_t *cpu = user;
+	struct _6502_watch *w = cpu->watch;
+	uint8_t pg = a >> 8, x;
+
+	if (w->saved[pg].rpage) {
+		x = w->saved[pg].rpage[a & 0xff];
+	} else {
+		lift(cpu, pg);
+		x = cpu->io[pg].read(cpu->io[pg].user, a);
+		hook(cpu, pg);
+	}
+
+	if (matches(w, a, _6502_WATCH_READ, x)) hit(cpu, a, _6502_WATCH_READ, x);
+
+	return x;
+}
+
+static void watch_write(void *user, uint16_t a, uint8_t x) {
+	cpu6502_t *cpu = user;
+	struct _6502_watch *w = cpu->watch;
+	uint8_t pg = a >> 8;
+
+	if (matches(w, a, _6502_WATCH_WRITE, x)) hit(cpu, a, _6502_WATCH_WRITE, x);
+
+	if (w->saved[pg].wpage) {
+		w->saved[pg].wpage[a & 0xff] = x;
+	} else {
+		lift(cpu, pg);
+		cpu->io[pg].write(cpu->io[pg].user, a, x);
+		hook(cpu, pg);
+	}
+}
+
+
+
+//unless the run before stopped right there
+static int stop_at(cpu6502_t *cpu, uint16_t pc, uint64_t cyc, uint8_t kind, uint8_t x) {
+	struct _6502_watch *w = cpu->watch;
+
+	if (w->at == pc && w->at_cyc == cyc) return 0;
+
+	w->at = pc;
+	w->at_cyc = cyc;
+	cpu->hit.addr = pc;
+	cpu->hit.kind = kind;
+	cpu->hit.value = x;
+	cpu->stop = _6502_STOP_BREAK;
+
+	return 1;
+}
+
+int _6502_break_at(cpu6502_t *cpu, uint16_t pc, uint64_t cyc) {
+	return (cpu->watch->kind[pc] & _6502_WATCH_EXEC) && stop_at(cpu, pc, cyc, _6502_WATCH_EXEC, 0);
+}
+
+int _6502_break_op_at(cpu6502_t *cpu, uint16_t pc, uint8_t op, uint64_t cyc) {
+	return stop_at(cpu, pc, cyc, _6502_WATCH_OPCODE, op);
+}
+
+void _6502_watch_lift(cpu6502_t *cpu) {
+	if (!cpu->watch) return;
+
+	for (int pg = 0; pg < 256; pg++)
+		lift(cpu, pg);
+}
+
+void _6502_watch_hook(cpu6502_t *cpu) {
+	if (!cpu->watch) return;
+
+	for (int pg = 0; pg < 256; pg++)
+		hook(cpu, pg);
+}
+
+void _6502_watch_remapped(cpu6502_t *cpu, uint8_t page, uint16_t n) {
+	if (!cpu->watch) return;
+
+	//(the new entries replaced the watch's own)
+	for (uint16_t i = 0; i < n; i++) {
+		cpu->watch->hooked[page + i] = 0;
+		hook(cpu, page + i);
+	}
+}
+
+
+
+static struct _6502_watch *watches(cpu6502_t *cpu) {
+	if (!cpu->watch && (cpu->watch = calloc(1, sizeof(struct _6502_watch))))
+		cpu->watch->at = -1;
+
+	return cpu->watch;
+}
+
+int _6502_watch(cpu6502_t *cpu, uint16_t a, uint32_t len, int kind, uint8_t value) {
+	struct _6502_watch *w;
+
+	if (!len || a + len > 0x10000 || !(kind & (_6502_WATCH_EXEC | RW)) || (kind & ~KINDS) || (kind & _6502_WATCH_VALUE && !(kind & RW))) return -1;
+	if (!(w = watches(cpu))) return -1;
+
+	for (uint32_t i = a; i < a + len; i++) {
+		uint8_t pg = i >> 8, old = w->kind[i];
+
+		w->kind[i] |= kind;
+		if (kind & _6502_WATCH_VALUE) w->value[i] = value;
+
+		if ((kind & _6502_WATCH_EXEC) && !(old & _6502_WATCH_EXEC)) w->exec[pg]++, w->nexec++;
+		if ((kind & RW) && !(old & RW)) w->rw[pg]++, w->nrw++;
+		hook(cpu, pg);
+	}
+
+	//the engine changes, and so may the zero page path
+	cpu->stop_req |= __6502_REQ_EVENT;
+
+	return 0;
+}
+
+void _6502_unwatch(cpu6502_t *cpu, uint16_t a, uint32_t len, int kind) {
+	struct _6502_watch *w = cpu->watch;
+	int any;
+
+	if (!w || !len || a + len > 0x10000) return;
+
+	any = WATCHING(cpu);
+
+	for (uint32_t i = a; i < a + len; i++) {
+		uint8_t pg = i >> 8, old = w->kind[i];
+
+		w->kind[i] &= ~kind;
+		if (!(w->kind[i] & RW)) w->kind[i] &= ~_6502_WATCH_VALUE;
+
+		if ((old & _6502_WATCH_EXEC) && !(w->kind[i] & _6502_WATCH_EXEC)) w->exec[pg]--, w->nexec--;
+		if ((old & RW) && !(w->kind[i] & RW)) {
+			w->rw[pg]--, w->nrw--;
+			if (!w->rw[pg]) lift(cpu, pg);
+		}
+	}
+
+	cpu->stop_req |= __6502_REQ_EVENT;
+
+	if (any && !WATCHING(cpu)) _6502_cache_stale(cpu);
+}
+
+int _6502_break_op(cpu6502_t *cpu, int op, int on) {
+	struct _6502_watch *w;
+	int any = WATCHING(cpu);
+
+	if (op < _6502_BREAK_ILLEGAL || op > 0xff) return -1;
+	if (!cpu->watch && !on) return 0;
+	if (!(w = watches(cpu))) return -1;
+
+	for (int i = 0; i < 256; i++) {
+		if ((op >= 0) ? (i != op) : (cpu->variant != _6502_CPU_NMOS || !_6502_illegal(i))) continue;
+
+		if (on && !w->ops[i]) w->ops[i] = 1, w->nops++;
+		else if (!on && w->ops[i]) w->ops[i] = 0, w->nops--;
+	}
+
+	cpu->stop_req |= __6502_REQ_EVENT;
+
+	if (any && !WATCHING(cpu)) _6502_cache_stale(cpu);
+
+	return 0;
+}
+
+void _6502_unwatch_all(cpu6502_t *cpu) {
+	int any = WATCHING(cpu);
+
+	if (!cpu->watch) return;
+
+	_6502_watch_lift(cpu);
+	free(cpu->watch);
+	cpu->watch = NULL;
+
+	if (any && !WATCHING(cpu)) _6502_cache_stale(cpu);
+}
+
+
+
+int _6502_cover(cpu6502_t *cpu, uint8_t *map, uint32_t size) {
+	int any = WATCHING(cpu);
+
+	if (map && (!size || (size & (size - 1)))) return -1;
+
+	cpu->cover.map = map;
+	cpu->cover.mask = map ? size - 1 : 0;
+	cpu->cover.prev = 0;
+	cpu->stop_req |= __6502_REQ_EVENT;
+
+	if (any && !WATCHING(cpu)) _6502_cache_stale(cpu);
+
+	return 0;
+}
+
+void _6502_cover_touched(cpu6502_t *cpu, uint32_t *list) {
+	cpu->cover.touched = list;
+	cpu->cover.ntouched = 0;
+	cpu->stop_req |= __6502_REQ_EVENT;
+}
\ No newline at end of file
@@ -1,5 +1,9 @@
+#include <getopt.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "6502.h"
 
@@ -9,52 +13,154 @@
 #define RAM_END						((uint16_t) (0xffff))
 #define RAM_SIZE					((size_t) (RAM_END - RAM_START + 1))
 
-#define PRG_START					((uint16_t) (0x000a))
+#define PRG_START					((uint16_t) (0x000a)) //where raw images go unless --load says otherwise
 
 
 
 static uint8_t ram[RAM_SIZE];
 
-inline uint8_t _6502_read(uint16_t a) {return ram[a];}
-inline void _6502_write(uint16_t a, uint8_t x) {ram[a] = x;}
+static uint8_t ram_read(void *user, uint16_t a) {return ((uint8_t *) user)[a];}
+static void ram_write(void *user, uint16_t a, uint8_t x) {((uint8_t *) user)[a] = x;}
 
 
 
-static size_t load_prg(const char *name) {
-	FILE *fp = fopen(name, "rb");
-	if (fp == NULL)
-		return -1;
+static const char *const cpu_names[] = _6502_CPU_NAMES;
 
-	fseek(fp, 0L, SEEK_END);
-	size_t s = ftell(fp);
-	rewind(fp);
+static void usage(const char *argv0) {
+	fprintf(stderr, "usage: %s [-f raw|prg|hex] [-l load] [-e entry|reset] [-r] [-c cpu] [-R file] image%s\n"
+		"  -f, --format  image format (default: from the extension, raw if unknown)\n"
+		"  -l, --load    where a raw image goes (default: 0x%04x)\n"
+		"  -e, --entry   start address, or reset for the reset vector (default: the image's, else 0x%04x)\n"
+		"  -r, --rom     map the image read-only\n"
+		"  -c, --cpu     nmos, nmosx (undocumented opcodes), 65c02 or r65c02, if compiled in (default: %s)\n"
+		"  -R, --record  record the run to a file, for _6502_replay_open\n",
+		argv0, (_6502_PROFILE) ? " [out.folded]" : "", PRG_START, _6502_START_ADDRESS, cpu_names[_6502_CPU]);
+	exit(1);
+}
 
-	fread(ram + PRG_START, s, 1, fp);
-	fclose(fp);
+//an address, in any base strtol understands
+static int32_t address(const char *s) {
+	char *end;
+	long a = strtol(s, &end, 0);
 
-	return s;
+	return (*s && !*end && a >= 0 && a <= 0xffff) ? a : -1;
 }
 
 int main(int argc, char** argv) {
-	if (argc < 2) return 1;
-
-	size_t prg_size = load_prg(argv[1]);
-	if (prg_size == (size_t) -1)
+	static const struct option opts[] = {
+		{"format", required_argument, NULL, 'f'},
+		{"load", required_argument, NULL, 'l'},
+		{"entry", required_argument, NULL, 'e'},
+		{"rom", no_argument, NULL, 'r'},
+		{"cpu", required_argument, NULL, 'c'},
+		{"record", required_argument, NULL, 'R'},
+		{NULL, 0, NULL, 0}
+	};
+	int format = -1, type = _6502_MAP_RAM, has_entry = 0, variant = _6502_CPU, c;
+	int32_t load = PRG_START, entry = 0;
+	const char *record = NULL;
+
+	while ((c = getopt_long(argc, argv, "f:l:e:rc:R:", opts, NULL)) != -1) {
+		switch (c) {
+			case 'f':
+				if (!strcmp(optarg, "raw")) format = _6502_IMAGE_RAW;
+				else if (!strcmp(optarg, "prg")) format = _6502_IMAGE_PRG;
+				else if (!strcmp(optarg, "hex")) format = _6502_IMAGE_HEX;
+				else usage(argv[0]);
+				break;
+			case 'l':
+				if ((load = address(optarg)) < 0) usage(argv[0]);
+				break;
+			case 'e':
+				if (!strcmp(optarg, "reset")) entry = _6502_START_VECTOR;
+				else if ((entry = address(optarg)) < 0) usage(argv[0]);
+				has_entry = 1;
+				break;
+			case 'r': type = _6502_MAP_ROM; break;
+			case 'c':
+				for (variant = 0; variant < (int) (sizeof(cpu_names) / sizeof(cpu_names[0])) && strcmp(optarg, cpu_names[variant]); variant++);
+				if (variant == sizeof(cpu_names) / sizeof(cpu_names[0])) usage(argv[0]);
+				break;
+			case 'R': record = optarg; break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if (optind >= argc) usage(argv[0]);
+
+	_6502_image_t img;
+	if (format < 0) format = _6502_image_format(argv[optind]);
+	if (_6502_image_open(&img, argv[optind], format, load)) {
+		fprintf(stderr, "%s: unreadable, malformed or not fitting in 64K\n", argv[optind]);
 		return 1;
+	}
+
+	size_t prg_size = 0;
+	for (int i = 0; i < img.nseg; i++)
+		prg_size += img.seg[i].len;
 
 	printf("MEM_SIZE:\t%lu bytes\t(0x%lx)\nFILE_SIZE:\t%lu bytes\t(0x%lx)\n\n", RAM_SIZE, RAM_SIZE, prg_size, prg_size);
 
-	_6502_reset();
+	cpu6502_t cpu;
+	_6502_init(&cpu, ram_read, ram_write, ram);
+	if (_6502_variant(&cpu, variant)) {
+		fprintf(stderr, "%s: not compiled in (make CPUS=all)\n", cpu_names[variant]);
+		return 1;
+	}
+	_6502_map(&cpu, 0, 256, ram, _6502_MAP_RAM);
+	if (_6502_image_load(&cpu, &img, ram, type)) {
+		fprintf(stderr, "%s: can't be loaded\n", argv[optind]);
+		_6502_image_close(&img);
+		return 1;
+	}
+
+	//--entry, or else wherever the image says it starts (raw images don't)
+	if (has_entry) cpu.start = entry;
+	else if (img.entry >= 0) cpu.start = img.entry;
+	_6502_reset(&cpu);
+
+	#if (_6502_PROFILE)
+	if (_6502_profile_enable(&cpu))
+		return 1;
+	#endif
+
+	#if (_6502_TRACE)
+	//the last instructions before getting stuck end up in c6502.trace (c6502-trace prints them)
+	if (_6502_trace_enable(&cpu, "c6502.trace", 1 << 16, _6502_TRACE_FLIGHT))
+		return 1;
+	#endif
 
-	//basically, loop till you get stuck. (not actually accurate, but works fine in this case)
-	uint16_t old_pc;
+	if (record && _6502_record(&cpu, record, 0)) {
+		fprintf(stderr, "%s: can't record there\n", record);
+		return 1;
+	}
 
+	//basically, run till you get stuck. (not actually accurate, but works fine in this case)
 	do {
-		old_pc = _PC;
-		_6502_clock();
-	} while (_PC != old_pc);
+		_6502_run(&cpu, UINT64_MAX);
+	} while (cpu.stop != _6502_STOP_STUCK);
+
+	printf("stuck at:\t0x%04x\ncycles:\t\t%" PRIu64 "\n", cpu.PC, cpu.cycles);
+
+	if (record && _6502_record_stop(&cpu)) fprintf(stderr, "%s: write error\n", record);
+
+	#if (_6502_TRACE)
+	_6502_trace_disable(&cpu);
+	#endif
+
+	#if (_6502_PROFILE)
+	//the folded stacks go to the file named by the second argument, if any
+	printf("\n");
+	_6502_profile_report(&cpu, stdout, 10);
+
+	FILE *fp = (optind + 1 < argc) ? fopen(argv[optind + 1], "w") : NULL;
+	if (fp != NULL) {
+		_6502_profile_folded(&cpu, fp);
+		fclose(fp);
+	}
+	#endif
 
-	printf("stuck at:\t0x%04x\n", _PC);
+	_6502_image_close(&img);
 
 	return 0;
 }
\ No newline at end of file
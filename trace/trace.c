@@ -0,0 +1,289 @@
+/*
+	This file is part of the CMOS6502 project.
+
+	BSD 3-Clause License
+
+	Copyright (c) 2024, Pietro Senesi
+	All rights reserved.
+*/
+
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/6502.h"
+
+
+
+/*
+	Trace decoder.
+	Reads a trace written by the core (see _6502_trace_enable), flight recorder dump or mapped ring alike,
+	and prints its records oldest first, one instruction per line: cycle count at its start, address,
+	bytes, disassembly, the registers before it ran and, for modes that have one, the effective address.
+	Opcodes are decoded as the variant the trace was made on (see _6502_CPU).
+*/
+
+#define M_IMP						0
+#define M_ACC						1
+#define M_IMM						2
+#define M_ZP0						3
+#define M_ZPX						4
+#define M_ZPY						5
+#define M_REL						6
+#define M_ABS						7
+#define M_ABX						8
+#define M_ABY						9
+#define M_IND						10
+#define M_INX						11
+#define M_INY						12
+#define M_IZP						13 //65C02 (zp)
+#define M_IAX						14 //65C02 (abs,x)
+#define M_ZPR						15 //Rockwell zp,rel
+
+//instruction length per mode
+static const uint8_t len[] = {1, 1, 2, 2, 2, 2, 2, 3, 3, 3, 3, 2, 2, 2, 3, 3};
+
+
+
+//NMOS: documented opcodes, the rest run as 1 byte nops
+static const char nmos_name[256][4] = {
+	"brk", "ora", "???", "???", "???", "ora", "asl", "???", "php", "ora", "asl", "???", "???", "ora", "asl", "???",
+	"bpl", "ora", "???", "???", "???", "ora", "asl", "???", "clc", "ora", "???", "???", "???", "ora", "asl", "???",
+	"jsr", "and", "???", "???", "bit", "and", "rol", "???", "plp", "and", "rol", "???", "bit", "and", "rol", "???",
+	"bmi", "and", "???", "???", "???", "and", "rol", "???", "sec", "and", "???", "???", "???", "and", "rol", "???",
+	"rti", "eor", "???", "???", "???", "eor", "lsr", "???", "pha", "eor", "lsr", "???", "jmp", "eor", "lsr", "???",
+	"bvc", "eor", "???", "???", "???", "eor", "lsr", "???", "cli", "eor", "???", "???", "???", "eor", "lsr", "???",
+	"rts", "adc", "???", "???", "???", "adc", "ror", "???", "pla", "adc", "ror", "???", "jmp", "adc", "ror", "???",
+	"bvs", "adc", "???", "???", "???", "adc", "ror", "???", "sei", "adc", "???", "???", "???", "adc", "ror", "???",
+	"???", "sta", "???", "???", "sty", "sta", "stx", "???", "dey", "???", "txa", "???", "sty", "sta", "stx", "???",
+	"bcc", "sta", "???", "???", "sty", "sta", "stx", "???", "tya", "sta", "txs", "???", "???", "sta", "???", "???",
+	"ldy", "lda", "ldx", "???", "ldy", "lda", "ldx", "???", "tay", "lda", "tax", "???", "ldy", "lda", "ldx", "???",
+	"bcs", "lda", "???", "???", "ldy", "lda", "ldx", "???", "clv", "lda", "tsx", "???", "ldy", "lda", "ldx", "???",
+	"cpy", "cmp", "???", "???", "cpy", "cmp", "dec", "???", "iny", "cmp", "dex", "???", "cpy", "cmp", "dec", "???",
+	"bne", "cmp", "???", "???", "???", "cmp", "dec", "???", "cld", "cmp", "???", "???", "???", "cmp", "dec", "???",
+	"cpx", "sbc", "???", "???", "cpx", "sbc", "inc", "???", "inx", "sbc", "nop", "???", "cpx", "sbc", "inc", "???",
+	"beq", "sbc", "???", "???", "???", "sbc", "inc", "???", "sed", "sbc", "???", "???", "???", "sbc", "inc", "???",
+};
+
+static const uint8_t nmos_mode[256] = {
+	M_IMP, M_INX, M_IMP, M_IMP, M_IMP, M_ZP0, M_ZP0, M_IMP, M_IMP, M_IMM, M_ACC, M_IMP, M_IMP, M_ABS, M_ABS, M_IMP,
+	M_REL, M_INY, M_IMP, M_IMP, M_IMP, M_ZPX, M_ZPX, M_IMP, M_IMP, M_ABY, M_IMP, M_IMP, M_IMP, M_ABX, M_ABX, M_IMP,
+	M_ABS, M_INX, M_IMP, M_IMP, M_ZP0, M_ZP0, M_ZP0, M_IMP, M_IMP, M_IMM, M_ACC, M_IMP, M_ABS, M_ABS, M_ABS, M_IMP,
+	M_REL, M_INY, M_IMP, M_IMP, M_IMP, M_ZPX, M_ZPX, M_IMP, M_IMP, M_ABY, M_IMP, M_IMP, M_IMP, M_ABX, M_ABX, M_IMP,
+	M_IMP, M_INX, M_IMP, M_IMP, M_IMP, M_ZP0, M_ZP0, M_IMP, M_IMP, M_IMM, M_ACC, M_IMP, M_ABS, M_ABS, M_ABS, M_IMP,
+	M_REL, M_INY, M_IMP, M_IMP, M_IMP, M_ZPX, M_ZPX, M_IMP, M_IMP, M_ABY, M_IMP, M_IMP, M_IMP, M_ABX, M_ABX, M_IMP,
+	M_IMP, M_INX, M_IMP, M_IMP, M_IMP, M_ZP0, M_ZP0, M_IMP, M_IMP, M_IMM, M_ACC, M_IMP, M_IND, M_ABS, M_ABS, M_IMP,
+	M_REL, M_INY, M_IMP, M_IMP, M_IMP, M_ZPX, M_ZPX, M_IMP, M_IMP, M_ABY, M_IMP, M_IMP, M_IMP, M_ABX, M_ABX, M_IMP,
+	M_IMP, M_INX, M_IMP, M_IMP, M_ZP0, M_ZP0, M_ZP0, M_IMP, M_IMP, M_IMP, M_IMP, M_IMP, M_ABS, M_ABS, M_ABS, M_IMP,
+	M_REL, M_INY, M_IMP, M_IMP, M_ZPX, M_ZPX, M_ZPY, M_IMP, M_IMP, M_ABY, M_IMP, M_IMP, M_IMP, M_ABX, M_IMP, M_IMP,
+	M_IMM, M_INX, M_IMM, M_IMP, M_ZP0, M_ZP0, M_ZP0, M_IMP, M_IMP, M_IMM, M_IMP, M_IMP, M_ABS, M_ABS, M_ABS, M_IMP,
+	M_REL, M_INY, M_IMP, M_IMP, M_ZPX, M_ZPX, M_ZPY, M_IMP, M_IMP, M_ABY, M_IMP, M_IMP, M_ABX, M_ABX, M_ABY, M_IMP,
+	M_IMM, M_INX, M_IMP, M_IMP, M_ZP0, M_ZP0, M_ZP0, M_IMP, M_IMP, M_IMM, M_IMP, M_IMP, M_ABS, M_ABS, M_ABS, M_IMP,
+	M_REL, M_INY, M_IMP, M_IMP, M_IMP, M_ZPX, M_ZPX, M_IMP, M_IMP, M_ABY, M_IMP, M_IMP, M_IMP, M_ABX, M_ABX, M_IMP,
+	M_IMM, M_INX, M_IMP, M_IMP, M_ZP0, M_ZP0, M_ZP0, M_IMP, M_IMP, M_IMM, M_IMP, M_IMP, M_ABS, M_ABS, M_ABS, M_IMP,
+	M_REL, M_INY, M_IMP, M_IMP, M_IMP, M_ZPX, M_ZPX, M_IMP, M_IMP, M_ABY, M_IMP, M_IMP, M_IMP, M_ABX, M_ABX, M_IMP,
+};
+
+
+struct op {
+	uint8_t op, mode;
+	char name[4];
+};
+
+//what the NMOS with illegals adds
+static const struct op undoc[] = {
+	{0x02, M_IMP, "jam"}, {0x12, M_IMP, "jam"}, {0x22, M_IMP, "jam"}, {0x32, M_IMP, "jam"}, {0x42, M_IMP, "jam"}, {0x52, M_IMP, "jam"},
+	{0x62, M_IMP, "jam"}, {0x72, M_IMP, "jam"}, {0x92, M_IMP, "jam"}, {0xb2, M_IMP, "jam"}, {0xd2, M_IMP, "jam"}, {0xf2, M_IMP, "jam"},
+	{0x03, M_INX, "slo"}, {0x07, M_ZP0, "slo"}, {0x0f, M_ABS, "slo"}, {0x13, M_INY, "slo"}, {0x17, M_ZPX, "slo"}, {0x1b, M_ABY, "slo"}, {0x1f, M_ABX, "slo"},
+	{0x23, M_INX, "rla"}, {0x27, M_ZP0, "rla"}, {0x2f, M_ABS, "rla"}, {0x33, M_INY, "rla"}, {0x37, M_ZPX, "rla"}, {0x3b, M_ABY, "rla"}, {0x3f, M_ABX, "rla"},
+	{0x43, M_INX, "sre"}, {0x47, M_ZP0, "sre"}, {0x4f, M_ABS, "sre"}, {0x53, M_INY, "sre"}, {0x57, M_ZPX, "sre"}, {0x5b, M_ABY, "sre"}, {0x5f, M_ABX, "sre"},
+	{0x63, M_INX, "rra"}, {0x67, M_ZP0, "rra"}, {0x6f, M_ABS, "rra"}, {0x73, M_INY, "rra"}, {0x77, M_ZPX, "rra"}, {0x7b, M_ABY, "rra"}, {0x7f, M_ABX, "rra"},
+	{0xc3, M_INX, "dcp"}, {0xc7, M_ZP0, "dcp"}, {0xcf, M_ABS, "dcp"}, {0xd3, M_INY, "dcp"}, {0xd7, M_ZPX, "dcp"}, {0xdb, M_ABY, "dcp"}, {0xdf, M_ABX, "dcp"},
+	{0xe3, M_INX, "isc"}, {0xe7, M_ZP0, "isc"}, {0xef, M_ABS, "isc"}, {0xf3, M_INY, "isc"}, {0xf7, M_ZPX, "isc"}, {0xfb, M_ABY, "isc"}, {0xff, M_ABX, "isc"},
+	{0x83, M_INX, "sax"}, {0x87, M_ZP0, "sax"}, {0x8f, M_ABS, "sax"}, {0x97, M_ZPY, "sax"},
+	{0xa3, M_INX, "lax"}, {0xa7, M_ZP0, "lax"}, {0xaf, M_ABS, "lax"}, {0xb3, M_INY, "lax"}, {0xb7, M_ZPY, "lax"}, {0xbf, M_ABY, "lax"},
+	{0x0b, M_IMM, "anc"}, {0x2b, M_IMM, "anc"}, {0x4b, M_IMM, "alr"}, {0x6b, M_IMM, "arr"}, {0x8b, M_IMM, "xaa"}, {0xab, M_IMM, "lxa"},
+	{0xcb, M_IMM, "sbx"}, {0xeb, M_IMM, "sbc"},
+	{0x93, M_INY, "sha"}, {0x9f, M_ABY, "sha"}, {0x9b, M_ABY, "tas"}, {0x9c, M_ABX, "shy"}, {0x9e, M_ABY, "shx"}, {0xbb, M_ABY, "las"},
+	{0x1a, M_IMP, "nop"}, {0x3a, M_IMP, "nop"}, {0x5a, M_IMP, "nop"}, {0x7a, M_IMP, "nop"}, {0xda, M_IMP, "nop"}, {0xfa, M_IMP, "nop"},
+	{0x80, M_IMM, "nop"}, {0x82, M_IMM, "nop"}, {0x89, M_IMM, "nop"}, {0xc2, M_IMM, "nop"}, {0xe2, M_IMM, "nop"},
+	{0x04, M_ZP0, "nop"}, {0x44, M_ZP0, "nop"}, {0x64, M_ZP0, "nop"}, {0x0c, M_ABS, "nop"},
+	{0x14, M_ZPX, "nop"}, {0x34, M_ZPX, "nop"}, {0x54, M_ZPX, "nop"}, {0x74, M_ZPX, "nop"}, {0xd4, M_ZPX, "nop"}, {0xf4, M_ZPX, "nop"},
+	{0x1c, M_ABX, "nop"}, {0x3c, M_ABX, "nop"}, {0x5c, M_ABX, "nop"}, {0x7c, M_ABX, "nop"}, {0xdc, M_ABX, "nop"}, {0xfc, M_ABX, "nop"},
+};
+
+//what the 65C02 adds or changes, its other undefined opcodes being single byte nops (x3, xb, and x7, xf without the Rockwell bit operations)
+static const struct op cmos[] = {
+	{0x12, M_IZP, "ora"}, {0x32, M_IZP, "and"}, {0x52, M_IZP, "eor"}, {0x72, M_IZP, "adc"},
+	{0x92, M_IZP, "sta"}, {0xb2, M_IZP, "lda"}, {0xd2, M_IZP, "cmp"}, {0xf2, M_IZP, "sbc"},
+	{0x04, M_ZP0, "tsb"}, {0x0c, M_ABS, "tsb"}, {0x14, M_ZP0, "trb"}, {0x1c, M_ABS, "trb"},
+	{0x1a, M_ACC, "inc"}, {0x3a, M_ACC, "dec"}, {0x34, M_ZPX, "bit"}, {0x3c, M_ABX, "bit"}, {0x89, M_IMM, "bit"},
+	{0x5a, M_IMP, "phy"}, {0x7a, M_IMP, "ply"}, {0xda, M_IMP, "phx"}, {0xfa, M_IMP, "plx"},
+	{0x64, M_ZP0, "stz"}, {0x74, M_ZPX, "stz"}, {0x9c, M_ABS, "stz"}, {0x9e, M_ABX, "stz"},
+	{0x7c, M_IAX, "jmp"}, {0x80, M_REL, "bra"},
+	{0x02, M_IMM, "nop"}, {0x22, M_IMM, "nop"}, {0x42, M_IMM, "nop"}, {0x62, M_IMM, "nop"}, {0x82, M_IMM, "nop"}, {0xc2, M_IMM, "nop"}, {0xe2, M_IMM, "nop"},
+	{0x44, M_ZP0, "nop"}, {0x54, M_ZPX, "nop"}, {0xd4, M_ZPX, "nop"}, {0xf4, M_ZPX, "nop"},
+	{0x5c, M_ABS, "nop"}, {0xdc, M_ABS, "nop"}, {0xfc, M_ABS, "nop"},
+};
+
+static char name[256][5];
+static uint8_t mode[256];
+
+static void patch(const struct op *ops, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		strcpy(name[ops[i].op], ops[i].name);
+		mode[ops[i].op] = ops[i].mode;
+	}
+}
+
+//the tables of the variant, 0 if it's none this decoder knows
+static int variant(uint8_t v) {
+	if (v > _6502_CPU_R65C02) return 0;
+
+	for (int op = 0; op < 256; op++) {
+		strcpy(name[op], nmos_name[op]);
+		mode[op] = nmos_mode[op];
+	}
+
+	if (v == _6502_CPU_NMOSX) patch(undoc, sizeof(undoc) / sizeof(undoc[0]));
+	if (v < _6502_CPU_65C02) return 1;
+
+	patch(cmos, sizeof(cmos) / sizeof(cmos[0]));
+
+	for (int op = 0; op < 256; op++)
+		if (!strcmp(name[op], "???")) strcpy(name[op], "nop");
+
+	if (v == _6502_CPU_R65C02)
+		for (int b = 0; b < 8; b++) {
+			snprintf(name[0x07 | (b << 4)], sizeof(name[0]), "rmb%d", b);
+			snprintf(name[0x87 | (b << 4)], sizeof(name[0]), "smb%d", b);
+			snprintf(name[0x0f | (b << 4)], sizeof(name[0]), "bbr%d", b);
+			snprintf(name[0x8f | (b << 4)], sizeof(name[0]), "bbs%d", b);
+			mode[0x07 | (b << 4)] = mode[0x87 | (b << 4)] = M_ZP0;
+			mode[0x0f | (b << 4)] = mode[0x8f | (b << 4)] = M_ZPR;
+		}
+
+	return 1;
+}
+
+
+static void disasm(const _6502_trace_rec_t *r, char *out, size_t size) {
+	uint16_t w = r->arg[0] | (r->arg[1] << 8);
+
+	switch (mode[r->op]) {
+		case M_ACC: snprintf(out, size, "%s a", name[r->op]); break;
+		case M_IMM: snprintf(out, size, "%s #$%02x", name[r->op], r->arg[0]); break;
+		case M_ZP0: snprintf(out, size, "%s $%02x", name[r->op], r->arg[0]); break;
+		case M_ZPX: snprintf(out, size, "%s $%02x,x", name[r->op], r->arg[0]); break;
+		case M_ZPY: snprintf(out, size, "%s $%02x,y", name[r->op], r->arg[0]); break;
+		case M_REL: snprintf(out, size, "%s $%04x", name[r->op], (uint16_t) (r->pc + 2 + (int8_t) r->arg[0])); break;
+		case M_ABS: snprintf(out, size, "%s $%04x", name[r->op], w); break;
+		case M_ABX: snprintf(out, size, "%s $%04x,x", name[r->op], w); break;
+		case M_ABY: snprintf(out, size, "%s $%04x,y", name[r->op], w); break;
+		case M_IND: snprintf(out, size, "%s ($%04x)", name[r->op], w); break;
+		case M_INX: snprintf(out, size, "%s ($%02x,x)", name[r->op], r->arg[0]); break;
+		case M_INY: snprintf(out, size, "%s ($%02x),y", name[r->op], r->arg[0]); break;
+		case M_IZP: snprintf(out, size, "%s ($%02x)", name[r->op], r->arg[0]); break;
+		case M_IAX: snprintf(out, size, "%s ($%04x,x)", name[r->op], w); break;
+		case M_ZPR: snprintf(out, size, "%s $%02x,$%04x", name[r->op], r->arg[0], (uint16_t) (r->pc + 3 + (int8_t) r->arg[1])); break;
+		default: snprintf(out, size, "%s", name[r->op]);
+	}
+}
+
+//does the record's effective address mean anything (jmp/jsr abs just go there)
+static int has_ea(uint8_t op) {
+	return mode[op] >= M_ZP0 && mode[op] != M_REL && op != 0x4c && op != 0x20;
+}
+
+static void print(const _6502_trace_rec_t *r, uint16_t ea) {
+	char bytes[12], text[24], flags[9];
+	int k = 0;
+
+	k += sprintf(bytes, "%02x", r->op);
+	for (int i = 1; i < len[mode[r->op]]; i++)
+		k += sprintf(bytes + k, " %02x", r->arg[i - 1]);
+
+	disasm(r, text, sizeof(text));
+
+	for (int i = 0; i < 8; i++)
+		flags[i] = (_6502_trace_p(r) & (0x80 >> i)) ? "NV-BDIZC"[i] : "nv-bdizc"[i];
+	flags[8] = 0;
+
+	printf("%12" PRIu64 "  %04x  %-8s  %-14s  a=%02x x=%02x y=%02x sp=%02x p=%s", r->cycles, r->pc, bytes, text, r->a, r->x, r->y, r->sp, flags);
+	if (has_ea(r->op)) printf("  [$%04x]", ea);
+	printf("\n");
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "usage: %s [-n last] trace\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	_6502_trace_hdr_t hdr;
+	_6502_trace_rec_t *rec;
+	uint64_t count, last = UINT64_MAX, first;
+	long size;
+	FILE *fp;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+			case 'n': last = strtoull(optarg, NULL, 0); break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1) usage(argv[0]);
+
+	fp = fopen(argv[optind], "rb");
+	if (fp == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	fseek(fp, 0L, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, _6502_TRACE_MAGIC, 8) || hdr.version != _6502_TRACE_VERSION || hdr.size != sizeof(_6502_trace_rec_t)) {
+		fprintf(stderr, "%s: not a trace of this version\n", argv[optind]);
+		return 1;
+	}
+
+	if (!variant(hdr.variant)) {
+		fprintf(stderr, "%s: cpu variant %d unknown\n", argv[optind], hdr.variant);
+		return 1;
+	}
+
+	//the ring holds the last 'count' records, the oldest at n % cap once it has wrapped
+	count = hdr.n < hdr.cap ? hdr.n : hdr.cap;
+	if (!hdr.cap || (hdr.cap & (hdr.cap - 1)) || (uint64_t) (size - sizeof(hdr)) / sizeof(_6502_trace_rec_t) < count) {
+		fprintf(stderr, "%s: truncated\n", argv[optind]);
+		return 1;
+	}
+
+	rec = malloc((count ? count : 1) * sizeof(_6502_trace_rec_t));
+	if (!rec || fread(rec, sizeof(_6502_trace_rec_t), count, fp) != count) {
+		fprintf(stderr, "%s: read error\n", argv[optind]);
+		return 1;
+	}
+	fclose(fp);
+
+	first = hdr.n - count;
+	if (last < count) first = hdr.n - last;
+
+	printf("%" PRIu64 " instructions traced, the last %" PRIu64 " kept\n\n", hdr.n, count);
+	printf("%12s  %-4s  %-8s  %-14s  registers\n", "cycle", "pc", "bytes", "instruction");
+
+	for (uint64_t i = first; i < hdr.n; i++)
+		print(&rec[i & (hdr.cap - 1)], _6502_trace_ea(&hdr, rec, i));
+
+	free(rec);
+
+	return 0;
+}
\ No newline at end of file